@@ -68,6 +68,10 @@ if(NOT DEFINED LUA_BUILD_SHARED_INIT)
     set(LUA_BUILD_SHARED_INIT ON)
 endif()
 
+if(NOT DEFINED LUA_BUILD_JIT_INIT)
+    set(LUA_BUILD_JIT_INIT OFF)
+endif()
+
 if(NOT DEFINED LUA_BUILD_INTERPRETER_INIT)
     set(LUA_BUILD_INTERPRETER_INIT ON)
 endif()
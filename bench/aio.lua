@@ -0,0 +1,130 @@
+--[[
+  Benchmark of asynchronous file I/O (LUA_USE_AIO): reads blocks at
+  random offsets of a file of a few megabytes, and writes many small
+  files, with the io library, with blocking 'aio' files (outside tasks)
+  and with 'aio' tasks, printing the time of each case:
+
+      delua-5.4 bench/aio.lua [megabytes] [tasks]
+
+  The file is in the page cache after it is written, so this measures
+  the cost of the system calls; reads that go to a disk gain much more
+  from having many of them in flight.
+--]]
+
+local aio = require "aio"
+
+local mb = tonumber(arg and arg[1]) or 64
+local ntasks = tonumber(arg and arg[2]) or 256
+local block = 4096
+local nreads = 100000
+local nfiles = 2000
+
+local name = os.tmpname()
+
+-- closing a file waits for the operations of other tasks on it; if it
+-- freed the descriptor at once, the next file opened would get them
+do
+  local fa = assert(aio.open(name, "w"))
+  local other = os.tmpname()
+  local fb
+  aio.spawn(function () assert(fa:write("SECRET", 0)) end)
+  aio.spawn(function ()
+    fa:close()
+    fb = assert(io.open(other, "w"))
+  end)
+  aio.run()
+  fb:close()
+  local f = assert(io.open(name, "rb"))
+  assert(f:read("a") == "SECRET")
+  f:close()
+  f = assert(io.open(other, "rb"))
+  assert(f:read("a") == "")
+  f:close()
+  os.remove(other)
+end
+
+do
+  local f = assert(io.open(name, "wb"))
+  local chunk = string.rep("0123456789abcdef", 1024 * 64)
+  for i = 1, mb // 1 do f:write(chunk) end
+  f:close()
+end
+local nblocks = mb * 1024 * 1024 // block
+
+local offsets = {}
+math.randomseed(11)
+for i = 1, nreads do offsets[i] = math.random(0, nblocks - 1) * block end
+
+local function time (name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local n = f()
+  print(string.format("%-22s %9.3fs %10d", name, os.clock() - t0, n))
+end
+
+print(string.format("%-22s %10s %10s   (aio available: %s)", "case", "time",
+                    "bytes", tostring(aio.available())))
+
+time("io seek+read", function ()
+  local f = assert(io.open(name, "rb"))
+  local n = 0
+  for i = 1, nreads do
+    f:seek("set", offsets[i])
+    n = n + #f:read(block)
+  end
+  f:close()
+  return n
+end)
+
+time("aio blocking read", function ()
+  local f = assert(aio.open(name))
+  local n = 0
+  for i = 1, nreads do n = n + #f:read(block, offsets[i]) end
+  f:close()
+  return n
+end)
+
+time("aio tasks read", function ()
+  local f = assert(aio.open(name))
+  local n = 0
+  for t = 1, ntasks do
+    aio.spawn(function ()
+      local m = 0  -- not 'n': the read yields between loading and storing it
+      for i = t, nreads, ntasks do m = m + #f:read(block, offsets[i]) end
+      n = n + m
+    end)
+  end
+  aio.run()
+  f:close()
+  return n
+end)
+
+local dir = name .. ".d"
+os.execute("mkdir " .. dir)
+local data = string.rep("x", 1000)
+
+time("io write files", function ()
+  for i = 1, nfiles do
+    local f = assert(io.open(dir .. "/a" .. i, "wb"))
+    f:write(data)
+    f:close()
+  end
+  return nfiles * #data
+end)
+
+time("aio tasks write files", function ()
+  for t = 1, ntasks do
+    aio.spawn(function ()
+      for i = t, nfiles, ntasks do
+        local f = assert(aio.open(dir .. "/b" .. i, "w"))
+        f:write(data)
+        f:close()
+      end
+    end)
+  end
+  aio.run()
+  return nfiles * #data
+end)
+
+os.execute("rm -r " .. dir)
+os.remove(name)
@@ -0,0 +1,58 @@
+--[[
+  Benchmark of array operations (LUA_USE_ARRAYOPS): runs 'table.concat',
+  'table.move', 'table.unpack', 'table.insert' and 'table.remove' over
+  arrays of several sizes, printing the time of each case and a
+  checksum of its results (which must not depend on the build):
+
+      delua-5.4 bench/arrays.lua [elements]
+--]]
+
+local n = tonumber(arg and arg[1]) or 200000
+
+local strs, nums, objs = {}, {}, {}
+for i = 1, n do
+  strs[i] = "item" .. i
+  nums[i] = (i % 2 == 0) and i or i / 4
+  objs[i] = {i}
+end
+
+local function time (f)
+  local t0 = os.clock()
+  local r, k = 0, 0
+  repeat
+    r = r + f()
+    k = k + 1
+  until os.clock() - t0 > 0.5
+  return (os.clock() - t0) / k, r // k
+end
+
+local cases = {
+  {"concat strings", function () return #table.concat(strs, ",") end},
+  {"concat numbers", function () return #table.concat(nums, " ") end},
+  {"move new", function () return #table.move(objs, 1, n, 1, {}) end},
+  {"move overlap", function ()
+     table.move(objs, 1, n - 1, 2)
+     table.move(objs, 2, n, 1)
+     return objs[n][1] end},
+  {"unpack 200", function ()
+     local s = 0
+     for i = 1, n - 200, 200 do s = s + select("#", table.unpack(nums, i, i + 199)) end
+     return s end},
+  {"insert front", function ()
+     local t = {}
+     for i = 1, 2000 do table.insert(t, 1, i) end
+     return #t end},
+  {"remove front", function ()
+     local t = table.move(strs, 1, 2000, 1, {})
+     local s = 0
+     for i = 1, 2000 do s = s + #table.remove(t, 1) end
+     return s end},
+}
+
+print(string.format("%-16s %10s %10s %12s", "case", "elements", "time",
+                    "checksum"))
+for _, case in ipairs(cases) do
+  collectgarbage()
+  local t, r = time(case[2])
+  print(string.format("%-16s %10d %9.4fs %12d", case[1], n, t, r))
+end
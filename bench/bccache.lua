@@ -0,0 +1,63 @@
+--[[
+  Benchmark of the bytecode cache of 'require': writes a set of
+  generated modules to a temporary directory and times, in new
+  interpreter processes, requiring all of them without the cache, with
+  an empty cache (cold start, which also fills it) and with the filled
+  cache (warm start). Needs an interpreter built with LUA_USE_BCCACHE
+  and a POSIX shell:
+
+      delua-5.4 bench/bccache.lua [number of modules]
+--]]
+
+local nmods = tonumber(arg and arg[1]) or 200
+local interp = arg[-1]
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute("mkdir -p " .. dir .. "/cache"))
+
+
+local function module (i)
+  local b = {"local M = {}\n"}
+  for j = 1, 100 do
+    b[#b + 1] = string.format([[
+function M.f%d (t, x)
+  local s = 0
+  for k = 1, #t do
+    if t[k] > x then s = s + t[k] * %d else s = s - k end
+  end
+  return s, "module %d function %d"
+end
+]], j, j, i, j)
+  end
+  b[#b + 1] = "return M\n"
+  return table.concat(b)
+end
+
+for i = 1, nmods do
+  local f = assert(io.open(string.format("%s/m%d.lua", dir, i), "w"))
+  f:write(module(i))
+  f:close()
+end
+
+
+local function run (cache)
+  local script = string.format([[
+    package.path = %q
+    package.bytecodecache = %s
+    local t0 = os.clock()
+    for i = 1, %d do require("m" .. i) end
+    io.write(os.clock() - t0)
+  ]], dir .. "/?.lua", cache and string.format("%q", dir .. "/cache")
+                                or "false", nmods)
+  local p = assert(io.popen(string.format("%q -e %q", interp, script)))
+  local t = tonumber(p:read("a"))
+  p:close()
+  return assert(t)
+end
+
+
+print(string.format("%d modules", nmods))
+print(string.format("no cache: %8.2f ms", run(false) * 1000))
+print(string.format("cold:     %8.2f ms", run(true) * 1000))
+print(string.format("warm:     %8.2f ms", run(true) * 1000))
+os.execute("rm -rf " .. dir)
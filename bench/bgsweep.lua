@@ -0,0 +1,33 @@
+--[[
+  Benchmark of sweeping: allocates many short-lived tables and strings
+  while keeping a small live set, so most of the collector's work is
+  freeing dead objects. Run it with and without the background sweeper
+  on an interpreter built with LUA_USE_BGSWEEP, on a machine with at
+  least two cores (os.clock counts the sweeper thread too, so compare
+  elapsed times as well):
+
+      delua-5.4 bench/bgsweep.lua [queue limit in Kbytes, 0 for off]
+--]]
+
+local clock = os.clock
+local limit = tonumber(arg and arg[1]) or 0
+
+if not pcall(collectgarbage, "background", limit) then
+  print("interpreter built without LUA_USE_BGSWEEP")
+  limit = 0
+end
+
+
+local function churn (n)
+  local keep = {}
+  for i = 1, n do
+    keep[i % 5000 + 1] = {i, tostring(i), {x = i}}
+  end
+  return #keep
+end
+
+
+local t0, w0 = clock(), os.time()
+assert(churn(3000000) == 5000)
+print(string.format("background %d KB: cpu %.2f s, elapsed %d s",
+                    limit, clock() - t0, os.time() - w0))
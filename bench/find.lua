@@ -0,0 +1,62 @@
+--[[
+  Benchmark of plain string searches (LUA_USE_SIMDFIND): searches for
+  needles of several lengths in a haystack of a few megabytes, with
+  'string.find' in plain mode, without special characters and as the
+  literal prefix of a pattern, printing the throughput of each case:
+
+      delua-5.4 bench/find.lua [megabytes]
+
+  In the "common" haystack, the first byte of the needle is frequent,
+  which is the worst case for a search driven by 'memchr'.
+--]]
+
+local mb = tonumber(arg and arg[1]) or 8
+local size = mb * 1024 * 1024
+
+local function haystack (kind)
+  local t = {}
+  math.randomseed(7)
+  if kind == "text" then
+    local words = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+                   "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"}
+    local n = 0
+    while n < size do
+      local w = words[math.random(#words)]
+      t[#t + 1] = w
+      n = n + #w + 1
+    end
+    return table.concat(t, " "):sub(1, size)
+  else  -- "common": mostly 'a', with the needle's first byte everywhere
+    local block = string.rep("a", 63) .. "b"
+    return string.rep(block, size // #block)
+  end
+end
+
+local function time (f)
+  local t0 = os.clock()
+  local n = 0
+  repeat
+    f()
+    n = n + 1
+  until os.clock() - t0 > 0.5
+  return (os.clock() - t0) / n
+end
+
+print(string.format("%-8s %-10s %4s %10s", "text", "mode", "len", "MB/s"))
+for _, kind in ipairs{"text", "common"} do
+  local h = haystack(kind)
+  for _, len in ipairs{2, 4, 8, 16, 64} do
+    local needle = string.rep("a", len - 1) .. "z"  -- never found
+    local pattern = needle .. "%d"
+    local cases = {
+      {"plain", function () assert(not h:find(needle, 1, true)) end},
+      {"nospecial", function () assert(not h:find(needle)) end},
+      {"prefix", function () assert(not h:find(pattern)) end},
+    }
+    for _, case in ipairs(cases) do
+      local t = time(case[2])
+      print(string.format("%-8s %-10s %4d %10.0f", kind, case[1], len,
+                          #h / t / 1e6))
+    end
+  end
+end
@@ -0,0 +1,91 @@
+--[[
+  Benchmark of frozen tables (LUA_USE_FROZEN with LUA_USE_WORKERS): gives
+  the same lookup data to every worker of a pool, first as a copy per
+  worker and then as one frozen table, and prints the growth of the
+  resident memory of the process while all workers hold it, plus the
+  time of a lookup loop in each worker:
+
+      delua-5.4 bench/frozen.lua [workers] [records]
+
+  Resident memory is read from /proc/self/status (Linux).
+--]]
+
+local worker = require "worker"
+local nworkers = tonumber(arg and arg[1]) or 4
+local nrecords = tonumber(arg and arg[2]) or 200000
+
+-- frozen tables used as metatables by several workers at once: looking
+-- for absent metamethods must not write to them (a data race under
+-- ThreadSanitizer when 'luaT_gettm' cached the absence)
+do
+  local mts = worker.freeze({plain = {}, index = {__index = {x = 1}}})
+  local function use (mts)
+    local o = setmetatable({}, mts.plain)
+    local o2 = setmetatable({}, mts.index)
+    local n = 0
+    for i = 1, 10000 do
+      if o.missing == nil then n = n + 1 end
+      o[i] = true; o[i] = nil
+      n = n + o2.x
+    end
+    return n
+  end
+  local pool = worker.pool(nworkers)
+  local futures = {}
+  for i = 1, 2 * nworkers do futures[i] = pool:submit(use, mts) end
+  for i = 1, 2 * nworkers do assert(futures[i]:await() == 20000) end
+  pool:close()
+end
+
+local function rss ()
+  local f = assert(io.open("/proc/self/status"))
+  local kb = f:read("a"):match("VmRSS:%s*(%d+)")
+  f:close()
+  return tonumber(kb) / 1024
+end
+
+local data = {index = {}}
+for i = 1, nrecords do
+  local r = {id = i, name = "item" .. i, price = i * 0.25,
+             tags = {"tag" .. i % 13, "tag" .. i % 17}}
+  data[i] = r
+  data.index[r.name] = r
+end
+
+-- each job takes one worker: it keeps the data, reports, and then waits
+local function hold (t, ready, go)
+  local t0 = os.clock()
+  local s = 0
+  for i = 1, #t do
+    local r = t.index["item" .. i]
+    s = s + r.id + #r.tags
+  end
+  ready:send(os.clock() - t0)
+  go:receive()
+  return s
+end
+
+local function run (name, arg)
+  local pool = worker.pool(nworkers)
+  local ready, go = worker.channel(), worker.channel()
+  collectgarbage()
+  local base = rss()
+  local futures, lookup = {}, 0
+  for i = 1, nworkers do futures[i] = pool:submit(hold, arg, ready, go) end
+  for i = 1, nworkers do lookup = lookup + ready:receive() end
+  local grown = rss() - base
+  for i = 1, nworkers do go:send(true) end
+  for i = 1, nworkers do futures[i]:await() end
+  pool:close()
+  print(string.format("%-7s %3d workers: +%7.1f MB resident, lookups %.3f s"
+                      .. " per worker", name, nworkers, grown,
+                      lookup / nworkers))
+end
+
+run("copies", data)
+collectgarbage()
+local m0, t0 = rss(), os.clock()
+local frozen = worker.freeze(data)
+print(string.format("freeze: +%.1f MB resident (once), %.3f s",
+                    rss() - m0, os.clock() - t0))
+run("frozen", frozen)
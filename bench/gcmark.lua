@@ -0,0 +1,41 @@
+--[[
+  Benchmark of the mark phase: builds a heap of tables, closures and
+  strings and times full collections (whose pause is mostly marking)
+  in incremental and generational modes. Compare interpreters built with
+  and without LUA_USE_PARALLELMARK, on machines with several cores:
+
+      delua-5.4 bench/gcmark.lua [number of objects, in thousands]
+--]]
+
+local clock = os.clock
+local n = (tonumber(arg and arg[1]) or 1000) * 1000
+
+local function heap (n)
+  local root = {}
+  for i = 1, n // 4 do
+    local t = {i, tostring(i), x = i * 0.5}
+    t.f = function () return t end
+    root[i] = t
+  end
+  return root
+end
+
+
+local function timegc (mode, rounds)
+  collectgarbage(mode)
+  collectgarbage()
+  local t0 = clock()
+  for _ = 1, rounds do collectgarbage() end
+  return (clock() - t0) / rounds
+end
+
+
+collectgarbage("stop")
+local root = heap(n)
+collectgarbage("restart")
+print(string.format("heap: %.1f MB", collectgarbage("count") / 1024))
+print(string.format("incremental full GC: %8.2f ms",
+                    timegc("incremental", 5) * 1000))
+print(string.format("generational full GC: %8.2f ms",
+                    timegc("generational", 5) * 1000))
+assert(#root == n // 4)
@@ -0,0 +1,112 @@
+--[[
+  Benchmark of the hash part of tables: insertion, successful and failed
+  lookups, and traversal with 'next', for string and integer keys at
+  several table sizes. Run it with interpreters built with and without
+  LUA_USE_SWISSTABLE and compare the times:
+
+      delua-5.4 bench/hashpart.lua [total operations per test]
+--]]
+
+local clock = os.clock
+local total = tonumber(arg and arg[1]) or 4000000
+local sizes = {10, 100, 1000, 10000, 100000}
+
+
+-- a key removed and collected, then inserted again, must get back its
+-- node; with a second node, 'next' found the dead one first and looped
+do
+  local function count (t)
+    local n = 0
+    for _ in pairs(t) do
+      n = n + 1
+      assert(n <= 1000, "'next' does not end")
+    end
+    return n
+  end
+  local t, k = {}, {}
+  t.a = 1; t.b = 2; t[k] = 3
+  t[k] = nil
+  collectgarbage()
+  t[k] = 4
+  assert(count(t) == 3 and t[k] == 4)
+  local keys = {}
+  t = {}
+  for i = 1, 100 do keys[i] = {}; t[keys[i]] = i end
+  for i = 1, 100, 2 do t[keys[i]] = nil end
+  collectgarbage()
+  for i = 1, 100 do t[keys[i]] = i end
+  assert(count(t) == 100)
+end
+
+
+local function keyset (kind, n, salt)
+  local keys = {}
+  for i = 1, n do
+    if kind == "string" then
+      keys[i] = salt .. i
+    else  -- integers spread outside the array part
+      keys[i] = i * 7919 + salt
+    end
+  end
+  return keys
+end
+
+
+local function bench (kind, n)
+  local keys = keyset(kind, n, kind == "string" and "k" or 0)
+  local misses = keyset(kind, n, kind == "string" and "m" or 1)
+  local rounds = math.max(1, total // n)
+  local times = {}
+
+  local t0 = clock()
+  local t
+  for _ = 1, rounds do
+    t = {}
+    for i = 1, n do t[keys[i]] = i end
+  end
+  times[1] = clock() - t0
+
+  t0 = clock()
+  local s = 0
+  for _ = 1, rounds do
+    for i = 1, n do s = s + t[keys[i]] end
+  end
+  times[2] = clock() - t0
+  assert(s == rounds * n * (n + 1) // 2)
+
+  t0 = clock()
+  local c = 0
+  for _ = 1, rounds do
+    for i = 1, n do
+      if t[misses[i]] == nil then c = c + 1 end
+    end
+  end
+  times[3] = clock() - t0
+  assert(c == rounds * n)
+
+  t0 = clock()
+  c = 0
+  for _ = 1, rounds do
+    local k = next(t)
+    while k ~= nil do c = c + 1; k = next(t, k) end
+  end
+  times[4] = clock() - t0
+  assert(c == rounds * n)
+
+  local ops = rounds * n
+  io.write(string.format("%-7s %7d", kind, n))
+  for i = 1, #times do
+    io.write(string.format(" %9.1f", times[i] * 1e9 / ops))
+  end
+  io.write("\n")
+end
+
+
+print(string.format("%-7s %7s %9s %9s %9s %9s  (ns/op)",
+                    "keys", "size", "insert", "hit", "miss", "next"))
+for _, kind in ipairs{"string", "integer"} do
+  for _, n in ipairs(sizes) do
+    collectgarbage()
+    bench(kind, n)
+  end
+end
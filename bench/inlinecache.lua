@@ -0,0 +1,111 @@
+--[[
+  Benchmark of field access by name ('t.x', 't.x = v', 't:m()', globals)
+  with monomorphic sites (one table), sites that see many tables with
+  the same keys, and polymorphic sites (tables with different key
+  layouts). Run it with interpreters built with and without
+  LUA_USE_INLINECACHE and compare the times (only globals have caches,
+  so the other columns should not change); with -DLUAI_ICSTATS it also
+  prints the hit rate of the caches for each test:
+
+      delua-5.4 bench/inlinecache.lua [total operations per test]
+--]]
+
+local clock = os.clock
+local total = tonumber(arg and arg[1]) or 20000000
+local icstats = debug.icstats
+
+
+local function point (x, y)
+  local p = {}
+  p.x = x; p.y = y
+  function p:norm () return self.x * self.x + self.y * self.y end
+  return p
+end
+
+
+-- the same keys, inserted in another order and with other keys first
+local function shuffled (x, y, i)
+  local p = {}
+  for k = 1, i % 5 do p["pad" .. k] = k end
+  p.y = y; p.x = x
+  p.norm = point(0, 0).norm
+  return p
+end
+
+
+local function getfields (ps, n)
+  local s = 0
+  local m = #ps
+  for i = 1, n do
+    local p = ps[i % m + 1]
+    s = s + p.x + p.y
+  end
+  return s
+end
+
+
+local function setfields (ps, n)
+  local m = #ps
+  for i = 1, n do
+    local p = ps[i % m + 1]
+    p.x = i; p.y = i
+  end
+end
+
+
+local function methods (ps, n)
+  local s = 0
+  local m = #ps
+  for i = 1, n do
+    s = s + ps[i % m + 1]:norm()
+  end
+  return s
+end
+
+
+count = 0
+local function globals (_, n)
+  for _ = 1, n do
+    count = count + 1
+  end
+end
+
+
+local sets = {
+  {"one table", {point(1, 2)}},
+  {"same keys", {}},
+  {"polymorphic", {}},
+}
+for i = 1, 64 do
+  sets[2][2][i] = point(i, i)
+  sets[3][2][i] = shuffled(i, i, i)
+end
+
+local tests = {
+  {"get", getfields}, {"set", setfields},
+  {"method", methods}, {"global", globals},
+}
+
+
+io.write(string.format("%-12s", "tables"))
+for _, t in ipairs(tests) do io.write(string.format(" %9s", t[1])) end
+io.write(icstats and "   (ns/op, hit %)\n" or "   (ns/op)\n")
+for _, set in ipairs(sets) do
+  io.write(string.format("%-12s", set[1]))
+  for _, t in ipairs(tests) do
+    collectgarbage()
+    if icstats then icstats() end
+    local t0 = clock()
+    t[2](set[2], total)
+    local time = clock() - t0
+    local hits, misses = 0, 0
+    if icstats then hits, misses = icstats() end
+    io.write(string.format(" %9.1f", time * 1e9 / total))
+    if icstats and hits + misses == 0 then
+      io.write("    -")  -- no instruction with a cache
+    elseif icstats then
+      io.write(string.format(" %3.0f%%", hits * 100 / (hits + misses)))
+    end
+  end
+  io.write("\n")
+end
@@ -0,0 +1,58 @@
+--[[
+  Benchmark of the baseline JIT compiler (LUA_BUILD_JIT): runs each case
+  as a fresh chunk in the interpreter (after 'jit.off()') and with
+  automatic compilation (after 'jit.on()'), printing both times. The
+  loops are in the main chunks, so they are compiled only by counting
+  their backward jumps:
+
+      delua-5.4 bench/jit.lua [iterations]
+--]]
+
+local n = math.floor(tonumber(arg and arg[1]) or 2e7)
+
+local cases = {
+  {"integer loop", [[
+    local s = 0
+    for i = 1, N do s = s + i * 3 - (i & 7) end
+    return s]]},
+  {"float loop", [[
+    local x, y = 0.0, 1.5
+    for i = 1, N do x = x + y * 0.5; y = y - x / 3.0 end
+    return x]]},
+  {"float sum", [[
+    local s, t = 0.0, 0.0
+    for i = 1, N do s = s + i * 0.25; t = t + i / 8 end
+    return s + t]]},
+  {"while loop", [[
+    local k, s = 0, 0.0
+    while k < N do k = k + 1; s = s + 1.5 end
+    return s]]},
+  {"fields", [[
+    local p = {x = 1, y = 2}
+    for i = 1, N // 4 do p.x = p.x + p.y; p.y = i end
+    return p.x]]},
+  {"calls", [[
+    local function fib (n) if n < 2 then return n end
+      return fib(n - 1) + fib(n - 2) end
+    return fib(math.floor(math.log(N, 1.618)) - 5)]]},
+}
+
+
+local function run (src)
+  local f = assert(load("local N = ...\n" .. src))
+  collectgarbage()
+  local t0 = os.clock()
+  local r = f(n)
+  return os.clock() - t0, r
+end
+
+
+print(string.format("%-14s %10s %10s", "case", "interp", "jit"))
+for _, c in ipairs(cases) do
+  jit.off()
+  local t1, r1 = run(c[2])
+  jit.on()
+  local t2, r2 = run(c[2])
+  assert(r1 == r2, c[1])
+  print(string.format("%-14s %9.3fs %9.3fs", c[1], t1, t2))
+end
@@ -0,0 +1,63 @@
+--[[
+  Benchmark of line reading (LUA_USE_FASTLINES): writes a temporary
+  file of lines of several lengths and reads it back with 'io.lines',
+  'file:lines("L")' and 'file:read("l")' mixed with 'read("n")',
+  printing the lines per second of each case and a checksum of what
+  was read (which must not depend on the build):
+
+      delua-5.4 bench/lines.lua [megabytes]
+--]]
+
+local mb = tonumber(arg and arg[1]) or 64
+local size = mb * 1024 * 1024
+
+local function makefile (len)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "w"))
+  local line = string.rep("x", len - 10)
+  local n = 0
+  for i = 1, size // (len + 1) do
+    f:write(string.format("%9d ", i), line, "\n")
+    n = n + 1
+  end
+  f:close()
+  return name, n
+end
+
+local cases = {
+  {"io.lines", function (name)
+     local s = 0
+     for l in io.lines(name) do s = s + #l end
+     return s end},
+  {"lines L", function (name)
+     local f = assert(io.open(name))
+     local s = 0
+     for l in f:lines("L") do s = s + #l end
+     f:close()
+     return s end},
+  {"read n + l", function (name)
+     local f = assert(io.open(name))
+     local s = 0
+     while true do
+       local k = f:read("n")
+       if not k then break end
+       s = s + k + #f:read("l")
+     end
+     f:close()
+     return s end},
+}
+
+print(string.format("%-12s %6s %10s %12s %14s", "case", "len", "lines",
+                    "lines/s", "checksum"))
+for _, len in ipairs{16, 80, 400, 20000} do
+  local name, n = makefile(len)
+  for _, case in ipairs(cases) do
+    collectgarbage()
+    local t0 = os.clock()
+    local r = case[2](name)
+    local t = os.clock() - t0
+    print(string.format("%-12s %6d %10d %12.0f %14d", case[1], len, n,
+                        n / t, r))
+  end
+  os.remove(name)
+end
@@ -0,0 +1,64 @@
+--[[
+  Benchmark of mapped files (LUA_USE_MMAPFILE): writes a temporary file
+  of a few megabytes and reads it with 'io.open' and with 'io.mmap':
+  records at random offsets ('seek' and 'read(n)'), lines, and numbers,
+  printing the time of each case and a checksum of what was read
+  (which must not depend on the build or the kind of file):
+
+      delua-5.4 bench/mmap.lua [megabytes] [record size]
+--]]
+
+local mb = tonumber(arg and arg[1]) or 64
+local recsize = tonumber(arg and arg[2]) or 256
+
+if not io.mmap then
+  print("io.mmap not available (build with LUA_USE_MMAPFILE)")
+  return
+end
+
+local name = os.tmpname()
+do
+  local f = assert(io.open(name, "w"))
+  local line = string.rep("y", 70)
+  for i = 1, mb * 1024 * 1024 // 80 do
+    f:write(string.format("%8d ", i), line, "\n")
+  end
+  f:close()
+end
+
+local cases = {
+  {"random read", function (f)
+     local size = f:seek("end")
+     local s = 0
+     math.randomseed(1)
+     for i = 1, 200000 do
+       f:seek("set", math.random(0, size - recsize))
+       s = s + #f:read(recsize)
+     end
+     return s end},
+  {"lines", function (f)
+     local s = 0
+     for l in f:lines() do s = s + #l end
+     return s end},
+  {"numbers", function (f)
+     local s = 0
+     for k, rest in f:lines("n", "l") do s = s + k + #rest end
+     return s end},
+  {"read all", function (f)
+     return #f:read("a") end},
+}
+
+print(string.format("%-12s %-6s %10s %14s", "case", "open", "time",
+                    "checksum"))
+for _, case in ipairs(cases) do
+  for _, kind in ipairs{"io", "mmap"} do
+    local f = assert(io[kind == "io" and "open" or "mmap"](name, "rb"))
+    collectgarbage()
+    local t0 = os.clock()
+    local r = case[2](f)
+    print(string.format("%-12s %-6s %9.3fs %14d", case[1], kind,
+                        os.clock() - t0, r))
+    f:close()
+  end
+end
+os.remove(name)
@@ -0,0 +1,78 @@
+--[[
+  Benchmark of mapped loading: compiles a large generated module with
+  'luac -a' and loads it many times, keeping the functions alive, by
+  reading it (mode "b") and by mapping it (mode "bm"). Reports load time,
+  the memory counted by the collector and, on Linux, the resident memory
+  not backed by files (the mapped chunks are shared with the page cache),
+  each in a new process. Needs an interpreter built with
+  LUA_USE_MMAPLOAD and a POSIX shell; the compiler
+  is found next to the interpreter unless given:
+
+      delua-5.4 bench/mmapload.lua [number of loads] [luac]
+--]]
+
+local clock = os.clock
+local nloads = tonumber(arg and arg[1]) or 200
+local luac = arg[2] or arg[-1]:gsub("delua([^/]*)$", "deluac%1")
+local src = os.tmpname()
+local chunk = src .. ".luac"
+
+
+local function module ()
+  local b = {"local M = {}\n"}
+  for j = 1, 2000 do
+    b[#b + 1] = string.format([[
+function M.f%d (t, x)
+  local s = 0
+  for k = 1, #t do
+    if t[k] > x then s = s + t[k] * %d else s = s - k end
+  end
+  return s
+end
+]], j, j)
+  end
+  b[#b + 1] = "return M\n"
+  return table.concat(b)
+end
+
+local f = assert(io.open(src, "w"))
+f:write(module())
+f:close()
+assert(os.execute(string.format("%q -a -o %q %q", luac, chunk, src)))
+
+
+-- loads the chunk in a new process, so that each mode starts afresh
+local function run (mode)
+  local script = string.format([[
+    local function private ()
+      local f = io.open("/proc/self/statm")
+      if not f then return 0 end
+      local _, resident, shared = f:read("n", "n", "n")
+      f:close()
+      return (resident - shared) * 4 / 1024
+    end
+    collectgarbage()
+    local mem0, priv0 = collectgarbage("count"), private()
+    local keep = {}
+    local t0 = os.clock()
+    for i = 1, %d do keep[i] = assert(loadfile(%q, %q))() end
+    local t = os.clock() - t0
+    collectgarbage()
+    assert(keep[#keep].f10({1, 2, 3}, 0) == 60)
+    io.write(t, " ", (collectgarbage("count") - mem0) / 1024, " ",
+             private() - priv0)
+  ]], nloads, chunk, mode)
+  local p = assert(io.popen(string.format("%q -e %q", arg[-1], script)))
+  local t, heap, mem = p:read("n", "n", "n")
+  p:close()
+  print(string.format("mode %-3s %7.2f ms/load  heap %7.1f MB  private %7.1f MB",
+                      mode, t * 1000 / nloads, heap, mem))
+end
+
+
+print(string.format("%d loads of a %d KB chunk", nloads,
+                    #io.open(chunk, "rb"):read("a") // 1024))
+run("b")
+run("bm")
+os.remove(src)
+os.remove(chunk)
@@ -0,0 +1,55 @@
+--[[
+  Benchmark of numeric conversions (LUA_USE_FASTNUM): converts a few
+  million floats of several kinds to strings with 'tostring' and the
+  strings back with 'tonumber', printing the time of each step and a
+  count of the values that do not read back as the same float:
+
+      delua-5.4 bench/numbers.lua [millions]
+
+  Without LUA_USE_FASTNUM, 'tostring' keeps only 14 significant digits,
+  so values needing more do not read back.
+--]]
+
+local n = math.floor((tonumber(arg and arg[1]) or 2) * 1e6)
+
+local kinds = {
+  {"prices", function (r) return r(0, 10000000) / 100 end},
+  {"coords", function (r) return (r() - 0.5) * 360 end},
+  {"ints", function (r) return r(-1000000, 1000000) + 0.0 end},
+  {"wide", function (r) return r() * 10.0 ^ r(-300, 300) end},
+}
+
+local function time (f, ...)
+  local t0 = os.clock()
+  local r = f(...)
+  return os.clock() - t0, r
+end
+
+local function format (t)
+  local s = {}
+  for i = 1, #t do s[i] = tostring(t[i]) end
+  return s
+end
+
+local function parse (s)
+  local t = {}
+  for i = 1, #s do t[i] = tonumber(s[i]) end
+  return t
+end
+
+print(string.format("%-8s %10s %12s %12s %10s", "kind", "values",
+                    "tostring s", "tonumber s", "inexact"))
+for _, kind in ipairs(kinds) do
+  local t = {}
+  math.randomseed(11)
+  for i = 1, n do t[i] = kind[2](math.random) end
+  collectgarbage()
+  local tf, s = time(format, t)
+  local tp, t2 = time(parse, s)
+  local inexact = 0
+  for i = 1, n do
+    if t2[i] ~= t[i] then inexact = inexact + 1 end
+  end
+  print(string.format("%-8s %10d %11.3fs %11.3fs %10d", kind[1], n, tf, tp,
+                      inexact))
+end
@@ -0,0 +1,72 @@
+--[[
+  Benchmark of compiled patterns (LUA_USE_PATTERNCACHE): runs 'gsub',
+  'gmatch' and 'find' with several patterns over a generated log of a
+  few megabytes, printing the time of each case and a checksum of its
+  results (which must not depend on the build):
+
+      delua-5.4 bench/patterns.lua [lines]
+--]]
+
+local nlines = tonumber(arg and arg[1]) or 60000
+
+local levels = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"}
+local words = {"request", "served", "user", "cache", "miss", "hit",
+               "timeout", "retry", "db", "query", "slow", "ok"}
+
+local function makelog ()
+  local t = {}
+  math.randomseed(42)
+  for i = 1, nlines do
+    local msg = {}
+    for j = 1, math.random(3, 9) do
+      msg[j] = words[math.random(#words)]
+    end
+    t[i] = string.format("2024-03-%02d %02d:%02d:%02d [%s] pid=%d %s " ..
+                         "took=%dms ip=10.%d.%d.%d",
+                         i % 28 + 1, i % 24, i % 60, (i * 7) % 60,
+                         levels[math.random(#levels)], 1000 + i % 97,
+                         table.concat(msg, " "), math.random(0, 900),
+                         i % 256, (i * 3) % 256, (i * 11) % 256)
+  end
+  return table.concat(t, "\n") .. "\n"
+end
+
+local function count (s, n) return #s + (n or 0) end
+
+local cases = {
+  {"gsub digits", function (log)
+     return count(log:gsub("%d+", "#")) end},
+  {"gsub literal", function (log)
+     return count(log:gsub("%[ERROR%]", "[E]")) end},
+  {"gsub kv swap", function (log)
+     return count(log:gsub("(%w+)=(%w+)", "%2=%1")) end},
+  {"gsub function", function (log)
+     return count(log:gsub("took=(%d+)ms", function (ms)
+                    return tonumber(ms) > 800 and "SLOW" or nil end)) end},
+  {"gsub trim", function (log)
+     return count(log:gsub("[ \t]+\n", "\n")) end},
+  {"gmatch lines", function (log)
+     local n = 0
+     for lvl, rest in log:gmatch("%[(%u+)%] ([^\n]*)") do
+       n = n + #lvl + #rest
+     end
+     return n end},
+  {"find ip", function (log)
+     local n, init = 0, 1
+     while true do
+       local s, e = log:find("ip=10%.%d+%.%d+%.%d+", init)
+       if not s then return n end
+       n, init = n + e - s, e + 1
+     end end},
+}
+
+local log = makelog()
+print(string.format("%-14s %10s %10s %12s", "case", "log bytes", "time",
+                    "checksum"))
+for _, case in ipairs(cases) do
+  collectgarbage()
+  local t0 = os.clock()
+  local r = case[2](log)
+  print(string.format("%-14s %10d %9.3fs %12d", case[1], #log,
+                      os.clock() - t0, r))
+end
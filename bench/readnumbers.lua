@@ -0,0 +1,77 @@
+--[[
+  Benchmark of number reading (LUA_USE_READNUMBERS): reads a file of
+  integers and one of floats with 'read("n")', one number per call and
+  several per call, and with 'file:readnumbers' when the build has it,
+  printing the time of each case and a checksum of the numbers read
+  (which must not depend on the build):
+
+      delua-5.4 bench/readnumbers.lua [count]
+--]]
+
+local count = tonumber(arg and arg[1]) or 1000000
+
+local function makefile (kind)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "wb"))
+  math.randomseed(5)
+  for i = 1, count do
+    if kind == "integers" then
+      f:write(math.random(-1000000, 1000000), (i % 10 == 0) and "\n" or " ")
+    else
+      f:write(string.format("%.6f", math.random() * 1000),
+              (i % 10 == 0) and "\n" or " ")
+    end
+  end
+  f:close()
+  return name
+end
+
+local function checksum (t, n)
+  local s = 0
+  for i = 1, n do s = s + t[i] end
+  return s
+end
+
+local cases = {
+  {"read(n)", function (f)
+     local t, n = {}, 0
+     while true do
+       local x = f:read("n")
+       if not x then return t, n end
+       n = n + 1
+       t[n] = x
+     end end},
+  {"read(n x 8)", function (f)
+     local t, n = {}, 0
+     while true do
+       local a, b, c, d, e, g, h, k = f:read("n", "n", "n", "n", "n", "n",
+                                            "n", "n")
+       for _, x in ipairs{a, b, c, d, e, g, h, k} do
+         n = n + 1
+         t[n] = x
+       end
+       if not k then return t, n end
+     end end},
+}
+if io.stdin.readnumbers then
+  cases[#cases + 1] = {"readnumbers", function (f)
+     local t = f:readnumbers()
+     return t, #t end}
+end
+
+print(string.format("%-10s %-12s %9s %10s %20s", "file", "case", "time",
+                    "numbers", "checksum"))
+for _, kind in ipairs{"integers", "floats"} do
+  local name = makefile(kind)
+  for _, case in ipairs(cases) do
+    local f = assert(io.open(name, "rb"))
+    collectgarbage()
+    local t0 = os.clock()
+    local t, n = case[2](f)
+    local time = os.clock() - t0
+    f:close()
+    print(string.format("%-10s %-12s %8.3fs %10d %20.6f", kind, case[1],
+                        time, n, checksum(t, n)))
+  end
+  os.remove(name)
+end
@@ -0,0 +1,57 @@
+--[[
+  Benchmark of ropes (LUA_USE_ROPES): builds strings by naive repeated
+  concatenation, appending and prepending pieces of several sizes, and
+  then reads each result once (its length, a table key, string.find),
+  printing the time of each step:
+
+      delua-5.4 bench/ropes.lua [pieces]
+
+  Without ropes, every 's = s .. x' copies all of 's'; with them, the
+  contents are copied once, when first read.
+--]]
+
+local npieces = tonumber(arg and arg[1]) or 20000
+
+local function time (f, ...)
+  local t0 = os.clock()
+  local r = f(...)
+  return os.clock() - t0, r
+end
+
+local function append (piece, n)
+  local s = ""
+  for i = 1, n do s = s .. piece end
+  return s
+end
+
+local function appendmany (piece, n)
+  local s = ""
+  for i = 1, n do s = s .. piece .. i .. "\n" end
+  return s
+end
+
+local function prepend (piece, n)
+  local s = ""
+  for i = 1, n do s = piece .. s end
+  return s
+end
+
+local function observe (s)
+  local t = {[s] = true}
+  assert(t[s] and s:find("x", 1, true))
+  return #s
+end
+
+print(string.format("%-12s %6s %10s %10s %10s", "build", "piece",
+                    "bytes", "build s", "read s"))
+for _, size in ipairs{1, 16, 128} do
+  local piece = string.rep("x", size)
+  for _, case in ipairs{{"append", append}, {"append 3", appendmany},
+                        {"prepend", prepend}} do
+    collectgarbage()
+    local tb, s = time(case[2], piece, npieces)
+    local tr, len = time(observe, s)
+    print(string.format("%-12s %6d %10d %9.3fs %9.3fs", case[1], size,
+                        len, tb, tr))
+  end
+end
@@ -0,0 +1,86 @@
+--[[
+  Benchmark of records (tables with a few string keys): memory per
+  record and time to build them and to read and write their fields, for
+  records built by constructors and field by field, with 2 to 16 fields.
+  Run it with interpreters built with and without LUA_USE_SHAPES and
+  compare bytes and times:
+
+      delua-5.4 bench/shapes.lua [number of records]
+--]]
+
+local clock = os.clock
+local nrec = tonumber(arg and arg[1]) or 200000
+local rounds = 20
+
+-- shapes no table uses any more are freed (with their keys) by full
+-- collections
+do
+  collectgarbage(); collectgarbage(); collectgarbage()
+  local m0 = collectgarbage("count")
+  for i = 1, 4000 do  -- about 4000 shapes, with 4000 keys of their own
+    local r = {}
+    r["a" .. i % 16] = i; r["b" .. i // 16 % 16] = i; r["c" .. i] = i
+    assert(r["a" .. i % 16] + r["b" .. i // 16 % 16] + r["c" .. i] == 3 * i)
+  end
+  collectgarbage(); collectgarbage(); collectgarbage()
+  assert(collectgarbage("count") - m0 < 64)
+end
+
+
+-- functions building records with 'n' fields by a constructor and by
+-- assignments to an empty table
+local function builders (n)
+  local names, inits, sets = {}, {}, {}
+  for i = 1, n do
+    names[i] = "f" .. i
+    inits[i] = string.format("f%d = i + %d", i, i)
+    sets[i] = string.format("r.f%d = i + %d", i, i)
+  end
+  local ctor = load(string.format(
+      "return function (i) return {%s} end", table.concat(inits, ", ")))()
+  local byfield = load(string.format(
+      "return function (i) local r = {} %s return r end",
+      table.concat(sets, " ")))()
+  -- reads all fields and writes the first one of every record
+  local access = load(string.format([[
+    return function (rs, rounds)
+      local s = 0
+      for _ = 1, rounds do
+        for i = 1, #rs do
+          local r = rs[i]
+          s = s + %s
+          r.f1 = i
+        end
+      end
+      return s
+    end]], "r." .. table.concat(names, " + r.")))()
+  return ctor, byfield, access
+end
+
+
+local function bench (name, n, build, access)
+  collectgarbage(); collectgarbage()
+  local rs = {}
+  for i = 1, nrec do rs[i] = false end  -- fill the array part first
+  local m0 = collectgarbage("count")
+  local t0 = clock()
+  for i = 1, nrec do rs[i] = build(i) end
+  local tbuild = clock() - t0
+  collectgarbage(); collectgarbage()
+  local bytes = (collectgarbage("count") - m0) * 1024 / nrec
+  t0 = clock()
+  access(rs, rounds)
+  local taccess = clock() - t0
+  print(string.format("%-8s %6d %10.1f %10.1f %10.2f", name, n, bytes,
+                      tbuild * 1e9 / nrec,
+                      taccess * 1e9 / (nrec * rounds * (n + 1))))
+end
+
+
+print(string.format("%-8s %6s %10s %10s %10s", "records", "fields",
+                    "bytes", "build ns", "field ns"))
+for _, n in ipairs{2, 4, 8, 16} do
+  local ctor, byfield, access = builders(n)
+  bench("ctor", n, ctor, access)
+  bench("byfield", n, byfield, access)
+end
@@ -0,0 +1,46 @@
+--[[
+  Benchmark of the allocator: creates and drops small tables, closures
+  and strings of several sizes while keeping a bounded live set. Compare
+  interpreters built with and without LUA_USE_SLABALLOC; with it, the
+  statistics of the busiest size classes are printed too:
+
+      delua-5.4 bench/slaballoc.lua [number of iterations, in thousands]
+--]]
+
+local clock = os.clock
+local n = (tonumber(arg and arg[1]) or 2000) * 1000
+
+local function churn (n)
+  local keep = {}
+  for i = 1, n do
+    local t = {i, i + 1, x = i}
+    local s = "k" .. i
+    local f = function () return t, s end
+    keep[i % 4096 + 1] = (i % 3 == 0) and {f, t, s, i % 7} or f
+  end
+  return #keep
+end
+
+
+local t0 = clock()
+assert(churn(n) == 4096)
+print(string.format("churn: %.2f s", clock() - t0))
+
+local ok, stats = pcall(collectgarbage, "slabs")
+if ok and stats then
+  local sizes = {}
+  for size, s in pairs(stats) do
+    if math.type(size) == "integer" then sizes[#sizes + 1] = size end
+  end
+  table.sort(sizes, function (a, b)
+    return stats[a].allocs > stats[b].allocs
+  end)
+  for i = 1, math.min(#sizes, 6) do
+    local s = stats[sizes[i]]
+    print(string.format("%4d bytes: %10d allocs %6d in use %4d pages",
+                        sizes[i], s.allocs, s.blocks, s.pages))
+  end
+  print(string.format("large: %d allocs %d in use (%d bytes)",
+                      stats.large.allocs, stats.large.blocks,
+                      stats.large.bytes))
+end
@@ -0,0 +1,71 @@
+--[[
+  Benchmark of slices (LUA_USE_SLICES): splits a text of long lines
+  with 'gmatch' and 'string.sub', keeping the pieces, and then reads a
+  few of them (their lengths, 'string.find'), printing the time of
+  each step:
+
+      delua-5.4 bench/slices.lua [lines] [line length]
+
+  Without slices, every piece is a copy of its bytes; with them, long
+  pieces refer to the text they come from.
+--]]
+
+local nlines = tonumber(arg and arg[1]) or 50000
+local linelen = tonumber(arg and arg[2]) or 200
+
+local function time (f, ...)
+  local t0 = os.clock()
+  local r = f(...)
+  return os.clock() - t0, r
+end
+
+local function maketext ()
+  local t = {}
+  for i = 1, nlines do
+    local head = string.format("%08d ", i)
+    t[i] = head .. string.rep(string.char(97 + i % 26), linelen - #head)
+  end
+  return table.concat(t, "\n") .. "\n"
+end
+
+local function lines (text)
+  local t = {}
+  for l in string.gmatch(text, "([^\n]*)\n") do t[#t + 1] = l end
+  return t
+end
+
+local function fields (text)
+  local t = {}
+  for id, body in string.gmatch(text, "(%d+) ([^\n]*)") do
+    t[#t + 1] = body
+  end
+  return t
+end
+
+local function subs (text)
+  local t = {}
+  local n = #text - linelen
+  for i = 1, n, linelen // 2 do t[#t + 1] = text:sub(i, i + linelen - 1) end
+  return t
+end
+
+local function observe (t)
+  local total = 0
+  for i = 1, #t, 97 do
+    total = total + #t[i]
+    assert(t[i]:find("a", 1, true) or t[i]:find("b", 1, true) or true)
+  end
+  return #t
+end
+
+local text = maketext()
+print(string.format("%-8s %10s %10s %10s %10s", "split", "text",
+                    "pieces", "split s", "read s"))
+for _, case in ipairs{{"lines", lines}, {"fields", fields},
+                      {"sub", subs}} do
+  collectgarbage()
+  local ts, t = time(case[2], text)
+  local tr, n = time(observe, t)
+  print(string.format("%-8s %10d %10d %9.3fs %9.3fs", case[1], #text,
+                      n, ts, tr))
+end
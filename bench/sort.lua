@@ -0,0 +1,44 @@
+--[[
+  Benchmark of 'table.sort' (LUA_USE_PDQSORT): sorts arrays of
+  integers, floats and strings with the default order, and arrays of
+  integers and of records with order functions, in several patterns,
+  printing the time of each case:
+
+      delua-5.4 bench/sort.lua [size]
+--]]
+
+local n = math.floor(tonumber(arg and arg[1]) or 1e6)
+
+local patterns = {
+  {"random", function (i) return math.random(n) end},
+  {"sorted", function (i) return i end},
+  {"reversed", function (i) return n - i end},
+  {"few", function (i) return math.random(8) end},
+  {"nearly", function (i)
+     return math.random(100) == 1 and math.random(n) or i end},
+}
+
+local kinds = {
+  {"int", function (v) return v end},
+  {"float", function (v) return v / 7 end},
+  {"string", function (v) return string.format("key%09d", v) end},
+  {"int/func", function (v) return v end,
+   function (a, b) return a > b end},
+  {"record", function (v) return {id = v} end,
+   function (a, b) return a.id < b.id end},
+}
+
+print(string.format("%-10s %-10s %10s %10s", "kind", "pattern", "size",
+                    "time"))
+for _, kind in ipairs(kinds) do
+  for _, pat in ipairs(patterns) do
+    local t = {}
+    math.randomseed(5)
+    for i = 1, n do t[i] = kind[2](pat[2](i)) end
+    collectgarbage()
+    local t0 = os.clock()
+    table.sort(t, kind[3])
+    print(string.format("%-10s %-10s %10d %9.3fs", kind[1], pat[1], n,
+                        os.clock() - t0))
+  end
+end
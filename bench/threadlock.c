@@ -0,0 +1,175 @@
+/*
+** Stress test and benchmark of LUA_USE_THREADLOCK. Several OS threads
+** share one state: each one resumes coroutines of its own, which update
+** shared tables and produce garbage, and the totals are checked at the
+** end. Then the cost of the lock on a single thread is measured with
+** calls through the API and a Lua loop calling a C function. Build it
+** against the static library of a build directory:
+**
+**   cc -O2 -I lua/src -I <build>/include bench/threadlock.c \
+**      <build>/bin/libdelua-5.4.a -lm -ldl -lpthread -o threadlock
+**   ./threadlock [threads] [resumes per thread]
+**
+** Without the option only the single-thread timings are taken, so that
+** they can be compared.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char worker[] =
+  "local id, n = ...\n"
+  "local co = coroutine.wrap(function ()\n"
+  "  local mine = 0\n"
+  "  while true do\n"
+  "    counts[id] = counts[id] + 1\n"
+  "    total.n = total.n + 1\n"
+  "    mine = mine + #{('x'):rep(id % 7 + 1), {}}\n"
+  "    coroutine.yield(mine)\n"
+  "  end\n"
+  "end)\n"
+  "local last\n"
+  "for i = 1, n do last = co() end\n"
+  "return last\n";
+
+
+typedef struct Worker {
+  lua_State *L;  /* thread of the shared state */
+  int id;
+  int n;
+  lua_Integer result;
+} Worker;
+
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void check (lua_State *L, int status) {
+  if (status != LUA_OK) {
+    fprintf(stderr, "error: %s\n", lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+#if defined(LUA_USE_THREADLOCK)
+
+static void *run (void *ud) {
+  Worker *w = (Worker *)ud;
+  lua_State *L = w->L;
+  check(L, luaL_loadstring(L, worker));
+  lua_pushinteger(L, w->id);
+  lua_pushinteger(L, w->n);
+  check(L, lua_pcall(L, 2, 1, 0));
+  w->result = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  return NULL;
+}
+
+
+static void stress (lua_State *L, int nthreads, int n) {
+  Worker *w = (Worker *)malloc(nthreads * sizeof(Worker));
+  pthread_t *th = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+  double t0;
+  int i;
+  check(L, luaL_dostring(L, "counts, total = {}, {n = 0}"));
+  lua_getglobal(L, "counts");
+  for (i = 0; i < nthreads; i++) {
+    lua_pushinteger(L, 0);
+    lua_rawseti(L, -2, i + 1);
+    w[i].L = lua_newthread(L);  /* anchored in the registry below */
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &w[i]);
+    w[i].id = i + 1;
+    w[i].n = n;
+  }
+  lua_pop(L, 1);
+  t0 = now();
+  for (i = 0; i < nthreads; i++)
+    pthread_create(&th[i], NULL, run, &w[i]);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(th[i], NULL);
+  printf("stress: %d threads x %d resumes: %.3f s\n", nthreads, n,
+         now() - t0);
+  lua_getglobal(L, "total");
+  lua_getfield(L, -1, "n");
+  if (lua_tointeger(L, -1) != (lua_Integer)nthreads * n) {
+    fprintf(stderr, "lost updates: %lld\n", (long long)lua_tointeger(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_pop(L, 2);
+  for (i = 0; i < nthreads; i++) {
+    if (w[i].result != 2 * (lua_Integer)n) {
+      fprintf(stderr, "thread %d: wrong result\n", w[i].id);
+      exit(EXIT_FAILURE);
+    }
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &w[i]);
+  }
+  free(th);
+  free(w);
+}
+
+#endif
+
+
+static int add (lua_State *L) {
+  lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+  return 1;
+}
+
+
+static void single (lua_State *L, int n) {
+  double t0 = now();
+  lua_Integer s = 0;
+  int i;
+  for (i = 0; i < n; i++) {  /* API calls, each taking the lock */
+    lua_pushcfunction(L, add);
+    lua_pushinteger(L, s);
+    lua_pushinteger(L, 1);
+    lua_call(L, 2, 1);
+    s = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  printf("api calls: %.3f s\n", now() - t0);
+  lua_pushcfunction(L, add);
+  lua_setglobal(L, "add");
+  t0 = now();
+  check(L, luaL_loadstring(L,
+    "local add, s = add, 0 for i = 1, ... do s = add(s, 1) end return s"));
+  lua_pushinteger(L, n);
+  check(L, lua_pcall(L, 1, 1, 0));
+  printf("lua calls: %.3f s\n", now() - t0);
+  if (s != n || lua_tointeger(L, -1) != n) {
+    fprintf(stderr, "wrong sum\n");
+    exit(EXIT_FAILURE);
+  }
+  lua_pop(L, 1);
+}
+
+
+int main (int argc, char **argv) {
+  int nthreads = (argc > 1) ? atoi(argv[1]) : 4;
+  int n = (argc > 2) ? atoi(argv[2]) : 200000;
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+#if defined(LUA_USE_THREADLOCK)
+  stress(L, nthreads, n);
+#else
+  (void)nthreads;
+  printf("stress: not built with LUA_USE_THREADLOCK\n");
+#endif
+  single(L, n * 20);
+  lua_close(L);
+  return 0;
+}
@@ -0,0 +1,64 @@
+--[[
+  Benchmark of the worker library (LUA_USE_WORKERS): runs the same
+  CPU-bound jobs on pools of 1 to 'worker.cores()' workers and prints the
+  speedup over one worker, then times small messages and a large blob
+  sent through a channel (the blob is not copied):
+
+      delua-5.4 bench/workers.lua [number of jobs]
+
+  Wall-clock times are taken with date(1).
+--]]
+
+local worker = require "worker"
+local njobs = tonumber(arg and arg[1]) or 32
+
+local function wallclock ()
+  local p = io.popen("date +%s%N")
+  local t = p:read("n")
+  p:close()
+  return t / 1e9
+end
+
+local function job (n)
+  local s = 0
+  for i = 1, n do
+    s = s + (i % 7) * (i % 11)
+  end
+  return s
+end
+
+local base
+for n = 1, worker.cores() do
+  local pool = worker.pool(n)
+  local futures = {}
+  local t0 = wallclock()
+  for i = 1, njobs do futures[i] = pool:submit(job, 2e6) end
+  for i = 1, njobs do futures[i]:await() end
+  local t = wallclock() - t0
+  pool:close()
+  base = base or t
+  print(string.format("%3d workers: %6.3f s  (speedup %.2f)", n, t, base / t))
+end
+
+
+local pool = worker.pool(1)
+local ch = worker.channel()
+local nmsg = 200000
+local t0 = wallclock()
+local f = pool:submit(function (ch, n)
+  for i = 1, n do ch:send(i, "item") end
+end, ch, nmsg)
+for i = 1, nmsg do assert(ch:receive() == i) end
+f:await()
+local t = wallclock() - t0
+print(string.format("messages: %.0f per second", nmsg / t))
+
+local blob = worker.blob(string.rep("x", 64 * 1024 * 1024))
+t0 = wallclock()
+for i = 1, 100 do
+  f = pool:submit(function (b) return #b end, blob)
+  assert(f:await() == #blob)
+end
+t = wallclock() - t0
+print(string.format("64 MB blob round trips: %.3f ms each", t * 10))
+pool:close()
@@ -0,0 +1,63 @@
+--[[
+  Benchmark of gathered writes (LUA_USE_GATHERWRITE): writes records of
+  integers, floats and strings, one 'file:write' per record, and through
+  a writer when the build has them, printing the time of each case and
+  the size of the output (which must not depend on the build):
+
+      delua-5.4 bench/write.lua [records] [file]
+
+  The file is a temporary one by default; "/dev/null" leaves out the
+  cost of the file system.
+--]]
+
+local nrecords = tonumber(arg and arg[1]) or 1000000
+local name = arg and arg[2] or os.tmpname()
+
+local function time (case, f)
+  local out = assert(io.open(name, "wb"))
+  collectgarbage()
+  local t0 = os.clock()
+  f(out)
+  out:close()
+  local t = os.clock() - t0
+  local size = io.open(name, "rb"):seek("end") or 0
+  print(string.format("%-22s %8.3fs %12d", case, t, size))
+end
+
+local function records (w)
+  for i = 1, nrecords do
+    w:write(i, ",", i * 7, ",", "name", ",", -i, "\n")
+  end
+end
+
+local function floats (w)
+  for i = 1, nrecords do
+    w:write(i * 0.25, " ", i / 3, "\n")
+  end
+end
+
+local function strings (w)
+  local words = {"alpha", "beta", "gamma", "delta", "epsilon"}
+  for i = 1, nrecords do
+    w:write(words[i % 5 + 1], "\t", words[(i * 3) % 5 + 1], "\t",
+            words[(i * 7) % 5 + 1], "\n")
+  end
+end
+
+local function single (w)
+  for i = 1, nrecords do w:write(i) end
+end
+
+print(string.format("%-22s %9s %12s", "case", "time", "bytes"))
+for _, case in ipairs{{"integer records", records}, {"float records", floats},
+                      {"string records", strings}, {"single integers", single}} do
+  time("file " .. case[1], case[2])
+  if io.stdout.writer then
+    time("writer " .. case[1], function (out)
+      local w <close> = out:writer()
+      case[2](w)
+    end)
+  end
+end
+
+if name ~= (arg and arg[2]) then os.remove(name) end
@@ -16,10 +16,12 @@ set(LUALIB_INTERNAL_HDRS
     ${DeLua_SOURCE_DIR}/lua/src/ldo.h
     ${DeLua_SOURCE_DIR}/lua/src/lfunc.h
     ${DeLua_SOURCE_DIR}/lua/src/lgc.h
+    ${DeLua_SOURCE_DIR}/lua/src/ljit.h
     ${DeLua_SOURCE_DIR}/lua/src/ljumptab.h
     ${DeLua_SOURCE_DIR}/lua/src/llex.h
     ${DeLua_SOURCE_DIR}/lua/src/llimits.h
     ${DeLua_SOURCE_DIR}/lua/src/lmem.h
+    ${DeLua_SOURCE_DIR}/lua/src/lnumtab.h
     ${DeLua_SOURCE_DIR}/lua/src/lobject.h
     ${DeLua_SOURCE_DIR}/lua/src/lopcodes.h
     ${DeLua_SOURCE_DIR}/lua/src/lopnames.h
@@ -46,6 +48,7 @@ set(LUACORE_SRCS
     ${DeLua_SOURCE_DIR}/lua/src/ldump.c
     ${DeLua_SOURCE_DIR}/lua/src/lfunc.c
     ${DeLua_SOURCE_DIR}/lua/src/lgc.c
+    ${DeLua_SOURCE_DIR}/lua/src/ljit.c
     ${DeLua_SOURCE_DIR}/lua/src/llex.c
     ${DeLua_SOURCE_DIR}/lua/src/lmem.c
     ${DeLua_SOURCE_DIR}/lua/src/lobject.c
@@ -60,17 +63,20 @@ set(LUACORE_SRCS
     ${DeLua_SOURCE_DIR}/lua/src/lzio.c)
 
 set(LUAAUX_SRCS
+    ${DeLua_SOURCE_DIR}/lua/src/laiolib.c
     ${DeLua_SOURCE_DIR}/lua/src/lauxlib.c
     ${DeLua_SOURCE_DIR}/lua/src/lbaselib.c
     ${DeLua_SOURCE_DIR}/lua/src/lcorolib.c
     ${DeLua_SOURCE_DIR}/lua/src/ldblib.c
     ${DeLua_SOURCE_DIR}/lua/src/liolib.c
+    ${DeLua_SOURCE_DIR}/lua/src/ljitlib.c
     ${DeLua_SOURCE_DIR}/lua/src/lmathlib.c
     ${DeLua_SOURCE_DIR}/lua/src/loadlib.c
     ${DeLua_SOURCE_DIR}/lua/src/loslib.c
     ${DeLua_SOURCE_DIR}/lua/src/lstrlib.c
     ${DeLua_SOURCE_DIR}/lua/src/ltablib.c
     ${DeLua_SOURCE_DIR}/lua/src/lutf8lib.c
+    ${DeLua_SOURCE_DIR}/lua/src/lworklib.c
     ${DeLua_SOURCE_DIR}/lua/src/linit.c)
 
 set(LUALIB_SRCS
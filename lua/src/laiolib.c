@@ -0,0 +1,770 @@
+/*
+** $Id: laiolib.c $
+** Asynchronous file I/O on io_uring for coroutines
+** See Copyright Notice in lua.h
+*/
+
+#define laiolib_c
+#define LUA_LIB
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* for 'syscall' and 'MAP_POPULATE' */
+#endif
+
+#include "lprefix.h"
+
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#if defined(LUA_USE_AIO)
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/*
+** The library keeps one ring per state. 'aio.spawn' creates tasks,
+** coroutines that 'aio.run' resumes. When a task reads or writes a
+** file, the operation goes into the submission queue of the ring and
+** the task yields (with a continuation); 'aio.run' submits all queued
+** operations at once, waits for completions, and resumes their tasks
+** with the results, a batch at a time. Outside tasks (and where
+** io_uring is not available), operations are blocking system calls.
+*/
+
+
+/* number of entries in the submission queue of a ring */
+#if !defined(LUAI_AIOENTRIES)
+#define LUAI_AIOENTRIES	256
+#endif
+
+/* maximum number of completions taken from the ring at once */
+#if !defined(LUAI_AIOBATCH)
+#define LUAI_AIOBATCH	64
+#endif
+
+
+#define RINGMETA	"aio.ring"
+#define FILEMETA	"aio.file"
+
+/* registry key */
+#define AIOSTATE	"aio.state"
+
+
+typedef struct Ring {
+  int fd;  /* the ring, or -1 without io_uring */
+  int running;  /* 'aio.run' is running */
+  int pending;  /* task that yielded last waits for an operation */
+  unsigned int tosubmit;  /* operations queued and not submitted */
+  unsigned int inflight;  /* operations submitted and not completed */
+  unsigned int maxinflight;  /* size of the completion queue */
+  unsigned int sqentries;
+  unsigned int sqmask;
+  unsigned int *sqhead, *sqtail, *sqarray;
+  struct io_uring_sqe *sqes;
+  unsigned int cqmask;
+  unsigned int *cqhead, *cqtail;
+  struct io_uring_cqe *cqes;
+  void *sqring, *cqring;  /* mappings of the queues */
+  size_t sqringsize, cqringsize, sqessize;
+} Ring;
+
+
+typedef struct AFile {
+  int fd;  /* -1 when closed */
+  int pending;  /* operations started and not finished (see 'closefile') */
+} AFile;
+
+
+/*
+** {======================================================
+** Rings
+** =======================================================
+*/
+
+static void closering (Ring *R) {
+  if (R->sqes != NULL)
+    munmap(R->sqes, R->sqessize);
+  if (R->cqring != NULL && R->cqring != R->sqring)
+    munmap(R->cqring, R->cqringsize);
+  if (R->sqring != NULL)
+    munmap(R->sqring, R->sqringsize);
+  if (R->fd >= 0)
+    close(R->fd);
+  R->sqes = NULL;
+  R->sqring = R->cqring = NULL;
+  R->fd = -1;
+}
+
+
+static void *mapring (Ring *R, size_t size, off_t offset) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, R->fd, offset);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+
+/*
+** Sets up the ring of 'R'; without io_uring (or with a kernel older
+** than 5.6, which cannot read at the current position of a file), it
+** leaves 'R->fd' as -1.
+*/
+static void setupring (Ring *R) {
+  struct io_uring_params p;
+  char *sq, *cq;
+  memset(&p, 0, sizeof(p));
+  R->fd = (int)syscall(__NR_io_uring_setup, LUAI_AIOENTRIES, &p);
+  if (R->fd < 0 || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+    closering(R);
+    return;
+  }
+  R->sqringsize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  R->cqringsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  R->sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {  /* one mapping for both? */
+    if (R->cqringsize > R->sqringsize)
+      R->sqringsize = R->cqringsize;
+    R->sqring = R->cqring = mapring(R, R->sqringsize, IORING_OFF_SQ_RING);
+  }
+  else {
+    R->sqring = mapring(R, R->sqringsize, IORING_OFF_SQ_RING);
+    R->cqring = mapring(R, R->cqringsize, IORING_OFF_CQ_RING);
+  }
+  R->sqes = (struct io_uring_sqe *)mapring(R, R->sqessize, IORING_OFF_SQES);
+  if (R->sqring == NULL || R->cqring == NULL || R->sqes == NULL) {
+    closering(R);
+    return;
+  }
+  sq = (char *)R->sqring;
+  cq = (char *)R->cqring;
+  R->sqentries = p.sq_entries;
+  R->sqmask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+  R->sqhead = (unsigned int *)(sq + p.sq_off.head);
+  R->sqtail = (unsigned int *)(sq + p.sq_off.tail);
+  R->sqarray = (unsigned int *)(sq + p.sq_off.array);
+  R->cqmask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+  R->cqhead = (unsigned int *)(cq + p.cq_off.head);
+  R->cqtail = (unsigned int *)(cq + p.cq_off.tail);
+  R->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  R->maxinflight = p.cq_entries;
+}
+
+
+/*
+** Submits the queued operations and, if 'wait', waits for at least one
+** completion. Returns 0 or an error code.
+*/
+static int enter (Ring *R, int wait) {
+  for (;;) {
+    int n = (int)syscall(__NR_io_uring_enter, R->fd, R->tosubmit,
+                         wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                         NULL, 0);
+    if (n >= 0) {
+      R->tosubmit -= (unsigned int)n;
+      R->inflight += (unsigned int)n;
+      return 0;
+    }
+    else if (errno != EINTR)
+      return errno;
+  }
+}
+
+
+/*
+** Queues an operation for task 'id'. Returns 0 when the ring already
+** has as many operations as its completion queue can take.
+*/
+static int queueop (Ring *R, int op, int fd, void *buff, size_t len,
+                    lua_Integer offset, lua_Integer id) {
+  unsigned int tail, idx;
+  struct io_uring_sqe *sqe;
+  if (R->inflight + R->tosubmit >= R->maxinflight)
+    return 0;
+  tail = *R->sqtail;
+  if (tail - __atomic_load_n(R->sqhead, __ATOMIC_ACQUIRE) >= R->sqentries) {
+    if (enter(R, 0) != 0)  /* submission queue full: submit it */
+      return 0;
+  }
+  idx = tail & R->sqmask;
+  sqe = &R->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = (unsigned char)op;
+  sqe->fd = fd;
+  sqe->off = (offset < 0) ? (unsigned long long)-1 : (unsigned long long)offset;
+  sqe->addr = (unsigned long long)(size_t)buff;
+  sqe->len = (unsigned int)len;
+  sqe->user_data = (unsigned long long)id;
+  R->sqarray[idx] = idx;
+  __atomic_store_n(R->sqtail, tail + 1, __ATOMIC_RELEASE);
+  R->tosubmit++;
+  return 1;
+}
+
+
+/*
+** Takes up to LUAI_AIOBATCH completions from the ring into 'ids' and
+** 'res', returning how many.
+*/
+static int reap (Ring *R, lua_Integer *ids, int *res) {
+  unsigned int head = *R->cqhead;
+  unsigned int tail = __atomic_load_n(R->cqtail, __ATOMIC_ACQUIRE);
+  int n = 0;
+  while (head != tail && n < LUAI_AIOBATCH) {
+    struct io_uring_cqe *cqe = &R->cqes[head & R->cqmask];
+    ids[n] = (lua_Integer)cqe->user_data;
+    res[n] = cqe->res;
+    n++;
+    head++;
+  }
+  __atomic_store_n(R->cqhead, head, __ATOMIC_RELEASE);
+  R->inflight -= (unsigned int)n;
+  return n;
+}
+
+
+/*
+** Submits all queued operations and waits for all operations in
+** flight, dropping their results (their tasks will never run again).
+*/
+static void drain (Ring *R) {
+  if (R->fd >= 0) {
+    lua_Integer ids[LUAI_AIOBATCH];
+    int res[LUAI_AIOBATCH];
+    while (R->inflight + R->tosubmit > 0) {
+      if (enter(R, 1) != 0)
+        break;
+      reap(R, ids, res);
+    }
+  }
+}
+
+
+/*
+** The kernel may still write into the buffers of operations in flight,
+** which the state is about to free: wait for them.
+*/
+static int ring_gc (lua_State *L) {
+  Ring *R = (Ring *)luaL_checkudata(L, 1, RINGMETA);
+  drain(R);
+  closering(R);
+  return 0;
+}
+
+
+/*
+** Pushes the ring userdata of the state, creating it the first time.
+** Its user values are the table of tasks (id -> thread and thread ->
+** id) and the list of tasks ready to run.
+*/
+static Ring *getring (lua_State *L) {
+  Ring *R;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, AIOSTATE) == LUA_TUSERDATA)
+    return (Ring *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  R = (Ring *)lua_newuserdatauv(L, sizeof(Ring), 2);
+  memset(R, 0, sizeof(Ring));
+  R->fd = -1;
+  if (luaL_newmetatable(L, RINGMETA)) {
+    lua_pushcfunction(L, ring_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 1);  /* tasks */
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 2);  /* ready tasks */
+  setupring(R);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, AIOSTATE);
+  return R;
+}
+
+
+/* id of the task running in 'L' (the ring on the top), or 0 */
+static lua_Integer taskid (lua_State *L) {
+  lua_Integer id;
+  lua_getiuservalue(L, -1, 1);
+  lua_pushthread(L);
+  lua_rawget(L, -2);
+  id = lua_tointeger(L, -1);
+  lua_pop(L, 2);
+  return id;
+}
+
+
+/* moves the task on the top to the ready tasks of the ring at 'r' */
+static void addready (lua_State *L, int r) {
+  lua_getiuservalue(L, r, 2);
+  lua_rotate(L, -2, 1);
+  lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+  lua_pop(L, 1);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Tasks
+** =======================================================
+*/
+
+/*
+** Starts an operation on file 'f' for the running task: queues it and
+** yields until 'aio.run' resumes the task with its result, for the
+** continuation 'k'. If the ring is full, the task yields to be resumed
+** later with 'again' instead, which must start the operation anew.
+** Outside tasks, does the operation at once, with a blocking system
+** call. The continuation gets the result (a count or minus an error
+** code) on the top, and must call 'endop'.
+*/
+static int startop (lua_State *L, int op, AFile *f, void *buff, size_t len,
+                    lua_Integer offset, lua_KContext ctx,
+                    lua_KFunction k, lua_KFunction again) {
+  Ring *R = getring(L);
+  lua_Integer id = (R->fd >= 0 && lua_isyieldable(L)) ? taskid(L) : 0;
+  if (id == 0) {  /* not in a task? */
+    ssize_t res;
+    lua_pop(L, 1);  /* ring */
+    if (op == IORING_OP_READ)
+      res = (offset < 0) ? read(f->fd, buff, len)
+                         : pread(f->fd, buff, len, (off_t)offset);
+    else
+      res = (offset < 0) ? write(f->fd, buff, len)
+                         : pwrite(f->fd, buff, len, (off_t)offset);
+    lua_pushinteger(L, (res < 0) ? -(lua_Integer)errno : (lua_Integer)res);
+    f->pending++;
+    return k(L, LUA_OK, ctx);
+  }
+  else if (!queueop(R, op, f->fd, buff, len, offset, id)) {  /* full? */
+    lua_pop(L, 1);  /* ring */
+    R->pending = 0;  /* to be resumed as ready */
+    return lua_yieldk(L, 0, ctx, again);
+  }
+  else {
+    lua_pop(L, 1);  /* ring */
+    R->pending = 1;  /* to be resumed with the result */
+    f->pending++;
+    return lua_yieldk(L, 0, ctx, k);
+  }
+}
+
+
+/* an operation started by 'startop' on the file at index 1 is over */
+static void endop (lua_State *L) {
+  AFile *f = (AFile *)lua_touserdata(L, 1);
+  f->pending--;
+}
+
+
+/*
+** Resumes the task on the top (popping it), with 'nargs' values on its
+** stack; the ring is at index 1 and the table of tasks at index 2. A
+** task that yields without waiting for an operation is ready to run
+** again; one that ends leaves the table of tasks. Errors propagate.
+*/
+static void resumetask (lua_State *L, Ring *R, int nargs) {
+  lua_State *co = lua_tothread(L, -1);
+  int nres;
+  int status;
+  R->pending = 0;
+  status = lua_resume(co, L, nargs, &nres);
+  if (status == LUA_YIELD) {
+    lua_pop(co, nres);
+    if (!R->pending)
+      addready(L, 1);
+    else
+      lua_pop(L, 1);
+  }
+  else {  /* task is over */
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 2);  /* its id */
+    luaL_unref(L, 2, (int)lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, 2);  /* tasks[co] = nil */
+    if (status != LUA_OK) {  /* error? */
+      R->running = 0;
+      lua_xmove(co, L, 1);  /* move error message */
+      lua_error(L);  /* propagate error */
+    }
+  }
+}
+
+
+static int aio_spawn (lua_State *L) {
+  lua_State *co;
+  int id;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  co = lua_newthread(L);
+  lua_rotate(L, 1, 1);  /* thread below function and arguments */
+  lua_xmove(L, co, lua_gettop(L) - 1);  /* move them to the task */
+  getring(L);
+  lua_getiuservalue(L, -1, 1);  /* tasks */
+  lua_pushvalue(L, 1);
+  id = luaL_ref(L, -2);  /* tasks[id] = co */
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, id);
+  lua_rawset(L, -3);  /* tasks[co] = id */
+  lua_pop(L, 1);  /* tasks */
+  lua_pushvalue(L, 1);
+  addready(L, 2);
+  lua_settop(L, 1);
+  return 1;  /* return the task */
+}
+
+
+/*
+** Runs the tasks until all of them are over: resumes the ready ones,
+** submits the operations they queued, and resumes the tasks of the
+** completed operations, waiting for them when there is nothing else
+** to do.
+*/
+static int aio_run (lua_State *L) {
+  Ring *R;
+  lua_Integer ids[LUAI_AIOBATCH];
+  int res[LUAI_AIOBATCH];
+  lua_settop(L, 0);
+  R = getring(L);  /* ring at index 1 */
+  luaL_argcheck(L, !R->running, 1, "tasks are already running");
+  lua_getiuservalue(L, 1, 1);  /* tasks at index 2 */
+  R->running = 1;
+  for (;;) {
+    lua_Integer i, n;
+    int wait, err;
+    lua_getiuservalue(L, 1, 2);  /* ready tasks at index 3 */
+    n = luaL_len(L, 3);
+    if (n > 0) {  /* resume ready tasks */
+      lua_newtable(L);
+      lua_setiuservalue(L, 1, 2);  /* new list for tasks that get ready */
+      for (i = 1; i <= n; i++) {
+        lua_State *co;
+        lua_rawgeti(L, 3, i);
+        co = lua_tothread(L, -1);
+        resumetask(L, R, (lua_status(co) == LUA_OK) ? lua_gettop(co) - 1 : 0);
+      }
+      lua_getiuservalue(L, 1, 2);
+      n = luaL_len(L, -1);  /* tasks ready again */
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    if (R->inflight + R->tosubmit == 0) {
+      if (n == 0)
+        break;  /* nothing left to do */
+      continue;
+    }
+    /* wait for completions when no task can run (a task waiting for
+       room in a full ring cannot) */
+    wait = (n == 0 || R->inflight + R->tosubmit >= R->maxinflight);
+    err = enter(R, wait);
+    if (err != 0 && err != EAGAIN && err != EBUSY) {
+      R->running = 0;
+      return luaL_error(L, "cannot submit operations (%s)", strerror(err));
+    }
+    while ((n = reap(R, ids, res)) > 0) {  /* resume a batch */
+      for (i = 0; i < n; i++) {
+        lua_State *co;
+        lua_rawgeti(L, 2, ids[i]);
+        co = lua_tothread(L, -1);
+        lua_pushinteger(co, res[i]);  /* yielded task has room for it */
+        resumetask(L, R, 1);
+      }
+    }
+  }
+  R->running = 0;
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Files
+** =======================================================
+*/
+
+static AFile *checkfile (lua_State *L) {
+  AFile *f = (AFile *)luaL_checkudata(L, 1, FILEMETA);
+  if (f->fd < 0)
+    luaL_error(L, "attempt to use a closed file");
+  return f;
+}
+
+
+static int opresult (lua_State *L, lua_Integer res) {
+  luaL_pushfail(L);
+  lua_pushstring(L, strerror((int)-res));
+  lua_pushinteger(L, -res);
+  return 3;
+}
+
+
+/* stack: file, count, offset, buffer, result */
+static int finishread (lua_State *L, int status, lua_KContext ctx) {
+  lua_Integer res = lua_tointeger(L, -1);
+  (void)status; (void)ctx;  /* not used */
+  endop(L);
+  if (res < 0)
+    return opresult(L, res);
+  else if (res == 0 && lua_tointeger(L, 2) > 0)  /* end of file? */
+    luaL_pushfail(L);
+  else
+    lua_pushlstring(L, (const char *)lua_touserdata(L, 4), (size_t)res);
+  return 1;
+}
+
+
+/* stack: file, count, offset, buffer */
+static int doread (lua_State *L, int status, lua_KContext ctx) {
+  AFile *f = checkfile(L);
+  (void)status; (void)ctx;  /* not used */
+  lua_settop(L, 4);
+  return startop(L, IORING_OP_READ, f, lua_touserdata(L, 4),
+                 (size_t)lua_tointeger(L, 2), lua_tointeger(L, 3), 0,
+                 finishread, doread);
+}
+
+
+/*
+** file:read(n [, offset]) reads up to 'n' bytes at 'offset', or at the
+** current position of the file
+*/
+static int f_read (lua_State *L) {
+  lua_Integer n = luaL_checkinteger(L, 2);
+  lua_Integer offset = luaL_optinteger(L, 3, -1);
+  checkfile(L);
+  luaL_argcheck(L, 0 <= n && n <= INT_MAX, 2, "out of range");
+  luaL_argcheck(L, offset >= -1, 3, "out of range");
+  lua_settop(L, 2);
+  lua_pushinteger(L, offset);
+  lua_newuserdatauv(L, (size_t)n, 0);  /* buffer */
+  return doread(L, LUA_OK, 0);
+}
+
+
+static int dowrite (lua_State *L, int status, lua_KContext done);
+
+/* stack: file, string, offset, result; 'done' is the count written */
+static int finishwrite (lua_State *L, int status, lua_KContext done) {
+  lua_Integer res = lua_tointeger(L, -1);
+  size_t len;
+  (void)status;  /* not used */
+  endop(L);
+  lua_tolstring(L, 2, &len);
+  if (res < 0)
+    return opresult(L, res);
+  done += (lua_KContext)res;
+  if ((size_t)done < len && res > 0)  /* short write? */
+    return dowrite(L, LUA_OK, done);  /* write the rest */
+  lua_settop(L, 1);
+  return 1;  /* return file */
+}
+
+
+/* stack: file, string, offset */
+static int dowrite (lua_State *L, int status, lua_KContext done) {
+  AFile *f = checkfile(L);
+  size_t len;
+  const char *s = lua_tolstring(L, 2, &len);
+  lua_Integer offset = lua_tointeger(L, 3);
+  (void)status;  /* not used */
+  lua_settop(L, 3);
+  return startop(L, IORING_OP_WRITE, f, (void *)(s + done),
+                 len - (size_t)done, (offset < 0) ? -1 : offset + done,
+                 done, finishwrite, dowrite);
+}
+
+
+/*
+** file:write(s [, offset]) writes 's' at 'offset', or at the current
+** position of the file
+*/
+static int f_write (lua_State *L) {
+  lua_Integer offset = luaL_optinteger(L, 3, -1);
+  size_t len;
+  checkfile(L);
+  luaL_checklstring(L, 2, &len);
+  luaL_argcheck(L, len <= INT_MAX, 2, "string too long");
+  luaL_argcheck(L, offset >= -1, 3, "out of range");
+  lua_settop(L, 2);
+  lua_pushinteger(L, offset);
+  return dowrite(L, LUA_OK, 0);
+}
+
+
+/*
+** Closes the file at index 1 once no operation refers to it: the kernel
+** takes files by number, and a number freed by 'close' can be reused by
+** the next file opened, which would get the pending operations. A task
+** waits for them, yielding until other tasks finish them; elsewhere,
+** they belong to tasks that are not running, and that is an error.
+*/
+static int closefile (lua_State *L, int status, lua_KContext ctx) {
+  AFile *f = (AFile *)lua_touserdata(L, 1);
+  int res;
+  (void)status;  /* not used */
+  if (f->pending > 0) {
+    Ring *R = getring(L);
+    lua_Integer id = (R->fd >= 0 && lua_isyieldable(L)) ? taskid(L) : 0;
+    lua_pop(L, 1);  /* ring */
+    if (id == 0)
+      return luaL_error(L, "file has pending operations");
+    R->pending = 0;  /* to be resumed as ready */
+    return lua_yieldk(L, 0, ctx, closefile);
+  }
+  res = close(f->fd);
+  f->fd = -1;
+  if (ctx)  /* from '__close'? */
+    return 0;
+  return luaL_fileresult(L, (res == 0), NULL);
+}
+
+
+static int f_close (lua_State *L) {
+  checkfile(L);
+  lua_settop(L, 1);
+  return closefile(L, LUA_OK, 0);
+}
+
+
+static int f_autoclose (lua_State *L) {
+  AFile *f = (AFile *)luaL_checkudata(L, 1, FILEMETA);
+  lua_settop(L, 1);
+  if (f->fd < 0)
+    return 0;
+  return closefile(L, LUA_OK, 1);
+}
+
+
+/*
+** A file with pending operations is only garbage with their tasks, when
+** the state is closing: finish all operations of the ring first.
+*/
+static int f_gc (lua_State *L) {
+  AFile *f = (AFile *)luaL_checkudata(L, 1, FILEMETA);
+  if (f->fd >= 0) {
+    if (f->pending > 0 &&
+        lua_getfield(L, LUA_REGISTRYINDEX, AIOSTATE) == LUA_TUSERDATA)
+      drain((Ring *)lua_touserdata(L, -1));
+    close(f->fd);
+    f->fd = -1;
+  }
+  return 0;
+}
+
+
+static int f_tostring (lua_State *L) {
+  AFile *f = (AFile *)luaL_checkudata(L, 1, FILEMETA);
+  if (f->fd < 0)
+    lua_pushliteral(L, "aio file (closed)");
+  else
+    lua_pushfstring(L, "aio file (%p)", (void *)f);
+  return 1;
+}
+
+
+/*
+** aio.open(name [, mode]) opens a file for asynchronous operations, with
+** the modes of 'io.open'
+*/
+static int aio_open (lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  const char *mode = luaL_optstring(L, 2, "r");
+  const char *m = mode;
+  int flags;
+  AFile *f;
+  switch (*m++) {
+    case 'r': flags = 0; break;
+    case 'w': flags = O_CREAT | O_TRUNC; break;
+    case 'a': flags = O_CREAT | O_APPEND; break;
+    default: return luaL_argerror(L, 2, "invalid mode");
+  }
+  if (*m == '+') {
+    flags |= O_RDWR;
+    m++;
+  }
+  else
+    flags |= (*mode == 'r') ? O_RDONLY : O_WRONLY;
+  luaL_argcheck(L, m[strspn(m, "b")] == '\0', 2, "invalid mode");
+  f = (AFile *)lua_newuserdatauv(L, sizeof(AFile), 0);
+  f->fd = -1;
+  f->pending = 0;
+  luaL_setmetatable(L, FILEMETA);
+  errno = 0;
+  f->fd = open(filename, flags | O_CLOEXEC, 0666);
+  if (f->fd < 0)
+    return luaL_fileresult(L, 0, filename);
+  return 1;
+}
+
+
+/*
+** methods for aio files
+*/
+static const luaL_Reg meth[] = {
+  {"read", f_read},
+  {"write", f_write},
+  {"close", f_close},
+  {NULL, NULL}
+};
+
+
+/*
+** metamethods for aio files
+*/
+static const luaL_Reg metameth[] = {
+  {"__index", NULL},  /* place holder */
+  {"__gc", f_gc},
+  {"__close", f_autoclose},
+  {"__tostring", f_tostring},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, FILEMETA);  /* metatable for aio files */
+  luaL_setfuncs(L, metameth, 0);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, meth);  /* create method table */
+  luaL_setfuncs(L, meth, 0);  /* add file methods to method table */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
+/* whether operations are asynchronous (io_uring is available) */
+static int aio_available (lua_State *L) {
+  lua_pushboolean(L, getring(L)->fd >= 0);
+  return 1;
+}
+
+
+static const luaL_Reg aio_funcs[] = {
+  {"open", aio_open},
+  {"spawn", aio_spawn},
+  {"run", aio_run},
+  {"available", aio_available},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_aio (lua_State *L) {
+  luaL_newlib(L, aio_funcs);
+  createmeta(L);
+  return 1;
+}
+
+#endif
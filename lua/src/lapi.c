@@ -21,6 +21,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -309,6 +310,10 @@ LUA_API int lua_isinteger (lua_State *L, int idx) {
 LUA_API int lua_isnumber (lua_State *L, int idx) {
   lua_Number n;
   const TValue *o = index2value(L, idx);
+#if defined(LUA_USE_ROPES)
+  TValue aux;
+  o = luaS_flatvalue(L, o, &aux);  /* numerals must be built */
+#endif
   return tonumber(o, &n);
 }
 
@@ -328,6 +333,11 @@ LUA_API int lua_isuserdata (lua_State *L, int idx) {
 LUA_API int lua_rawequal (lua_State *L, int index1, int index2) {
   const TValue *o1 = index2value(L, index1);
   const TValue *o2 = index2value(L, index2);
+#if defined(LUA_USE_ROPES)
+  TValue aux1, aux2;
+  o1 = luaS_flatvalue(L, o1, &aux1);  /* see 'luaS_eqrope' */
+  o2 = luaS_flatvalue(L, o2, &aux2);
+#endif
   return (isvalid(L, o1) && isvalid(L, o2)) ? luaV_rawequalobj(o1, o2) : 0;
 }
 
@@ -368,6 +378,229 @@ LUA_API int lua_compare (lua_State *L, int index1, int index2, int op) {
 }
 
 
+#if defined(LUA_USE_PDQSORT)
+LUA_API int lua_sortarray (lua_State *L, int idx, lua_Integer n) {
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttistable(o) && 0 <= n && l_castS2U(n) <= UINT_MAX)
+    res = luaV_sortarray(L, hvalue(o), cast_uint(n));
+  lua_unlock(L);
+  return res;
+}
+#endif
+
+
+#if defined(LUA_USE_ARRAYOPS)
+/*
+** {======================================================
+** Array operations (LUA_USE_ARRAYOPS): copies to and from the array
+** part of a table, for when they cannot call metamethods
+** =======================================================
+*/
+
+/*
+** Elements 'i .. i + n - 1' (n > 0) of the table at 'o', if they are
+** all in its array part and reading them cannot call '__index' (there
+** is no such metamethod or no element is empty); NULL otherwise.
+*/
+static const TValue *getarray (lua_State *L, const TValue *o,
+                               lua_Integer i, lua_Unsigned n) {
+  Table *t;
+  const TValue *a;
+  unsigned int size;
+  if (!ttistable(o))
+    return NULL;
+  t = hvalue(o);
+  size = luaH_realasize(t);
+  if (i < 1 || n > size || l_castS2U(i) - 1u > size - n)
+    return NULL;  /* not all in the array part */
+  a = &t->array[i - 1];
+  if (fasttm(L, t->metatable, TM_INDEX) != NULL) {
+    lua_Unsigned k;
+    for (k = 0; k < n; k++)
+      if (isempty(&a[k])) return NULL;
+  }
+  return a;
+}
+
+
+/*
+** Room for elements 'i .. i + n - 1' (n > 0) in the array part of the
+** table at 'o', if writing them cannot call '__newindex'; NULL
+** otherwise. When the interval starts inside the array part or right
+** after it, the array part grows to hold it (which changes nothing
+** visible).
+*/
+static TValue *setarray (lua_State *L, const TValue *o, lua_Integer i,
+                         lua_Unsigned n) {
+  Table *t;
+  unsigned int size;
+  lua_Unsigned need;
+  if (!ttistable(o))
+    return NULL;
+  t = hvalue(o);
+#if defined(LUA_USE_FROZEN)
+  if (isfrozen(t))
+    return NULL;  /* let the general path raise the error */
+#endif
+  size = luaH_realasize(t);
+  if (i < 1 || l_castS2U(i) - 1u > size || n > MAXASIZE - (l_castS2U(i) - 1u))
+    return NULL;
+  need = l_castS2U(i) - 1u + n;  /* array size needed */
+  if (fasttm(L, t->metatable, TM_NEWINDEX) != NULL) {
+    lua_Unsigned k;
+    if (need > size)
+      return NULL;  /* new elements would call the metamethod */
+    for (k = 0; k < n; k++)
+      if (isempty(&t->array[i - 1 + k])) return NULL;
+  }
+  if (need > size) {  /* grow like a rehash would, at least doubling */
+    lua_Unsigned nsize = (size <= MAXASIZE / 2 && need < 2u * size)
+                       ? 2u * size : need;
+    luaH_resizearray(L, t, cast_uint(nsize));
+  }
+  return &t->array[i - 1];
+}
+
+
+LUA_API int lua_movearray (lua_State *L, int src, lua_Integer f,
+                                         lua_Integer e, lua_Integer t,
+                                         int dst) {
+  const TValue *so;
+  const TValue *d;
+  TValue *to;
+  lua_Unsigned n;
+  int res = 0;
+  lua_lock(L);
+  api_check(L, f <= e, "empty interval");
+  n = l_castS2U(e) - l_castS2U(f) + 1u;
+  so = index2value(L, src);
+  d = index2value(L, dst);
+  if (getarray(L, so, f, n) != NULL && (to = setarray(L, d, t, n)) != NULL) {
+    const TValue *from = getarray(L, so, f, n);  /* ('setarray' may move it) */
+    memmove(to, from, n * sizeof(TValue));
+    if (hvalue(so) != hvalue(d) && isblack(hvalue(d)))
+      luaC_barrierback_(L, obj2gco(hvalue(d)));
+    res = 1;
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_unpackarray (lua_State *L, int idx, lua_Integer i, int n) {
+  const TValue *a;
+  lua_lock(L);
+  api_check(L, n > 0 && n <= L->stack_last.p - L->top.p, "stack overflow");
+  a = getarray(L, index2value(L, idx), i, cast(lua_Unsigned, n));
+  if (a != NULL) {
+    StkId top = L->top.p;
+    int k;
+    for (k = 0; k < n; k++) {
+      if (isempty(&a[k]))
+        setnilvalue(s2v(top + k));
+      else
+        setobj2s(L, top + k, &a[k]);
+    }
+    L->top.p = top + n;
+  }
+  lua_unlock(L);
+  return (a != NULL);
+}
+
+
+/*
+** Length of the concatenation of 'a[0 .. n - 1]' with separators of
+** length 'lsep', or MAX_SIZE if some element is not a string or a
+** number, or if the result would be too long.
+*/
+static size_t concatlen (const TValue *a, lua_Unsigned n, size_t lsep) {
+  const size_t maxlen = MAX_SIZE - sizeof(TString);
+  char numbuff[MAXNUMBER2STR];
+  size_t total;
+  lua_Unsigned k;
+  if (lsep > 0 && n - 1u >= maxlen / lsep)
+    return MAX_SIZE;
+  total = cast_sizet(n - 1u) * lsep;
+  for (k = 0; k < n; k++) {
+    size_t l;
+    if (ttisstring(&a[k]))
+      l = vslen(&a[k]);
+    else if (ttisnumber(&a[k]))
+      l = cast_sizet(luaO_tostringbuff(&a[k], numbuff));
+    else
+      return MAX_SIZE;
+    if (l >= maxlen - total)
+      return MAX_SIZE;
+    total += l;
+  }
+  return total;
+}
+
+
+static void concatcopy (lua_State *L, char *buff, const TValue *a,
+                        lua_Unsigned n, const char *sep, size_t lsep) {
+  lua_Unsigned k;
+  for (k = 0; k < n; k++) {
+    const TValue *o = &a[k];
+    if (k > 0) {
+      memcpy(buff, sep, lsep * sizeof(char));
+      buff += lsep;
+    }
+    if (ttisstring(o)) {
+      TString *ts = luaS_tostr(L, o);
+      size_t l = tsslen(ts);
+      memcpy(buff, getstr(ts), l * sizeof(char));
+      buff += l;
+    }
+    else {  /* number */
+      char numbuff[MAXNUMBER2STR];
+      int l = luaO_tostringbuff(o, numbuff);
+      memcpy(buff, numbuff, cast_sizet(l) * sizeof(char));
+      buff += l;
+    }
+  }
+}
+
+
+LUA_API int lua_concatarray (lua_State *L, int idx, lua_Integer i,
+                             lua_Integer j, const char *sep, size_t lsep) {
+  const TValue *a;
+  lua_Unsigned n;
+  size_t len;
+  int res = 0;
+  lua_lock(L);
+  api_check(L, i <= j, "empty interval");
+  n = l_castS2U(j) - l_castS2U(i) + 1u;
+  a = getarray(L, index2value(L, idx), i, n);
+  if (a != NULL && (len = concatlen(a, n, lsep)) != MAX_SIZE) {
+    TString *ts;
+    if (len <= LUAI_MAXSHORTLEN) {
+      char buff[LUAI_MAXSHORTLEN];
+      concatcopy(L, buff, a, n, sep, lsep);
+      ts = luaS_newlstr(L, buff, len);
+      setsvalue2s(L, L->top.p, ts);
+      api_incr_top(L);
+    }
+    else {
+      ts = luaS_createlngstrobj(L, len);
+      setsvalue2s(L, L->top.p, ts);  /* anchor it */
+      api_incr_top(L);
+      concatcopy(L, getlngstr(ts), a, n, sep, lsep);
+    }
+    luaC_checkGC(L);
+    res = 1;
+  }
+  lua_unlock(L);
+  return res;
+}
+
+/* }====================================================== */
+#endif
+
+
 LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
   size_t sz = luaO_str2num(s, s2v(L->top.p));
   if (sz != 0)
@@ -379,7 +612,12 @@ LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
 LUA_API lua_Number lua_tonumberx (lua_State *L, int idx, int *pisnum) {
   lua_Number n = 0;
   const TValue *o = index2value(L, idx);
-  int isnum = tonumber(o, &n);
+  int isnum;
+#if defined(LUA_USE_ROPES)
+  TValue aux;
+  o = luaS_flatvalue(L, o, &aux);  /* numerals must be built */
+#endif
+  isnum = tonumber(o, &n);
   if (pisnum)
     *pisnum = isnum;
   return n;
@@ -389,7 +627,12 @@ LUA_API lua_Number lua_tonumberx (lua_State *L, int idx, int *pisnum) {
 LUA_API lua_Integer lua_tointegerx (lua_State *L, int idx, int *pisnum) {
   lua_Integer res = 0;
   const TValue *o = index2value(L, idx);
-  int isnum = tointeger(o, &res);
+  int isnum;
+#if defined(LUA_USE_ROPES)
+  TValue aux;
+  o = luaS_flatvalue(L, o, &aux);  /* numerals must be built */
+#endif
+  isnum = tointeger(o, &res);
   if (pisnum)
     *pisnum = isnum;
   return res;
@@ -416,6 +659,22 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     luaC_checkGC(L);
     o = index2value(L, idx);  /* previous call may reallocate the stack */
   }
+#if defined(LUA_USE_ROPES)
+  else if (ttisrope(o)) {
+    Rope *r = ropevalue(o);
+    const char *s;
+#if defined(LUA_USE_SLICES)
+    if (luaS_issuffix(r))  /* ends with the '\0' of its piece? */
+      s = getlngstr(gco2ts(r->piece[0])) + r->off;  /* no copy needed */
+    else
+#endif
+    s = getstr(luaS_flatten(L, r));  /* build contents, kept by the rope */
+    if (len != NULL)
+      *len = r->len;
+    lua_unlock(L);
+    return s;
+  }
+#endif
   if (len != NULL)
     *len = tsslen(tsvalue(o));
   lua_unlock(L);
@@ -428,6 +687,9 @@ LUA_API lua_Unsigned lua_rawlen (lua_State *L, int idx) {
   switch (ttypetag(o)) {
     case LUA_VSHRSTR: return tsvalue(o)->shrlen;
     case LUA_VLNGSTR: return tsvalue(o)->u.lnglen;
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE: return ropevalue(o)->len;
+#endif
     case LUA_VUSERDATA: return uvalue(o)->len;
     case LUA_VTABLE: return luaH_getn(hvalue(o));
     default: return 0;
@@ -535,6 +797,44 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+#if defined(LUA_USE_SLICES)
+LUA_API void lua_pushsubstring (lua_State *L, int idx, size_t i, size_t len) {
+  const TValue *o;
+  lua_lock(L);
+  o = index2value(L, idx);
+  api_check(L, ttisstring(o), "string expected");
+  api_check(L, i <= vslen(o) && len <= vslen(o) - i, "invalid substring");
+  luaS_sub(L, o, i, len, s2v(L->top.p));
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+#endif
+
+
+#if defined(LUA_USE_MMAPFILE)
+LUA_API const char *lua_pushmappedstring (lua_State *L, char *buff,
+                                          size_t len,
+                                          void (*release) (void *buff,
+                                                           size_t size)) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, buff[len] == '\0', "string not terminated");
+  ts = luaS_newmapped(L, buff, len, release);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  if (len <= LUAI_MAXSHORTLEN) {  /* must be internalized? */
+    /* (the mapped string on the stack releases the bytes if this fails) */
+    ts = luaS_newlstr(L, buff, len);
+    setsvalue2s(L, L->top.p - 1, ts);
+  }
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+#endif
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -735,6 +1035,9 @@ LUA_API int lua_rawget (lua_State *L, int idx) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = gettable(L, idx);
+#if defined(LUA_USE_ROPES)
+  cast_void(luaS_flatvalue(L, s2v(L->top.p - 1), s2v(L->top.p - 1)));
+#endif
   val = luaH_get(t, s2v(L->top.p - 1));
   L->top.p--;  /* remove key */
   return finishrawget(L, val);
@@ -830,7 +1133,7 @@ static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
   const TValue *slot;
   TString *str = luaS_new(L, k);
   api_checknelems(L, 1);
-  if (luaV_fastget(L, t, str, slot, luaH_getstr)) {
+  if (luaV_fastset(L, t, str, slot, luaH_getstr)) {
     luaV_finishfastset(L, t, slot, s2v(L->top.p - 1));
     L->top.p--;  /* pop value */
   }
@@ -858,7 +1161,7 @@ LUA_API void lua_settable (lua_State *L, int idx) {
   lua_lock(L);
   api_checknelems(L, 2);
   t = index2value(L, idx);
-  if (luaV_fastget(L, t, s2v(L->top.p - 2), slot, luaH_get)) {
+  if (luaV_fastset(L, t, s2v(L->top.p - 2), slot, luaH_get)) {
     luaV_finishfastset(L, t, slot, s2v(L->top.p - 1));
   }
   else
@@ -880,7 +1183,7 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = index2value(L, idx);
-  if (luaV_fastgeti(L, t, n, slot)) {
+  if (luaV_fastseti(L, t, n, slot)) {
     luaV_finishfastset(L, t, slot, s2v(L->top.p - 1));
   }
   else {
@@ -944,6 +1247,10 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+#if defined(LUA_USE_FROZEN)
+      if (l_unlikely(isfrozen(hvalue(obj))))
+        luaG_runerror(L, "attempt to modify a frozen table");
+#endif
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1084,6 +1391,21 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+/*
+** Sets the global table as the first upvalue (may be LUA_ENV) of the
+** function just loaded.
+*/
+static void setglobalenv (lua_State *L) {
+  LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
+  if (f->nupvalues >= 1) {  /* does it have an upvalue? */
+    /* get global table from registry */
+    const TValue *gt = getGtable(L);
+    setobj(L, f->upvals[0]->v.p, gt);
+    luaC_barrier(L, f->upvals[0], gt);
+  }
+}
+
+
 LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
                       const char *chunkname, const char *mode) {
   ZIO z;
@@ -1092,19 +1414,37 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
   status = luaD_protectedparser(L, &z, chunkname, mode);
-  if (status == LUA_OK) {  /* no errors? */
-    LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
-    if (f->nupvalues >= 1) {  /* does it have an upvalue? */
-      /* get global table from registry */
-      const TValue *gt = getGtable(L);
-      /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-      setobj(L, f->upvals[0]->v.p, gt);
-      luaC_barrier(L, f->upvals[0], gt);
-    }
-  }
+  if (status == LUA_OK)  /* no errors? */
+    setglobalenv(L);
+  lua_unlock(L);
+  return status;
+}
+
+
+#if defined(LUA_USE_MMAPLOAD)
+LUA_API int lua_loadmapped (lua_State *L, void *buff, size_t size,
+                            const char *chunkname,
+                            void (*release) (void *buff, size_t size)) {
+  ZIO z;
+  Mapping *m;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  m = luaM_new(L, Mapping);
+  m->base = cast_charp(buff);
+  m->size = size;
+  m->refs = 1;  /* reference of the loader */
+  m->given = 0;
+  m->release = release;
+  luaZ_init(L, &z, luaU_mapreader, m);
+  status = luaD_protectedparser(L, &z, chunkname, "b");
+  if (status == LUA_OK)
+    setglobalenv(L);
+  luaU_unmap(L, m);  /* released now if no prototype uses it */
   lua_unlock(L);
   return status;
 }
+#endif
 
 
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
@@ -1114,7 +1454,11 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   api_checknelems(L, 1);
   o = s2v(L->top.p - 1);
   if (isLfunction(o))
+#if defined(LUA_USE_MMAPLOAD)
+    status = luaU_dump(L, getproto(o), writer, data, strip ? LUAU_STRIP : 0);
+#else
     status = luaU_dump(L, getproto(o), writer, data, strip);
+#endif
   else
     status = 1;
   lua_unlock(L);
@@ -1229,6 +1573,41 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 }
 
 
+#if defined(LUA_USE_FROZEN)
+/*
+** The state becomes a frozen heap: a full collection leaves only what
+** the root and the stack reach, and then all objects are frozen. (If
+** there is no memory for the handle, the state is left frozen, and it
+** can only be closed.)
+*/
+LUA_API lua_Frozen *lua_freezestate (lua_State *L, int idx) {
+  Frozen *f;
+  TValue *o;
+  lua_lock(L);
+  o = index2value(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  luaC_fullgc(L, 0);
+  luaC_freeze(L);  /* before other threads can see it */
+  f = luaE_newfrozen(L, hvalue(o));
+  lua_unlock(L);
+  return f;
+}
+
+
+LUA_API int lua_pushfrozen (lua_State *L, lua_Frozen *f) {
+  int res;
+  lua_lock(L);
+  res = luaE_seesfrozen(G(L), f);
+  if (res) {
+    sethvalue2s(L, L->top.p, f->root);
+    api_incr_top(L);
+  }
+  lua_unlock(L);
+  return res;
+}
+#endif
+
+
 
 /*
 ** miscellaneous functions
@@ -1256,6 +1635,9 @@ LUA_API int lua_next (lua_State *L, int idx) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = gettable(L, idx);
+#if defined(LUA_USE_ROPES)
+  cast_void(luaS_flatvalue(L, s2v(L->top.p - 1), s2v(L->top.p - 1)));
+#endif
   more = luaH_next(L, t, L->top.p - 1);
   if (more) {
     api_incr_top(L);
@@ -1461,3 +1843,59 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
 }
 
 
+#if defined(LUA_USE_JIT)
+
+LUA_API int lua_jitcompile (lua_State *L, int idx) {
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttisLclosure(o))
+    res = luaJ_compile(L, clLvalue(o)->p);
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_jitmode (lua_State *L, int mode) {
+  int res;
+  lua_lock(L);
+  res = G(L)->jitmode;
+  if (mode == 0 || mode == 1)
+    G(L)->jitmode = cast_byte(mode);
+  lua_unlock(L);
+  return res;
+}
+
+#endif
+
+
+#if defined(LUA_USE_INLINECACHE) && defined(LUAI_ICSTATS)
+
+LUA_API void lua_icstats (lua_State *L, lua_Integer *hits,
+                                        lua_Integer *misses) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  *hits = l_castU2S(g->ichits);
+  *misses = l_castU2S(g->icmisses);
+  g->ichits = g->icmisses = 0;
+  lua_unlock(L);
+}
+
+#endif
+
+
+#if defined(LUA_USE_BGSWEEP)
+
+LUA_API int lua_bgsweep (lua_State *L, int limit) {
+  int res;
+  lua_lock(L);
+  res = luaC_bgsweep(L, limit);
+  lua_unlock(L);
+  return res;
+}
+
+#endif
+
+
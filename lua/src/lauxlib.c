@@ -11,6 +11,7 @@
 
 
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,6 +27,13 @@
 
 #include "lauxlib.h"
 
+#if defined(LUA_USE_MMAPLOAD)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
 #if !defined(MAX_SIZET)
 /* maximum value for size_t */
@@ -781,12 +789,63 @@ static int skipcomment (FILE *f, int *cp) {
 }
 
 
+#if defined(LUA_USE_MMAPLOAD)
+
+static void unmap (void *buff, size_t size) {
+  munmap(buff, size);
+}
+
+
+/*
+** Loads a binary chunk by mapping its file into memory (privately,
+** so that the rewriting of code by the VM does not reach the file).
+** Returns -1, with nothing pushed, when the file cannot be mapped or
+** does not start with a binary chunk; it is then loaded as usual.
+*/
+static int loadmapped (lua_State *L, const char *filename,
+                                     const char *chunkname) {
+  struct stat st;
+  void *p;
+  size_t size;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return -1;
+  }
+  size = (size_t)st.st_size;
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return -1;
+  if (*(char *)p != LUA_SIGNATURE[0]) {  /* not a binary chunk? */
+    munmap(p, size);
+    return -1;
+  }
+  return lua_loadmapped(L, p, size, chunkname, unmap);
+}
+
+#endif
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+#if defined(LUA_USE_MMAPLOAD)
+  if (filename != NULL && mode != NULL && strchr(mode, 'm') != NULL) {
+    lua_pushfstring(L, "@%s", filename);
+    status = loadmapped(L, filename, lua_tostring(L, -1));
+    if (status >= 0) {  /* was it mapped? */
+      lua_remove(L, fnameindex);
+      return status;
+    }
+    lua_pop(L, 1);
+  }
+#endif
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
@@ -1105,8 +1164,8 @@ static void warnfon (void *ud, const char *message, int tocont) {
 }
 
 
-LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
+static lua_State *newstate (lua_Alloc f, void *ud) {
+  lua_State *L = lua_newstate(f, ud);
   if (l_likely(L)) {
     lua_atpanic(L, &panic);
     lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
@@ -1115,6 +1174,555 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+LUALIB_API lua_State *luaL_newstate (void) {
+  return newstate(l_alloc, NULL);
+}
+
+
+#if defined(LUA_USE_SLABALLOC)
+
+/*
+** {======================================================
+** Slab allocator
+** =======================================================
+*/
+
+/*
+** Blocks of up to SLABMAX bytes come from pages of SLABPAGE bytes,
+** each one holding blocks of a single size class (a multiple of
+** SLABGRAIN); larger blocks use 'malloc'. Pages are aligned to their
+** size, so the page of a block is found by masking its address. Each
+** state has a heap of its own, used only by the thread running the
+** state, so allocations and frees take no locks. Blocks freed by other
+** threads (e.g., the background sweeper) are pushed into a lock-free
+** list, which the heap reclaims when a class runs out of free blocks.
+*/
+
+#define SLABGRAIN	16
+#define SLABMAX		512
+#define SLABCLASSES	(SLABMAX / SLABGRAIN)
+#define SLABPAGE	((size_t)1 << 16)
+#define SLABSPARE	8	/* maximum number of empty pages kept */
+
+#define slabclass(sz)	((unsigned int)(((sz) - 1) / SLABGRAIN))
+#define classsize(c)	(((size_t)(c) + 1) * SLABGRAIN)
+
+
+typedef struct SlabPage {
+  struct SlabPage *prev, *next;  /* list of pages with free blocks */
+  void *free;  /* list of freed blocks */
+  char *top;  /* first block never allocated */
+  char *limit;  /* end of the last block */
+  unsigned int used;  /* number of blocks in use */
+  unsigned int sclass;
+} SlabPage;
+
+/* blocks start after the page header, at a cache-line boundary */
+#define PAGEHEADER	((sizeof(SlabPage) + 63) & ~(size_t)63)
+
+#define pageof(b)	((SlabPage *)((size_t)(b) & ~(SLABPAGE - 1)))
+#define isfull(p)	((p)->free == NULL && (p)->top == (p)->limit)
+
+
+typedef struct SlabClass {
+  SlabPage *avail;  /* pages with free blocks */
+  size_t npages;  /* number of pages of the class */
+  size_t nalloc, nfree;  /* number of allocations and frees */
+} SlabClass;
+
+
+/* a block freed by a thread that does not own the heap */
+typedef struct RemoteBlock {
+  struct RemoteBlock *next;
+  size_t size;
+} RemoteBlock;
+
+
+typedef struct SlabHeap {
+  SlabClass cls[SLABCLASSES];
+  SlabPage *spare;  /* empty pages, linked by 'next' */
+  int nspare;  /* number of pages in 'spare' */
+  size_t nblocks;  /* number of blocks in use, small or large */
+  size_t nlargealloc, nlargefree;  /* allocations and frees of large blocks */
+  size_t largebytes;  /* total size of the large blocks in use */
+  const char *owner;  /* thread allocating from the heap (atomic) */
+  RemoteBlock *remote;  /* blocks freed by other threads (atomic) */
+  size_t nremote;  /* number of blocks in 'remote' (atomic) */
+  int *alive;  /* cleared if the heap is released while creating a state */
+} SlabHeap;
+
+
+/* its address identifies the running thread */
+static __thread char slabthread __attribute__((tls_model("initial-exec")));
+
+
+static void linkpage (SlabClass *sc, SlabPage *p) {
+  p->prev = NULL;
+  p->next = sc->avail;
+  if (sc->avail != NULL)
+    sc->avail->prev = p;
+  sc->avail = p;
+}
+
+
+static void unlinkpage (SlabClass *sc, SlabPage *p) {
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    sc->avail = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+}
+
+
+static SlabPage *newpage (SlabHeap *h, unsigned int c) {
+  SlabPage *p = h->spare;
+  size_t bsize = classsize(c);
+  if (p != NULL) {  /* reuse an empty page */
+    h->spare = p->next;
+    h->nspare--;
+  }
+  else {
+    void *mem;
+    if (posix_memalign(&mem, SLABPAGE, SLABPAGE) != 0)
+      return NULL;
+    p = (SlabPage *)mem;
+  }
+  p->free = NULL;
+  p->top = (char *)p + PAGEHEADER;
+  p->limit = p->top + ((SLABPAGE - PAGEHEADER) / bsize) * bsize;
+  p->used = 0;
+  p->sclass = c;
+  h->cls[c].npages++;
+  linkpage(&h->cls[c], p);
+  return p;
+}
+
+
+static void releasepage (SlabHeap *h, SlabPage *p) {
+  if (h->nspare < SLABSPARE) {
+    p->next = h->spare;
+    h->spare = p;
+    h->nspare++;
+  }
+  else
+    free(p);
+}
+
+
+static void freeblock (SlabHeap *h, void *b, size_t size);
+
+
+/*
+** Frees, on behalf of their threads, the blocks freed by other threads.
+*/
+static void reclaim (SlabHeap *h) {
+  RemoteBlock *r = __atomic_exchange_n(&h->remote, NULL, __ATOMIC_ACQUIRE);
+  size_t n = 0;
+  while (r != NULL) {
+    RemoteBlock *next = r->next;
+    freeblock(h, r, r->size);
+    r = next;
+    n++;
+  }
+  __atomic_fetch_sub(&h->nremote, n, __ATOMIC_RELAXED);
+}
+
+
+static void *allocsmall (SlabHeap *h, unsigned int c) {
+  SlabClass *sc = &h->cls[c];
+  SlabPage *p = sc->avail;
+  void *b;
+  if (l_unlikely(p == NULL)) {  /* no free blocks in this class? */
+    reclaim(h);
+    p = sc->avail;
+    if (p == NULL && (p = newpage(h, c)) == NULL)
+      return NULL;
+  }
+  if (p->free != NULL) {  /* reuse a freed block? */
+    b = p->free;
+    p->free = *(void **)b;
+  }
+  else {  /* take a new one */
+    b = p->top;
+    p->top += classsize(c);
+  }
+  p->used++;
+  if (isfull(p))
+    unlinkpage(sc, p);
+  sc->nalloc++;
+  h->nblocks++;
+  return b;
+}
+
+
+static void freesmall (SlabHeap *h, void *b, unsigned int c) {
+  SlabClass *sc = &h->cls[c];
+  SlabPage *p = pageof(b);
+  if (isfull(p))  /* page will have a free block? */
+    linkpage(sc, p);
+  *(void **)b = p->free;
+  p->free = b;
+  sc->nfree++;
+  h->nblocks--;
+  /* release an empty page, unless it is the only one available */
+  if (--p->used == 0 && (p->prev != NULL || p->next != NULL)) {
+    unlinkpage(sc, p);
+    sc->npages--;
+    releasepage(h, p);
+  }
+}
+
+
+static void *alloclarge (SlabHeap *h, size_t size) {
+  void *b = malloc(size);
+  if (b != NULL) {
+    h->nlargealloc++;
+    h->largebytes += size;
+    h->nblocks++;
+  }
+  return b;
+}
+
+
+static void freeblock (SlabHeap *h, void *b, size_t size) {
+  if (size <= SLABMAX)
+    freesmall(h, b, slabclass(size));
+  else {
+    free(b);
+    h->nlargefree++;
+    h->largebytes -= size;
+    h->nblocks--;
+  }
+}
+
+
+static void *newblock (SlabHeap *h, size_t size) {
+  return (size <= SLABMAX) ? allocsmall(h, slabclass(size))
+                           : alloclarge(h, size);
+}
+
+
+static void *resizeblock (SlabHeap *h, void *b, size_t osize,
+                                                size_t nsize) {
+  if (osize > SLABMAX && nsize > SLABMAX) {  /* both large? */
+    void *nb = realloc(b, nsize);
+    if (nb != NULL)
+      h->largebytes += nsize - osize;
+    return nb;
+  }
+  else if (osize <= SLABMAX && nsize <= SLABMAX &&
+           slabclass(osize) == slabclass(nsize))
+    return b;  /* block is already big enough */
+  else {
+    void *nb = newblock(h, nsize);
+    if (nb != NULL) {
+      memcpy(nb, b, (osize < nsize) ? osize : nsize);
+      freeblock(h, b, osize);
+    }
+    return nb;
+  }
+}
+
+
+/*
+** Releases the heap, with all its pages (which are all empty, and so
+** in the lists of available pages or in the spare list).
+*/
+static void freeheap (SlabHeap *h) {
+  unsigned int c;
+  for (c = 0; c < SLABCLASSES; c++) {
+    SlabPage *p = h->cls[c].avail;
+    while (p != NULL) {
+      SlabPage *next = p->next;
+      free(p);
+      p = next;
+    }
+  }
+  while (h->spare != NULL) {
+    SlabPage *next = h->spare->next;
+    free(h->spare);
+    h->spare = next;
+  }
+  if (h->alive != NULL)
+    *h->alive = 0;
+  free(h);
+}
+
+
+static void *slab_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  SlabHeap *h = (SlabHeap *)ud;
+  const char *self = &slabthread;
+  if (nsize == 0) {
+    if (ptr == NULL)
+      return NULL;
+    else if (__atomic_load_n(&h->owner, __ATOMIC_RELAXED) != self) {
+      RemoteBlock *r = (RemoteBlock *)ptr;  /* give it to the owner */
+      r->size = osize;
+      r->next = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&h->remote, &r->next, r, 1,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;  /* retry with the new head */
+      __atomic_fetch_add(&h->nremote, 1, __ATOMIC_RELAXED);
+    }
+    else {
+      freeblock(h, ptr, osize);
+      /* all blocks freed (the state was closed)? */
+      if (l_unlikely(h->nblocks ==
+                     __atomic_load_n(&h->nremote, __ATOMIC_RELAXED))) {
+        reclaim(h);
+        freeheap(h);
+      }
+    }
+    return NULL;
+  }
+  if (l_unlikely(h->owner != self))  /* state moved to this thread? */
+    __atomic_store_n(&h->owner, self, __ATOMIC_RELAXED);
+  if (ptr == NULL)
+    return newblock(h, nsize);
+  else
+    return resizeblock(h, ptr, osize, nsize);
+}
+
+
+LUALIB_API lua_State *luaL_newslabstate (void) {
+  int alive = 1;
+  lua_State *L;
+  SlabHeap *h = (SlabHeap *)calloc(1, sizeof(SlabHeap));
+  if (h == NULL)
+    return NULL;
+  h->owner = &slabthread;
+  h->alive = &alive;
+  L = newstate(slab_alloc, h);
+  if (alive) {  /* heap not released by a failed 'lua_newstate'? */
+    h->alive = NULL;
+    if (L == NULL)
+      freeheap(h);
+  }
+  return L;
+}
+
+
+static void setcount (lua_State *L, const char *k, size_t n) {
+  lua_pushinteger(L, (lua_Integer)n);
+  lua_setfield(L, -2, k);
+}
+
+
+/*
+** Pushes a table with an entry for each size class that was used,
+** indexed by its block size, plus an entry 'large' for the blocks
+** given by 'malloc'. The counts are copied first, as building the
+** result allocates from the heap.
+*/
+LUALIB_API int luaL_slabstats (lua_State *L) {
+  void *ud;
+  SlabHeap *h;
+  SlabClass cls[SLABCLASSES];
+  size_t nlargealloc, nlargefree, largebytes;
+  int nspare;
+  unsigned int c;
+  if (lua_getallocf(L, &ud) != slab_alloc)
+    return 0;
+  h = (SlabHeap *)ud;
+  reclaim(h);
+  memcpy(cls, h->cls, sizeof(cls));
+  nlargealloc = h->nlargealloc;
+  nlargefree = h->nlargefree;
+  largebytes = h->largebytes;
+  nspare = h->nspare;
+  lua_createtable(L, 0, SLABCLASSES + 3);
+  for (c = 0; c < SLABCLASSES; c++) {
+    if (cls[c].nalloc > 0) {
+      lua_createtable(L, 0, 4);
+      setcount(L, "blocks", cls[c].nalloc - cls[c].nfree);
+      setcount(L, "pages", cls[c].npages);
+      setcount(L, "allocs", cls[c].nalloc);
+      setcount(L, "frees", cls[c].nfree);
+      lua_rawseti(L, -2, (lua_Integer)classsize(c));
+    }
+  }
+  lua_createtable(L, 0, 4);
+  setcount(L, "blocks", nlargealloc - nlargefree);
+  setcount(L, "bytes", largebytes);
+  setcount(L, "allocs", nlargealloc);
+  setcount(L, "frees", nlargefree);
+  lua_setfield(L, -2, "large");
+  setcount(L, "spare", (size_t)nspare);
+  setcount(L, "pagesize", SLABPAGE);
+  return 1;
+}
+
+/* }====================================================== */
+
+#endif
+
+
+#if defined(LUA_USE_FROZEN)
+
+/*
+** {======================================================
+** Frozen tables
+** =======================================================
+*/
+
+/* maximum depth of nested tables in a frozen tree */
+#if !defined(LUAI_MAXFREEZE)
+#define LUAI_MAXFREEZE	200
+#endif
+
+/* index, in the stack of the heap, of the table of copied tables */
+#define COPIED	2
+
+
+typedef struct Freezer {
+  lua_State *L;  /* state with the original tree */
+  lua_State *H;  /* new heap */
+  int depth;  /* current nesting of tables */
+} Freezer;
+
+
+static void freezevalue (Freezer *F);
+
+
+/* is the key on the top of 'L' in [1, n]? */
+static int insequence (lua_State *L, lua_Integer n) {
+  lua_Integer k;
+  return lua_isinteger(L, -1) && (k = lua_tointeger(L, -1)) >= 1 && k <= n;
+}
+
+
+/*
+** Copies the table on the top of 'L' (a table already copied is
+** reused, keeping the shape of the tree). Its sequence 1..n goes to
+** the array part, the rest to a hash part of the exact size; so the
+** copy never needs a rehash, and '#' never updates it.
+*/
+static void freezetable (Freezer *F) {
+  lua_State *L = F->L;
+  lua_State *H = F->H;
+  const void *p = lua_topointer(L, -1);
+  lua_Integer n = 0, i;
+  int nrec = 0;
+  if (lua_rawgetp(H, COPIED, p) != LUA_TNIL)
+    return;  /* reuse it */
+  lua_pop(H, 1);
+  if (F->depth++ >= LUAI_MAXFREEZE || !lua_checkstack(L, 4))
+    luaL_error(H, "tables nested too deep to freeze");
+  luaL_checkstack(H, 4, "tables nested too deep to freeze");
+  if (lua_getmetatable(L, -1))
+    luaL_error(H, "cannot freeze a table with a metatable");
+  while (lua_rawgeti(L, -1, n + 1) != LUA_TNIL) {
+    lua_pop(L, 1);
+    n++;
+  }
+  lua_pop(L, 1);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pop(L, 1);
+    if (!insequence(L, n))
+      nrec++;
+  }
+  if (n > INT_MAX)
+    luaL_error(H, "table too big to freeze");
+  lua_createtable(H, (int)n, nrec);
+  lua_pushvalue(H, -1);
+  lua_rawsetp(H, COPIED, p);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    freezevalue(F);
+    lua_rawseti(H, -2, i);
+  }
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pushvalue(L, -2);
+    if (!insequence(L, n)) {
+      freezevalue(F);  /* key */
+      freezevalue(F);  /* value */
+      lua_rawset(H, -3);
+    }
+    else
+      lua_pop(L, 2);
+  }
+  F->depth--;
+}
+
+
+/* copies the value on the top of 'L' onto 'H' and pops it */
+static void freezevalue (Freezer *F) {
+  lua_State *L = F->L;
+  lua_State *H = F->H;
+  switch (lua_type(L, -1)) {
+    case LUA_TBOOLEAN:
+      lua_pushboolean(H, lua_toboolean(L, -1));
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, -1))
+        lua_pushinteger(H, lua_tointeger(L, -1));
+      else
+        lua_pushnumber(H, lua_tonumber(L, -1));
+      break;
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, -1, &l);
+      lua_pushlstring(H, s, l);
+      break;
+    }
+    case LUA_TTABLE:
+      freezetable(F);
+      break;
+    default:
+      luaL_error(H, "cannot freeze a %s", luaL_typename(L, -1));
+  }
+  lua_pop(L, 1);
+}
+
+
+static int freezeaux (lua_State *H) {
+  Freezer *F = (Freezer *)lua_touserdata(H, 1);
+  lua_newtable(H);  /* COPIED */
+  freezevalue(F);
+  return 1;
+}
+
+
+/*
+** The copy runs inside the new heap, protected: 'L' only has its
+** tables traversed, which raises no errors.
+*/
+LUALIB_API lua_Frozen *luaL_freeze (lua_State *L, int idx) {
+  Freezer F;
+  lua_Frozen *f;
+  int top = lua_gettop(L);
+  luaL_checktype(L, idx, LUA_TTABLE);
+  F.L = L;
+  F.H = luaL_newstate();
+  F.depth = 0;
+  if (F.H == NULL)
+    luaL_error(L, "not enough memory");
+  lua_gc(F.H, LUA_GCSTOP);  /* the copy is all live */
+  lua_pushvalue(L, idx);  /* popped by the copy */
+  lua_pushcfunction(F.H, freezeaux);
+  lua_pushlightuserdata(F.H, &F);
+  if (lua_pcall(F.H, 1, 1, 0) != LUA_OK) {
+    lua_settop(L, top);  /* remove the partial walk */
+    lua_pushstring(L, lua_tostring(F.H, -1));
+    lua_close(F.H);
+    lua_error(L);
+  }
+  f = lua_freezestate(F.H, -1);
+  if (f == NULL) {
+    lua_close(F.H);
+    luaL_error(L, "not enough memory");
+  }
+  return f;
+}
+
+/* }====================================================== */
+
+#endif
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -196,13 +196,28 @@ static int pushmode (lua_State *L, int oldmode) {
 */
 #define checkvalres(res) { if (res == -1) break; }
 
+/* options "background" and "slabs", which are not 'lua_gc' options */
+#define GCBGSWEEP	(-1)
+#define GCSLABS		(-2)
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental",
+#if defined(LUA_USE_BGSWEEP)
+    "background",
+#endif
+#if defined(LUA_USE_SLABALLOC)
+    "slabs",
+#endif
+    NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,
+#if defined(LUA_USE_BGSWEEP)
+    GCBGSWEEP,
+#endif
+    GCSLABS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -244,6 +259,22 @@ static int luaB_collectgarbage (lua_State *L) {
       int stepsize = (int)luaL_optinteger(L, 4, 0);
       return pushmode(L, lua_gc(L, o, pause, stepmul, stepsize));
     }
+#if defined(LUA_USE_BGSWEEP)
+    case GCBGSWEEP: {
+      int limit = (int)luaL_optinteger(L, 2, -1);
+      int previous = lua_bgsweep(L, limit);
+      checkvalres(previous);
+      lua_pushinteger(L, previous);
+      return 1;
+    }
+#endif
+#if defined(LUA_USE_SLABALLOC)
+    case GCSLABS: {
+      if (!luaL_slabstats(L))  /* state does not use the slab allocator? */
+        luaL_pushfail(L);
+      return 1;
+    }
+#endif
     default: {
       int res = lua_gc(L, o);
       checkvalres(res);
@@ -454,6 +454,21 @@ static int db_setcstacklimit (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_INLINECACHE) && defined(LUAI_ICSTATS)
+/*
+** Returns the numbers of hits and misses of the inline caches since
+** the previous call.
+*/
+static int db_icstats (lua_State *L) {
+  lua_Integer hits, misses;
+  lua_icstats(L, &hits, &misses);
+  lua_pushinteger(L, hits);
+  lua_pushinteger(L, misses);
+  return 2;
+}
+#endif
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -472,6 +487,9 @@ static const luaL_Reg dblib[] = {
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
   {"setcstacklimit", db_setcstacklimit},
+#if defined(LUA_USE_INLINECACHE) && defined(LUAI_ICSTATS)
+  {"icstats", db_icstats},
+#endif
   {NULL, NULL}
 };
 
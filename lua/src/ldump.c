@@ -16,6 +16,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -26,6 +27,10 @@ typedef struct {
   void *data;
   int strip;
   int status;
+#if defined(LUA_USE_MMAPLOAD)
+  int align;  /* use LUAC_FORMATALIGNED */
+  size_t offset;  /* bytes written so far */
+#endif
 } DumpState;
 
 
@@ -44,6 +49,9 @@ static void dumpBlock (DumpState *D, const void *b, size_t size) {
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
   }
+#if defined(LUA_USE_MMAPLOAD)
+  D->offset += size;
+#endif
 }
 
 
@@ -103,7 +111,26 @@ static void dumpString (DumpState *D, const TString *s) {
 
 static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
+#if defined(LUA_USE_MMAPLOAD)
+  if (D->align) {  /* pad so that the code is aligned in the chunk */
+    static const char zeros[sizeof(Instruction)] = {0};
+    size_t rem = D->offset % sizeof(Instruction);
+    if (rem != 0)
+      dumpBlock(D, zeros, sizeof(Instruction) - rem);
+  }
+#endif
+#if defined(LUA_USE_QUICKENING)
+  {  /* undo superinstructions */
+    int i;
+    for (i = 0; i < f->sizecode; i++) {
+      Instruction inst = f->code[i];
+      SET_OPCODE(inst, GET_BASEOPCODE(inst));
+      dumpVar(D, inst);
+    }
+  }
+#else
   dumpVector(D, f->code, f->sizecode);
+#endif
 }
 
 
@@ -201,7 +228,11 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
 static void dumpHeader (DumpState *D) {
   dumpLiteral(D, LUA_SIGNATURE);
   dumpByte(D, LUAC_VERSION);
+#if defined(LUA_USE_MMAPLOAD)
+  dumpByte(D, D->align ? LUAC_FORMATALIGNED : LUAC_FORMAT);
+#else
   dumpByte(D, LUAC_FORMAT);
+#endif
   dumpLiteral(D, LUAC_DATA);
   dumpByte(D, sizeof(Instruction));
   dumpByte(D, sizeof(lua_Integer));
@@ -220,7 +251,13 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
   D.L = L;
   D.writer = w;
   D.data = data;
+#if defined(LUA_USE_MMAPLOAD)
+  D.strip = strip & LUAU_STRIP;
+  D.align = strip & LUAU_ALIGN;
+  D.offset = 0;
+#else
   D.strip = strip;
+#endif
   D.status = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
@@ -18,9 +18,12 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "lundump.h"
 
 
 
@@ -255,16 +258,52 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+#if defined(LUA_USE_QUICKENING)
+  f->hotcount = 0;
+#endif
+#if defined(LUA_USE_JIT)
+  f->jitcount = 0;
+  f->jit = NULL;
+#endif
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+#if defined(LUA_USE_INLINECACHE)
+  f->icache = NULL;
+  f->icbase = NULL;
+  f->icslot = NULL;
+  f->sizeicache = 0;
+#endif
+#if defined(LUA_USE_MMAPLOAD)
+  f->mapping = NULL;
+#endif
   return f;
 }
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
+#if defined(LUA_USE_INLINECACHE)
+  if (f->icbase != NULL)  /* (map sizes depend on 'sizecode') */
+    luaM_freearray(L, f->icbase, sizeicbase(f));
+  if (f->icslot != NULL)
+    luaM_freearray(L, f->icslot, f->sizecode);
+  luaM_freearray(L, f->icache, f->sizeicache);
+#endif
+#if defined(LUA_USE_MMAPLOAD)
+  if (f->mapping != NULL) {  /* arrays may point into a mapped chunk */
+    if (luaU_inmapping(f->mapping, f->code)) {
+      f->code = NULL;
+      f->sizecode = 0;
+    }
+    if (luaU_inmapping(f->mapping, f->lineinfo)) {
+      f->lineinfo = NULL;
+      f->sizelineinfo = 0;
+    }
+    luaU_unmap(L, f->mapping);
+  }
+#endif
   luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
@@ -272,10 +311,53 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+#if defined(LUA_USE_JIT)
+  luaJ_freecode(f);
+#endif
   luaM_free(L, f);
 }
 
 
+#if defined(LUA_USE_INLINECACHE)
+
+/* whether instruction 'i' accesses a global through an inline cache */
+#define hasicache(i)  \
+	(GET_OPCODE(i) == OP_GETTABUP || GET_OPCODE(i) == OP_SETTABUP)
+
+
+/*
+** Create the inline caches of a prototype, one entry for each of its
+** instructions that access globals (see 'luaH_getshortstrIC'),
+** and the map from those instructions to their entries (see
+** 'luaF_icache'). All entries start pointing to node 0; as every hit
+** is validated, a wrong hint only costs a miss.
+*/
+void luaF_initicache (lua_State *L, Proto *f) {
+  int pc;
+  unsigned int n = 0;
+  lua_assert(f->icache == NULL && f->icslot == NULL);
+  for (pc = 0; pc < f->sizecode; pc++)
+    n += hasicache(f->code[pc]);
+  if (n == 0)
+    return;  /* no caches */
+  f->icbase = luaM_newvector(L, sizeicbase(f), unsigned int);
+  f->icslot = luaM_newvector(L, f->sizecode, lu_byte);
+  n = 0;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    unsigned int *base = &f->icbase[pc >> ICBLOCKBITS];
+    if ((pc & ((1 << ICBLOCKBITS) - 1)) == 0)  /* first of its block? */
+      *base = n;
+    f->icslot[pc] = cast_byte(n - *base);
+    n += hasicache(f->code[pc]);
+  }
+  f->icache = luaM_newvector(L, n, unsigned int);
+  f->sizeicache = cast_int(n);
+  while (n > 0)
+    f->icache[--n] = 0;
+}
+#endif
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
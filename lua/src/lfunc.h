@@ -47,6 +47,28 @@
 #define CLOSEKTOP	(-1)
 
 
+#if defined(LUA_USE_INLINECACHE)
+
+/*
+** Instructions are mapped to their inline caches in blocks of
+** 2^ICBLOCKBITS instructions, so that the position of a cache in its
+** block fits in a byte.
+*/
+#define ICBLOCKBITS	8
+
+/* number of blocks of instructions of prototype 'f' */
+#define sizeicbase(f)	(((f)->sizecode >> ICBLOCKBITS) + 1)
+
+/*
+** Inline cache of instruction 'pc' of prototype 'f', which must be one
+** of the instructions with caches (see 'luaF_initicache').
+*/
+#define luaF_icache(f,pc)  \
+	(&(f)->icache[(f)->icbase[(pc) >> ICBLOCKBITS] + (f)->icslot[pc]])
+
+#endif
+
+
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
 LUAI_FUNC CClosure *luaF_newCclosure (lua_State *L, int nupvals);
 LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nupvals);
@@ -57,6 +79,9 @@ LUAI_FUNC void luaF_closeupval (lua_State *L, StkId level);
 LUAI_FUNC StkId luaF_close (lua_State *L, StkId level, int status, int yy);
 LUAI_FUNC void luaF_unlinkupval (UpVal *uv);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
+#if defined(LUA_USE_INLINECACHE)
+LUAI_FUNC void luaF_initicache (lua_State *L, Proto *f);
+#endif
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
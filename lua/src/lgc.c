@@ -15,6 +15,15 @@
 
 #include "lua.h"
 
+#if defined(LUA_USE_PARALLELMARK) || defined(LUA_USE_BGSWEEP)
+#include <pthread.h>
+#include <stdlib.h>
+#endif
+#if defined(LUA_USE_PARALLELMARK)
+#include <sched.h>
+#include <unistd.h>
+#endif
+
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -80,9 +89,93 @@
   (x->marked = cast_byte((x->marked & ~WHITEBITS) | bitmask(BLACKBIT)))
 
 
-#define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
+#if defined(LUA_USE_PARALLELMARK)
+
+/* size of the shared section of a marking worker */
+#define GCPUBSIZE	64
+
+/*
+** A thread taking part in a parallel mark phase. Gray objects are kept
+** in a private stack; some of them can be moved to the shared section
+** 'pub', where idle workers steal them from.
+*/
+typedef struct GCWorker {
+  GCObject **stk;  /* private stack of gray objects */
+  size_t n;  /* number of objects in 'stk' */
+  size_t size;  /* size of 'stk' */
+  lu_mem work;  /* work done in the current round */
+  struct GCPool *pool;
+  pthread_t thread;
+  pthread_mutex_t lock;  /* protects 'pub' */
+  int npub;  /* number of objects in 'pub' (also read without 'lock') */
+  GCObject *pub[GCPUBSIZE];
+} GCWorker;
+
+
+typedef struct GCPool {
+  global_State *g;
+  pthread_mutex_t lock;  /* protects the gray lists and the fields below */
+  pthread_cond_t start;  /* signals a new round to helpers */
+  pthread_cond_t done;  /* signals that helpers finished a round */
+  unsigned int round;  /* number of the current round */
+  int running;  /* number of helpers still working in current round */
+  int quit;  /* true when helpers must exit */
+  int nidle;  /* number of workers without work (atomic) */
+  int nworkers;  /* number of workers (the collector is worker 0) */
+  GCWorker w[1];  /* workers (variable size) */
+} GCPool;
+
 
-#define keyiswhite(n)   (keyiscollectable(n) && iswhite(gckey(n)))
+/*
+** Worker running in the current thread (NULL outside parallel marks).
+** (It is checked at every mark, so it avoids the slow dynamic TLS
+** model of shared libraries.)
+*/
+static __thread GCWorker *gcworker
+  __attribute__((tls_model("initial-exec"))) = NULL;
+
+/*
+** Colors of objects not owned by a worker may change under its feet.
+** (The only change is from white to gray or black, with an atomic
+** compare-and-swap; see 'claim'.)
+*/
+#define gciswhite(x)  \
+	testbits(__atomic_load_n(&(x)->marked, __ATOMIC_RELAXED), WHITEBITS)
+
+/* protect gray lists of 'g' while workers are running */
+#define lockgraylists() \
+	{ if (gcworker != NULL) pthread_mutex_lock(&gcworker->pool->lock); }
+#define unlockgraylists() \
+	{ if (gcworker != NULL) pthread_mutex_unlock(&gcworker->pool->lock); }
+
+/*
+** Color changes of objects owned by worker 'w' (if not NULL) must be
+** atomic, as other workers may be reading those colors. (A claimed
+** object is already gray.)
+*/
+#define markblack(w,x)  ((w) ? cast_void(__atomic_fetch_or(&(x)->marked, \
+	bitmask(BLACKBIT), __ATOMIC_RELAXED)) : cast_void(set2black(x)))
+#define markgray(w,x)	((w) ? cast_void(0) : cast_void(set2gray(x)))
+#define markbits(w,x,op,m)  ((w) ? cast_void(__atomic_fetch_##op( \
+	&(x)->marked, cast_byte(m), __ATOMIC_RELAXED)) : cast_void(0))
+
+static int claim (GCObject *o);
+static void pushgray (GCWorker *w, GCObject *o);
+
+#else
+
+#define gciswhite(x)		iswhite(x)
+#define lockgraylists()		((void)0)
+#define unlockgraylists()	((void)0)
+#define markblack(w,x)		set2black(x)
+#define markgray(w,x)		set2gray(x)
+
+#endif
+
+
+#define valiswhite(x)   (iscollectable(x) && gciswhite(gcvalue(x)))
+
+#define keyiswhite(n)   (keyiscollectable(n) && gciswhite(gckey(n)))
 
 
 /*
@@ -96,7 +189,7 @@
 
 #define markkey(g, n)	{ if keyiswhite(n) reallymarkobject(g,gckey(n)); }
 
-#define markobject(g,t)	{ if (iswhite(t)) reallymarkobject(g, obj2gco(t)); }
+#define markobject(g,t)	{ if (gciswhite(t)) reallymarkobject(g, obj2gco(t)); }
 
 /*
 ** mark an object that can be NULL (either because it is really optional,
@@ -129,6 +222,9 @@ static GCObject **getgclist (GCObject *o) {
     case LUA_VCCL: return &gco2ccl(o)->gclist;
     case LUA_VTHREAD: return &gco2th(o)->gclist;
     case LUA_VPROTO: return &gco2p(o)->gclist;
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE: return &gco2rope(o)->gclist;
+#endif
     case LUA_VUSERDATA: {
       Udata *u = gco2u(o);
       lua_assert(u->nuvalue > 0);
@@ -147,8 +243,16 @@ static GCObject **getgclist (GCObject *o) {
 
 static void linkgclist_ (GCObject *o, GCObject **pnext, GCObject **list) {
   lua_assert(!isgray(o));  /* cannot be in a gray list */
+  lockgraylists();
   *pnext = *list;
   *list = o;
+  unlockgraylists();
+#if defined(LUA_USE_PARALLELMARK)
+  if (gcworker != NULL) {
+    markbits(gcworker, o, and, ~maskcolors);  /* now it is gray */
+    return;
+  }
+#endif
   set2gray(o);  /* now it is */
 }
 
@@ -188,7 +292,7 @@ static int iscleared (global_State *g, const GCObject *o) {
     markobject(g, o);  /* strings are 'values', so are never weak */
     return 0;
   }
-  else return iswhite(o);
+  else return gciswhite(o);
 }
 
 
@@ -242,6 +346,10 @@ void luaC_barrierback_ (lua_State *L, GCObject *o) {
 
 void luaC_fix (lua_State *L, GCObject *o) {
   global_State *g = G(L);
+#if defined(LUA_USE_FROZEN)
+  if (isblack(o))  /* string from a frozen heap? */
+    return;  /* it is never collected anyway */
+#endif
   lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
   set2gray(o);  /* they will be gray forever */
   setage(o, G_OLD);  /* and old forever */
@@ -271,6 +379,21 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   return luaC_newobjdt(L, tt, sz, 0);
 }
 
+
+#if defined(LUA_USE_MMAPFILE)
+/*
+** link to 'allgc' a new object whose memory does not come from the
+** allocator (see 'luaS_newmapped')
+*/
+void luaC_linkobj (lua_State *L, GCObject *o, int tt) {
+  global_State *g = G(L);
+  o->marked = luaC_white(g);
+  o->tt = tt;
+  o->next = g->allgc;
+  g->allgc = o;
+}
+#endif
+
 /* }====================================================== */
 
 
@@ -295,18 +418,23 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 ** (only closures can), and a userdata's metatable must be a table.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
+#if defined(LUA_USE_PARALLELMARK)
+  GCWorker *w = gcworker;
+  if (w != NULL && !claim(o))
+    return;  /* another worker marked it first */
+#endif
   switch (o->tt) {
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
-      set2black(o);  /* nothing to visit */
+      markblack(w, o);  /* nothing to visit */
       break;
     }
     case LUA_VUPVAL: {
       UpVal *uv = gco2upv(o);
       if (upisopen(uv))
-        set2gray(uv);  /* open upvalues are kept gray */
+        markgray(w, uv);  /* open upvalues are kept gray */
       else
-        set2black(uv);  /* closed upvalues are visited here */
+        markblack(w, uv);  /* closed upvalues are visited here */
       markvalue(g, uv->v.p);  /* mark its content */
       break;
     }
@@ -314,13 +442,23 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       Udata *u = gco2u(o);
       if (u->nuvalue == 0) {  /* no user values? */
         markobjectN(g, u->metatable);  /* mark its metatable */
-        set2black(u);  /* nothing else to mark */
+        markblack(w, u);  /* nothing else to mark */
         break;
       }
       /* else... */
     }  /* FALLTHROUGH */
     case LUA_VLCL: case LUA_VCCL: case LUA_VTABLE:
-    case LUA_VTHREAD: case LUA_VPROTO: {
+    case LUA_VTHREAD: case LUA_VPROTO:
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE:
+#endif
+    {
+#if defined(LUA_USE_PARALLELMARK)
+      if (w != NULL) {  /* claimed by a worker? */
+        pushgray(w, o);  /* it is already gray */
+        break;
+      }
+#endif
       linkobjgclist(o, g->gray);  /* to be visited later */
       break;
     }
@@ -339,6 +477,58 @@ static void markmt (global_State *g) {
 }
 
 
+#if defined(LUA_USE_SHAPES)
+/*
+** Shapes live while tables use them. Traversing a table makes its
+** shape (and the shape's ancestors) young, as does giving a shape to a
+** table ('luaH_useshape'); each full collection ages all shapes. A
+** shape that no table used in two full collections is unused: its
+** tables, dead in the first one, were freed by its sweep. Such shapes
+** are freed, children before parents (shapes are older than their
+** children, and 'g->shapes' goes from new to old), and the keys of
+** all other shapes are marked. (Each key is the last key of some
+** shape; tables with shapes do not mark their keys.) Young collections
+** do not traverse old tables, so only full ones age shapes.
+*/
+static lu_mem sweepshapes (lua_State *L, int full) {
+  global_State *g = G(L);
+  lu_mem count = 0;
+  Shape **p = &g->shapes;
+  while (*p != NULL) {
+    Shape *s = *p;
+    if (full && s->age >= 2) {  /* unused for two full collections? */
+      *p = s->gnext;
+      luaH_freeshape(L, s);
+    }
+    else {
+      if (full)
+        s->age++;
+      if (s->nkeys > 0)
+        markobject(g, s->keys[s->nkeys - 1]);
+      count++;
+      p = &s->gnext;
+    }
+  }
+  return count;
+}
+
+
+/*
+** Make the shape of a traversed table young. Parallel markers may
+** traverse tables sharing a shape at the same time.
+*/
+#if defined(LUA_USE_PARALLELMARK)
+static void useshape (Shape *s) {
+  for (; s != NULL && __atomic_load_n(&s->age, __ATOMIC_RELAXED) != 0;
+         s = s->parent)
+    __atomic_store_n(&s->age, 0, __ATOMIC_RELAXED);
+}
+#else
+#define useshape(s)	luaH_useshape(s)
+#endif
+#endif
+
+
 /*
 ** mark all objects in list of being-finalized
 */
@@ -432,8 +622,15 @@ static void genlink (global_State *g, GCObject *o) {
   if (getage(o) == G_TOUCHED1) {  /* touched in this cycle? */
     linkobjgclist(o, g->grayagain);  /* link it back in 'grayagain' */
   }  /* everything else do not need to be linked back */
-  else if (getage(o) == G_TOUCHED2)
+  else if (getage(o) == G_TOUCHED2) {
+#if defined(LUA_USE_PARALLELMARK)
+    if (gcworker != NULL) {
+      markbits(gcworker, o, xor, G_TOUCHED2 ^ G_OLD);  /* advance age */
+      return;
+    }
+#endif
     changeage(o, G_TOUCHED2, G_OLD);  /* advance age */
+  }
 }
 
 
@@ -458,6 +655,15 @@ static void traverseweakvalue (global_State *g, Table *h) {
         hasclears = 1;  /* table will have to be cleared */
     }
   }
+#if defined(LUA_USE_SHAPES)
+  if (h->shape != NULL) {  /* traverse shape part */
+    int j;
+    for (j = 0; j < h->shape->nkeys; j++) {
+      if (!hasclears && iscleared(g, gcvalueN(&h->svals[j])))
+        hasclears = 1;  /* table will have to be cleared */
+    }
+  }
+#endif
   if (g->gcstate == GCSatomic && hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
   else
@@ -507,6 +713,16 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
       reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
     }
   }
+#if defined(LUA_USE_SHAPES)
+  if (h->shape != NULL) {  /* keys in shapes are strings, never cleared */
+    for (i = 0; i < h->shape->nkeys; i++) {
+      if (valiswhite(&h->svals[i])) {
+        marked = 1;
+        reallymarkobject(g, gcvalue(&h->svals[i]));
+      }
+    }
+  }
+#endif
   /* link table into proper list */
   if (g->gcstate == GCSpropagate)
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
@@ -535,13 +751,34 @@ static void traversestrongtable (global_State *g, Table *h) {
       markvalue(g, gval(n));
     }
   }
+#if defined(LUA_USE_SHAPES)
+  if (h->shape != NULL) {  /* traverse shape part (keys are in the shape) */
+    for (i = 0; i < h->shape->nkeys; i++)
+      markvalue(g, &h->svals[i]);
+  }
+#endif
   genlink(g, obj2gco(h));
 }
 
 
+#if defined(LUA_USE_PARALLELMARK)
+/*
+** Like 'gfasttm', but without caching an absent '__mode' in the flags
+** of the metatable, which other workers may be reading.
+*/
+static const TValue *getmode (global_State *g, Table *mt) {
+  if (mt == NULL || (mt->flags & (1u << TM_MODE)))
+    return NULL;
+  return luaH_getshortstr(mt, g->tmname[TM_MODE]);
+}
+#else
+#define getmode(g,mt)	gfasttm(g, mt, TM_MODE)
+#endif
+
+
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
-  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  const TValue *mode = getmode(g, h->metatable);
   TString *smode;
   markobjectN(g, h->metatable);
   if (mode && ttisshrstring(mode) &&  /* is there a weak mode? */
@@ -558,6 +795,12 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
+#if defined(LUA_USE_SHAPES)
+  if (h->shape != NULL) {
+    useshape(h->shape);
+    return 1 + h->alimit + h->shape->nkeys;
+  }
+#endif
   return 1 + h->alimit + 2 * allocsizenode(h);
 }
 
@@ -592,6 +835,21 @@ static int traverseproto (global_State *g, Proto *f) {
 }
 
 
+#if defined(LUA_USE_ROPES)
+/*
+** Traverse a rope: its contents, if built, and its pieces. (Long
+** chains of ropes go through the gray list, not the C stack.)
+*/
+static int traverserope (global_State *g, Rope *r) {
+  unsigned int i;
+  markobjectN(g, r->flat);
+  for (i = 0; i < r->n; i++)
+    markobject(g, r->piece[i]);
+  return 1 + r->n;
+}
+#endif
+
+
 static int traverseCclosure (global_State *g, CClosure *cl) {
   int i;
   for (i = 0; i < cl->nupvalues; i++)  /* mark its upvalues */
@@ -655,12 +913,9 @@ static int traversethread (global_State *g, lua_State *th) {
 
 
 /*
-** traverse one gray object, turning it to black.
+** traverse one (black) object.
 */
-static lu_mem propagatemark (global_State *g) {
-  GCObject *o = g->gray;
-  nw2black(o);
-  g->gray = *getgclist(o);  /* remove from 'gray' list */
+static lu_mem traverseobject (global_State *g, GCObject *o) {
   switch (o->tt) {
     case LUA_VTABLE: return traversetable(g, gco2t(o));
     case LUA_VUSERDATA: return traverseudata(g, gco2u(o));
@@ -668,13 +923,332 @@ static lu_mem propagatemark (global_State *g) {
     case LUA_VCCL: return traverseCclosure(g, gco2ccl(o));
     case LUA_VPROTO: return traverseproto(g, gco2p(o));
     case LUA_VTHREAD: return traversethread(g, gco2th(o));
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE: return traverserope(g, gco2rope(o));
+#endif
     default: lua_assert(0); return 0;
   }
 }
 
 
+/*
+** traverse one gray object, turning it to black.
+*/
+static lu_mem propagatemark (global_State *g) {
+  GCObject *o = g->gray;
+  nw2black(o);
+  g->gray = *getgclist(o);  /* remove from 'gray' list */
+  return traverseobject(g, o);
+}
+
+
+#if defined(LUA_USE_PARALLELMARK)
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+** In large heaps, 'propagateall' spreads its work over a pool of helper
+** threads, in rounds. A round distributes the 'gray' list over the
+** workers' stacks and runs until all workers run out of work. Workers
+** claim white objects by clearing their white bits with an atomic
+** compare-and-swap, so that each object is traversed by exactly one
+** worker. A worker with enough work publishes part of it when other
+** workers are idle; idle workers steal published objects.
+** Links to the other gray lists are protected by the pool lock.
+** Threads are not traversed by workers, as their traversal can resize
+** their stacks; workers move them (and objects that do not fit in
+** their stacks) back to the 'gray' list, which the collector traverses
+** after the round. What that traversal marks goes to the next round.
+** Helper threads and stacks are allocated with 'malloc', as the
+** allocation function of the state need not be thread safe.
+** =======================================================
+*/
+
+/* number of processors available to the collector */
+#if !defined(luai_ncpus)
+#define luai_ncpus()	sysconf(_SC_NPROCESSORS_ONLN)
+#endif
+
+
+#define loadint(x)	__atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define storeint(x,v)	__atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define addint(x,v)	__atomic_add_fetch(&(x), (v), __ATOMIC_SEQ_CST)
+
+
+/* turn a white object gray; return false if it was not white */
+static int claim (GCObject *o) {
+  lu_byte old = __atomic_load_n(&o->marked, __ATOMIC_RELAXED);
+  do {
+    if (!(old & WHITEBITS))
+      return 0;  /* already marked */
+  } while (!__atomic_compare_exchange_n(&o->marked, &old,
+                                        cast_byte(old & ~WHITEBITS), 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+
+/* ensure space for 'n' more objects in the stack of 'w' */
+static int growstack (GCWorker *w, size_t n) {
+  if (w->n + n > w->size) {
+    size_t newsize = (w->size < 256) ? 256 : w->size * 2;
+    GCObject **stk;
+    while (newsize < w->n + n)
+      newsize *= 2;
+    stk = (GCObject **)realloc(w->stk, newsize * sizeof(GCObject *));
+    if (stk == NULL)
+      return 0;
+    w->stk = stk;
+    w->size = newsize;
+  }
+  return 1;
+}
+
+
+/* link gray object 'o' back to the 'gray' list, to be traversed later */
+static void graylater (GCPool *p, GCObject *o) {
+  pthread_mutex_lock(&p->lock);
+  *getgclist(o) = p->g->gray;
+  p->g->gray = o;
+  pthread_mutex_unlock(&p->lock);
+}
+
+
+static void pushgray (GCWorker *w, GCObject *o) {
+  if (l_likely(w->n < w->size) || growstack(w, 1))
+    w->stk[w->n++] = o;
+  else
+    graylater(w->pool, o);
+}
+
+
+/* move the top of the private stack of 'w' to its shared section */
+static void publish (GCWorker *w) {
+  pthread_mutex_lock(&w->lock);
+  lua_assert(w->npub == 0 && w->n > GCPUBSIZE);
+  w->n -= GCPUBSIZE;
+  memcpy(w->pub, w->stk + w->n, GCPUBSIZE * sizeof(GCObject *));
+  storeint(w->npub, GCPUBSIZE);
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+/*
+** Worker 'w' takes objects published by worker 'v': all of them, if 'v'
+** is itself, or half of them, if stealing from another worker.
+*/
+static int steal (GCWorker *w, GCWorker *v) {
+  int k;
+  pthread_mutex_lock(&v->lock);
+  k = (v == w) ? v->npub : (v->npub + 1) / 2;
+  if (k > 0) {
+    int i;
+    storeint(v->npub, v->npub - k);
+    if (growstack(w, cast_sizet(k))) {
+      memcpy(w->stk + w->n, v->pub + v->npub, k * sizeof(GCObject *));
+      w->n += k;
+    }
+    else {  /* no memory; leave them to the collector */
+      for (i = 0; i < k; i++)
+        graylater(w->pool, v->pub[v->npub + i]);
+      k = 0;
+    }
+  }
+  pthread_mutex_unlock(&v->lock);
+  return (k > 0);
+}
+
+
+/*
+** Find more work for worker 'w', which has an empty stack. Returns
+** false when all workers are idle (and so there is no work left).
+*/
+static int getwork (GCWorker *w) {
+  GCPool *p = w->pool;
+  if (loadint(w->npub) > 0 && steal(w, w))
+    return 1;
+  addint(p->nidle, 1);
+  for (;;) {
+    int i;
+    for (i = 0; i < p->nworkers; i++) {
+      GCWorker *v = &p->w[i];
+      if (v != w && loadint(v->npub) > 0) {
+        addint(p->nidle, -1);  /* it may become busy */
+        if (steal(w, v))
+          return 1;
+        addint(p->nidle, 1);
+      }
+    }
+    if (loadint(p->nidle) == p->nworkers)
+      return 0;  /* nobody has work left */
+    sched_yield();
+  }
+}
+
+
+/* traverse gray objects until there is no work left for anybody */
+static void drain (GCWorker *w) {
+  global_State *g = w->pool->g;
+  gcworker = w;
+  do {
+    while (w->n > 0) {
+      GCObject *o = w->stk[--w->n];
+      if (o->tt == LUA_VTHREAD)
+        graylater(w->pool, o);  /* collector will traverse it */
+      else {
+        __atomic_fetch_or(&o->marked, bitmask(BLACKBIT), __ATOMIC_RELAXED);
+        w->work += traverseobject(g, o);
+        if (w->n > 2 * GCPUBSIZE && loadint(w->npub) == 0 &&
+            loadint(w->pool->nidle) > 0)
+          publish(w);  /* share some work with idle workers */
+      }
+    }
+  } while (getwork(w));
+  gcworker = NULL;
+}
+
+
+static void *helper (void *ud) {
+  GCWorker *w = cast(GCWorker *, ud);
+  GCPool *p = w->pool;
+  unsigned int round = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->round == round && !p->quit)
+      pthread_cond_wait(&p->start, &p->lock);
+    if (p->quit)
+      break;
+    round = p->round;
+    pthread_mutex_unlock(&p->lock);
+    drain(w);
+    pthread_mutex_lock(&p->lock);
+    if (--p->running == 0)
+      pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+
+/*
+** Get the pool of helpers of 'g', creating it if needed. Returns NULL
+** if there is no pool (and none could be created now).
+*/
+static GCPool *getpool (global_State *g) {
+  GCPool *p = g->gcpool;
+  if (p == NULL && !g->gcemergency) {
+    long ncpu = luai_ncpus();
+    int n = (ncpu < 1) ? 1 : (ncpu > LUAI_GCTHREADS) ? LUAI_GCTHREADS
+                                                     : cast_int(ncpu);
+    int i;
+    p = (GCPool *)calloc(1, sizeof(GCPool) + (n - 1) * sizeof(GCWorker));
+    if (p == NULL)
+      return NULL;  /* try again in next cycle */
+    p->g = g;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for (i = 0; i < n; i++) {  /* create workers (and start helpers) */
+      GCWorker *w = &p->w[i];
+      w->pool = p;
+      pthread_mutex_init(&w->lock, NULL);
+      if (i > 0 && pthread_create(&w->thread, NULL, helper, w) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        break;  /* keep the ones already running */
+      }
+      p->nworkers = i + 1;
+    }
+    g->gcpool = p;  /* with only one worker, it remains serial */
+  }
+  return p;
+}
+
+
+/* run a round of parallel marking over the objects in the 'gray' list */
+static lu_mem parallelround (global_State *g, GCPool *p) {
+  lu_mem work = 0;
+  GCObject *o = g->gray;
+  int i = 0;
+  g->gray = NULL;
+  while (o != NULL) {  /* distribute gray objects among workers */
+    GCObject *next = *getgclist(o);
+    pushgray(&p->w[i], o);
+    if (++i == p->nworkers) i = 0;
+    o = next;
+  }
+  for (i = 0; i < p->nworkers; i++)
+    p->w[i].work = 0;
+  p->nidle = 0;
+  pthread_mutex_lock(&p->lock);
+  p->round++;
+  p->running = p->nworkers - 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  drain(&p->w[0]);  /* collector works too */
+  pthread_mutex_lock(&p->lock);
+  while (p->running > 0)
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 0; i < p->nworkers; i++)
+    work += p->w[i].work;
+  return work;
+}
+
+
+static lu_mem parallelpropagate (global_State *g, GCPool *p) {
+  lu_mem work = 0;
+  while (g->gray != NULL) {
+    GCObject *o;
+    work += parallelround(g, p);
+    o = g->gray;  /* threads and objects left by workers */
+    g->gray = NULL;
+    while (o != NULL) {  /* traverse them here */
+      GCObject *next = *getgclist(o);
+      nw2black(o);
+      work += traverseobject(g, o);
+      o = next;
+    }
+  }
+  return work;
+}
+
+
+/* stop the helper threads of 'g' and free its pool */
+void luaC_freemarkers (global_State *g) {
+  GCPool *p = g->gcpool;
+  if (p != NULL) {
+    int i;
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 1; i < p->nworkers; i++)
+      pthread_join(p->w[i].thread, NULL);
+    for (i = 0; i < p->nworkers; i++) {
+      pthread_mutex_destroy(&p->w[i].lock);
+      free(p->w[i].stk);
+    }
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+    g->gcpool = NULL;
+  }
+}
+
+/* }====================================================== */
+#endif
+
+
 static lu_mem propagateall (global_State *g) {
   lu_mem tot = 0;
+#if defined(LUA_USE_PARALLELMARK)
+  if (g->gray != NULL && gettotalbytes(g) >= LUAI_GCPARMIN) {
+    GCPool *p = getpool(g);
+    if (p != NULL && p->nworkers > 1)
+      return parallelpropagate(g, p);
+  }
+#endif
   while (g->gray)
     tot += propagatemark(g);
   return tot;
@@ -758,6 +1332,15 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
       if (isempty(gval(n)))  /* is entry empty? */
         clearkey(n);  /* clear its key */
     }
+#if defined(LUA_USE_SHAPES)
+    if (h->shape != NULL) {
+      for (i = 0; i < h->shape->nkeys; i++) {
+        TValue *o = &h->svals[i];
+        if (iscleared(g, gcvalueN(o)))  /* value was collected? */
+          setempty(o);  /* remove entry */
+      }
+    }
+#endif
   }
 }
 
@@ -806,14 +1389,262 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
+#if defined(LUA_USE_MMAPFILE)
+      if (ismapped(ts)) {  /* bytes are not in the heap? */
+        luaS_freemapped(ts);
+        break;
+      }
+#endif
       luaM_freemem(L, ts, sizelstring(ts->u.lnglen));
       break;
     }
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE:
+      luaM_freemem(L, o, sizerope(gco2rope(o)->size));
+      break;
+#endif
     default: lua_assert(0);
   }
 }
 
 
+#if defined(LUA_USE_BGSWEEP)
+/*
+** {======================================================
+** Background sweeping
+** =======================================================
+** When the sweeper is on, the memory of dead objects found by sweeps
+** is not released at once: 'luaM_free_' gives it to 'luaC_deferfree',
+** which queues it in chunks for a thread that calls the allocation
+** function to release it. (Everything else that freeing an object
+** involves, such as removing a string from the string table, still
+** happens here.) Queued memory is counted as in use until the thread
+** releases it; the collector gets the count of released bytes back
+** ('settle') at each step. The amount of queued memory is limited:
+** above the limit, memory is released at once, as usual.
+** =======================================================
+*/
+
+/* number of blocks in a chunk */
+#define SWEEPCHUNK	1024
+
+/*
+** All blocks of a chunk are released with the allocation function that
+** was current when they were queued; a chunk is sent to the thread as
+** soon as that function changes (see 'luaC_deferfree').
+*/
+typedef struct SweepChunk {
+  struct SweepChunk *next;
+  lua_Alloc frealloc;  /* function to release the blocks... */
+  void *ud;  /* ...and its auxiliary data */
+  int n;  /* number of blocks in the chunk */
+  void *block[SWEEPCHUNK];
+  size_t size[SWEEPCHUNK];
+} SweepChunk;
+
+
+typedef struct Sweeper {
+  pthread_t thread;
+  pthread_mutex_t lock;  /* protects the fields up to 'quit' */
+  pthread_cond_t work;  /* signals new chunks (or 'quit') */
+  pthread_cond_t idle;  /* signals that all chunks were released */
+  SweepChunk *first, *last;  /* queue of chunks to be released */
+  SweepChunk *spare;  /* a released chunk, for reuse */
+  int busy;  /* true while the thread releases a chunk */
+  int quit;  /* true when the thread must exit */
+  SweepChunk *cur;  /* chunk being filled by the collector */
+  l_mem limit;  /* maximum number of queued bytes */
+  l_mem queued;  /* bytes queued and not settled yet */
+  l_mem freed;  /* bytes released and not settled yet (atomic) */
+} Sweeper;
+
+
+static void *sweeper (void *ud) {
+  Sweeper *s = cast(Sweeper *, ud);
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    SweepChunk *c;
+    l_mem total = 0;
+    int i;
+    while (s->first == NULL && !s->quit)
+      pthread_cond_wait(&s->work, &s->lock);
+    if ((c = s->first) == NULL)
+      break;  /* quit with nothing left to do */
+    if ((s->first = c->next) == NULL)
+      s->last = NULL;
+    s->busy = 1;
+    pthread_mutex_unlock(&s->lock);
+    for (i = 0; i < c->n; i++) {
+      (*c->frealloc)(c->ud, c->block[i], c->size[i], 0);
+      total += cast(l_mem, c->size[i]);
+    }
+    __atomic_add_fetch(&s->freed, total, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&s->lock);
+    s->busy = 0;
+    if (s->spare == NULL) {  /* keep chunk for reuse? */
+      s->spare = c;
+      c = NULL;
+    }
+    if (s->first == NULL)
+      pthread_cond_broadcast(&s->idle);
+    if (c != NULL) {
+      pthread_mutex_unlock(&s->lock);
+      free(c);
+      pthread_mutex_lock(&s->lock);
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+
+/* account the memory released by the sweeper thread */
+static void settle (global_State *g) {
+  Sweeper *s = g->sweeper;
+  l_mem freed = __atomic_exchange_n(&s->freed, 0, __ATOMIC_SEQ_CST);
+  s->queued -= freed;
+  g->GCdebt -= freed;
+}
+
+
+/* send the current chunk (if any) to the sweeper thread */
+static void flushsweeper (global_State *g) {
+  Sweeper *s = g->sweeper;
+  SweepChunk *c = s->cur;
+  if (c != NULL && c->n > 0) {
+    s->cur = NULL;
+    c->next = NULL;
+    pthread_mutex_lock(&s->lock);
+    if (s->last != NULL)
+      s->last->next = c;
+    else
+      s->first = c;
+    s->last = c;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+  }
+  settle(g);
+}
+
+
+/* send everything to the sweeper thread and wait until it is released */
+static void drainsweeper (global_State *g) {
+  Sweeper *s = g->sweeper;
+  flushsweeper(g);
+  pthread_mutex_lock(&s->lock);
+  while (s->first != NULL || s->busy)
+    pthread_cond_wait(&s->idle, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+  settle(g);
+}
+
+
+/*
+** Queue block 'block' with size 'osize' to be released by the sweeper
+** thread. Returns false if the caller must release it.
+*/
+int luaC_deferfree (global_State *g, void *block, size_t osize) {
+  Sweeper *s = g->sweeper;
+  SweepChunk *c = s->cur;
+  if (block == NULL)
+    return 0;
+  if (s->queued + cast(l_mem, osize) > s->limit) {  /* queue is full? */
+    settle(g);  /* maybe the thread released something */
+    if (s->queued + cast(l_mem, osize) > s->limit)
+      return 0;
+  }
+  if (c != NULL && (c->frealloc != g->frealloc || c->ud != g->ud)) {
+    flushsweeper(g);  /* allocator changed ('lua_setallocf') */
+    c = NULL;
+  }
+  if (c == NULL) {  /* needs a new chunk? */
+    pthread_mutex_lock(&s->lock);
+    c = s->spare;
+    s->spare = NULL;
+    pthread_mutex_unlock(&s->lock);
+    if (c == NULL && (c = (SweepChunk *)malloc(sizeof(SweepChunk))) == NULL)
+      return 0;
+    c->n = 0;
+    c->frealloc = g->frealloc;
+    c->ud = g->ud;
+    s->cur = c;
+  }
+  c->block[c->n] = block;
+  c->size[c->n] = osize;
+  s->queued += cast(l_mem, osize);
+  if (++c->n == SWEEPCHUNK)
+    flushsweeper(g);
+  return 1;
+}
+
+
+/*
+** Set the limit (in Kbytes) of memory waiting for the sweeper; a limit
+** of 0 turns it off. Returns the previous limit, or -1 if the sweeper
+** could not be started.
+*/
+int luaC_bgsweep (lua_State *L, int limit) {
+  global_State *g = G(L);
+  Sweeper *s = g->sweeper;
+  int old = (s == NULL) ? 0 : cast_int(s->limit >> 10);
+  if (limit > 0 && s == NULL) {  /* turn it on? */
+    s = (Sweeper *)calloc(1, sizeof(Sweeper));
+    if (s == NULL)
+      return -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->idle, NULL);
+    if (pthread_create(&s->thread, NULL, sweeper, s) != 0) {
+      pthread_cond_destroy(&s->idle);
+      pthread_cond_destroy(&s->work);
+      pthread_mutex_destroy(&s->lock);
+      free(s);
+      return -1;
+    }
+    g->sweeper = s;
+  }
+  if (limit > 0)
+    s->limit = cast(l_mem, limit) << 10;
+  else if (limit == 0 && s != NULL) {  /* turn it off? */
+    flushsweeper(g);
+    pthread_mutex_lock(&s->lock);
+    s->quit = 1;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);  /* thread releases everything */
+    settle(g);
+    lua_assert(s->queued == 0);
+    free(s->spare);
+    pthread_cond_destroy(&s->idle);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    g->sweeper = NULL;
+  }
+  return old;
+}
+
+
+/*
+** Free a dead object found by a sweep, letting the sweeper release
+** its memory (except in emergency collections, which need the memory
+** at once).
+*/
+static void freedead (lua_State *L, global_State *g, GCObject *o) {
+  g->gcdefer = (g->sweeper != NULL && !g->gcemergency);
+  freeobj(L, o);
+  g->gcdefer = 0;
+}
+
+/* }====================================================== */
+
+#else
+
+#define freedead(L,g,o)		freeobj(L, o)
+
+#endif
+
+
 /*
 ** sweep at most 'countin' elements from a list of GCObjects erasing dead
 ** objects, where a dead object is one marked with the old (non current)
@@ -832,7 +1663,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
     int marked = curr->marked;
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
       *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
+      freedead(L, g, curr);  /* erase 'curr' */
     }
     else {  /* change mark to 'white' */
       curr->marked = cast_byte((marked & ~maskgcbits) | white);
@@ -1083,7 +1914,7 @@ static void sweep2old (lua_State *L, GCObject **p) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
+      freedead(L, g, curr);  /* erase 'curr' */
     }
     else {  /* all surviving objects become old */
       setage(curr, G_OLD);
@@ -1129,7 +1960,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(!isold(curr) && isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
+      freedead(L, g, curr);  /* erase 'curr' */
     }
     else {  /* correct mark and age */
       if (getage(curr) == G_NEW) {  /* new objects go back to white */
@@ -1522,6 +2353,50 @@ void luaC_freeallobjects (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_FROZEN)
+/*
+** Objects of a frozen heap are black for good: the collectors of the
+** states that reach them never mark, sweep or otherwise write to them.
+** Long strings get their hashes now, as readers must not set them; so
+** do tables their cache of absent metamethods ('luaT_gettm').
+*/
+static void freezelist (global_State *g, GCObject *o) {
+  for (; o != NULL; o = o->next) {
+    if (o->tt == LUA_VTABLE) {
+      Table *t = gco2t(o);
+      int e;
+      for (e = 0; e <= TM_EQ; e++)  /* fill the cache of 'fasttm' */
+        luaT_gettm(t, cast(TMS, e), g->tmname[e]);
+      t->flags |= BITFROZEN;
+    }
+    else if (o->tt == LUA_VLNGSTR)
+      luaS_hashlongstr(gco2ts(o));
+    o->marked = cast_byte((o->marked & ~WHITEBITS) | bitmask(BLACKBIT));
+  }
+}
+
+
+/*
+** Freeze all objects of a state, which must never run again: its
+** collector is stopped, and only 'lua_close' can free its objects.
+*/
+void luaC_freeze (lua_State *L) {
+  global_State *g = G(L);
+#if defined(LUA_USE_ROPES)
+  GCObject *o;
+  for (o = g->allgc; o != NULL; o = o->next) {
+    if (o->tt == LUA_VROPE)  /* build ropes now, as readers must not */
+      luaS_flatten(L, gco2rope(o));
+  }
+#endif
+  g->gcstp = GCSTPUSR;
+  freezelist(g, g->allgc);
+  freezelist(g, g->finobj);
+  freezelist(g, g->fixedgc);
+}
+#endif
+
+
 static lu_mem atomic (lua_State *L) {
   global_State *g = G(L);
   lu_mem work = 0;
@@ -1552,6 +2427,11 @@ static lu_mem atomic (lua_State *L) {
   work += propagateall(g);  /* remark, to propagate 'resurrection' */
   convergeephemerons(g);
   /* at this point, all resurrected objects are marked. */
+#if defined(LUA_USE_SHAPES)
+  /* all live tables were traversed (in a full collection); strings
+     need no propagation */
+  work += sweepshapes(L, g->gckind == KGC_INC);
+#endif
   /* remove dead objects from weak tables */
   clearbykeys(g, g->ephemeron);  /* clear keys from all ephemeron tables */
   clearbykeys(g, g->allweak);  /* clear keys from all 'allweak' tables */
@@ -1689,6 +2569,10 @@ static void incstep (lua_State *L, global_State *g) {
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
+#if defined(LUA_USE_BGSWEEP)
+  if (g->sweeper != NULL)
+    settle(g);  /* account memory released in background */
+#endif
   if (!gcrunning(g))  /* not running? */
     luaE_setdebt(g, -2000);
   else {
@@ -1697,6 +2581,10 @@ void luaC_step (lua_State *L) {
     else
       incstep(L, g);
   }
+#if defined(LUA_USE_BGSWEEP)
+  if (g->sweeper != NULL)
+    flushsweeper(g);  /* send what this step freed */
+#endif
 }
 
 
@@ -1735,6 +2623,14 @@ void luaC_fullgc (lua_State *L, int isemergency) {
     fullinc(L, g);
   else
     fullgen(L, g);
+#if defined(LUA_USE_BGSWEEP)
+  if (g->sweeper != NULL) {
+    if (isemergency)
+      drainsweeper(g);  /* memory is needed now */
+    else
+      flushsweeper(g);
+  }
+#endif
   g->gcemergency = 0;
 }
 
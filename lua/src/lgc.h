@@ -141,6 +141,19 @@
 #define LUAI_GCSTEPSIZE 13      /* 8 KB */
 
 
+#if defined(LUA_USE_PARALLELMARK)
+/* maximum number of threads (the collector's included) marking together */
+#if !defined(LUAI_GCTHREADS)
+#define LUAI_GCTHREADS	16
+#endif
+
+/* minimum heap size (in bytes) for the mark phase to run in parallel */
+#if !defined(LUAI_GCPARMIN)
+#define LUAI_GCPARMIN	(cast(lu_mem, 16) << 20)	/* 16 MB */
+#endif
+#endif
+
+
 /*
 ** Check whether the declared GC mode is generational. While in
 ** generational mode, the collector can go temporarily to incremental
@@ -193,10 +206,23 @@ LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz,
                                                  size_t offset);
+#if defined(LUA_USE_MMAPFILE)
+LUAI_FUNC void luaC_linkobj (lua_State *L, GCObject *o, int tt);
+#endif
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+#if defined(LUA_USE_PARALLELMARK)
+LUAI_FUNC void luaC_freemarkers (global_State *g);
+#endif
+#if defined(LUA_USE_BGSWEEP)
+LUAI_FUNC int luaC_deferfree (global_State *g, void *block, size_t osize);
+LUAI_FUNC int luaC_bgsweep (lua_State *L, int limit);
+#endif
+#if defined(LUA_USE_FROZEN)
+LUAI_FUNC void luaC_freeze (lua_State *L);
+#endif
 
 
 #endif
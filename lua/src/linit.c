@@ -50,10 +50,29 @@ static const luaL_Reg loadedlibs[] = {
   {LUA_MATHLIBNAME, luaopen_math},
   {LUA_UTF8LIBNAME, luaopen_utf8},
   {LUA_DBLIBNAME, luaopen_debug},
+#if defined(LUA_USE_JIT)
+  {LUA_JITLIBNAME, luaopen_jit},
+#endif
   {NULL, NULL}
 };
 
 
+#if defined(LUA_USE_WORKERS) || defined(LUA_USE_AIO)
+/*
+** these libs are preloaded and must be required before used
+*/
+static const luaL_Reg preloadedlibs[] = {
+#if defined(LUA_USE_WORKERS)
+  {LUA_WORKLIBNAME, luaopen_worker},
+#endif
+#if defined(LUA_USE_AIO)
+  {LUA_AIOLIBNAME, luaopen_aio},
+#endif
+  {NULL, NULL}
+};
+#endif
+
+
 LUALIB_API void luaL_openlibs (lua_State *L) {
   const luaL_Reg *lib;
   /* "require" functions from 'loadedlibs' and set results to global table */
@@ -61,5 +80,14 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
     luaL_requiref(L, lib->name, lib->func, 1);
     lua_pop(L, 1);  /* remove lib */
   }
+#if defined(LUA_USE_WORKERS) || defined(LUA_USE_AIO)
+  /* add open functions from 'preloadedlibs' into 'package.preload' table */
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  for (lib = preloadedlibs; lib->func; lib++) {
+    lua_pushcfunction(L, lib->func);
+    lua_setfield(L, -2, lib->name);
+  }
+  lua_pop(L, 1);  /* remove PRELOAD table */
+#endif
 }
 
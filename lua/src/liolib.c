@@ -7,6 +7,10 @@
 #define liolib_c
 #define LUA_LIB
 
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* for 'MAP_ANONYMOUS' (LUA_USE_MMAPFILE) */
+#endif
+
 #include "lprefix.h"
 
 
@@ -22,6 +26,13 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#if defined(LUA_USE_MMAPFILE)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
 
 
@@ -107,6 +118,36 @@ static int l_checkmode (const char *mode) {
 #endif				/* } */
 
 
+/*
+** {======================================================
+** l_readbuff: direct access to the bytes that a FILE has already read
+** into its buffer, so that they can be scanned in blocks instead of
+** with 'l_getc'. 'l_readavail' gives how many there are (none while
+** the stream is writing) and 'l_readskip' consumes them. Only for a
+** locked file.
+** =======================================================
+*/
+
+#if !defined(l_readbuff)	/* { */
+
+#if defined(__GLIBC__)
+#define l_readavail(f)  \
+	((f)->_IO_write_ptr > (f)->_IO_write_base ? 0 : \
+	  (size_t)((f)->_IO_read_end - (f)->_IO_read_ptr))
+#define l_readbuff(f)		((const char *)(f)->_IO_read_ptr)
+#define l_readskip(f,n)		((void)((f)->_IO_read_ptr += (n)))
+#elif defined(__APPLE__)
+#define l_readavail(f)  \
+	(((f)->_flags & __SWR) || (f)->_r <= 0 ? 0 : (size_t)(f)->_r)
+#define l_readbuff(f)		((const char *)(f)->_p)
+#define l_readskip(f,n)		((void)((f)->_p += (n), (f)->_r -= (int)(n)))
+#endif
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** l_fseek: configuration for longer offsets
@@ -426,15 +467,97 @@ static int io_lines (lua_State *L) {
 #endif
 
 
+/*
+** With LUA_USE_READNUMBERS, numerals are read from a window on the
+** buffer of their FILE, as far as it goes, instead of with 'l_getc'.
+*/
+#if defined(LUA_USE_READNUMBERS) && defined(l_readbuff)
+#define L_RNWINDOW
+#endif
+
+
 /* auxiliary structure used by 'read_number' */
 typedef struct {
   FILE *f;  /* file being read */
+#if defined(LUA_USE_MMAPFILE) || defined(L_RNWINDOW)
+  const char *p, *e;  /* window of bytes being read (all of them when 'f'
+                         is NULL) */
+#endif
+#if defined(L_RNWINDOW)
+  const char *b;  /* start of the window (not yet consumed from 'f') */
+#endif
   int c;  /* current character (look ahead) */
   int n;  /* number of elements in buffer 'buff' */
   char buff[L_MAXLENNUM + 1];  /* +1 for ending '\0' */
 } RN;
 
 
+#if defined(LUA_USE_MMAPFILE) || defined(L_RNWINDOW)
+
+/*
+** Called when the window of 'rn' is over: for a file, consumes it and
+** reads the next character with 'l_getc' (which refills the buffer of
+** the file), opening a new window on the rest of that buffer.
+*/
+static int rnfill (RN *rn) {
+  int c;
+  if (rn->f == NULL)  /* bytes of a mapped file? */
+    return EOF;
+#if defined(L_RNWINDOW)
+  l_readskip(rn->f, (size_t)(rn->p - rn->b));
+  c = l_getc(rn->f);
+  rn->b = rn->p = l_readbuff(rn->f);
+  rn->e = rn->p + l_readavail(rn->f);
+#else
+  c = l_getc(rn->f);
+#endif
+  return c;
+}
+
+#define rngetc(rn)  \
+	((rn)->p < (rn)->e ? (unsigned char)*(rn)->p++ : rnfill(rn))
+
+#else
+#define rngetc(rn)	l_getc((rn)->f)
+#endif
+
+
+/*
+** Starts reading numerals from the locked file 'f'.
+*/
+static void rninit (RN *rn, FILE *f) {
+  rn->f = f;
+#if defined(LUA_USE_MMAPFILE) || defined(L_RNWINDOW)
+  rn->p = rn->e = NULL;  /* no window yet */
+#endif
+#if defined(L_RNWINDOW)
+  rn->b = NULL;
+#endif
+}
+
+
+/*
+** Gives the look-ahead character back to the file and consumes what
+** was read from the window.
+*/
+static void rnunread (RN *rn) {
+#if defined(L_RNWINDOW)
+  if (rn->c != EOF && rn->p == rn->b) {  /* it came from 'l_getc'? */
+    ungetc(rn->c, rn->f);
+    rn->b = rn->p = rn->e = NULL;  /* 'ungetc' may move the buffer */
+  }
+  else {
+    if (rn->c != EOF)
+      rn->p--;  /* look ahead is the last byte read from the window */
+    l_readskip(rn->f, (size_t)(rn->p - rn->b));
+    rn->b = rn->p;
+  }
+#else
+  ungetc(rn->c, rn->f);
+#endif
+}
+
+
 /*
 ** Add current char to buffer (if not out of space) and read next one
 */
@@ -445,7 +568,7 @@ static int nextc (RN *rn) {
   }
   else {
     rn->buff[rn->n++] = rn->c;  /* save current char */
-    rn->c = l_getc(rn->f);  /* read next one */
+    rn->c = rngetc(rn);  /* read next one */
     return 1;
   }
 }
@@ -473,36 +596,39 @@ static int readdigits (RN *rn, int hex) {
 
 
 /*
-** Read a number: first reads a valid prefix of a numeral into a buffer.
-** Then it calls 'lua_stringtonumber' to check whether the format is
-** correct and to convert it to a Lua number.
+** Reads into 'rn->buff' a valid prefix of a numeral, skipping spaces
+** before it; 'rn->c' is left with the look-ahead character.
 */
-static int read_number (lua_State *L, FILE *f) {
-  RN rn;
+static void readnumeral (RN *rn) {
   int count = 0;
   int hex = 0;
   char decp[2];
-  rn.f = f; rn.n = 0;
+  rn->n = 0;
   decp[0] = lua_getlocaledecpoint();  /* get decimal point from locale */
   decp[1] = '.';  /* always accept a dot */
-  l_lockfile(rn.f);
-  do { rn.c = l_getc(rn.f); } while (isspace(rn.c));  /* skip spaces */
-  test2(&rn, "-+");  /* optional sign */
-  if (test2(&rn, "00")) {
-    if (test2(&rn, "xX")) hex = 1;  /* numeral is hexadecimal */
+  do { rn->c = rngetc(rn); } while (isspace(rn->c));  /* skip spaces */
+  test2(rn, "-+");  /* optional sign */
+  if (test2(rn, "00")) {
+    if (test2(rn, "xX")) hex = 1;  /* numeral is hexadecimal */
     else count = 1;  /* count initial '0' as a valid digit */
   }
-  count += readdigits(&rn, hex);  /* integral part */
-  if (test2(&rn, decp))  /* decimal point? */
-    count += readdigits(&rn, hex);  /* fractional part */
-  if (count > 0 && test2(&rn, (hex ? "pP" : "eE"))) {  /* exponent mark? */
-    test2(&rn, "-+");  /* exponent sign */
-    readdigits(&rn, 0);  /* exponent digits */
+  count += readdigits(rn, hex);  /* integral part */
+  if (test2(rn, decp))  /* decimal point? */
+    count += readdigits(rn, hex);  /* fractional part */
+  if (count > 0 && test2(rn, (hex ? "pP" : "eE"))) {  /* exponent mark? */
+    test2(rn, "-+");  /* exponent sign */
+    readdigits(rn, 0);  /* exponent digits */
   }
-  ungetc(rn.c, rn.f);  /* unread look-ahead char */
-  l_unlockfile(rn.f);
-  rn.buff[rn.n] = '\0';  /* finish string */
-  if (l_likely(lua_stringtonumber(L, rn.buff)))
+  rn->buff[rn->n] = '\0';  /* finish string */
+}
+
+
+/*
+** Converts the numeral read into 'rn' with 'lua_stringtonumber', which
+** checks whether its format is correct.
+*/
+static int pushnumeral (lua_State *L, RN *rn) {
+  if (l_likely(lua_stringtonumber(L, rn->buff)))
     return 1;  /* ok, it is a valid number */
   else {  /* invalid format */
    lua_pushnil(L);  /* "result" to be removed */
@@ -511,6 +637,22 @@ static int read_number (lua_State *L, FILE *f) {
 }
 
 
+/*
+** Read a number: first reads a valid prefix of a numeral into a buffer.
+** Then it calls 'lua_stringtonumber' to check whether the format is
+** correct and to convert it to a Lua number.
+*/
+static int read_number (lua_State *L, FILE *f) {
+  RN rn;
+  rninit(&rn, f);
+  l_lockfile(rn.f);
+  readnumeral(&rn);
+  rnunread(&rn);  /* unread look-ahead char */
+  l_unlockfile(rn.f);
+  return pushnumeral(L, &rn);
+}
+
+
 static int test_eof (lua_State *L, FILE *f) {
   int c = getc(f);
   ungetc(c, f);  /* no-op when c == EOF */
@@ -519,11 +661,70 @@ static int test_eof (lua_State *L, FILE *f) {
 }
 
 
+#if defined(LUA_USE_FASTLINES) && defined(l_readbuff)
+
+/*
+** Reads into 'buff' the rest of the current line, up to 'sz' bytes,
+** copying whole blocks from the buffer of 'f' and finding the newline
+** with 'memchr'; 'l_getc' only refills that buffer. Sets '*c' to the
+** character that stopped the reading ('\n', EOF, or 0 when 'buff' is
+** full) and returns the number of bytes read.
+*/
+static size_t scanline (FILE *f, char *buff, size_t sz, int *c) {
+  size_t i = 0;
+  while (i < sz) {
+    size_t n = l_readavail(f);
+    if (n > 0) {  /* scan what is buffered */
+      const char *p = l_readbuff(f);
+      const char *nl;
+      if (n > sz - i)
+        n = sz - i;
+      nl = (const char *)memchr(p, '\n', n);
+      if (nl != NULL) {  /* end of line? */
+        n = (size_t)(nl - p);
+        memcpy(buff + i, p, n);
+        l_readskip(f, n + 1);  /* skip the newline too */
+        *c = '\n';
+        return i + n;
+      }
+      memcpy(buff + i, p, n);
+      l_readskip(f, n);
+      i += n;
+    }
+    else {  /* buffer is empty; refill it */
+      int ch = l_getc(f);
+      if (ch == EOF || ch == '\n') {
+        *c = ch;
+        return i;
+      }
+      buff[i++] = (char)ch;
+    }
+  }
+  *c = 0;  /* line continues */
+  return i;
+}
+
+#endif
+
+
 static int read_line (lua_State *L, FILE *f, int chop) {
   luaL_Buffer b;
   int c;
+#if defined(LUA_USE_FASTLINES) && defined(l_readbuff)
+  size_t sz = LUAL_BUFFERSIZE;
+#endif
   luaL_buffinit(L, &b);
   do {  /* may need to read several chunks to get whole line */
+#if defined(LUA_USE_FASTLINES) && defined(l_readbuff)
+    char *buff = luaL_prepbuffsize(&b, sz);  /* preallocate buffer space */
+    size_t n;
+    l_lockfile(f);  /* no memory errors can happen inside the lock */
+    n = scanline(f, buff, sz, &c);
+    if (c == 0 && l_readavail(f) > sz)  /* long line? */
+      sz = l_readavail(f);  /* next chunk takes all that is buffered */
+    l_unlockfile(f);
+    luaL_addsize(&b, n);
+#else
     char *buff = luaL_prepbuffer(&b);  /* preallocate buffer space */
     int i = 0;
     l_lockfile(f);  /* no memory errors can happen inside the lock */
@@ -531,6 +732,7 @@ static int read_line (lua_State *L, FILE *f, int chop) {
       buff[i++] = c;  /* read up to end of line or buffer limit */
     l_unlockfile(f);
     luaL_addsize(&b, i);
+#endif
   } while (c != EOF && c != '\n');  /* repeat until end of line */
   if (!chop && c == '\n')  /* want a newline and have one? */
     luaL_addchar(&b, c);  /* add ending newline to result */
@@ -627,6 +829,55 @@ static int f_read (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_READNUMBERS)
+
+/* maximum number of numerals read in each lock of the file */
+#define L_RNBATCH	128
+
+/*
+** file:readnumbers([n]) reads up to 'n' numbers (all of them by
+** default) as 'read("n")' would, and returns them in a sequence. It
+** stops at the end of the file or at the first invalid numeral, which
+** is consumed as 'read("n")' consumes it. Numbers are converted onto
+** the stack in batches, as no memory errors can happen inside the lock.
+*/
+static int f_readnumbers (lua_State *L) {
+  FILE *f = tofile(L);
+  lua_Integer n = luaL_optinteger(L, 2, LUA_MAXINTEGER);
+  lua_Integer i = 0;
+  int done = 0;
+  RN rn;
+  luaL_argcheck(L, n >= 0, 2, "out of range");
+  lua_settop(L, 2);
+  lua_createtable(L, (n < LUAL_BUFFERSIZE) ? (int)n : LUAL_BUFFERSIZE, 0);
+  luaL_checkstack(L, L_RNBATCH, "too many results");
+  clearerr(f);
+  errno = 0;
+  while (!done && i < n) {
+    lua_Integer j;
+    int k;
+    rninit(&rn, f);  /* buffer of 'f' may have changed since last lock */
+    l_lockfile(f);
+    for (k = 0; k < L_RNBATCH && i + k < n; k++) {
+      readnumeral(&rn);
+      rnunread(&rn);  /* next numeral starts at the look-ahead char */
+      if (!lua_stringtonumber(L, rn.buff)) {  /* invalid numeral? */
+        done = 1;
+        break;
+      }
+    }
+    l_unlockfile(f);
+    for (j = i + k; j > i; j--)  /* move the numbers to the table */
+      lua_rawseti(L, 3, j);  /* (the last one is on the top) */
+    i += k;
+  }
+  if (ferror(f))
+    return luaL_fileresult(L, 0, NULL);
+  return 1;
+}
+#endif
+
+
 /*
 ** Iteration function for 'lines'.
 */
@@ -661,9 +912,651 @@ static int io_readline (lua_State *L) {
 /* }====================================================== */
 
 
+#if defined(LUA_USE_MMAPFILE)
+/*
+** {======================================================
+** Mapped files (LUA_USE_MMAPFILE): 'io.mmap' maps a file into memory
+** as one string (see 'lua_pushmappedstring'), which the mapped-file
+** object reads with the formats of 'file:read' and no system calls.
+** With slices, long results share the bytes of the mapping.
+** =======================================================
+*/
+
+#define LUA_MAPHANDLE	"MAPPEDFILE*"
+
+typedef struct LMap {
+  lua_Integer pos;  /* current position */
+} LMap;
+
+
+/*
+** Checks that 'arg' is an open mapped file and pushes its string.
+*/
+static LMap *tomap (lua_State *L, int arg) {
+  LMap *m = (LMap *)luaL_checkudata(L, arg, LUA_MAPHANDLE);
+  if (l_unlikely(lua_getiuservalue(L, arg, 1) != LUA_TSTRING))
+    luaL_error(L, "attempt to use a closed file");
+  return m;
+}
+
+
+/*
+** Pushes the 'n' bytes at offset 'i' of the string at 'si' (of length
+** 'len'), sharing them when possible.
+*/
+static void pushbytes (lua_State *L, int si, const char *s, size_t len,
+                       size_t i, size_t n) {
+  if (i == 0 && n == len)  /* the whole string? */
+    lua_pushvalue(L, si);
+  else {
+#if defined(LUA_USE_SLICES)
+    (void)s;  /* not used */
+    lua_pushsubstring(L, si, i, n);
+#else
+    lua_pushlstring(L, s + i, n);
+#endif
+  }
+}
+
+
+/* number of bytes after the current position */
+#define mavail(m,len)  \
+	((m)->pos < (lua_Integer)(len) ? (len) - (size_t)(m)->pos : 0)
+
+
+static int m_readline (lua_State *L, LMap *m, int si, const char *s,
+                       size_t len, int chop) {
+  size_t n = mavail(m, len);
+  size_t i = len - n;  /* where the line starts */
+  const char *nl = (const char *)memchr(s + i, '\n', n);
+  if (nl != NULL) {
+    n = (size_t)(nl - (s + i));  /* length without the newline */
+    m->pos = (lua_Integer)(i + n + 1);
+    if (!chop)
+      n++;  /* keep the newline */
+  }
+  else if (n > 0)
+    m->pos = (lua_Integer)len;
+  else {  /* at the end */
+    lua_pushliteral(L, "");
+    return 0;
+  }
+  pushbytes(L, si, s, len, i, n);
+  return 1;
+}
+
+
+static int m_readchars (lua_State *L, LMap *m, int si, const char *s,
+                        size_t len, size_t n) {
+  size_t avail = mavail(m, len);
+  size_t i = len - avail;
+  if (n > avail)
+    n = avail;
+  pushbytes(L, si, s, len, i, n);
+  if (n > 0)
+    m->pos = (lua_Integer)(i + n);
+  return (n > 0);
+}
+
+
+static int m_readnumber (lua_State *L, LMap *m, const char *s, size_t len) {
+  RN rn;
+  size_t avail = mavail(m, len);
+  rn.f = NULL;
+  rn.p = s + len - avail;
+  rn.e = s + len;
+  readnumeral(&rn);
+  if (rn.c != EOF)
+    rn.p--;  /* unread look-ahead char */
+  if (avail > 0)
+    m->pos = (lua_Integer)(rn.p - s);
+  return pushnumeral(L, &rn);
+}
+
+
+/*
+** Reads from the mapped file 'm' with the formats at 'first' and
+** after, as 'g_read' does from a file. Its string must be on the top,
+** after the formats.
+*/
+static int m_gread (lua_State *L, LMap *m, int first) {
+  int si = lua_gettop(L);
+  int nargs = si - first;
+  size_t len;
+  const char *s = lua_tolstring(L, si, &len);
+  int n, success;
+  if (nargs == 0) {  /* no arguments? */
+    success = m_readline(L, m, si, s, len, 1);
+    n = first + 1;  /* to return 1 result */
+  }
+  else {
+    /* ensure stack space for all results */
+    luaL_checkstack(L, nargs+LUA_MINSTACK, "too many arguments");
+    success = 1;
+    for (n = first; nargs-- && success; n++) {
+      if (lua_type(L, n) == LUA_TNUMBER) {
+        size_t l = (size_t)luaL_checkinteger(L, n);
+        if (l == 0) {  /* test eof */
+          lua_pushliteral(L, "");
+          success = (mavail(m, len) > 0);
+        }
+        else
+          success = m_readchars(L, m, si, s, len, l);
+      }
+      else {
+        const char *p = luaL_checkstring(L, n);
+        if (*p == '*') p++;  /* skip optional '*' (for compatibility) */
+        switch (*p) {
+          case 'n':  /* number */
+            success = m_readnumber(L, m, s, len);
+            break;
+          case 'l':  /* line */
+            success = m_readline(L, m, si, s, len, 1);
+            break;
+          case 'L':  /* line with end-of-line */
+            success = m_readline(L, m, si, s, len, 0);
+            break;
+          case 'a':  /* file */
+            m_readchars(L, m, si, s, len, len);  /* read the rest */
+            success = 1; /* always success */
+            break;
+          default:
+            return luaL_argerror(L, n, "invalid format");
+        }
+      }
+    }
+  }
+  if (!success) {
+    lua_pop(L, 1);  /* remove last result */
+    luaL_pushfail(L);  /* push nil instead */
+  }
+  return n - first;
+}
+
+
+static int m_read (lua_State *L) {
+  LMap *m = tomap(L, 1);
+  return m_gread(L, m, 2);
+}
+
+
+/*
+** Iteration function for 'lines' of mapped files, a closure with the
+** mapped file, the number of formats, and the formats as upvalues.
+*/
+static int m_readlines (lua_State *L) {
+  int i;
+  int n = (int)lua_tointeger(L, lua_upvalueindex(2));
+  LMap *m;
+  lua_settop(L, 0);
+  luaL_checkstack(L, n + 1, "too many arguments");
+  for (i = 1; i <= n; i++)  /* push arguments to 'm_gread' */
+    lua_pushvalue(L, lua_upvalueindex(2 + i));
+  lua_pushvalue(L, lua_upvalueindex(1));
+  m = (LMap *)lua_touserdata(L, -1);
+  if (lua_getiuservalue(L, -1, 1) != LUA_TSTRING)
+    return luaL_error(L, "file is already closed");
+  lua_remove(L, -2);  /* remove mapped file */
+  n = m_gread(L, m, 1);  /* 'n' is number of results */
+  lua_assert(n > 0);  /* should return at least a nil */
+  return lua_toboolean(L, -n) ? n : 0;  /* read at least one value? */
+}
+
+
+static int m_lines (lua_State *L) {
+  int n = lua_gettop(L) - 1;  /* number of arguments to read */
+  tomap(L, 1);  /* check that it is an open mapped file */
+  lua_pop(L, 1);
+  luaL_argcheck(L, n <= MAXARGLINE, MAXARGLINE + 2, "too many arguments");
+  lua_pushvalue(L, 1);  /* mapped file */
+  lua_pushinteger(L, n);  /* number of arguments to read */
+  lua_rotate(L, 2, 2);  /* move the two values to their positions */
+  lua_pushcclosure(L, m_readlines, 2 + n);
+  return 1;
+}
+
+
+static int m_seek (lua_State *L) {
+  static const char *const modenames[] = {"set", "cur", "end", NULL};
+  int op = luaL_checkoption(L, 2, "cur", modenames);
+  lua_Integer offset = luaL_optinteger(L, 3, 0);
+  LMap *m = tomap(L, 1);
+  lua_Integer len = (lua_Integer)lua_rawlen(L, -1);
+  lua_Integer base = (op == 0) ? 0 : (op == 1) ? m->pos : len;
+  if (offset < -base || offset > LUA_MAXINTEGER - base) {
+    errno = EINVAL;  /* as 'fseek' for a negative position */
+    return luaL_fileresult(L, 0, NULL);
+  }
+  m->pos = base + offset;
+  lua_pushinteger(L, m->pos);
+  return 1;
+}
+
+
+/* the contents of the mapped file, as a string */
+static int m_string (lua_State *L) {
+  tomap(L, 1);
+  return 1;
+}
+
+
+static int m_close (lua_State *L) {
+  tomap(L, 1);  /* check that it is open */
+  lua_pushnil(L);
+  lua_setiuservalue(L, 1, 1);  /* the collector unmaps the string */
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int m_tostring (lua_State *L) {
+  luaL_checkudata(L, 1, LUA_MAPHANDLE);
+  if (lua_getiuservalue(L, 1, 1) != LUA_TSTRING)
+    lua_pushliteral(L, "mapped file (closed)");
+  else
+    lua_pushfstring(L, "mapped file (%p)", lua_touserdata(L, 1));
+  return 1;
+}
+
+
+static void unmapstring (void *buff, size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  munmap((char *)buff - page, page + ((size + page) & ~(page - 1)));
+}
+
+
+/*
+** Maps the file 'fd' (with size 'size') and pushes it as a string. The
+** mapping has a page before the file for the header of the string,
+** and ends with a zero for its terminator: the rest of the last page
+** of the file, or a page after it.
+*/
+static int mapfile (lua_State *L, int fd, size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t total = page + ((size + page) & ~(page - 1));
+  char *base = (char *)mmap(NULL, total, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return 0;
+  if (mmap(base + page, size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+           fd, 0) == MAP_FAILED) {
+    int en = errno;
+    munmap(base, total);
+    errno = en;
+    return 0;
+  }
+  lua_pushmappedstring(L, base + page, size, unmapstring);
+  return 1;
+}
+
+
+static int io_mmap (lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  const char *mode = luaL_optstring(L, 2, "r");
+  struct stat st;
+  int fd, ok;
+  luaL_argcheck(L, strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0,
+                   2, "invalid mode");
+  ((LMap *)lua_newuserdatauv(L, sizeof(LMap), 1))->pos = 0;
+  luaL_setmetatable(L, LUA_MAPHANDLE);
+  errno = 0;
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return luaL_fileresult(L, 0, filename);
+  if (fstat(fd, &st) != 0)
+    ok = 0;
+  else if (!S_ISREG(st.st_mode)) {
+    errno = ENODEV;  /* as 'mmap' for files that cannot be mapped */
+    ok = 0;
+  }
+  else if (st.st_size > LUA_MAXINTEGER ||
+           (size_t)st.st_size > ((size_t)-1) / 2) {
+    errno = EFBIG;
+    ok = 0;
+  }
+  else if (st.st_size == 0) {
+    lua_pushliteral(L, "");
+    ok = 1;
+  }
+  else
+    ok = mapfile(L, fd, (size_t)st.st_size);
+  if (!ok) {
+    int en = errno;
+    close(fd);
+    errno = en;
+    return luaL_fileresult(L, 0, filename);
+  }
+  close(fd);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+
+/*
+** methods for mapped files
+*/
+static const luaL_Reg mmeth[] = {
+  {"read", m_read},
+  {"lines", m_lines},
+  {"seek", m_seek},
+  {"string", m_string},
+  {"close", m_close},
+  {NULL, NULL}
+};
+
+
+/*
+** metamethods for mapped files
+*/
+static const luaL_Reg mmetameth[] = {
+  {"__index", NULL},  /* place holder */
+  {"__close", m_close},
+  {"__tostring", m_tostring},
+  {NULL, NULL}
+};
+
+
+static void createmapmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_MAPHANDLE);  /* metatable for mapped files */
+  luaL_setfuncs(L, mmetameth, 0);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, mmeth);  /* create method table */
+  luaL_setfuncs(L, mmeth, 0);  /* add file methods to method table */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+#endif
+
+
+#if defined(LUA_USE_GATHERWRITE)
+/*
+** {======================================================
+** Gathered writes (LUA_USE_GATHERWRITE): the arguments of a write go
+** into one buffer, numbers included, and reach the FILE with a single
+** 'fwrite'; pieces that do not fit in the buffer are written directly.
+** A writer ('file:writer') keeps such a buffer across calls, and writes
+** it only when it reaches its size.
+** =======================================================
+*/
+
+#define LUA_WRITERHANDLE	"WRITER*"
+
+/* default size of the buffer of a writer */
+#if !defined(LUAI_WRITERSIZE)
+#define LUAI_WRITERSIZE		65536
+#endif
+
+/* maximum size of a formatted number */
+#define L_MAXNUM2STR		64
+
+
+typedef struct WBuff {
+  FILE *f;
+  char *b;  /* buffer */
+  size_t n;  /* number of bytes in the buffer */
+  size_t size;  /* size of the buffer */
+  int status;  /* false after a failed write */
+} WBuff;
+
+
+static void wflush (WBuff *w) {
+  if (w->n > 0) {
+    w->status = w->status && (fwrite(w->b, sizeof(char), w->n, w->f) == w->n);
+    w->n = 0;
+  }
+}
+
+
+static void wput (WBuff *w, const char *s, size_t l) {
+  if (l > w->size - w->n) {  /* does not fit? */
+    wflush(w);
+    if (l >= w->size) {  /* too large for the buffer? */
+      w->status = w->status && (fwrite(s, sizeof(char), l, w->f) == l);
+      return;
+    }
+  }
+  memcpy(w->b + w->n, s, l);
+  w->n += l;
+}
+
+
+/*
+** Formats the number at 'arg' into 'buff' as 'fprintf' would in the
+** original 'g_write'; integers do not need 'printf' for that.
+*/
+static const char *numtostr (lua_State *L, int arg, char *buff,
+                             size_t *len) {
+  if (lua_isinteger(L, arg)) {
+    lua_Integer i = lua_tointeger(L, arg);
+    lua_Unsigned u = (i < 0) ? 0u - (lua_Unsigned)i : (lua_Unsigned)i;
+    char *p = buff + L_MAXNUM2STR;
+    do {
+      *--p = (char)('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (i < 0)
+      *--p = '-';
+    *len = (size_t)(buff + L_MAXNUM2STR - p);
+    return p;
+  }
+  else {
+    *len = (size_t)lua_number2str(buff, L_MAXNUM2STR, lua_tonumber(L, arg));
+    return buff;
+  }
+}
+
+
+/*
+** Puts the 'nargs' values from 'arg' into 'w'. Before an invalid value
+** raises its error, the previous ones are written, as they would be
+** without gathering.
+*/
+static void wargs (lua_State *L, WBuff *w, int arg, int nargs) {
+  for (; nargs--; arg++) {
+    char num[L_MAXNUM2STR];
+    size_t l;
+    const char *s;
+    if (lua_type(L, arg) == LUA_TNUMBER)
+      s = numtostr(L, arg, num, &l);
+    else {
+      if (l_unlikely(lua_type(L, arg) != LUA_TSTRING))
+        wflush(w);
+      s = luaL_checklstring(L, arg, &l);
+    }
+    wput(w, s, l);
+  }
+}
+
+
+typedef struct LWriter {
+  size_t n;  /* number of bytes in the buffer */
+  size_t size;  /* size of the buffer, which follows this header */
+  int closed;
+} LWriter;
+
+#define wbuffer(wr)	((char *)((wr) + 1))
+
+
+static LWriter *towriter (lua_State *L) {
+  LWriter *wr = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  if (l_unlikely(wr->closed))
+    luaL_error(L, "attempt to use a closed writer");
+  return wr;
+}
+
+
+/* the file of the writer at index 1, or NULL if it is closed */
+static FILE *writerfile (lua_State *L) {
+  LStream *p;
+  lua_getiuservalue(L, 1, 1);
+  p = (LStream *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return isclosed(p) ? NULL : p->f;
+}
+
+
+static void initwbuff (WBuff *w, LWriter *wr, FILE *f) {
+  w->f = f;
+  w->b = wbuffer(wr);
+  w->n = wr->n;
+  w->size = wr->size;
+  w->status = 1;
+}
+
+
+/*
+** Writes the buffer of the writer at index 1 to its file and flushes
+** the file; returns whether both worked.
+*/
+static int writerflush (lua_State *L, LWriter *wr) {
+  FILE *f = writerfile(L);
+  WBuff w;
+  if (f == NULL)
+    return luaL_error(L, "attempt to use a closed file");
+  initwbuff(&w, wr, f);
+  errno = 0;
+  wflush(&w);
+  wr->n = 0;
+  return w.status && fflush(f) == 0;
+}
+
+
+static int w_write (lua_State *L) {
+  LWriter *wr = towriter(L);
+  FILE *f = writerfile(L);
+  WBuff w;
+  if (f == NULL)
+    return luaL_error(L, "attempt to use a closed file");
+  initwbuff(&w, wr, f);
+  errno = 0;
+  wargs(L, &w, 2, lua_gettop(L) - 1);
+  wr->n = w.n;
+  if (l_likely(w.status)) {
+    lua_settop(L, 1);
+    return 1;  /* return writer */
+  }
+  else
+    return luaL_fileresult(L, 0, NULL);
+}
+
+
+static int w_flush (lua_State *L) {
+  LWriter *wr = towriter(L);
+  return luaL_fileresult(L, writerflush(L, wr), NULL);
+}
+
+
+static int w_close (lua_State *L) {
+  LWriter *wr = towriter(L);
+  int res = writerflush(L, wr);
+  wr->closed = 1;
+  return luaL_fileresult(L, res, NULL);
+}
+
+
+/*
+** Writes what is left in the buffer, if the file is still open; there
+** is no one to report errors to.
+*/
+static int w_gc (lua_State *L) {
+  LWriter *wr = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  FILE *f;
+  if (!wr->closed && (f = writerfile(L)) != NULL) {
+    WBuff w;
+    initwbuff(&w, wr, f);
+    wflush(&w);
+    wr->n = 0;
+  }
+  wr->closed = 1;
+  return 0;
+}
+
+
+static int w_tostring (lua_State *L) {
+  LWriter *wr = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  if (wr->closed)
+    lua_pushliteral(L, "writer (closed)");
+  else
+    lua_pushfstring(L, "writer (%p)", (void *)wr);
+  return 1;
+}
+
+
+/*
+** file:writer([size]) creates a writer for the file, with a buffer of
+** 'size' bytes: its output reaches the file only when the buffer fills
+** up or with 'flush' or 'close', which do not close the file.
+*/
+static int f_writer (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 2, LUAI_WRITERSIZE);
+  LWriter *wr;
+  tofile(L);  /* check that it is an open file */
+  luaL_argcheck(L, 0 < size && (lua_Unsigned)size <= (~(size_t)0) / 2, 2,
+                   "out of range");
+  wr = (LWriter *)lua_newuserdatauv(L, sizeof(LWriter) + (size_t)size, 1);
+  wr->n = 0;
+  wr->size = (size_t)size;
+  wr->closed = 0;
+  luaL_setmetatable(L, LUA_WRITERHANDLE);
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);  /* the writer keeps its file */
+  return 1;
+}
+
+
+/*
+** methods for writers
+*/
+static const luaL_Reg wmeth[] = {
+  {"write", w_write},
+  {"flush", w_flush},
+  {"close", w_close},
+  {NULL, NULL}
+};
+
+
+/*
+** metamethods for writers
+*/
+static const luaL_Reg wmetameth[] = {
+  {"__index", NULL},  /* place holder */
+  {"__gc", w_gc},
+  {"__close", w_gc},
+  {"__tostring", w_tostring},
+  {NULL, NULL}
+};
+
+
+static void createwritermeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_WRITERHANDLE);  /* metatable for writers */
+  luaL_setfuncs(L, wmetameth, 0);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, wmeth);  /* create method table */
+  luaL_setfuncs(L, wmeth, 0);  /* add writer methods to method table */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+#endif
+
+
 static int g_write (lua_State *L, FILE *f, int arg) {
   int nargs = lua_gettop(L) - arg;
   int status = 1;
+#if defined(LUA_USE_GATHERWRITE)
+  char buff[LUAL_BUFFERSIZE];
+  WBuff w;
+  w.f = f;
+  w.b = buff;
+  w.n = 0;
+  w.size = sizeof(buff);
+  w.status = 1;
+  errno = 0;
+  wargs(L, &w, arg, nargs);
+  wflush(&w);
+  status = w.status;
+#else
   errno = 0;
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
@@ -681,6 +1574,7 @@ static int g_write (lua_State *L, FILE *f, int arg) {
       status = status && (fwrite(s, sizeof(char), l, f) == l);
     }
   }
+#endif
   if (l_likely(status))
     return 1;  /* file handle already on stack top */
   else
@@ -756,6 +1650,9 @@ static const luaL_Reg iolib[] = {
   {"flush", io_flush},
   {"input", io_input},
   {"lines", io_lines},
+#if defined(LUA_USE_MMAPFILE)
+  {"mmap", io_mmap},
+#endif
   {"open", io_open},
   {"output", io_output},
   {"popen", io_popen},
@@ -778,6 +1675,12 @@ static const luaL_Reg meth[] = {
   {"seek", f_seek},
   {"close", f_close},
   {"setvbuf", f_setvbuf},
+#if defined(LUA_USE_READNUMBERS)
+  {"readnumbers", f_readnumbers},
+#endif
+#if defined(LUA_USE_GATHERWRITE)
+  {"writer", f_writer},
+#endif
   {NULL, NULL}
 };
 
@@ -832,6 +1735,12 @@ static void createstdfile (lua_State *L, FILE *f, const char *k,
 LUAMOD_API int luaopen_io (lua_State *L) {
   luaL_newlib(L, iolib);  /* new module */
   createmeta(L);
+#if defined(LUA_USE_MMAPFILE)
+  createmapmeta(L);
+#endif
+#if defined(LUA_USE_GATHERWRITE)
+  createwritermeta(L);
+#endif
   /* create (and set) default files */
   createstdfile(L, stdin, IO_INPUT, "stdin");
   createstdfile(L, stdout, IO_OUTPUT, "stdout");
@@ -0,0 +1,1727 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* for 'MAP_ANONYMOUS' */
+#endif
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** The compiler translates each instruction of a prototype into a
+** piece of machine code. Simple instructions (moves, loads of constants,
+** jumps, and tests) are written directly in machine code; all others
+** call a "stencil", a C function that executes that single instruction
+** with the same semantics as 'luaV_execute'. Arithmetic, comparisons,
+** and numeric loops try an inline integer path before their stencils,
+** and addition, subtraction, multiplication, and division also an
+** inline float path.
+** Stencils return whether the instruction takes its branch, so that all
+** control flow of the function is made of direct jumps in the native
+** code, without any dispatch.
+**
+** All state lives in the CallInfo and in the stack, exactly as in the
+** interpreter, so that errors and yields (which use 'longjmp') can
+** unwind native frames freely and the interpreter can resume at any
+** instruction. Calls and returns between compiled functions jump
+** directly to the code of the other function; the native code returns
+** to the interpreter when it reaches a function that is not compiled,
+** and when the 'trap' of the running function signals active hooks.
+** ('trap' can only change inside stencils, so it is checked after them
+** and at jump targets.)
+**
+** Registers used by the native code (all callee saved):
+**   rbx: lua_State
+**   r14: CallInfo
+**   r12: base of the running function
+**   r13: index of the instruction that stopped at a trap
+*/
+
+
+/*
+** {==================================================================
+** Stencils
+** ===================================================================
+*/
+
+#define STENCIL(name)  \
+	static int name (lua_State *L, CallInfo *ci, const Instruction *pc)
+
+
+#define RA(i)	(base+GETARG_A(i))
+#define RB(i)	(base+GETARG_B(i))
+#define vRB(i)	s2v(RB(i))
+#define KB(i)	(k+GETARG_B(i))
+#define RC(i)	(base+GETARG_C(i))
+#define vRC(i)	s2v(RC(i))
+#define KC(i)	(k+GETARG_C(i))
+#define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
+
+
+/* correct global 'pc' (the instruction after the one being executed) */
+#define savepc(ci)	((ci)->u.l.savedpc = pc + 1)
+
+#define savestate(L,ci)		(savepc(ci), L->top.p = (ci)->top.p)
+
+#define checkGC(L,c)  \
+	{ luaC_condGC(L, (savepc(ci), L->top.p = (c)), (void)0); \
+           luai_threadyield(L); }
+
+
+#define l_addi(L,a,b)	intop(+, a, b)
+#define l_subi(L,a,b)	intop(-, a, b)
+#define l_muli(L,a,b)	intop(*, a, b)
+
+
+#if defined(LUA_USE_INLINECACHE)
+#define globalgetshortstr(t,key)  \
+	luaV_getshortstrIC(L, t, key, \
+	                   luaF_icache(cl->p, cast_int(pc - cl->p->code)))
+#else
+#define globalgetshortstr(t,key)	luaH_getshortstr(t, key)
+#endif
+
+
+STENCIL(j_loadkx) {
+  StkId base = ci->func.p + 1;
+  setobj2s(L, RA(*pc), ci_func(ci)->p->k + GETARG_Ax(pc[1]));
+  return 0;
+}
+
+
+STENCIL(j_lfalseskip) {
+  StkId base = ci->func.p + 1;
+  UNUSED(L);
+  setbfvalue(s2v(RA(*pc)));
+  return 1;
+}
+
+
+STENCIL(j_loadnil) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  int b = GETARG_B(i);
+  UNUSED(L);
+  do {
+    setnilvalue(s2v(ra++));
+  } while (b--);
+  return 0;
+}
+
+
+STENCIL(j_setupval) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  UpVal *uv = ci_func(ci)->upvals[GETARG_B(i)];
+  setobj(L, uv->v.p, s2v(RA(i)));
+  luaC_barrier(L, uv, s2v(RA(i)));
+  return 0;
+}
+
+
+STENCIL(j_gettabup) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  LClosure *cl = ci_func(ci);
+  TValue *k = cl->p->k;
+  const TValue *slot;
+  TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
+  TValue *rc = KC(i);
+  TString *key = tsvalue(rc);  /* key must be a short string */
+  if (luaV_fastget(L, upval, key, slot, globalgetshortstr)) {
+    setobj2s(L, RA(i), slot);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishget(L, upval, rc, RA(i), slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_gettable) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  TValue *rc = vRC(i);
+  lua_Unsigned n;
+  if (ttisinteger(rc)  /* fast track for integers? */
+      ? (cast_void(n = ivalue(rc)), luaV_fastgeti(L, rb, n, slot))
+      : luaV_fastget(L, rb, rc, slot, luaH_get)) {
+    setobj2s(L, RA(i), slot);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishget(L, rb, rc, RA(i), slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_geti) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  int c = GETARG_C(i);
+  if (luaV_fastgeti(L, rb, c, slot)) {
+    setobj2s(L, RA(i), slot);
+  }
+  else {
+    TValue key;
+    setivalue(&key, c);
+    savestate(L, ci);
+    luaV_finishget(L, rb, &key, RA(i), slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_getfield) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  LClosure *cl = ci_func(ci);
+  TValue *k = cl->p->k;
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  TValue *rc = KC(i);
+  TString *key = tsvalue(rc);  /* key must be a short string */
+  if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
+    setobj2s(L, RA(i), slot);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishget(L, rb, rc, RA(i), slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_settabup) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  LClosure *cl = ci_func(ci);
+  TValue *k = cl->p->k;
+  const TValue *slot;
+  TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
+  TValue *rb = KB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rb);  /* key must be a short string */
+  if (luaV_fastset(L, upval, key, slot, globalgetshortstr)) {
+    luaV_finishfastset(L, upval, slot, rc);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishset(L, upval, rb, rc, slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_settable) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *k = ci_func(ci)->p->k;
+  StkId ra = RA(i);
+  const TValue *slot;
+  TValue *rb = vRB(i);  /* key (table is in 'ra') */
+  TValue *rc = RKC(i);  /* value */
+  lua_Unsigned n;
+  if (ttisinteger(rb)  /* fast track for integers? */
+      ? (cast_void(n = ivalue(rb)), luaV_fastseti(L, s2v(ra), n, slot))
+      : luaV_fastset(L, s2v(ra), rb, slot, luaH_get)) {
+    luaV_finishfastset(L, s2v(ra), slot, rc);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishset(L, s2v(ra), rb, rc, slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_seti) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *k = ci_func(ci)->p->k;
+  StkId ra = RA(i);
+  const TValue *slot;
+  int c = GETARG_B(i);
+  TValue *rc = RKC(i);
+  if (luaV_fastseti(L, s2v(ra), c, slot)) {
+    luaV_finishfastset(L, s2v(ra), slot, rc);
+  }
+  else {
+    TValue key;
+    setivalue(&key, c);
+    savestate(L, ci);
+    luaV_finishset(L, s2v(ra), &key, rc, slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_setfield) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  LClosure *cl = ci_func(ci);
+  TValue *k = cl->p->k;
+  StkId ra = RA(i);
+  const TValue *slot;
+  TValue *rb = KB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rb);  /* key must be a short string */
+  if (luaV_fastset(L, s2v(ra), key, slot, luaH_getshortstr)) {
+    luaV_finishfastset(L, s2v(ra), slot, rc);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishset(L, s2v(ra), rb, rc, slot);
+  }
+  return 0;
+}
+
+
+STENCIL(j_newtable) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  int b = GETARG_B(i);  /* log2(hash size) + 1 */
+  int c = GETARG_C(i);  /* array size */
+  Table *t;
+  if (b > 0)
+    b = 1 << (b - 1);  /* size is 2^(b - 1) */
+  if (TESTARG_k(i))  /* non-zero extra argument? */
+    c += GETARG_Ax(pc[1]) * (MAXARG_C + 1);  /* add it to size */
+  savepc(ci);
+  L->top.p = ra + 1;  /* correct top in case of emergency GC */
+  t = luaH_new(L);  /* memory allocation */
+  sethvalue2s(L, ra, t);
+#if defined(LUA_USE_SHAPES)
+  if (c == 0)  /* only record fields? */
+    luaH_newrecord(L, t, b);  /* idem */
+  else
+#endif
+  if (b != 0 || c != 0)
+    luaH_resize(L, t, c, b);  /* idem */
+  checkGC(L, ra + 1);
+  return 0;
+}
+
+
+STENCIL(j_self) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  LClosure *cl = ci_func(ci);
+  TValue *k = cl->p->k;
+  StkId ra = RA(i);
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rc);  /* key must be a string */
+  setobj2s(L, ra + 1, rb);
+  if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
+    setobj2s(L, ra, slot);
+  }
+  else {
+    savestate(L, ci);
+    luaV_finishget(L, rb, rc, ra, slot);
+  }
+  return 0;
+}
+
+
+/*
+** Arithmetic and bitwise operations return true when they succeed, so
+** that the native code skips the following metamethod instruction.
+** The three most common operations have their numeric fast paths
+** inlined; all others use 'luaO_rawarith', which computes exactly what
+** the interpreter computes. (The order of the opcodes matches the order
+** of the LUA_OP* operators.)
+*/
+
+STENCIL(j_addi) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *v1 = vRB(i);
+  int imm = GETARG_sC(i);
+  UNUSED(L);
+  if (ttisinteger(v1)) {
+    lua_Integer iv1 = ivalue(v1);
+    setivalue(s2v(RA(i)), intop(+, iv1, imm));
+    return 1;
+  }
+  else if (ttisfloat(v1)) {
+    lua_Number nb = fltvalue(v1);
+    setfltvalue(s2v(RA(i)), luai_numadd(L, nb, cast_num(imm)));
+    return 1;
+  }
+  return 0;
+}
+
+
+#define jit_arith(L,v1,v2,iop,fop) {  \
+  if (ttisinteger(v1) && ttisinteger(v2)) {  \
+    lua_Integer i1 = ivalue(v1); lua_Integer i2 = ivalue(v2);  \
+    setivalue(s2v(RA(i)), iop(L, i1, i2));  \
+    return 1;  \
+  }  \
+  else {  \
+    lua_Number n1; lua_Number n2;  \
+    if (tonumberns(v1, n1) && tonumberns(v2, n2)) {  \
+      setfltvalue(s2v(RA(i)), fop(L, n1, n2));  \
+      return 1;  \
+    }  \
+    return 0;  \
+  } }
+
+
+STENCIL(j_add) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  UNUSED(L);
+  jit_arith(L, vRB(i), vRC(i), l_addi, luai_numadd);
+}
+
+
+STENCIL(j_sub) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  UNUSED(L);
+  jit_arith(L, vRB(i), vRC(i), l_subi, luai_numsub);
+}
+
+
+STENCIL(j_mul) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  UNUSED(L);
+  jit_arith(L, vRB(i), vRC(i), l_muli, luai_nummul);
+}
+
+
+STENCIL(j_arith) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  int op = GET_BASEOPCODE(i) - OP_ADD + LUA_OPADD;
+  savestate(L, ci);  /* in case of division by 0 */
+  return luaO_rawarith(L, op, vRB(i), vRC(i), s2v(RA(i)));
+}
+
+
+STENCIL(j_arithK) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *k = ci_func(ci)->p->k;
+  int op = GET_BASEOPCODE(i) - OP_ADDK + LUA_OPADD;
+  savestate(L, ci);  /* in case of division by 0 */
+  return luaO_rawarith(L, op, vRB(i), KC(i), s2v(RA(i)));
+}
+
+
+STENCIL(j_shri) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  lua_Integer ib;
+  UNUSED(L);
+  if (tointegerns(vRB(i), &ib)) {
+    setivalue(s2v(RA(i)), luaV_shiftl(ib, -GETARG_sC(i)));
+    return 1;
+  }
+  return 0;
+}
+
+
+STENCIL(j_shli) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  lua_Integer ib;
+  UNUSED(L);
+  if (tointegerns(vRB(i), &ib)) {
+    setivalue(s2v(RA(i)), luaV_shiftl(GETARG_sC(i), ib));
+    return 1;
+  }
+  return 0;
+}
+
+
+STENCIL(j_mmbin) {
+  Instruction i = *pc;
+  Instruction pi = *(pc - 1);  /* original arith. expression */
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  luaT_trybinTM(L, s2v(RA(i)), vRB(i), RA(pi), (TMS)GETARG_C(i));
+  return 0;
+}
+
+
+STENCIL(j_mmbini) {
+  Instruction i = *pc;
+  Instruction pi = *(pc - 1);  /* original arith. expression */
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  luaT_trybiniTM(L, s2v(RA(i)), GETARG_sB(i), GETARG_k(i), RA(pi),
+                    (TMS)GETARG_C(i));
+  return 0;
+}
+
+
+STENCIL(j_mmbink) {
+  Instruction i = *pc;
+  Instruction pi = *(pc - 1);  /* original arith. expression */
+  StkId base = ci->func.p + 1;
+  TValue *k = ci_func(ci)->p->k;
+  savestate(L, ci);
+  luaT_trybinassocTM(L, s2v(RA(i)), KB(i), GETARG_k(i), RA(pi),
+                        (TMS)GETARG_C(i));
+  return 0;
+}
+
+
+STENCIL(j_unm) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  TValue *rb = vRB(i);
+  lua_Number nb;
+  if (ttisinteger(rb)) {
+    lua_Integer ib = ivalue(rb);
+    setivalue(s2v(ra), intop(-, 0, ib));
+  }
+  else if (tonumberns(rb, nb)) {
+    setfltvalue(s2v(ra), luai_numunm(L, nb));
+  }
+  else {
+    savestate(L, ci);
+    luaT_trybinTM(L, rb, rb, ra, TM_UNM);
+  }
+  return 0;
+}
+
+
+STENCIL(j_bnot) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  TValue *rb = vRB(i);
+  lua_Integer ib;
+  if (tointegerns(rb, &ib)) {
+    setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
+  }
+  else {
+    savestate(L, ci);
+    luaT_trybinTM(L, rb, rb, ra, TM_BNOT);
+  }
+  return 0;
+}
+
+
+STENCIL(j_not) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  UNUSED(L);
+  if (l_isfalse(vRB(i)))
+    setbtvalue(s2v(RA(i)));
+  else
+    setbfvalue(s2v(RA(i)));
+  return 0;
+}
+
+
+STENCIL(j_len) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  luaV_objlen(L, RA(i), vRB(i));
+  return 0;
+}
+
+
+STENCIL(j_concat) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  int n = GETARG_B(i);  /* number of elements to concatenate */
+  L->top.p = RA(i) + n;  /* mark the end of concat operands */
+  savepc(ci);
+  luaV_concat(L, n);
+  checkGC(L, L->top.p); /* 'luaV_concat' ensures correct top */
+  return 0;
+}
+
+
+STENCIL(j_close) {
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  luaF_close(L, RA(*pc), LUA_OK, 1);
+  return 0;
+}
+
+
+STENCIL(j_tbc) {
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  luaF_newtbcupval(L, RA(*pc));  /* create new to-be-closed upvalue */
+  return 0;
+}
+
+
+/*
+** Comparisons return true when the following jump must be skipped.
+*/
+
+STENCIL(j_eq) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  int cond;
+  savestate(L, ci);
+  cond = luaV_equalobj(L, s2v(RA(i)), vRB(i));
+  return (cond != GETARG_k(i));
+}
+
+
+STENCIL(j_lt) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *ra = s2v(RA(i));
+  TValue *rb = vRB(i);
+  int cond;
+  if (ttisinteger(ra) && ttisinteger(rb))
+    cond = (ivalue(ra) < ivalue(rb));
+  else {
+    savestate(L, ci);
+    cond = luaV_lessthan(L, ra, rb);
+  }
+  return (cond != GETARG_k(i));
+}
+
+
+STENCIL(j_le) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *ra = s2v(RA(i));
+  TValue *rb = vRB(i);
+  int cond;
+  if (ttisinteger(ra) && ttisinteger(rb))
+    cond = (ivalue(ra) <= ivalue(rb));
+  else {
+    savestate(L, ci);
+    cond = luaV_lessequal(L, ra, rb);
+  }
+  return (cond != GETARG_k(i));
+}
+
+
+STENCIL(j_eqk) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *k = ci_func(ci)->p->k;
+  /* basic types do not use '__eq'; we can use raw equality */
+  int cond = luaV_rawequalobj(s2v(RA(i)), KB(i));
+  UNUSED(L);
+  return (cond != GETARG_k(i));
+}
+
+
+STENCIL(j_eqi) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *ra = s2v(RA(i));
+  int im = GETARG_sB(i);
+  int cond;
+  UNUSED(L);
+  if (ttisinteger(ra))
+    cond = (ivalue(ra) == im);
+  else if (ttisfloat(ra))
+    cond = luai_numeq(fltvalue(ra), cast_num(im));
+  else
+    cond = 0;  /* other types cannot be equal to a number */
+  return (cond != GETARG_k(i));
+}
+
+
+/* order with an immediate operand (OP_LTI, OP_LEI, OP_GTI, OP_GEI) */
+STENCIL(j_orderI) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *ra = s2v(RA(i));
+  int im = GETARG_sB(i);
+  OpCode op = GET_BASEOPCODE(i);
+  int cond;
+  if (ttisinteger(ra) || ttisfloat(ra)) {
+    lua_Number fa;
+    lua_Number fim = cast_num(im);
+    if (ttisinteger(ra)) {
+      lua_Integer ia = ivalue(ra);
+      switch (op) {
+        case OP_LTI: cond = (ia < im); break;
+        case OP_LEI: cond = (ia <= im); break;
+        case OP_GTI: cond = (ia > im); break;
+        default: cond = (ia >= im); break;
+      }
+      return (cond != GETARG_k(i));
+    }
+    fa = fltvalue(ra);
+    switch (op) {
+      case OP_LTI: cond = luai_numlt(fa, fim); break;
+      case OP_LEI: cond = luai_numle(fa, fim); break;
+      case OP_GTI: cond = luai_numgt(fa, fim); break;
+      default: cond = luai_numge(fa, fim); break;
+    }
+  }
+  else {
+    int inv = (op == OP_GTI || op == OP_GEI);
+    TMS tm = (op == OP_LTI || op == OP_GTI) ? TM_LT : TM_LE;
+    savestate(L, ci);
+    cond = luaT_callorderiTM(L, ra, im, inv, GETARG_C(i), tm);
+  }
+  return (cond != GETARG_k(i));
+}
+
+
+STENCIL(j_test) {
+  StkId base = ci->func.p + 1;
+  int cond = !l_isfalse(s2v(RA(*pc)));
+  UNUSED(L);
+  return (cond != GETARG_k(*pc));
+}
+
+
+STENCIL(j_testset) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  TValue *rb = vRB(i);
+  if (l_isfalse(rb) == GETARG_k(i))
+    return 1;
+  setobj2s(L, RA(i), rb);
+  return 0;
+}
+
+
+/*
+** Calls and returns give the native code where execution continues:
+** NULL to go on with the next instruction (after calling a C function)
+** or to leave to the interpreter (for returns with active hooks), the
+** code of another compiled function (running its frame, now 'L->ci'),
+** or one of the exits of the current code.
+*/
+#define PSTENCIL(name)  \
+	static const void *name (lua_State *L, CallInfo *ci, \
+                                 const Instruction *pc)
+
+
+PSTENCIL(j_call) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  CallInfo *newci;
+  int b = GETARG_B(i);
+  if (b != 0)  /* fixed number of arguments? */
+    L->top.p = ra + b;  /* top signals number of arguments */
+  /* else previous instruction set top */
+  savepc(ci);  /* in case of errors */
+  if ((newci = luaD_precall(L, ra, GETARG_C(i) - 1)) == NULL)
+    return NULL;  /* C call; nothing else to be done */
+  else {
+    Proto *p = ci_func(newci)->p;
+    if (p->jit != NULL && !L->hookmask)  /* callee compiled? */
+      return p->jit->pcmap[0];
+    return ci_func(ci)->p->jit->newframe;  /* let the interpreter run it */
+  }
+}
+
+
+/* continue in the caller of 'ci', which has just returned */
+static const void *retcaller (CallInfo *ci, const JitCode *jc) {
+  if (ci->callstatus & CIST_FRESH)
+    return jc->retexit;  /* end this frame */
+  else {
+    CallInfo *caller = ci->previous;
+    Proto *p = ci_func(caller)->p;
+    if (p->jit != NULL)
+      return p->jit->pcmap[caller->u.l.savedpc - p->code];
+    return jc->newframe;
+  }
+}
+
+
+PSTENCIL(j_return0) {
+  StkId base = ci->func.p + 1;
+  const JitCode *jc = ci_func(ci)->p->jit;  /* function slot is reused */
+  int nres;
+  UNUSED(pc);
+  if (l_unlikely(L->hookmask))
+    return NULL;
+  L->ci = ci->previous;  /* back to caller */
+  L->top.p = base - 1;
+  for (nres = ci->nresults; l_unlikely(nres > 0); nres--)
+    setnilvalue(s2v(L->top.p++));  /* all results are nil */
+  return retcaller(ci, jc);
+}
+
+
+PSTENCIL(j_return1) {
+  StkId base = ci->func.p + 1;
+  const JitCode *jc = ci_func(ci)->p->jit;  /* function slot is reused */
+  int nres = ci->nresults;
+  if (l_unlikely(L->hookmask))
+    return NULL;
+  L->ci = ci->previous;  /* back to caller */
+  if (nres == 0)
+    L->top.p = base - 1;  /* asked for no results */
+  else {
+    setobjs2s(L, base - 1, RA(*pc));  /* at least this result */
+    L->top.p = base;
+    for (; l_unlikely(nres > 1); nres--)
+      setnilvalue(s2v(L->top.p++));  /* complete missing results */
+  }
+  return retcaller(ci, jc);
+}
+
+
+STENCIL(j_forloop) {
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(*pc);
+  UNUSED(L);
+  if (ttisinteger(s2v(ra + 2))) {  /* integer loop? */
+    lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
+    if (count > 0) {  /* still more iterations? */
+      lua_Integer step = ivalue(s2v(ra + 2));
+      lua_Integer idx = ivalue(s2v(ra));  /* internal index */
+      chgivalue(s2v(ra + 1), count - 1);  /* update counter */
+      idx = intop(+, idx, step);  /* add step to index */
+      chgivalue(s2v(ra), idx);  /* update internal index */
+      setivalue(s2v(ra + 3), idx);  /* and control variable */
+      return 1;  /* jump back */
+    }
+    return 0;
+  }
+  else
+    return luaV_floatforloop(ra);
+}
+
+
+/* returns true to skip the loop */
+STENCIL(j_forprep) {
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);  /* in case of errors */
+  return luaV_forprep(L, RA(*pc));
+}
+
+
+STENCIL(j_tforprep) {
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  /* create to-be-closed upvalue (if needed) */
+  luaF_newtbcupval(L, RA(*pc) + 3);
+  return 0;
+}
+
+
+STENCIL(j_tforcall) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  /* push function, state, and control variable */
+  memcpy(ra + 4, ra, 3 * sizeof(*ra));
+  L->top.p = ra + 4 + 3;
+  savepc(ci);
+  luaD_call(L, ra + 4, GETARG_C(i));  /* do the call */
+  return 0;
+}
+
+
+STENCIL(j_tforloop) {
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(*pc);
+  UNUSED(L);
+  if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
+    setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
+    return 1;  /* jump back */
+  }
+  return 0;
+}
+
+
+STENCIL(j_setlist) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  StkId ra = RA(i);
+  int n = GETARG_B(i);
+  unsigned int last = GETARG_C(i);
+  Table *h = hvalue(s2v(ra));
+  if (n == 0)
+    n = cast_int(L->top.p - ra) - 1;  /* get up to the top */
+  else
+    L->top.p = ci->top.p;  /* correct top in case of emergency GC */
+  last += n;
+  if (TESTARG_k(i))
+    last += GETARG_Ax(pc[1]) * (MAXARG_C + 1);
+  savepc(ci);
+  if (last > luaH_realasize(h))  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* preallocate it at once */
+  for (; n > 0; n--) {
+    TValue *val = s2v(ra + n);
+    setobj2t(L, &h->array[last - 1], val);
+    last--;
+    luaC_barrierback(L, obj2gco(h), val);
+  }
+  return 0;
+}
+
+
+STENCIL(j_closure) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  LClosure *cl = ci_func(ci);
+  StkId ra = RA(i);
+  savestate(L, ci);
+  luaV_pushclosure(L, cl->p->p[GETARG_Bx(i)], cl->upvals, base, ra);
+  checkGC(L, ra + 1);
+  return 0;
+}
+
+
+STENCIL(j_vararg) {
+  Instruction i = *pc;
+  StkId base = ci->func.p + 1;
+  savestate(L, ci);
+  luaT_getvarargs(L, ci, RA(i), GETARG_C(i) - 1);
+  return 0;
+}
+
+
+STENCIL(j_varargprep) {
+  savepc(ci);
+  luaT_adjustvarargs(L, GETARG_A(*pc), ci, ci_func(ci)->p);
+  return 0;
+}
+
+
+/*
+** Called by the native code when the 'trap' of the running function is
+** set. Without line or count hooks, the trap only signals a stack
+** reallocation (which native code handles by itself), so it is cleared
+** and the native code continues at instruction 'idx'. Otherwise, returns
+** NULL and the interpreter continues from there.
+*/
+const void *luaJ_trap (lua_State *L, int idx) {
+  CallInfo *ci = L->ci;
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
+    return NULL;
+  ci->u.l.trap = 0;
+  return ci_func(ci)->p->jit->pcmap[idx];
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Code generation
+** ===================================================================
+*/
+
+/*
+** Upper limits for the code of one instruction (with its trap check and
+** its stub) and for the code shared by all instructions.
+*/
+#define MAXINSTCODE	320
+#define MAXFIXEDCODE	128
+
+
+typedef struct JitState {
+  lu_byte *code;  /* start of the code area */
+  lu_byte *p;  /* current position */
+  lu_byte *limit;  /* end of the code area */
+  const void **pcmap;
+  lu_byte *target;  /* true for instructions that are targets of jumps */
+  lu_byte *epilogue;
+  lu_byte *trapexit;  /* shared exit for traps */
+  lu_byte *newframe;  /* exit returning JITNEWFRAME */
+  lu_byte *retexit;  /* exit returning JITRETURN */
+  lu_byte *stubs;  /* per-instruction entries to 'trapexit' */
+  int prevcall;  /* true if previous instruction called a stencil */
+} JitState;
+
+
+/* size of the per-instruction stubs (mov r13d, idx; jmp trapexit) */
+#define STUBSIZE	11
+
+
+static void emitbytes (JitState *J, const char *b, size_t n) {
+  if (J->p + n <= J->limit)
+    memcpy(J->p, b, n);
+  J->p += n;
+}
+
+
+static void emit8 (JitState *J, int b) {
+  if (J->p < J->limit)
+    *J->p = cast_byte(b);
+  J->p++;
+}
+
+
+static void emit32 (JitState *J, l_uint32 v) {
+  emitbytes(J, cast_charp(&v), sizeof(v));
+}
+
+
+/* 64-bit immediate (addresses and values; 'size_t' has 64 bits here) */
+static void emit64 (JitState *J, size_t v) {
+  emitbytes(J, cast_charp(&v), sizeof(v));
+}
+
+
+/* 'rel32' for a jump whose displacement ends at the current position */
+static void emitrel (JitState *J, const void *target) {
+  emit32(J, cast(l_uint32, cast_sizet(target) - cast_sizet(J->p + 4)));
+}
+
+
+/* jmp rel32 */
+static void emitjmp (JitState *J, const void *target) {
+  emit8(J, 0xE9);
+  emitrel(J, target);
+}
+
+
+/* condition codes (negate a condition flipping its lowest bit) */
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+
+/* jcc rel32 */
+static void emitjcc (JitState *J, int cc, const void *target) {
+  emit8(J, 0x0F); emit8(J, 0x80 | cc);
+  emitrel(J, target);
+}
+
+
+/*
+** jcc rel32 to a label later in the same instruction; returns the
+** displacement to be fixed by 'patchhere' at that label.
+*/
+static lu_byte *emitjccfwd (JitState *J, int cc) {
+  emit8(J, 0x0F); emit8(J, 0x80 | cc);
+  emit32(J, 0);
+  return J->p - 4;
+}
+
+
+static void patchhere (JitState *J, lu_byte *rel) {
+  if (J->p <= J->limit) {
+    l_uint32 d = cast(l_uint32, J->p - (rel + 4));
+    memcpy(rel, &d, sizeof(d));
+  }
+}
+
+
+/* mov r12, [r14 + ci->func]; add r12, sizeof(StackValue) */
+static void emitloadbase (JitState *J) {
+  emitbytes(J, "\x4D\x8B\xA6", 3);
+  emit32(J, cast(l_uint32, offsetof(CallInfo, func)));
+  emitbytes(J, "\x49\x83\xC4", 3);
+  emit8(J, sizeof(StackValue));
+}
+
+
+/* call stencil 'st(L, ci, pc)' and reload the base */
+static void emitstencil (JitState *J, size_t st, const Instruction *pc) {
+  emitbytes(J, "\x48\x89\xDF", 3);  /* mov rdi, rbx */
+  emitbytes(J, "\x4C\x89\xF6", 3);  /* mov rsi, r14 */
+  emitbytes(J, "\x48\xBA", 2);  /* mov rdx, imm64 */
+  emit64(J, cast_sizet(pc));
+  emitbytes(J, "\x48\xB8", 2);  /* mov rax, imm64 */
+  emit64(J, st);
+  emitbytes(J, "\xFF\xD0", 2);  /* call rax */
+  emitloadbase(J);
+  J->prevcall = 1;
+}
+
+
+/*
+** After a call or return stencil: if it returned some code, load the
+** new frame ('L->ci') and jump there.
+*/
+static void emitgoframe (JitState *J) {
+  emitbytes(J, "\x48\x85\xC0", 3);  /* test rax, rax */
+  emitbytes(J, "\x74\x14", 2);  /* jz +20 */
+  emitbytes(J, "\x4C\x8B\xB3", 3);  /* mov r14, [rbx + L->ci] */
+  emit32(J, cast(l_uint32, offsetof(lua_State, ci)));
+  emitloadbase(J);
+  emitbytes(J, "\xFF\xE0", 2);  /* jmp rax */
+}
+
+
+/* mov eax, n; jmp epilogue */
+static void emitexit (JitState *J, int n) {
+  emit8(J, 0xB8);
+  emit32(J, cast(l_uint32, n));
+  emitjmp(J, J->epilogue);
+}
+
+
+/* displacement of the value and of the tag of register 'r' */
+#define valoff(r)	cast(l_uint32, (r) * sizeof(StackValue))
+#define tagoff(r)	cast(l_uint32, (r) * sizeof(StackValue) + \
+                                       offsetof(TValue, tt_))
+
+
+/* ModRM and SIB for [r12 + disp32], with 'reg' in the ModRM */
+static void emitr12 (JitState *J, int reg, l_uint32 disp) {
+  emit8(J, 0x84 | ((reg & 7) << 3));
+  emit8(J, 0x24);
+  emit32(J, disp);
+}
+
+
+/* R[a] := R[b] */
+static void emitmove (JitState *J, int a, int b) {
+  emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(b));  /* mov rax, ... */
+  emitbytes(J, "\x49\x89", 2); emitr12(J, 0, valoff(a));  /* mov ..., rax */
+  emitbytes(J, "\x41\x0F\xB6", 3); emitr12(J, 1, tagoff(b));  /* movzx ecx */
+  emitbytes(J, "\x41\x88", 2); emitr12(J, 1, tagoff(a));  /* mov ..., cl */
+}
+
+
+/* R[a] := tag 'tt' (for values without contents) */
+static void emitloadtag (JitState *J, int a, int tt) {
+  emitbytes(J, "\x41\xC6", 2); emitr12(J, 0, tagoff(a));  /* mov ..., imm8 */
+  emit8(J, tt);
+}
+
+
+/* R[a] := value 'v' with tag 'tt' */
+static void emitloadval (JitState *J, int a, size_t v, int tt) {
+  emitbytes(J, "\x48\xB8", 2); emit64(J, v);  /* mov rax, imm64 */
+  emitbytes(J, "\x49\x89", 2); emitr12(J, 0, valoff(a));  /* mov ..., rax */
+  emitloadtag(J, a, tt);
+}
+
+
+/* R[a] := *rax */
+static void emitloadrax (JitState *J, int a) {
+  emitbytes(J, "\x48\x8B\x08", 3);  /* mov rcx, [rax] */
+  emitbytes(J, "\x49\x89", 2); emitr12(J, 1, valoff(a));  /* mov ..., rcx */
+  emitbytes(J, "\x0F\xB6\x48", 3);  /* movzx ecx, byte [rax + tt_] */
+  emit8(J, offsetof(TValue, tt_));
+  emitbytes(J, "\x41\x88", 2); emitr12(J, 1, tagoff(a));  /* mov ..., cl */
+}
+
+
+/* R[a] := *o */
+static void emitloadk (JitState *J, int a, const TValue *o) {
+  emitbytes(J, "\x48\xB8", 2); emit64(J, cast_sizet(o));  /* mov rax, imm64 */
+  emitloadrax(J, a);
+}
+
+
+/* R[a] := UpValue[b] */
+static void emitgetupval (JitState *J, int a, int b) {
+  /* mov rax, [r12 - 1] (the closure) */
+  emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(-1));
+  emitbytes(J, "\x48\x8B\x80", 3);  /* mov rax, [rax + upvals[b]] */
+  emit32(J, cast(l_uint32, offsetof(LClosure, upvals) + b * sizeof(UpVal *)));
+  emitbytes(J, "\x48\x8B\x80", 3);  /* mov rax, [rax + v] */
+  emit32(J, cast(l_uint32, offsetof(UpVal, v)));
+  emitloadrax(J, a);
+}
+
+
+/* jump to the returned label if R[r] is not an integer */
+static lu_byte *emitcheckint (JitState *J, int r) {
+  emitbytes(J, "\x41\x80", 2); emitr12(J, 7, tagoff(r));  /* cmp ..., imm8 */
+  emit8(J, LUA_VNUMINT);
+  return emitjccfwd(J, CC_NE);
+}
+
+
+/*
+** xmm'x' := R[r] converted to a float; jumps to the returned label if
+** R[r] is not a number. (The short jumps skip 30 and 10 bytes.)
+*/
+static lu_byte *emitloadflt (JitState *J, int x, int r) {
+  lu_byte *slow;
+  emitbytes(J, "\x41\x80", 2); emitr12(J, 7, tagoff(r));  /* cmp ..., imm8 */
+  emit8(J, LUA_VNUMFLT);
+  emitbytes(J, "\x74\x1E", 2);  /* je +30 */
+  slow = emitcheckint(J, r);
+  /* xorps xmm'x', xmm'x' (so that 'cvtsi2sd' does not wait for it) */
+  emitbytes(J, "\x0F\x57", 2); emit8(J, 0xC0 | (x << 3) | x);
+  emitbytes(J, "\xF2\x49\x0F\x2A", 4); emitr12(J, x, valoff(r));  /* cvtsi2sd */
+  emitbytes(J, "\xEB\x0A", 2);  /* jmp +10 */
+  emitbytes(J, "\xF2\x41\x0F\x10", 4); emitr12(J, x, valoff(r));  /* movsd */
+  return slow;
+}
+
+
+/* R[a] := rax (integer) */
+static void emitstoreint (JitState *J, int a) {
+  emitbytes(J, "\x49\x89", 2); emitr12(J, 0, valoff(a));  /* mov ..., rax */
+  emitloadtag(J, a, LUA_VNUMINT);
+}
+
+
+/* true if integer 'v' fits in a (sign-extended) 32-bit immediate */
+#define fitsimm32(v)	((v) >= -2147483647 - 1 && (v) <= 2147483647)
+
+
+/* operations between rax and an integer register or an immediate */
+typedef enum { AADD, ASUB, AMUL } ArithOp;
+
+static void emitopreg (JitState *J, ArithOp op, int r) {
+  switch (op) {
+    case AADD: emitbytes(J, "\x49\x03", 2); break;  /* add rax, ... */
+    case ASUB: emitbytes(J, "\x49\x2B", 2); break;  /* sub rax, ... */
+    case AMUL: emitbytes(J, "\x49\x0F\xAF", 3); break;  /* imul rax, ... */
+  }
+  emitr12(J, 0, valoff(r));
+}
+
+
+static void emitopimm (JitState *J, ArithOp op, lua_Integer v) {
+  if (fitsimm32(v)) {
+    switch (op) {
+      case AADD: emitbytes(J, "\x48\x05", 2); break;  /* add rax, imm32 */
+      case ASUB: emitbytes(J, "\x48\x2D", 2); break;  /* sub rax, imm32 */
+      case AMUL: emitbytes(J, "\x48\x69\xC0", 3); break;  /* imul rax, imm */
+    }
+    emit32(J, cast(l_uint32, v));
+  }
+  else {
+    emitbytes(J, "\x48\xB9", 2); emit64(J, l_castS2U(v));  /* mov rcx, imm */
+    switch (op) {
+      case AADD: emitbytes(J, "\x48\x01\xC8", 3); break;  /* add rax, rcx */
+      case ASUB: emitbytes(J, "\x48\x29\xC8", 3); break;  /* sub rax, rcx */
+      case AMUL: emitbytes(J, "\x48\x0F\xAF\xC1", 4); break;  /* imul */
+    }
+  }
+}
+
+
+/*
+** Conditional jump for a comparison whose condition (when true) is 'cc':
+** skip the following jump when the condition is different from 'k'.
+*/
+static void emitcondjump (JitState *J, int cc, int k, int n) {
+  emitjcc(J, k ? (cc ^ 1) : cc, J->pcmap[n + 2]);
+  emitjmp(J, J->pcmap[n + 1]);
+}
+
+
+/*
+** Code shared by all instructions: the entry (which saves registers,
+** loads the state, and jumps to the start instruction), the exits,
+** and the stubs for traps.
+*/
+static void emitfixed (JitState *J, int ninst) {
+  int n;
+  /* entry: (L, ci, start) */
+  emit8(J, 0x53);  /* push rbx */
+  emitbytes(J, "\x41\x54\x41\x55\x41\x56\x41\x57", 8);  /* push r12-r15 */
+  emitbytes(J, "\x48\x89\xFB", 3);  /* mov rbx, rdi */
+  emitbytes(J, "\x49\x89\xF6", 3);  /* mov r14, rsi */
+  emitloadbase(J);
+  emitbytes(J, "\xFF\xE2", 2);  /* jmp rdx */
+  J->epilogue = J->p;
+  emitbytes(J, "\x41\x5F\x41\x5E\x41\x5D\x41\x5C", 8);  /* pop r15-r12 */
+  emit8(J, 0x5B);  /* pop rbx */
+  emit8(J, 0xC3);  /* ret */
+  J->newframe = J->p;
+  emitexit(J, JITNEWFRAME);
+  J->retexit = J->p;
+  emitexit(J, JITRETURN);
+  J->trapexit = J->p;
+  emitbytes(J, "\x48\x89\xDF", 3);  /* mov rdi, rbx */
+  emitbytes(J, "\x44\x89\xEE", 3);  /* mov esi, r13d */
+  emitbytes(J, "\x48\xB8", 2);  /* mov rax, imm64 */
+  emit64(J, cast_sizet(&luaJ_trap));
+  emitbytes(J, "\xFF\xD0", 2);  /* call rax */
+  emitbytes(J, "\x48\x85\xC0", 3);  /* test rax, rax */
+  emitbytes(J, "\x74\x02", 2);  /* jz +2 */
+  emitbytes(J, "\xFF\xE0", 2);  /* jmp rax */
+  emitbytes(J, "\x44\x89\xE8", 3);  /* mov eax, r13d */
+  emitjmp(J, J->epilogue);
+  J->stubs = J->p;
+  for (n = 0; n < ninst; n++) {
+    emitbytes(J, "\x41\xBD", 2);  /* mov r13d, imm32 */
+    emit32(J, cast(l_uint32, n));
+    emitjmp(J, J->trapexit);
+  }
+}
+
+
+/* kind of control flow of each instruction */
+typedef enum {
+  JNONE,  /* fall through */
+  JSKIP,  /* skip next instruction when stencil returns true */
+  JLOOP,  /* jump back when stencil returns true */
+  JPREP,  /* skip loop when stencil returns true */
+  JGOTO,  /* always jump after the stencil */
+  JCALL,  /* continue in the code returned by the stencil, if any */
+  JRET,  /* idem, or leave native code if there is none */
+  JEXIT   /* leave native code before the instruction */
+} JitKind;
+
+
+/* returns the kind of instruction 'n' and its jump target */
+static JitKind getkind (const Proto *p, int n, int *target) {
+  Instruction i = p->code[n];
+  *target = n + 2;
+  switch (GET_BASEOPCODE(i)) {
+    case OP_JMP: *target = n + 1 + GETARG_sJ(i); return JGOTO;
+    case OP_LFALSESKIP: return JGOTO;
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK:
+    case OP_BORK: case OP_BXORK: case OP_SHRI: case OP_SHLI:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_EQK: case OP_EQI:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+    case OP_TEST: case OP_TESTSET:
+      return JSKIP;
+    case OP_CALL: return JCALL;
+    case OP_RETURN0: case OP_RETURN1: return JRET;
+    case OP_TAILCALL: case OP_RETURN: return JEXIT;
+    case OP_FORLOOP: case OP_TFORLOOP:
+      *target = n + 1 - GETARG_Bx(i); return JLOOP;
+    case OP_FORPREP: *target = n + GETARG_Bx(i) + 2; return JPREP;
+    case OP_TFORPREP: *target = n + GETARG_Bx(i) + 1; return JGOTO;
+    default: return JNONE;
+  }
+}
+
+
+/*
+** Mark the instructions that are targets of jumps, which must check
+** the trap. (All others only check it after a stencil, which is
+** when it can change.)
+*/
+static void marktargets (JitState *J, const Proto *p) {
+  int n, target;
+  memset(J->target, 0, p->sizecode);
+  for (n = 0; n < p->sizecode; n++) {
+    switch (getkind(p, n, &target)) {
+      case JSKIP: J->target[n + 1] = 1;  /* FALLTHROUGH */
+      case JLOOP: case JPREP: case JGOTO: J->target[target] = 1; break;
+      default: break;
+    }
+  }
+}
+
+
+/* integer fast paths for arithmetic (jumping over the metamethod) */
+static void emitfastarith (JitState *J, const Proto *p, int n) {
+  Instruction i = p->code[n];
+  int a = GETARG_A(i), b = GETARG_B(i);
+  lu_byte *slow1, *slow2 = NULL;
+  slow1 = emitcheckint(J, b);
+  switch (GET_BASEOPCODE(i)) {
+    case OP_ADD: case OP_SUB: case OP_MUL: {
+      OpCode op = GET_BASEOPCODE(i);
+      slow2 = emitcheckint(J, GETARG_C(i));
+      emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(b));  /* mov rax */
+      emitopreg(J, op == OP_ADD ? AADD : op == OP_SUB ? ASUB : AMUL,
+                   GETARG_C(i));
+      break;
+    }
+    case OP_ADDI: {
+      emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(b));  /* mov rax */
+      emitopimm(J, AADD, GETARG_sC(i));
+      break;
+    }
+    default: {  /* OP_ADDK, OP_SUBK, OP_MULK with an integer constant */
+      OpCode op = GET_BASEOPCODE(i);
+      emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(b));  /* mov rax */
+      emitopimm(J, op == OP_ADDK ? AADD : op == OP_SUBK ? ASUB : AMUL,
+                   ivalue(p->k + GETARG_C(i)));
+      break;
+    }
+  }
+  emitstoreint(J, a);
+  emitjmp(J, J->pcmap[n + 2]);
+  patchhere(J, slow1);
+  if (slow2) patchhere(J, slow2);
+}
+
+
+/*
+** Float fast paths for the arithmetic operations that are plain SSE
+** instructions, after the integer ones: the operands are converted to
+** floats exactly as 'luai_num*' get them. Constant operands are
+** converted when compiling.
+*/
+static void emitfastfltarith (JitState *J, const Proto *p, int n) {
+  Instruction i = p->code[n];
+  OpCode op = GET_BASEOPCODE(i);
+  int a = GETARG_A(i);
+  lu_byte *slow1, *slow2 = NULL;
+  int sseop;
+  switch (op) {
+    case OP_ADD: case OP_ADDK: case OP_ADDI: sseop = 0x58; break;
+    case OP_SUB: case OP_SUBK: sseop = 0x5C; break;
+    case OP_MUL: case OP_MULK: sseop = 0x59; break;
+    default: sseop = 0x5E; break;  /* OP_DIV, OP_DIVK */
+  }
+  slow1 = emitloadflt(J, 0, GETARG_B(i));
+  if (op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV)
+    slow2 = emitloadflt(J, 1, GETARG_C(i));
+  else {
+    const TValue *o = p->k + GETARG_C(i);  /* a number (if not OP_ADDI) */
+    lua_Number k;
+    size_t v;
+    if (op == OP_ADDI)
+      k = cast_num(GETARG_sC(i));
+    else
+      k = ttisinteger(o) ? cast_num(ivalue(o)) : fltvalue(o);
+    memcpy(&v, &k, sizeof(v));
+    emitbytes(J, "\x48\xB9", 2); emit64(J, v);  /* mov rcx, imm64 */
+    emitbytes(J, "\x66\x48\x0F\x6E\xC9", 5);  /* movq xmm1, rcx */
+  }
+  emitbytes(J, "\xF2\x0F", 2); emit8(J, sseop);  /* addsd, ... */
+  emit8(J, 0xC1);  /* xmm0, xmm1 */
+  emitbytes(J, "\xF2\x41\x0F\x11", 4); emitr12(J, 0, valoff(a));  /* movsd */
+  emitloadtag(J, a, LUA_VNUMFLT);
+  emitjmp(J, J->pcmap[n + 2]);
+  patchhere(J, slow1);
+  if (slow2) patchhere(J, slow2);
+}
+
+
+/* integer fast paths for comparisons */
+static void emitfastorder (JitState *J, const Proto *p, int n) {
+  Instruction i = p->code[n];
+  OpCode op = GET_BASEOPCODE(i);
+  int a = GETARG_A(i);
+  lu_byte *slow1, *slow2 = NULL;
+  int cc;
+  slow1 = emitcheckint(J, a);
+  if (op == OP_EQ || op == OP_LT || op == OP_LE) {
+    slow2 = emitcheckint(J, GETARG_B(i));
+    emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(a));  /* mov rax */
+    emitbytes(J, "\x49\x3B", 2); emitr12(J, 0, valoff(GETARG_B(i)));  /* cmp */
+    cc = (op == OP_EQ) ? CC_E : (op == OP_LT) ? CC_L : CC_LE;
+  }
+  else {
+    lua_Integer im = (op == OP_EQK) ? ivalue(p->k + GETARG_B(i))
+                                    : GETARG_sB(i);
+    emitbytes(J, "\x49\x81", 2); emitr12(J, 7, valoff(a));  /* cmp ..., imm */
+    emit32(J, cast(l_uint32, im));
+    switch (op) {
+      case OP_LTI: cc = CC_L; break;
+      case OP_LEI: cc = CC_LE; break;
+      case OP_GTI: cc = CC_G; break;
+      case OP_GEI: cc = CC_GE; break;
+      default: cc = CC_E; break;  /* OP_EQI, OP_EQK */
+    }
+  }
+  emitcondjump(J, cc, GETARG_k(i), n);
+  patchhere(J, slow1);
+  if (slow2) patchhere(J, slow2);
+}
+
+
+/* OP_TEST, which needs no stencil */
+static void emittest (JitState *J, Instruction i, int n) {
+  int k = GETARG_k(i);
+  const void *iffalse = J->pcmap[k ? n + 2 : n + 1];
+  /* movzx eax, byte [tag]; cmp eax, LUA_VFALSE */
+  emitbytes(J, "\x41\x0F\xB6", 3); emitr12(J, 0, tagoff(GETARG_A(i)));
+  emitbytes(J, "\x83\xF8", 2); emit8(J, LUA_VFALSE);
+  emitjcc(J, CC_E, iffalse);
+  emitbytes(J, "\xA8\x0F", 2);  /* test al, 0x0F (nil has type 0) */
+  emitjcc(J, CC_E, iffalse);
+  emitjmp(J, J->pcmap[k ? n + 1 : n + 2]);
+}
+
+
+/* integer loop step of OP_FORLOOP; returns the label of the loop end */
+static lu_byte *emitfastforloop (JitState *J, int a, int target) {
+  lu_byte *slow = emitcheckint(J, a + 2);
+  lu_byte *done;
+  emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(a + 1));  /* mov rax */
+  emitbytes(J, "\x48\x85\xC0", 3);  /* test rax, rax (counter) */
+  done = emitjccfwd(J, CC_E);
+  emitbytes(J, "\x48\xFF\xC8", 3);  /* dec rax */
+  emitbytes(J, "\x49\x89", 2); emitr12(J, 0, valoff(a + 1));  /* mov ..., rax */
+  emitbytes(J, "\x49\x8B", 2); emitr12(J, 0, valoff(a));  /* mov rax, idx */
+  emitopreg(J, AADD, a + 2);  /* add step */
+  emitbytes(J, "\x49\x89", 2); emitr12(J, 0, valoff(a));  /* mov ..., rax */
+  emitstoreint(J, a + 3);  /* control variable */
+  emitjmp(J, J->pcmap[target]);
+  patchhere(J, slow);
+  return done;
+}
+
+
+/* stencil for each opcode */
+static size_t getstencil (OpCode op) {
+  switch (op) {
+    case OP_LOADKX: return cast_sizet(j_loadkx);
+    case OP_LFALSESKIP: return cast_sizet(j_lfalseskip);
+    case OP_LOADNIL: return cast_sizet(j_loadnil);
+    case OP_SETUPVAL: return cast_sizet(j_setupval);
+    case OP_GETTABUP: return cast_sizet(j_gettabup);
+    case OP_GETTABLE: return cast_sizet(j_gettable);
+    case OP_GETI: return cast_sizet(j_geti);
+    case OP_GETFIELD: return cast_sizet(j_getfield);
+    case OP_SETTABUP: return cast_sizet(j_settabup);
+    case OP_SETTABLE: return cast_sizet(j_settable);
+    case OP_SETI: return cast_sizet(j_seti);
+    case OP_SETFIELD: return cast_sizet(j_setfield);
+    case OP_NEWTABLE: return cast_sizet(j_newtable);
+    case OP_SELF: return cast_sizet(j_self);
+    case OP_ADDI: return cast_sizet(j_addi);
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK:
+      return cast_sizet(j_arithK);
+    case OP_SHRI: return cast_sizet(j_shri);
+    case OP_SHLI: return cast_sizet(j_shli);
+    case OP_ADD: return cast_sizet(j_add);
+    case OP_SUB: return cast_sizet(j_sub);
+    case OP_MUL: return cast_sizet(j_mul);
+    case OP_MMBIN: return cast_sizet(j_mmbin);
+    case OP_MMBINI: return cast_sizet(j_mmbini);
+    case OP_MMBINK: return cast_sizet(j_mmbink);
+    case OP_UNM: return cast_sizet(j_unm);
+    case OP_BNOT: return cast_sizet(j_bnot);
+    case OP_NOT: return cast_sizet(j_not);
+    case OP_LEN: return cast_sizet(j_len);
+    case OP_CONCAT: return cast_sizet(j_concat);
+    case OP_CLOSE: return cast_sizet(j_close);
+    case OP_TBC: return cast_sizet(j_tbc);
+    case OP_EQ: return cast_sizet(j_eq);
+    case OP_LT: return cast_sizet(j_lt);
+    case OP_LE: return cast_sizet(j_le);
+    case OP_EQK: return cast_sizet(j_eqk);
+    case OP_EQI: return cast_sizet(j_eqi);
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      return cast_sizet(j_orderI);
+    case OP_TEST: return cast_sizet(j_test);
+    case OP_TESTSET: return cast_sizet(j_testset);
+    case OP_CALL: return cast_sizet(j_call);
+    case OP_RETURN0: return cast_sizet(j_return0);
+    case OP_RETURN1: return cast_sizet(j_return1);
+    case OP_FORLOOP: return cast_sizet(j_forloop);
+    case OP_FORPREP: return cast_sizet(j_forprep);
+    case OP_TFORPREP: return cast_sizet(j_tforprep);
+    case OP_TFORCALL: return cast_sizet(j_tforcall);
+    case OP_TFORLOOP: return cast_sizet(j_tforloop);
+    case OP_SETLIST: return cast_sizet(j_setlist);
+    case OP_CLOSURE: return cast_sizet(j_closure);
+    case OP_VARARG: return cast_sizet(j_vararg);
+    case OP_VARARGPREP: return cast_sizet(j_varargprep);
+    default: return cast_sizet(j_arith);  /* other arithmetic operations */
+  }
+}
+
+
+/* true if constant 'o' is an integer fitting in a 32-bit immediate */
+#define isimm32(o)	(ttisinteger(o) && fitsimm32(ivalue(o)))
+
+
+/*
+** Write the code of instruction 'n'. Jumps use 'J->pcmap', which
+** holds the final addresses only in the second pass.
+*/
+static void emitinst (JitState *J, const Proto *p, int n) {
+  const Instruction *pc = p->code + n;
+  Instruction i = *pc;
+  OpCode op = GET_BASEOPCODE(i);
+  lu_byte *done = NULL;
+  int target;
+  JitKind kind = getkind(p, n, &target);
+  if (op == OP_EXTRAARG)
+    return;  /* consumed by the previous instruction */
+  if (J->target[n] || J->prevcall) {  /* check the trap */
+    emitbytes(J, "\x41\x83\xBE", 3);  /* cmp dword [r14 + trap], 0 */
+    emit32(J, cast(l_uint32, offsetof(CallInfo, u.l.trap)));
+    emit8(J, 0);
+    emitjcc(J, CC_NE, J->stubs + n * STUBSIZE);
+  }
+  J->prevcall = 0;
+  switch (op) {  /* instructions written directly */
+    case OP_MOVE: emitmove(J, GETARG_A(i), GETARG_B(i)); return;
+    case OP_LOADI: {
+      emitloadval(J, GETARG_A(i), l_castS2U(GETARG_sBx(i)), LUA_VNUMINT);
+      return;
+    }
+    case OP_LOADF: {
+      lua_Number f = cast_num(GETARG_sBx(i));
+      size_t v;
+      memcpy(&v, &f, sizeof(v));
+      emitloadval(J, GETARG_A(i), v, LUA_VNUMFLT);
+      return;
+    }
+    case OP_LOADK: emitloadk(J, GETARG_A(i), p->k + GETARG_Bx(i)); return;
+    case OP_LOADFALSE: emitloadtag(J, GETARG_A(i), LUA_VFALSE); return;
+    case OP_LOADTRUE: emitloadtag(J, GETARG_A(i), LUA_VTRUE); return;
+    case OP_GETUPVAL: emitgetupval(J, GETARG_A(i), GETARG_B(i)); return;
+    case OP_JMP: emitjmp(J, J->pcmap[target]); return;
+    case OP_TEST: emittest(J, i, n); return;
+    case OP_TAILCALL: case OP_RETURN: emitexit(J, n); return;
+    /* instructions with a fast path before the stencil */
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_ADDI:
+      emitfastarith(J, p, n);
+      emitfastfltarith(J, p, n);
+      break;
+    case OP_ADDK: case OP_SUBK: case OP_MULK:
+      if (ttisinteger(p->k + GETARG_C(i)))
+        emitfastarith(J, p, n);
+      emitfastfltarith(J, p, n);
+      break;
+    case OP_DIV: case OP_DIVK: emitfastfltarith(J, p, n); break;
+    case OP_EQ: case OP_LT: case OP_LE:
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      emitfastorder(J, p, n);
+      break;
+    case OP_EQK:
+      if (isimm32(p->k + GETARG_B(i)))
+        emitfastorder(J, p, n);
+      break;
+    case OP_FORLOOP:
+      done = emitfastforloop(J, GETARG_A(i), target);
+      break;
+    default: break;
+  }
+  emitstencil(J, getstencil(op), pc);
+  switch (kind) {
+    case JSKIP: case JLOOP: case JPREP:
+      emitbytes(J, "\x85\xC0", 2);  /* test eax, eax */
+      emitjcc(J, CC_NE, J->pcmap[target]);
+      break;
+    case JGOTO:
+      emitjmp(J, J->pcmap[target]);
+      break;
+    case JCALL:
+      emitgoframe(J);
+      break;
+    case JRET:
+      emitgoframe(J);
+      emitexit(J, n);  /* let the interpreter return */
+      break;
+    default: break;
+  }
+  if (done)
+    patchhere(J, done);
+}
+
+
+/*
+** Write all the code of prototype 'p'. Sizes of instructions do not
+** depend on the addresses of their targets, so a first pass computes
+** 'pcmap' and a second pass writes the final jumps.
+*/
+static void emitcode (JitState *J, const Proto *p) {
+  int n;
+  J->p = J->code;
+  J->prevcall = 0;
+  emitfixed(J, p->sizecode);
+  for (n = 0; n < p->sizecode; n++) {
+    J->pcmap[n] = J->p;
+    emitinst(J, p, n);
+  }
+}
+
+
+int luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  JitCode *jc;
+  size_t page = cast_sizet(sysconf(_SC_PAGESIZE));
+  size_t size = sizeof(JitCode) + p->sizecode * (sizeof(void *) + 1) +
+                p->sizecode * MAXINSTCODE + MAXFIXEDCODE;
+  void *m;
+  UNUSED(L);
+  if (p->jit != NULL)
+    return 1;  /* already compiled */
+  size = (size + page - 1) & ~(page - 1);
+  m = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED) {
+    p->jitcount = JITNEVER;
+    return 0;
+  }
+  jc = cast(JitCode *, m);
+  jc->size = size;
+  jc->pcmap = cast(const void **, jc + 1);
+  J.pcmap = jc->pcmap;
+  J.target = cast(lu_byte *, J.pcmap + p->sizecode);
+  J.code = J.target + p->sizecode;
+  J.limit = cast(lu_byte *, m) + size;
+  marktargets(&J, p);
+  emitcode(&J, p);  /* first pass: compute addresses */
+  emitcode(&J, p);  /* second pass: final code */
+  jc->entry = cast(int (*) (lua_State *, CallInfo *, const void *), J.code);
+  jc->newframe = J.newframe;
+  jc->retexit = J.retexit;
+  if (J.p > J.limit ||
+      mprotect(m, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(m, size);
+    p->jitcount = JITNEVER;
+    return 0;
+  }
+  p->jit = jc;
+  return 1;
+}
+
+
+/*
+** Called by 'luaJ_checkhot' when 'p' becomes hot. With automatic
+** compilation turned off, start counting again.
+*/
+void luaJ_hot (lua_State *L, Proto *p) {
+  if (G(L)->jitmode)
+    luaJ_compile(L, p);
+  else
+    p->jitcount = 0;
+}
+
+
+void luaJ_freecode (Proto *p) {
+  if (p->jit != NULL) {
+    munmap(p->jit, p->jit->size);
+    p->jit = NULL;
+  }
+}
+
+/* }================================================================== */
+
+#endif
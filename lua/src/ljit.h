@@ -0,0 +1,81 @@
+/*
+** $Id: ljit.h $
+** Baseline JIT compiler (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** Number of times a function must be called, start a loop, or jump
+** back in a loop before it is compiled into native code.
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT		50
+#endif
+
+#if LUAI_JITHOT >= 255
+#error "LUAI_JITHOT must be smaller than 255"
+#endif
+
+
+/* value of 'jitcount' for prototypes that cannot be compiled */
+#define JITNEVER		255
+
+
+/*
+** Native code of a prototype. The header, the map from instructions to
+** native code, and the code itself live in one mapping, which is read
+** only (and executable) after compilation.
+*/
+typedef struct JitCode {
+  size_t size;  /* size of the whole mapping */
+  int (*entry) (lua_State *L, CallInfo *ci, const void *start);
+  const void **pcmap;  /* native address of each instruction */
+  const void *newframe;  /* exit returning JITNEWFRAME */
+  const void *retexit;  /* exit returning JITRETURN */
+} JitCode;
+
+
+/*
+** Results of native code, besides the index of the instruction where
+** the interpreter must continue (in 'L->ci').
+*/
+#define JITNEWFRAME	(-1)  /* continue 'L->ci' from its saved pc */
+#define JITRETURN	(-2)  /* the frame of 'luaV_execute' returned */
+
+
+/* count one more use of 'p' and compile it when it becomes hot */
+#define luaJ_checkhot(L,p)  \
+	{ if (l_unlikely((p)->jitcount < LUAI_JITHOT) && \
+	      ++(p)->jitcount == LUAI_JITHOT) luaJ_hot(L, p); }
+
+
+/*
+** Run the native code of the function running in 'ci' from instruction
+** 'pc'. Native code follows calls and returns between compiled functions,
+** so the interpreter continues in 'L->ci' (see JITNEWFRAME/JITRETURN).
+*/
+#define luaJ_execute(L,ci,p,pc)  \
+	((p)->jit->entry(L, ci, (p)->jit->pcmap[(pc) - (p)->code]))
+
+
+LUAI_FUNC void luaJ_hot (lua_State *L, Proto *p);
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_freecode (Proto *p);
+LUAI_FUNC const void *luaJ_trap (lua_State *L, int idx);
+
+#else
+
+#define luaJ_checkhot(L,p)	((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+/*
+** $Id: ljitlib.c $
+** Library for the JIT compiler
+** See Copyright Notice in lua.h
+*/
+
+#define ljitlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#if defined(LUA_USE_JIT)
+
+static int jit_on (lua_State *L) {
+  lua_jitmode(L, 1);
+  return 0;
+}
+
+
+static int jit_off (lua_State *L) {
+  lua_jitmode(L, 0);
+  return 0;
+}
+
+
+/*
+** Compiles a Lua function now; returns false for C functions and for
+** functions that cannot be compiled.
+*/
+static int jit_compile (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  lua_pushboolean(L, lua_jitcompile(L, 1));
+  return 1;
+}
+
+
+static int jit_status (lua_State *L) {
+  lua_pushboolean(L, lua_jitmode(L, -1));
+  return 1;
+}
+
+
+static const luaL_Reg jit_funcs[] = {
+  {"on", jit_on},
+  {"off", jit_off},
+  {"compile", jit_compile},
+  {"status", jit_status},
+  {NULL, NULL}
+};
+
+
+
+LUAMOD_API int luaopen_jit (lua_State *L) {
+  luaL_newlib(L, jit_funcs);
+  return 1;
+}
+
+#endif
@@ -108,5 +108,10 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
 &&L_OP_EXTRAARG
+#if defined(LUA_USE_QUICKENING)
+,&&L_OP_GETUPVAL_GETFIELD,
+&&L_OP_GETTABUP_GETFIELD,
+&&L_OP_MOVE_CALL
+#endif
 
 };
@@ -260,6 +260,16 @@ typedef l_uint32 Instruction;
 ** macros that are executed whenever program enters the Lua core
 ** ('lua_lock') and leaves the core ('lua_unlock')
 */
+#if defined(LUA_USE_THREADLOCK)
+/* one lock per global state, so that several OS threads can share it
+   (see 'luaE_lock' in 'lstate.h') */
+#define lua_lock(L)		luaE_lock(G(L))
+#define lua_unlock(L)		luaE_unlock(G(L))
+#define luai_threadyield(L)	luaE_threadyield(G(L))
+#define luai_userstateopen(L)	luaE_initlock(G(L))
+#define luai_userstateclose(L)	luaE_freelock(G(L))
+#endif
+
 #if !defined(lua_lock)
 #define lua_lock(L)	((void) 0)
 #define lua_unlock(L)	((void) 0)
@@ -150,6 +150,10 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
+#if defined(LUA_USE_BGSWEEP)
+  if (g->gcdefer && luaC_deferfree(g, block, osize))
+    return;  /* sweeper thread will release it */
+#endif
   callfrealloc(g, block, osize, 0);
   g->GCdebt -= osize;
 }
@@ -20,6 +20,12 @@
 
 #include "lua.h"
 
+#if defined(LUA_USE_BCCACHE)
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 #include "lauxlib.h"
 #include "lualib.h"
 
@@ -559,12 +565,294 @@ static int checkload (lua_State *L, int stat, const char *filename) {
 }
 
 
+#if defined(LUA_USE_BCCACHE)
+/*
+** {==================================================================
+** Bytecode cache for Lua modules
+** ===================================================================
+*/
+
+/*
+** Each module loaded by 'searcher_Lua' is dumped to a file in the
+** directory 'package.bytecodecache' (unless that field is not a
+** string), named after a hash of the real path of the source. The file
+** starts with a header recording the size, modification time and
+** contents hash of the source. A cached chunk is used when the size
+** matches and the source still has the hash of the header (the header
+** is refreshed when only the time changed). With LUAI_BCCTRUSTTIME,
+** the source is not read when size and time both match, which misses
+** rewrites that keep them. Any problem with the cache only makes the
+** module load from its source.
+*/
+
+#define BCC_MAGIC	"\x1b" "DBC"
+#define BCC_DIR		LUA_PROGDIR LUA_DIRSEP LUA_VDIR LUA_DIRSEP "bytecode"
+#define BCC_BUFF	4096
+
+#if defined(LUAI_BCCTRUSTTIME)
+#define BCC_TRUSTTIME	1
+#else
+#define BCC_TRUSTTIME	0
+#endif
+
+typedef struct CacheHeader {
+  char magic[4];
+  unsigned int pathlen;  /* length of the path that follows the header */
+  long long size;  /* size of the source */
+  long long mtime;  /* its modification time (0 if not reliable) */
+  unsigned long long hash;  /* hash of its contents */
+} CacheHeader;
+
+
+/* 64-bit FNV-1a */
+static unsigned long long hashbytes (const char *s, size_t l,
+                                     unsigned long long h) {
+  while (l--)
+    h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+  return h;
+}
+
+#define HASHSEED	0xcbf29ce484222325ULL
+
+
+static int hashfile (const char *filename, unsigned long long *h) {
+  char buff[BCC_BUFF];
+  size_t n;
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return 0;
+  *h = HASHSEED;
+  while ((n = fread(buff, 1, sizeof(buff), f)) > 0)
+    *h = hashbytes(buff, n, *h);
+  n = ferror(f);
+  fclose(f);
+  return (n == 0);
+}
+
+
+/*
+** Pushes the name of the cache file for the source with real path
+** 'key'.
+*/
+static const char *pushcachename (lua_State *L, const char *dir,
+                                                const char *key) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx",
+           hashbytes(key, strlen(key), HASHSEED));
+  return lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", dir, hex);
+}
+
+
+/* creates the cache directory, and its parents if it is the default */
+static void makecachedir (lua_State *L, const char *dir) {
+  static const char *const parents[] = {
+    LUA_PROGDIR, LUA_PROGDIR LUA_DIRSEP LUA_VDIR
+  };
+  int i;
+  if (!lua_expandhome(L, BCC_DIR))
+    lua_pushliteral(L, BCC_DIR);
+  if (strcmp(dir, lua_tostring(L, -1)) == 0) {  /* default directory? */
+    for (i = 0; i < 2; i++) {
+      if (!lua_expandhome(L, parents[i]))
+        lua_pushstring(L, parents[i]);
+      mkdir(lua_tostring(L, -1), 0700);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+  mkdir(dir, 0700);
+}
+
+
+static int writer (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** Writes the cache file 'cname' for the source 'key' with status 'st'
+** and hash 'hash', with the given bytecode or, if 'code' is NULL, with
+** the dump of the function on the top of the stack. The file is
+** written under a temporary name and then renamed, so that concurrent
+** states never see a partial file.
+*/
+static void savecache (lua_State *L, const char *cname, const char *key,
+                       const struct stat *st, unsigned long long hash,
+                       const char *code, size_t len) {
+  CacheHeader h;
+  FILE *f;
+  int fd, ok;
+  int func = lua_gettop(L);  /* function to be dumped, if 'code' is NULL */
+  const char *tmp = lua_pushfstring(L, "%s.XXXXXX", cname);
+  char *tmpname = (char *)lua_newuserdatauv(L, strlen(tmp) + 1, 0);
+  strcpy(tmpname, tmp);
+  if ((fd = mkstemp(tmpname)) < 0 || (f = fdopen(fd, "wb")) == NULL) {
+    if (fd >= 0) {
+      close(fd);
+      remove(tmpname);
+    }
+    lua_pop(L, 2);
+    return;
+  }
+  memcpy(h.magic, BCC_MAGIC, sizeof(h.magic));
+  h.pathlen = (unsigned int)strlen(key);
+  h.size = (long long)st->st_size;
+  /* a source changed within the last second may change again with
+     the same time; its cache is then validated by the hash */
+  h.mtime = (st->st_mtime + 1 < time(NULL)) ? (long long)st->st_mtime : 0;
+  h.hash = hash;
+  ok = (fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(key, 1, h.pathlen, f) == h.pathlen);
+  if (ok) {
+    if (code != NULL)
+      ok = (fwrite(code, 1, len, f) == len);
+    else {
+      lua_pushvalue(L, func);
+      ok = (lua_dump(L, writer, f, 0) == 0);
+      lua_pop(L, 1);
+    }
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmpname, cname) != 0)
+    remove(tmpname);
+  lua_pop(L, 2);  /* remove 'tmp' and 'tmpname' */
+}
+
+
+/*
+** Tries to load the cached chunk in 'f' (positioned after the header
+** and path), which is valid for the current source if it still has the
+** hash in the header ('sametime' tells whether it also kept the time
+** of the header). Returns 1 with the function on the stack or 0 with
+** nothing pushed.
+*/
+static int loadcache (lua_State *L, FILE *f, const char *filename,
+                      const char *cname, const char *key,
+                      const struct stat *st, const CacheHeader *h,
+                      int sametime) {
+  luaL_Buffer b;
+  size_t n;
+  int status;
+  unsigned long long hash = h->hash;
+  if (!(sametime && BCC_TRUSTTIME) &&
+      !(hashfile(filename, &hash) && hash == h->hash))
+    return 0;  /* source changed */
+  luaL_buffinit(L, &b);
+  do {
+    char *p = luaL_prepbuffsize(&b, BCC_BUFF);
+    n = fread(p, 1, BCC_BUFF, f);
+    luaL_addsize(&b, n);
+  } while (n == BCC_BUFF);
+  if (ferror(f)) {
+    luaL_pushresult(&b);
+    lua_pop(L, 1);
+    return 0;
+  }
+  luaL_pushresult(&b);
+  lua_pushfstring(L, "@%s", filename);
+  status = luaL_loadbufferx(L, lua_tostring(L, -2), lua_rawlen(L, -2),
+                               lua_tostring(L, -1), "b");
+  if (status != LUA_OK) {  /* e.g., a chunk from another version */
+    lua_pop(L, 3);
+    return 0;
+  }
+  if (!sametime)  /* source was touched but not changed? */
+    savecache(L, cname, key, st, hash, lua_tostring(L, -3),
+                                       lua_rawlen(L, -3));
+  lua_replace(L, -3);  /* function replaces the bytecode */
+  lua_pop(L, 1);  /* remove chunk name */
+  return 1;
+}
+
+
+/*
+** Loads a Lua module through the cache in directory 'dir'; behaves
+** like 'luaL_loadfile'.
+*/
+static int loadfilecached (lua_State *L, const char *filename,
+                                         const char *dir) {
+  struct stat st;
+  CacheHeader h;
+  FILE *f;
+  const char *key, *cname;
+  char *real;
+  int top = lua_gettop(L);
+  int status;
+  unsigned long long hash;
+  if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode) ||
+      (real = realpath(filename, NULL)) == NULL)
+    return luaL_loadfile(L, filename);  /* let it handle the problem */
+  key = lua_pushstring(L, real);
+  free(real);
+  cname = pushcachename(L, dir, key);
+  f = fopen(cname, "rb");
+  if (f != NULL) {
+    size_t len = strlen(key);
+    if (fread(&h, sizeof(h), 1, f) == 1 &&
+        memcmp(h.magic, BCC_MAGIC, sizeof(h.magic)) == 0 &&
+        h.pathlen == len && h.size == (long long)st.st_size) {
+      char *path = (char *)lua_newuserdatauv(L, len, 0);
+      int found = (fread(path, 1, len, f) == len &&
+                   memcmp(path, key, len) == 0);
+      lua_pop(L, 1);
+      if (found && loadcache(L, f, filename, cname, key, &st, &h,
+                             h.mtime != 0 && h.mtime == st.st_mtime)) {
+        fclose(f);
+        lua_replace(L, top + 1);  /* function replaces 'key' */
+        lua_settop(L, top + 1);
+        return LUA_OK;
+      }
+    }
+    fclose(f);
+  }
+  status = luaL_loadfile(L, filename);
+  if (status == LUA_OK && hashfile(filename, &hash)) {
+    makecachedir(L, dir);
+    savecache(L, cname, key, &st, hash, NULL, 0);
+  }
+  lua_replace(L, top + 1);  /* result replaces 'key' */
+  lua_settop(L, top + 1);
+  return status;
+}
+
+
+static int loadmodule (lua_State *L, const char *filename) {
+  const char *dir;
+  int status;
+  lua_getfield(L, lua_upvalueindex(1), "bytecodecache");
+  dir = (lua_type(L, -1) == LUA_TSTRING) ? lua_tostring(L, -1) : NULL;
+  status = (dir != NULL) ? loadfilecached(L, filename, dir)
+                         : luaL_loadfile(L, filename);
+  lua_remove(L, -2);  /* remove 'bytecodecache' */
+  return status;
+}
+
+
+static void setbytecodecache (lua_State *L) {
+  if (*BCC_DIR == *LUA_HOME_MARK && getenv("HOME") == NULL)
+    return;  /* no home directory; cache is off */
+  if (!lua_expandhome(L, BCC_DIR))
+    lua_pushliteral(L, BCC_DIR);
+  lua_setfield(L, -2, "bytecodecache");
+}
+
+/* }================================================================== */
+
+#else
+
+#define loadmodule(L,f)		luaL_loadfile(L, f)
+#define setbytecodecache(L)	((void)0)
+
+#endif
+
+
 static int searcher_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
   filename = findfile(L, name, "path", LUA_LSUBSEP);
   if (filename == NULL) return 1;  /* module not found in this path */
-  return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
+  return checkload(L, (loadmodule(L, filename) == LUA_OK), filename);
 }
 
 
@@ -769,6 +1057,7 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
   lua_setfield(L, -2, "config");
+  setbytecodecache(L);
   /* set field 'loaded' */
   luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
   lua_setfield(L, -2, "loaded");
@@ -29,6 +29,15 @@
 #include "lvm.h"
 
 
+/* fast conversions need IEEE doubles and 64-bit integers */
+#if defined(LUA_USE_FASTNUM) && LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && \
+    !defined(LUA_USE_C89)
+#define l_fastnum
+#include <float.h>
+#include <stdint.h>
+#endif
+
+
 /*
 ** Computes ceil(log2(x))
 */
@@ -214,6 +223,399 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 #endif
 /* }====================================================== */
 
+/*
+** {==================================================================
+** Fast decimal conversions (LUA_USE_FASTNUM)
+** ===================================================================
+*/
+
+#if defined(l_fastnum)
+
+#include "lnumtab.h"
+
+/* precision of LUA_NUMBER_FMT, which 'luaO_tostringbuff' mimics */
+#if !defined(LUAI_NUMPREC)
+#define LUAI_NUMPREC	14
+#endif
+
+/* maximum number of significant digits in a fast numeral */
+#define MAXFASTDIG	19
+
+/* bits of a double */
+#define DMANTBITS	52
+#define DEXPMASK	0x7FF
+#define DBIAS		1023
+
+
+typedef struct U128 {
+  uint64_t hi, lo;
+} U128;
+
+
+static U128 mul64 (uint64_t a, uint64_t b) {
+  U128 r;
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 l_uint128;
+  l_uint128 p = (l_uint128)a * b;
+  r.hi = (uint64_t)(p >> 64);
+  r.lo = (uint64_t)p;
+#else
+  uint64_t a0 = a & 0xFFFFFFFFu, a1 = a >> 32;
+  uint64_t b0 = b & 0xFFFFFFFFu, b1 = b >> 32;
+  uint64_t p01 = a0 * b1, p10 = a1 * b0;
+  uint64_t mid = ((a0 * b0) >> 32) + (p01 & 0xFFFFFFFFu) +
+                 (p10 & 0xFFFFFFFFu);
+  r.lo = a * b;
+  r.hi = a1 * b1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+  return r;
+}
+
+
+static int clz64 (uint64_t x) {
+  lua_assert(x != 0);
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  {
+    int n = 0;
+    while (!(x & (UINT64_C(1) << 63))) { x <<= 1; n++; }
+    return n;
+  }
+#endif
+}
+
+
+/* exact powers of 10, for Clinger's fast path */
+static const double exact10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*
+** Compute the double nearest to 'w * 10^q' ('w' != 0), rounding ties
+** to even, as 'strtod' does. When the product of two exact doubles is
+** exact enough (Clinger), use it; otherwise, use a 128-bit truncated
+** power of 5 (Eisel-Lemire). Return 0 for results that are subnormal,
+** overflow, or out of the tables, leaving them to 'strtod'.
+*/
+static int dec2double (uint64_t w, int q, double *res) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+  if (w <= (UINT64_C(1) << 53) && -22 <= q && q <= 22) {
+    double d = (double)w;  /* exact */
+    *res = (q < 0) ? d / exact10[-q] : d * exact10[q];  /* one rounding */
+    return 1;
+  }
+#endif
+  if (q < NUMTAB_MINP5 || q > NUMTAB_MAXP5)
+    return 0;
+  else {
+    const uint64_t *p5 = numtab_p5[q - NUMTAB_MINP5];
+    int lz = clz64(w);
+    U128 r;
+    uint64_t m;
+    int upper, shift, e2;
+    w <<= lz;  /* normalize 'w' */
+    r = mul64(w, p5[0]);
+    if ((r.hi & 0x1FF) == 0x1FF) {  /* low bits may be inexact? */
+      U128 r2 = mul64(w, p5[1]);  /* use the rest of the power */
+      r.lo += r2.hi;
+      if (r2.hi > r.lo) r.hi++;
+    }
+    upper = (int)(r.hi >> 63);
+    shift = upper + 64 - DMANTBITS - 3;
+    m = r.hi >> shift;  /* mantissa with two extra bits */
+    e2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz + DBIAS;
+    if (e2 <= 0)  /* subnormal? */
+      return 0;
+    if (r.lo <= 1 && -4 <= q && q <= 23 && (m & 3) == 1 &&
+        (m << shift) == r.hi)  /* exactly halfway? */
+      m &= ~UINT64_C(1);  /* round down, to even */
+    m += (m & 1);  /* round */
+    m >>= 1;
+    if (m >= (UINT64_C(2) << DMANTBITS)) {  /* rounding overflowed? */
+      m = UINT64_C(1) << DMANTBITS;
+      e2++;
+    }
+    if (e2 >= DEXPMASK)  /* overflow? */
+      return 0;
+    m &= ~(UINT64_C(1) << DMANTBITS);  /* remove implicit bit */
+    m |= (uint64_t)e2 << DMANTBITS;
+    memcpy(res, &m, sizeof(m));
+    return 1;
+  }
+}
+
+
+/*
+** Add a significant digit to 'w'. Leading zeros are not significant;
+** more than MAXFASTDIG digits make the numeral not fast.
+*/
+#define adddigit(w,nd,c)  \
+  { if ((nd) > 0 || (c) != '0') {  \
+      if ((nd)++ == MAXFASTDIG) return NULL;  \
+      (w) = (w) * 10 + cast_uint((c) - '0'); } }
+
+
+/*
+** Convert a plain decimal numeral (optional sign, digits with an
+** optional dot, optional exponent, spaces around) with up to
+** MAXFASTDIG significant digits. Return NULL for anything else, which
+** the general path handles (and may still accept).
+*/
+static const char *l_fastdec (const char *s, lua_Number *result) {
+  uint64_t w = 0;
+  int nd = 0;  /* number of significant digits in 'w' */
+  int e = 0;  /* decimal exponent */
+  int any = 0;  /* found any digit? */
+  int neg;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (; lisdigit(cast_uchar(*s)); s++, any = 1)
+    adddigit(w, nd, *s);
+  if (*s == '.') {
+    for (s++; lisdigit(cast_uchar(*s)); s++, any = 1) {
+      adddigit(w, nd, *s);
+      if (e-- < NUMTAB_MINP5)  /* too many leading zeros? */
+        return NULL;
+    }
+  }
+  if (!any)
+    return NULL;
+  if (*s == 'e' || *s == 'E') {
+    int ex = 0;
+    int negex;
+    s++;  /* skip 'e' */
+    negex = isneg(&s);
+    if (!lisdigit(cast_uchar(*s)))
+      return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++)
+      if (ex < 100000)  /* avoid overflows; large values fail anyway */
+        ex = ex * 10 + (*s - '0');
+    e += negex ? -ex : ex;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0')
+    return NULL;
+  if (w == 0)
+    *result = l_mathop(0.0);
+  else if (!dec2double(w, e, result))
+    return NULL;
+  if (neg) *result = -*result;
+  return s;
+}
+
+
+/* Ryu's approximations of logarithms */
+#define pow5bits(e)	cast_int(((cast_uint(e) * 1217359) >> 19) + 1)
+#define log10pow2(e)	cast_int((cast_uint(e) * 78913) >> 18)
+#define log10pow5(e)	cast_int((cast_uint(e) * 732923) >> 20)
+
+
+static int pow5factor (uint64_t v) {
+  int n = 0;
+  while (v % 5 == 0) { v /= 5; n++; }
+  return n;
+}
+
+#define ismult5(v,p)	(pow5factor(v) >= (p))
+#define ismult2(v,p)	(((v) & ((UINT64_C(1) << (p)) - 1)) == 0)
+
+
+/* (m * mul) >> j, for a 125-bit 'mul' (low half first) */
+static uint64_t mulshift (uint64_t m, const uint64_t *mul, int j) {
+  U128 b0 = mul64(m, mul[0]);
+  U128 b2 = mul64(m, mul[1]);
+  uint64_t lo = b0.hi + b2.lo;
+  uint64_t hi = b2.hi + (lo < b0.hi);
+  int s = j - 64;
+  lua_assert(0 < s && s < 64);
+  return (lo >> s) | (hi << (64 - s));
+}
+
+
+/*
+** Compute the shortest decimal 'digits * 10^e10' that reads back as the
+** (finite, positive) double with fields 'ieeem' and 'ieeee', choosing
+** the nearest one when there are several (Ryu, by Ulf Adams).
+*/
+static uint64_t shortest (uint64_t ieeem, int ieeee, int *e10) {
+  int e2;
+  uint64_t m2, mv, vr, vp, vm;
+  int even, mmshift;
+  int vmzeros = 0, vrzeros = 0;  /* digits removed from 'vm'/'vr' are 0s? */
+  int removed = 0;
+  int lastdigit = 0;  /* last removed digit of 'vr' */
+  if (ieeee == 0) {  /* subnormal? */
+    e2 = 1 - DBIAS - DMANTBITS - 2;
+    m2 = ieeem;
+  }
+  else {
+    e2 = ieeee - DBIAS - DMANTBITS - 2;
+    m2 = (UINT64_C(1) << DMANTBITS) | ieeem;
+  }
+  even = (m2 & 1) == 0;  /* bounds of the interval round to it? */
+  mv = 4 * m2;
+  mmshift = (ieeem != 0 || ieeee <= 1);  /* lower gap is a full one? */
+  /* compute 'vr', 'vp', and 'vm': value and bounds times 10^-e10 */
+  if (e2 >= 0) {
+    int q = log10pow2(e2) - (e2 > 3);
+    int k = 125 + pow5bits(q) - 1;
+    int i = -e2 + q + k;
+    lua_assert(q < NUMTAB_INV5);
+    *e10 = q;
+    vr = mulshift(mv, numtab_inv5[q], i);
+    vp = mulshift(mv + 2, numtab_inv5[q], i);
+    vm = mulshift(mv - 1 - cast_uint(mmshift), numtab_inv5[q], i);
+    if (q <= 21) {  /* only then can one of them be a multiple of 5^q */
+      if (mv % 5 == 0)
+        vrzeros = ismult5(mv, q);
+      else if (even)
+        vmzeros = ismult5(mv - 1 - cast_uint(mmshift), q);
+      else
+        vp -= ismult5(mv + 2, q);
+    }
+  }
+  else {
+    int q = log10pow5(-e2) - (-e2 > 1);
+    int i = -e2 - q;
+    int k = pow5bits(i) - 125;
+    int j = q - k;
+    lua_assert(i < NUMTAB_POW5);
+    *e10 = q + e2;
+    vr = mulshift(mv, numtab_pow5[i], j);
+    vp = mulshift(mv + 2, numtab_pow5[i], j);
+    vm = mulshift(mv - 1 - cast_uint(mmshift), numtab_pow5[i], j);
+    if (q <= 1) {  /* trailing zeros iff at least 'q' trailing 0 bits */
+      vrzeros = 1;
+      if (even)
+        vmzeros = mmshift;
+      else
+        vp--;
+    }
+    else if (q < 63)
+      vrzeros = ismult2(mv, q);
+  }
+  /* remove digits while the bounds keep differing */
+  if (vmzeros || vrzeros) {  /* general (and rare) case */
+    while (vp / 10 > vm / 10) {
+      vmzeros &= (vm % 10 == 0);
+      vrzeros &= (lastdigit == 0);
+      lastdigit = cast_int(vr % 10);
+      vr /= 10; vp /= 10; vm /= 10;
+      removed++;
+    }
+    if (vmzeros) {
+      while (vm % 10 == 0) {
+        vrzeros &= (lastdigit == 0);
+        lastdigit = cast_int(vr % 10);
+        vr /= 10; vp /= 10; vm /= 10;
+        removed++;
+      }
+    }
+    if (vrzeros && lastdigit == 5 && vr % 2 == 0)
+      lastdigit = 4;  /* exactly halfway: round to even */
+    vr += ((vr == vm && (!even || !vmzeros)) || lastdigit >= 5);
+  }
+  else {  /* common case */
+    int roundup = 0;
+    if (vp / 100 > vm / 100) {  /* remove two digits at a time */
+      roundup = (vr % 100 >= 50);
+      vr /= 100; vp /= 100; vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10) {
+      roundup = (vr % 10 >= 5);
+      vr /= 10; vp /= 10; vm /= 10;
+      removed++;
+    }
+    vr += (vr == vm || roundup);
+  }
+  *e10 += removed;
+  return vr;
+}
+
+
+/*
+** Write the shortest numeral that reads back as 'x', laid out as
+** LUA_NUMBER_FMT ("%.14g" for doubles) would do: exponential notation
+** for exponents below -4 or from LUAI_NUMPREC on, fixed notation
+** otherwise. So, normal numbers with up to LUAI_NUMPREC significant
+** digits have the same text as before; others get the digits they need
+** to be read back exactly. Return the length of the numeral, or 0 (writing
+** nothing) for inf and nan.
+*/
+static int fmtshortest (char *buff, lua_Number x) {
+  char digs[20];
+  char *p = buff;
+  uint64_t bits, v;
+  int ieeee, nd, e10, xe, i;
+  memcpy(&bits, &x, sizeof(bits));
+  ieeee = cast_int((bits >> DMANTBITS) & DEXPMASK);
+  if (ieeee == DEXPMASK)  /* inf or nan? */
+    return 0;
+  if (bits >> 63) *p++ = '-';
+  v = bits & ((UINT64_C(1) << DMANTBITS) - 1);
+  if (ieeee == 0 && v == 0) {  /* zero? */
+    *p++ = '0';
+    *p = '\0';
+    return cast_int(p - buff);
+  }
+  v = shortest(v, ieeee, &e10);
+  while (v % 10 == 0) { v /= 10; e10++; }  /* remove trailing zeros */
+  nd = 0;
+  do {  /* write digits backwards, at the end of 'digs' */
+    digs[sizeof(digs) - ++nd] = cast_char('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  xe = e10 + nd - 1;  /* exponent of the first digit */
+  {
+    const char *d = digs + sizeof(digs) - nd;
+    if (xe < -4 || xe >= LUAI_NUMPREC) {  /* exponential notation */
+      *p++ = d[0];
+      if (nd > 1) {
+        *p++ = lua_getlocaledecpoint();
+        memcpy(p, d + 1, nd - 1);
+        p += nd - 1;
+      }
+      *p++ = 'e';
+      *p++ = (xe < 0) ? '-' : '+';
+      if (xe < 0) xe = -xe;
+      if (xe >= 100) {
+        *p++ = cast_char('0' + xe / 100);
+        xe %= 100;
+      }
+      *p++ = cast_char('0' + xe / 10);
+      *p++ = cast_char('0' + xe % 10);
+    }
+    else if (xe < 0) {  /* 0.00ddd */
+      *p++ = '0';
+      *p++ = lua_getlocaledecpoint();
+      for (i = -1; i > xe; i--) *p++ = '0';
+      memcpy(p, d, nd);
+      p += nd;
+    }
+    else if (xe + 1 >= nd) {  /* integral value: ddd00 */
+      memcpy(p, d, nd);
+      p += nd;
+      for (i = nd; i <= xe; i++) *p++ = '0';
+    }
+    else {  /* ddd.ddd */
+      memcpy(p, d, xe + 1);
+      p += xe + 1;
+      *p++ = lua_getlocaledecpoint();
+      memcpy(p, d + xe + 1, nd - xe - 1);
+      p += nd - xe - 1;
+    }
+  }
+  *p = '\0';
+  return cast_int(p - buff);
+}
+
+#endif
+/* }================================================================== */
+
 
 /* maximum length of a numeral to be converted to a number */
 #if !defined (L_MAXLENNUM)
@@ -250,8 +652,14 @@ static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
 */
 static const char *l_str2d (const char *s, lua_Number *result) {
   const char *endptr;
-  const char *pmode = strpbrk(s, ".xXnN");  /* look for special chars */
-  int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+  const char *pmode;
+  int mode;
+#if defined(l_fastnum)
+  if ((endptr = l_fastdec(s, result)) != NULL)  /* plain decimal? */
+    return endptr;
+#endif
+  pmode = strpbrk(s, ".xXnN");  /* look for special chars */
+  mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
@@ -339,25 +747,19 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 
 
 /*
-** Maximum length of the conversion of a number to a string. Must be
-** enough to accommodate both LUA_INTEGER_FMT and LUA_NUMBER_FMT.
-** (For a long long int, this is 19 digits plus a sign and a final '\0',
-** adding to 21. For a long double, it can go to a sign, 33 digits,
-** the dot, an exponent letter, an exponent sign, 5 exponent digits,
-** and a final '\0', adding to 43.)
-*/
-#define MAXNUMBER2STR	44
-
-
-/*
-** Convert a number object to a string, adding it to a buffer
+** Convert a number object to a string, adding it to a buffer (which
+** must have at least MAXNUMBER2STR bytes)
 */
-static int tostringbuff (TValue *obj, char *buff) {
+int luaO_tostringbuff (const TValue *obj, char *buff) {
   int len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
     len = lua_integer2str(buff, MAXNUMBER2STR, ivalue(obj));
   else {
+#if defined(l_fastnum)
+    len = fmtshortest(buff, fltvalue(obj));
+    if (len == 0)  /* inf or nan? */
+#endif
     len = lua_number2str(buff, MAXNUMBER2STR, fltvalue(obj));
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
       buff[len++] = lua_getlocaledecpoint();
@@ -373,7 +775,7 @@ static int tostringbuff (TValue *obj, char *buff) {
 */
 void luaO_tostring (lua_State *L, TValue *obj) {
   char buff[MAXNUMBER2STR];
-  int len = tostringbuff(obj, buff);
+  int len = luaO_tostringbuff(obj, buff);
   setsvalue(L, obj, luaS_newlstr(L, buff, len));
 }
 
@@ -468,7 +870,7 @@ static void addstr2buff (BuffFS *buff, const char *str, size_t slen) {
 */
 static void addnum2buff (BuffFS *buff, TValue *num) {
   char *numbuff = getbuff(buff, MAXNUMBER2STR);
-  int len = tostringbuff(num, numbuff);  /* format number into 'numbuff' */
+  int len = luaO_tostringbuff(num, numbuff);  /* format number into 'numbuff' */
   addsize(buff, len);
 }
 
@@ -542,7 +944,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
   addstr2buff(&buff, fmt, strlen(fmt));  /* rest of 'fmt' */
   clearbuff(&buff);  /* empty buffer into the stack */
   lua_assert(buff.pushed == 1);
-  return getstr(tsvalue(s2v(L->top.p - 1)));
+  return getstr(luaS_tostr(L, s2v(L->top.p - 1)));
 }
 
 
@@ -366,7 +366,12 @@ typedef struct GCObject {
 
 #define tsvalueraw(v)	(gco2ts((v).gc))
 
+#if defined(LUA_USE_ROPES)
+#define tsvalue(o)  \
+	check_exp(ttisstring(o) && !ttisrope(o), gco2ts(val_(o).gc))
+#else
 #define tsvalue(o)	check_exp(ttisstring(o), gco2ts(val_(o).gc))
+#endif
 
 #define setsvalue(L,obj,x) \
   { TValue *io = (obj); TString *x_ = (x); \
@@ -385,7 +390,7 @@ typedef struct GCObject {
 */
 typedef struct TString {
   CommonHeader;
-  lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
+  lu_byte extra;  /* reserved words for short strings; flags for longs */
   lu_byte shrlen;  /* length for short strings, 0xFF for long strings */
   unsigned int hash;
   union {
@@ -410,6 +415,48 @@ typedef struct TString {
 #define tsslen(s)  \
 	((s)->shrlen != 0xFF ? (s)->shrlen : (s)->u.lnglen)
 
+
+#if defined(LUA_USE_ROPES)
+/*
+** Ropes (lazy concatenations). A rope is a string value whose contents
+** are the concatenation of its pieces, which are strings or other
+** ropes. The contents are built only when they are observed; then they
+** are kept in 'flat' and the pieces are dropped. Only ropes that are
+** not first pieces make nested copies when flattening, so 'depth'
+** counts them (a chain of first pieces is copied with a loop).
+** With LUA_USE_SLICES, a rope with a single piece is a slice: its
+** contents are the 'len' bytes at 'off' of that piece, a long string,
+** which the slice keeps alive until it is flattened.
+*/
+#define LUA_VROPE	makevariant(LUA_TSTRING, 2)
+
+#define ttisrope(o)	checktag((o), ctb(LUA_VROPE))
+
+#define ropevalue(o)	check_exp(ttisrope(o), gco2rope(val_(o).gc))
+
+#define setropevalue(L,obj,x) \
+  { TValue *io = (obj); Rope *x_ = (x); \
+    val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VROPE)); \
+    checkliveness(L,io); }
+
+#define setropevalue2s(L,o,r)	setropevalue(L,s2v(o),r)
+
+
+typedef struct Rope {
+  CommonHeader;
+  lu_byte depth;  /* nesting of ropes out of the first-piece chain */
+  unsigned int size;  /* number of slots in 'piece' */
+  unsigned int n;  /* number of pieces (0 once flattened) */
+  size_t len;  /* length of the contents */
+#if defined(LUA_USE_SLICES)
+  size_t off;  /* offset of the contents in the piece of a slice */
+#endif
+  struct TString *flat;  /* contents, once observed */
+  GCObject *gclist;
+  GCObject *piece[1];  /* strings and ropes, in order */
+} Rope;
+#endif
+
 /* }================================================================== */
 
 
@@ -544,6 +591,7 @@ typedef struct AbsLineInfo {
   int line;
 } AbsLineInfo;
 
+
 /*
 ** Function Prototypes
 */
@@ -552,6 +600,12 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+#if defined(LUA_USE_QUICKENING)
+  lu_byte hotcount;  /* calls/loops counted before quickening its code */
+#endif
+#if defined(LUA_USE_JIT)
+  lu_byte jitcount;  /* calls/loops counted before compiling it */
+#endif
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -570,6 +624,18 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+#if defined(LUA_USE_INLINECACHE)
+  int sizeicache;
+  unsigned int *icache;  /* inline caches (node hints) */
+  unsigned int *icbase;  /* first cache of each block of instructions */
+  lu_byte *icslot;  /* cache of each instruction in its block ('luaF_icache') */
+#endif
+#if defined(LUA_USE_JIT)
+  struct JitCode *jit;  /* native code (see 'ljit.c') */
+#endif
+#if defined(LUA_USE_MMAPLOAD)
+  struct Mapping *mapping;  /* mapped chunk it was loaded from, if any */
+#endif
 } Proto;
 
 /* }================================================================== */
@@ -734,6 +800,46 @@ typedef union Node {
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
+#if defined(LUA_USE_FROZEN)
+/* bit 6 of 'flags': table belongs to a frozen heap (read only) */
+#define BITFROZEN	(1 << 6)
+#define isfrozen(t)		((t)->flags & BITFROZEN)
+#endif
+
+
+#if defined(LUA_USE_SHAPES)
+
+/* maximum number of keys in a shape (a power of 2) */
+#define LUAI_MAXSHAPEKEYS	16
+
+/*
+** Shapes (hidden classes): an immutable sequence of short-string keys,
+** in insertion order. Tables with a shape keep no nodes for these keys,
+** only a vector with their values, in the same order. Shapes form trees
+** (one for each initial size of the vectors); a shape is extended by
+** adding one key, which gives one of its children. 'index' is a small
+** hash table over 'keys', with linear probing; its entries are key
+** indices plus one (0 is an empty entry). Shapes are not collectable
+** objects: the tables using them keep them young ('age'), and full
+** collections free shapes (and unpin their keys) that no table used
+** for two cycles (see 'sweepshapes' in 'lgc.c').
+*/
+typedef struct Shape {
+  struct Shape *gnext;  /* next in list of all shapes */
+  struct Shape *parent;  /* shape this one extends (NULL for roots) */
+  struct Shape *child;  /* first shape extending this one */
+  struct Shape *sibling;  /* next shape extending the same parent */
+  lu_byte nkeys;  /* number of keys */
+  lu_byte size;  /* size of the value vectors of tables with this shape */
+  lu_byte nchildren;  /* number of shapes extending this one */
+  lu_byte age;  /* full collections since a table last used it */
+  lu_byte index[2 * LUAI_MAXSHAPEKEYS];  /* hash of 'keys' */
+  TString *keys[1];  /* keys (allocated with 'nkeys' entries) */
+} Shape;
+
+#endif
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -744,6 +850,10 @@ typedef struct Table {
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
   GCObject *gclist;
+#if defined(LUA_USE_SHAPES)
+  Shape *shape;  /* shape of the hash part, or NULL for plain nodes */
+  TValue *svals;  /* values of the keys in 'shape' */
+#endif
 } Table;
 
 
@@ -794,6 +904,18 @@ typedef struct Table {
 /* size of buffer for 'luaO_utf8esc' function */
 #define UTF8BUFFSZ	8
 
+
+/*
+** Maximum length of the conversion of a number to a string. Must be
+** enough to accommodate both LUA_INTEGER_FMT and LUA_NUMBER_FMT.
+** (For a long long int, this is 19 digits plus a sign and a final '\0',
+** adding to 21. For a long double, it can go to a sign, 33 digits,
+** the dot, an exponent letter, an exponent sign, 5 exponent digits,
+** and a final '\0', adding to 43.)
+*/
+#define MAXNUMBER2STR	44
+
+
 LUAI_FUNC int luaO_utf8esc (char *buff, unsigned long x);
 LUAI_FUNC int luaO_ceillog2 (unsigned int x);
 LUAI_FUNC int luaO_rawarith (lua_State *L, int op, const TValue *p1,
@@ -802,6 +924,7 @@ LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, StkId res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
+LUAI_FUNC int luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC void luaO_tostring (lua_State *L, TValue *obj);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
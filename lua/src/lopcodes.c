@@ -100,5 +100,22 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+#if defined(LUA_USE_QUICKENING)
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETUPVAL_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUP_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVE_CALL */
+#endif
 };
 
+
+#if defined(LUA_USE_QUICKENING)
+/* ORDER OP */
+
+LUAI_DDEF const lu_byte luaP_baseops[NUM_OPCODES - NUM_BASEOPCODES] = {
+   OP_GETUPVAL		/* OP_GETUPVAL_GETFIELD */
+  ,OP_GETTABUP		/* OP_GETTABUP_GETFIELD */
+  ,OP_MOVE		/* OP_MOVE_CALL */
+};
+#endif
+
+
@@ -307,10 +307,23 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
 OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+
+#if defined(LUA_USE_QUICKENING)
+/* superinstructions, only created at run time (see 'luaV_quicken') */
+,OP_GETUPVAL_GETFIELD/* A B	OP_GETUPVAL followed by OP_GETFIELD		*/
+,OP_GETTABUP_GETFIELD/* A B C	OP_GETTABUP followed by OP_GETFIELD		*/
+,OP_MOVE_CALL/*	A B	OP_MOVE followed by OP_CALL			*/
+#endif
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_BASEOPCODES	((int)(OP_EXTRAARG) + 1)
+
+#if defined(LUA_USE_QUICKENING)
+#define NUM_OPCODES	((int)(OP_MOVE_CALL) + 1)
+#else
+#define NUM_OPCODES	NUM_BASEOPCODES
+#endif
 
 
 
@@ -365,6 +378,12 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) A superinstruction replaces the opcode of the first instruction
+  of a pair and keeps all its arguments; the second instruction is left
+  untouched. So, the code is still valid when read with 'luaP_baseop',
+  and jumps into the second instruction of a pair remain correct.
+  Superinstructions are never dumped (see 'dumpCode').
+
 ===========================================================================*/
 
 
@@ -395,6 +414,22 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
 /* "in top" (uses top from previous instruction) */
 #define isIT(i)		(testITMode(GET_OPCODE(i)) && GETARG_B(i) == 0)
 
+
+/*
+** Original opcode of a (possibly quickened) opcode
+*/
+#if defined(LUA_USE_QUICKENING)
+LUAI_DDEC(const lu_byte luaP_baseops[NUM_OPCODES - NUM_BASEOPCODES];)
+
+#define luaP_baseop(o)  \
+	(cast_int(o) < NUM_BASEOPCODES ? (o) \
+	  : cast(OpCode, luaP_baseops[cast_int(o) - NUM_BASEOPCODES]))
+#else
+#define luaP_baseop(o)	(o)
+#endif
+
+#define GET_BASEOPCODE(i)	luaP_baseop(GET_OPCODE(i))
+
 #define opmode(mm,ot,it,t,a,m)  \
     (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
@@ -96,6 +96,11 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+#if defined(LUA_USE_QUICKENING)
+  "GETUPVAL_GETFIELD",
+  "GETTABUP_GETFIELD",
+  "MOVE_CALL",
+#endif
   NULL
 };
 
@@ -15,6 +15,14 @@
 
 #include "lua.h"
 
+#if defined(LUA_USE_THREADLOCK)
+#include <sched.h>
+#endif
+
+#if defined(LUA_USE_FROZEN)
+#include <pthread.h>
+#endif
+
 #include "lapi.h"
 #include "ldebug.h"
 #include "ldo.h"
@@ -225,12 +233,141 @@ static void init_registry (lua_State *L, global_State *g) {
 }
 
 
+#if defined(LUA_USE_FROZEN)
+/*
+** {======================================================
+** Frozen heaps
+** =======================================================
+*/
+
+/*
+** Frozen tables find their keys by address and by hash, so the states
+** that read them share their short strings with them (see
+** 'internshrstr') and use the same seed.
+*/
+static pthread_mutex_t frozenlock = PTHREAD_MUTEX_INITIALIZER;
+static Frozen *frozenlist = NULL;  /* all live heaps */
+static unsigned int frozenseed;
+static int hasseed = 0;
+
+
+static unsigned int globalseed (lua_State *L) {
+  unsigned int seed;
+  pthread_mutex_lock(&frozenlock);
+  if (!hasseed) {
+    frozenseed = luai_makeseed(L);
+    hasseed = 1;
+  }
+  seed = frozenseed;
+  pthread_mutex_unlock(&frozenlock);
+  return seed;
+}
+
+
+/*
+** Take a reference to all live heaps: they are the ones the new state
+** can read. The array is outside the count of the collector.
+*/
+static void snapfrozen (lua_State *L) {
+  global_State *g = G(L);
+  Frozen *f;
+  int n = 0;
+  pthread_mutex_lock(&frozenlock);
+  for (f = frozenlist; f != NULL; f = f->next) n++;
+  if (n > 0) {
+    g->frozen = cast(Frozen **,
+                     (*g->frealloc)(g->ud, NULL, 0, n * sizeof(Frozen *)));
+    if (g->frozen != NULL) {
+      for (f = frozenlist; f != NULL; f = f->next) {
+        f->refs++;
+        g->frozen[g->nfrozen++] = f;
+      }
+    }
+  }
+  pthread_mutex_unlock(&frozenlock);
+  if (n > 0 && g->frozen == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+}
+
+
+static void dropfrozen (global_State *g) {
+  int i;
+  for (i = 0; i < g->nfrozen; i++)
+    lua_releasefrozen(g->frozen[i]);
+  if (g->frozen != NULL)
+    (*g->frealloc)(g->ud, g->frozen, g->nfrozen * sizeof(Frozen *), 0);
+}
+
+
+/*
+** Publish state 'L', whose objects were frozen, as a heap with root
+** 'root' and one handle. Returns NULL if there is no memory.
+*/
+Frozen *luaE_newfrozen (lua_State *L, Table *root) {
+  global_State *g = G(L);
+  Frozen *f = cast(Frozen *, (*g->frealloc)(g->ud, NULL, 0, sizeof(Frozen)));
+  if (f != NULL) {
+    f->heap = L;
+    f->root = root;
+    f->refs = 1;
+    pthread_mutex_lock(&frozenlock);
+    f->next = frozenlist;
+    frozenlist = f;
+    pthread_mutex_unlock(&frozenlock);
+  }
+  return f;
+}
+
+
+int luaE_seesfrozen (global_State *g, Frozen *f) {
+  int i;
+  for (i = 0; i < g->nfrozen; i++) {
+    if (g->frozen[i] == f)
+      return 1;
+  }
+  return 0;
+}
+
+
+LUA_API void lua_retainfrozen (lua_Frozen *f) {
+  pthread_mutex_lock(&frozenlock);
+  f->refs++;
+  pthread_mutex_unlock(&frozenlock);
+}
+
+
+LUA_API void lua_releasefrozen (lua_Frozen *f) {
+  int dead;
+  pthread_mutex_lock(&frozenlock);
+  dead = (--f->refs == 0);
+  if (dead) {  /* remove it from the list */
+    Frozen **p = &frozenlist;
+    while (*p != f) p = &(*p)->next;
+    *p = f->next;
+  }
+  pthread_mutex_unlock(&frozenlock);
+  if (dead) {
+    lua_State *heap = f->heap;
+    global_State *g = G(heap);
+    (*g->frealloc)(g->ud, f, sizeof(Frozen), 0);
+    lua_close(heap);  /* may release older heaps */
+  }
+}
+
+/* }====================================================== */
+
+#endif
+
+
 /*
 ** open parts of the state that may cause memory-allocation errors.
 */
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
+#if defined(LUA_USE_FROZEN)
+  snapfrozen(L);  /* before any string is created */
+#endif
   stack_init(L, L);  /* init stack */
   init_registry(L, g);
   luaS_init(L);
@@ -279,6 +416,18 @@ static void close_state (lua_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+#if defined(LUA_USE_FROZEN)
+  dropfrozen(g);
+#endif
+#if defined(LUA_USE_SHAPES)
+  luaH_freeshapes(L);
+#endif
+#if defined(LUA_USE_PARALLELMARK)
+  luaC_freemarkers(g);
+#endif
+#if defined(LUA_USE_BGSWEEP)
+  luaC_bgsweep(L, 0);  /* wait for the release of all dead objects */
+#endif
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
@@ -380,7 +529,13 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->warnf = NULL;
   g->ud_warn = NULL;
   g->mainthread = L;
+#if defined(LUA_USE_FROZEN)
+  g->seed = globalseed(L);
+  g->frozen = NULL;
+  g->nfrozen = 0;
+#else
   g->seed = luai_makeseed(L);
+#endif
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
@@ -406,6 +561,24 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcstepsize = LUAI_GCSTEPSIZE;
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
+#if defined(LUA_USE_JIT)
+  g->jitmode = 1;
+#endif
+#if defined(LUA_USE_SHAPES)
+  g->shapes = NULL;
+  for (i=0; i <= LUAI_MAXSHAPEKEYS; i++) g->shaperoot[i] = NULL;
+  g->nshapes = 0;
+#endif
+#if defined(LUA_USE_INLINECACHE) && defined(LUAI_ICSTATS)
+  g->ichits = g->icmisses = 0;
+#endif
+#if defined(LUA_USE_PARALLELMARK)
+  g->gcpool = NULL;
+#endif
+#if defined(LUA_USE_BGSWEEP)
+  g->sweeper = NULL;
+  g->gcdefer = 0;
+#endif
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
@@ -436,7 +609,7 @@ void luaE_warning (lua_State *L, const char *msg, int tocont) {
 void luaE_warnerror (lua_State *L, const char *where) {
   TValue *errobj = s2v(L->top.p - 1);  /* error object */
   const char *msg = (ttisstring(errobj))
-                  ? getstr(tsvalue(errobj))
+                  ? getstr(luaS_tostr(L, errobj))
                   : "error object is not a string";
   /* produce warning "error in %s (%s)" (where, msg) */
   luaE_warning(L, "error in ", 1);
@@ -446,3 +619,77 @@ void luaE_warnerror (lua_State *L, const char *where) {
   luaE_warning(L, ")", 0);
 }
 
+
+
+#if defined(LUA_USE_THREADLOCK)
+/*
+** {======================================================
+** Global lock (see 'luaE_lock')
+** =======================================================
+*/
+
+/* number of times a thread polls a held lock before sleeping */
+#if !defined(LUAI_LOCKSPIN)
+#define LUAI_LOCKSPIN	100
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define lockpause()	__builtin_ia32_pause()
+#else
+#define lockpause()	((void)0)
+#endif
+
+void luaE_initlock (global_State *g) {
+  g->lock = 0;
+  pthread_mutex_init(&g->sleeplock, NULL);
+  pthread_cond_init(&g->wakeup, NULL);
+}
+
+
+/* called by 'lua_close', which holds the lock */
+void luaE_freelock (global_State *g) {
+  pthread_cond_destroy(&g->wakeup);
+  pthread_mutex_destroy(&g->sleeplock);
+}
+
+
+/*
+** A waiter holds 'sleeplock' from marking the lock until it sleeps, so
+** the wake-up of a release cannot be lost.
+*/
+void luaE_lockslow (global_State *g) {
+  int i;
+  for (i = 0; i < LUAI_LOCKSPIN; i++) {  /* holder may leave soon */
+    lockpause();
+    if (__atomic_load_n(&g->lock, __ATOMIC_RELAXED) == 0 &&
+        __atomic_exchange_n(&g->lock, 1, __ATOMIC_ACQUIRE) == 0)
+      return;
+  }
+  pthread_mutex_lock(&g->sleeplock);
+  /* mark the lock as contended; sleep until it is free */
+  while (__atomic_exchange_n(&g->lock, 2, __ATOMIC_ACQUIRE) != 0)
+    pthread_cond_wait(&g->wakeup, &g->sleeplock);
+  pthread_mutex_unlock(&g->sleeplock);
+}
+
+
+void luaE_lockwake (global_State *g) {
+  pthread_mutex_lock(&g->sleeplock);
+  pthread_cond_signal(&g->wakeup);
+  pthread_mutex_unlock(&g->sleeplock);
+}
+
+
+/*
+** Called by a running thread when others wait for the lock: releases
+** it and lets them run before competing for it again.
+*/
+void luaE_lockyield (global_State *g) {
+  luaE_unlock(g);
+  sched_yield();
+  luaE_lock(g);
+}
+
+/* }====================================================== */
+
+#endif
@@ -9,6 +9,10 @@
 
 #include "lua.h"
 
+#if defined(LUA_USE_THREADLOCK)
+#include <pthread.h>
+#endif
+
 
 /* Some header files included here need this definition */
 typedef struct CallInfo CallInfo;
@@ -248,6 +252,21 @@ struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+#if defined(LUA_USE_FROZEN)
+/*
+** A frozen heap: a state turned into a read-only tree of tables (see
+** 'lua_freezestate'). It is referenced by its handles and by the states
+** created while it lived, which read its objects in place.
+*/
+typedef struct lua_Frozen {
+  struct lua_Frozen *next;  /* list of live heaps */
+  struct lua_State *heap;  /* state owning the objects */
+  struct Table *root;  /* root of the tree */
+  int refs;  /* handles and states referencing it (under a global lock) */
+} Frozen;
+#endif
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -273,6 +292,9 @@ typedef struct global_State {
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
+#if defined(LUA_USE_JIT)
+  lu_byte jitmode;  /* true if hot functions are compiled */
+#endif
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -298,8 +320,36 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTYPES];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+#if defined(LUA_USE_SHAPES)
+  Shape *shapes;  /* list of all shapes */
+  Shape *shaperoot[LUAI_MAXSHAPEKEYS + 1];  /* empty shapes, by size */
+  int nshapes;  /* number of shapes in 'shapes' */
+#endif
+#if defined(LUA_USE_INLINECACHE) && defined(LUAI_ICSTATS)
+  lu_mem ichits;  /* number of hits of inline caches (see 'lua_icstats') */
+  lu_mem icmisses;  /* number of misses of inline caches */
+#endif
+#if defined(LUA_USE_PARALLELMARK)
+  struct GCPool *gcpool;  /* helper threads for the mark phase */
+#endif
+#if defined(LUA_USE_BGSWEEP)
+  struct Sweeper *sweeper;  /* thread releasing dead objects */
+  lu_byte gcdefer;  /* true if freed blocks can go to 'sweeper' */
+#endif
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+#if defined(LUA_USE_THREADLOCK)
+  int lock;  /* 0: free; 1: held; 2: held, maybe with waiters (atomic) */
+  pthread_mutex_t sleeplock;  /* held by a waiter until it sleeps */
+  pthread_cond_t wakeup;  /* where waiters sleep */
+#endif
+#if defined(LUA_USE_FROZEN)
+  Frozen **frozen;  /* heaps this state can read */
+  int nfrozen;  /* number of elements in 'frozen' */
+#endif
+#if defined(LUA_GLOBAL_USERSTATE)
+  LUA_GLOBAL_USERSTATE;  /* user entry, for the 'luai_userstate*' hooks */
+#endif
 } global_State;
 
 
@@ -359,6 +409,9 @@ union GCUnion {
   struct Proto p;
   struct lua_State th;  /* thread */
   struct UpVal upv;
+#if defined(LUA_USE_ROPES)
+  struct Rope rope;
+#endif
 };
 
 
@@ -381,6 +434,9 @@ union GCUnion {
 #define gco2p(o)  check_exp((o)->tt == LUA_VPROTO, &((cast_u(o))->p))
 #define gco2th(o)  check_exp((o)->tt == LUA_VTHREAD, &((cast_u(o))->th))
 #define gco2upv(o)	check_exp((o)->tt == LUA_VUPVAL, &((cast_u(o))->upv))
+#if defined(LUA_USE_ROPES)
+#define gco2rope(o)  check_exp((o)->tt == LUA_VROPE, &((cast_u(o))->rope))
+#endif
 
 
 /*
@@ -403,6 +459,39 @@ LUAI_FUNC void luaE_warning (lua_State *L, const char *msg, int tocont);
 LUAI_FUNC void luaE_warnerror (lua_State *L, const char *where);
 LUAI_FUNC int luaE_resetthread (lua_State *L, int status);
 
+#if defined(LUA_USE_THREADLOCK)
+/*
+** The global lock. Taking and releasing a free lock costs one atomic
+** exchange each; 'luaE_lockslow' spins a little and then sleeps, and
+** marks the lock so that its holder wakes a sleeper when releasing
+** it. A running thread gives the lock away at its GC checks only when
+** the lock is so marked.
+*/
+
+#define luaE_lock(g)  \
+	((void)(__atomic_exchange_n(&(g)->lock, 1, __ATOMIC_ACQUIRE) == 0 || \
+	        (luaE_lockslow(g), 0)))
+
+#define luaE_unlock(g)  \
+	((void)(__atomic_exchange_n(&(g)->lock, 0, __ATOMIC_RELEASE) != 2 || \
+	        (luaE_lockwake(g), 0)))
+
+#define luaE_threadyield(g)  \
+	((void)(__atomic_load_n(&(g)->lock, __ATOMIC_RELAXED) != 2 || \
+	        (luaE_lockyield(g), 0)))
+
+LUAI_FUNC void luaE_initlock (global_State *g);
+LUAI_FUNC void luaE_freelock (global_State *g);
+LUAI_FUNC void luaE_lockslow (global_State *g);
+LUAI_FUNC void luaE_lockwake (global_State *g);
+LUAI_FUNC void luaE_lockyield (global_State *g);
+#endif
+
+#if defined(LUA_USE_FROZEN)
+LUAI_FUNC Frozen *luaE_newfrozen (lua_State *L, Table *root);
+LUAI_FUNC int luaE_seesfrozen (global_State *g, Frozen *f);
+#endif
+
 
 #endif
 
@@ -50,10 +50,10 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_VLNGSTR);
-  if (ts->extra == 0) {  /* no hash? */
+  if (!(ts->extra & LSTRHASHED)) {  /* no hash? */
     size_t len = ts->u.lnglen;
     ts->hash = luaS_hash(getlngstr(ts), len, ts->hash);
-    ts->extra = 1;  /* now it has its hash */
+    ts->extra |= LSTRHASHED;  /* now it has its hash */
   }
   return ts->hash;
 }
@@ -162,6 +162,38 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+#if defined(LUA_USE_MMAPFILE)
+/*
+** Creates a long string with the 'l' bytes at 'buff' (followed by a
+** '\0'), which it does not own: its header goes in the LUA_MAPHEADER
+** bytes before them, and freeing it calls 'release(buff, l)'.
+*/
+TString *luaS_newmapped (lua_State *L, char *buff, size_t l,
+                         void (*release) (void *buff, size_t size)) {
+  MappedStr *ms = cast(MappedStr *, buff - offsetof(MappedStr, ts.contents));
+  GCObject *o = cast(GCObject *, &ms->ts);
+  TString *ts;
+  lua_assert(offsetof(MappedStr, ts.contents) <= LUA_MAPHEADER);
+  lua_assert(buff[l] == '\0');
+  ms->release = release;
+  luaC_linkobj(L, o, LUA_VLNGSTR);
+  ts = gco2ts(o);
+  ts->hash = G(L)->seed;
+  ts->extra = LSTRMAPPED;
+  ts->shrlen = 0xFF;  /* signals that it is a long string */
+  ts->u.lnglen = l;
+  return ts;
+}
+
+
+void luaS_freemapped (TString *ts) {
+  MappedStr *ms = cast(MappedStr *, cast_charp(ts) - offsetof(MappedStr, ts));
+  lua_assert(ismapped(ts));
+  ms->release(getlngstr(ts), ts->u.lnglen);
+}
+#endif
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
   TString **p = &tb->hash[lmod(ts->hash, tb->size)];
@@ -186,6 +218,29 @@ static void growstrtab (lua_State *L, stringtable *tb) {
 /*
 ** Checks whether short string exists and reuses it or creates a new one.
 */
+#if defined(LUA_USE_FROZEN)
+/*
+** Search for a short string among those of the frozen heaps seen by
+** the state: a state must use their copy of a string, as they compare
+** keys by address. (Each string has only one copy in all those heaps,
+** as each heap was built seeing the older ones.)
+*/
+static TString *findfrozen (global_State *g, const char *str, size_t l,
+                                             unsigned int h) {
+  int i;
+  for (i = 0; i < g->nfrozen; i++) {
+    stringtable *tb = &G(g->frozen[i]->heap)->strt;
+    TString *ts;
+    for (ts = tb->hash[lmod(h, tb->size)]; ts != NULL; ts = ts->u.hnext) {
+      if (l == ts->shrlen && (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0))
+        return ts;
+    }
+  }
+  return NULL;
+}
+#endif
+
+
 static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
@@ -201,6 +256,10 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
+#if defined(LUA_USE_FROZEN)
+  if (g->nfrozen > 0 && (ts = findfrozen(g, str, l, h)) != NULL)
+    return ts;
+#endif
   /* else must create a new string */
   if (tb->nuse >= tb->size) {  /* need to grow string table? */
     growstrtab(L, tb);
@@ -272,3 +331,235 @@ Udata *luaS_newudata (lua_State *L, size_t s, int nuvalue) {
   return u;
 }
 
+
+
+#if defined(LUA_USE_ROPES)
+/*
+** {======================================================
+** Ropes
+** =======================================================
+*/
+
+/*
+** Create a rope with the 'n' string values at the top of the stack,
+** with total length 'l', and put it in place of the first one. Pieces
+** already flattened enter with their contents, so that their pieces
+** can be collected. Return false (and create nothing) if the rope
+** would be too deep.
+*/
+int luaS_newrope (lua_State *L, StkId top, int n, size_t l) {
+  int depth = 0;
+  int i;
+  GCObject *o;
+  Rope *r;
+  for (i = 0; i < n; i++) {
+    const TValue *v = s2v(top - n + i);
+    if (ttisrope(v) && ropevalue(v)->flat == NULL) {
+      int d = ropevalue(v)->depth + (i > 0);  /* first piece is a loop */
+      if (d > depth) depth = d;
+    }
+  }
+  if (depth > LUAI_ROPEDEPTH)
+    return 0;
+  o = luaC_newobj(L, LUA_VROPE, sizerope(n));
+  r = gco2rope(o);
+  r->depth = cast_byte(depth);
+  r->size = r->n = cast_uint(n);
+  r->len = l;
+#if defined(LUA_USE_SLICES)
+  r->off = 0;
+#endif
+  r->flat = NULL;
+  r->gclist = NULL;
+  for (i = 0; i < n; i++) {
+    const TValue *v = s2v(top - n + i);
+    if (ttisrope(v) && ropevalue(v)->flat != NULL)
+      r->piece[i] = obj2gco(ropevalue(v)->flat);
+    else
+      r->piece[i] = gcvalue(v);
+  }
+  setropevalue2s(L, top - n, r);
+  return 1;
+}
+
+
+/*
+** Copy (or compare, if 'cmp') the 'l' bytes of 's' to (with) the 'l'
+** bytes before '*end', and move '*end' back over them.
+*/
+static int visit (const char *s, size_t l, char **end, int cmp) {
+  *end -= l;
+  if (cmp)
+    return (memcmp(*end, s, l) == 0);
+  memcpy(*end, s, l * sizeof(char));
+  return 1;
+}
+
+
+/*
+** Copy (or compare) the contents of rope 'r' to (with) the 'r->len'
+** bytes before 'end', from the last piece to the first one. Ropes in
+** the first piece are followed by the loop; others, by recursion,
+** whose depth is bounded by LUAI_ROPEDEPTH. Return false at the first
+** difference.
+*/
+static int walkrope (const Rope *r, char *end, int cmp) {
+  for (;;) {
+    unsigned int i;
+    GCObject *o;
+    if (r->flat != NULL)  /* contents already built? */
+      return visit(getlngstr(r->flat), r->len, &end, cmp);
+#if defined(LUA_USE_SLICES)
+    if (r->n == 1)  /* a slice? */
+      return visit(getlngstr(gco2ts(r->piece[0])) + r->off, r->len,
+                   &end, cmp);
+#endif
+    for (i = r->n - 1; i > 0; i--) {  /* all pieces but the first */
+      o = r->piece[i];
+      if (o->tt == LUA_VROPE) {
+        const Rope *p = gco2rope(o);
+        if (!walkrope(p, end, cmp))
+          return 0;
+        end -= p->len;
+      }
+      else if (!visit(getstr(gco2ts(o)), tsslen(gco2ts(o)), &end, cmp))
+        return 0;
+    }
+    o = r->piece[0];
+    if (o->tt != LUA_VROPE)
+      return visit(getstr(gco2ts(o)), tsslen(gco2ts(o)), &end, cmp);
+    r = gco2rope(o);  /* first piece ends where the others start */
+  }
+}
+
+
+/* copy the contents of rope 'r' to 'buff' */
+void luaS_copyrope (const Rope *r, char *buff) {
+  walkrope(r, buff + r->len, 0);
+}
+
+
+/*
+** Build the contents of rope 'r', if not built yet, and drop its
+** pieces.
+*/
+TString *luaS_flatten (lua_State *L, Rope *r) {
+  if (r->flat == NULL) {
+    TString *ts = luaS_createlngstrobj(L, r->len);
+    walkrope(r, getlngstr(ts) + r->len, 0);
+    r->flat = ts;
+    r->n = 0;  /* pieces are not needed anymore */
+    luaC_objbarrier(L, r, ts);
+  }
+  return r->flat;
+}
+
+
+/*
+** Return a string value equal to 'o' that is not a rope, using 'aux'
+** if needed. ('aux' can be 'o' itself, to flatten it in place.)
+*/
+const TValue *luaS_flatvalue (lua_State *L, const TValue *o, TValue *aux) {
+  if (ttisrope(o)) {
+    TString *ts = luaS_flatten(L, ropevalue(o));
+    setsvalue(L, aux, ts);
+    return aux;
+  }
+  return o;
+}
+
+
+/*
+** Contents of a string value, or NULL for a rope not built yet. (The
+** contents of a slice are in its piece.)
+*/
+static const char *builtstr (const TValue *o) {
+  const Rope *r;
+  if (!ttisrope(o))
+    return getstr(tsvalue(o));
+  r = ropevalue(o);
+  if (r->flat != NULL)
+    return getlngstr(r->flat);
+#if defined(LUA_USE_SLICES)
+  if (r->n == 1)
+    return getlngstr(gco2ts(r->piece[0])) + r->off;
+#endif
+  return NULL;
+}
+
+
+/*
+** Equality of two string values, at least one of them a rope. Built
+** contents are compared in place, walking the other value if it is a
+** rope. When neither is built, one of them is flattened, as in any
+** other observation; raw equality ('L' == NULL) cannot allocate, so
+** raw comparisons of two arbitrary values, in 'lua_rawequal', flatten
+** them first.
+*/
+int luaS_eqrope (lua_State *L, const TValue *a, const TValue *b) {
+  size_t l = vslen(a);
+  const char *sa, *sb;
+  if (l != vslen(b))
+    return 0;
+  sa = builtstr(a);
+  sb = builtstr(b);
+  if (sa == NULL && sb == NULL) {  /* neither is built? */
+    lua_assert(L != NULL);
+    sa = getlngstr(luaS_flatten(L, ropevalue(a)));
+    sb = builtstr(b);  /* ('b' may be 'a') */
+  }
+  if (sa != NULL && sb != NULL)
+    return (sa == sb || memcmp(sa, sb, l * sizeof(char)) == 0);
+  else if (sb != NULL)
+    return walkrope(ropevalue(a), cast_charp(sb) + l, 1);
+  else
+    return walkrope(ropevalue(b), cast_charp(sa) + l, 1);
+}
+
+
+#if defined(LUA_USE_SLICES)
+/*
+** Set 'res' to the substring of string value 'o' with the 'l' bytes
+** starting at offset 'i'. Long substrings are slices of the long
+** string with the contents of 'o' (a slice of a slice refers to the
+** same string); shorter ones are copied.
+*/
+void luaS_sub (lua_State *L, const TValue *o, size_t i, size_t l,
+               TValue *res) {
+  TString *ts;
+  if (!ttisrope(o))
+    ts = tsvalue(o);
+  else {
+    Rope *r = ropevalue(o);
+    if (r->flat != NULL)
+      ts = r->flat;
+    else if (r->n == 1) {  /* a slice? */
+      ts = gco2ts(r->piece[0]);
+      i += r->off;
+    }
+    else
+      ts = luaS_flatten(L, r);
+  }
+  if (l < LUAI_SLICEMIN) {
+    setsvalue(L, res, luaS_newlstr(L, getstr(ts) + i, l));
+  }
+  else if (l == tsslen(ts)) {  /* the whole string? */
+    setsvalue(L, res, ts);
+  }
+  else {
+    GCObject *o1 = luaC_newobj(L, LUA_VROPE, sizerope(1));
+    Rope *s = gco2rope(o1);
+    s->depth = 0;
+    s->size = s->n = 1;
+    s->len = l;
+    s->off = i;
+    s->flat = NULL;
+    s->gclist = NULL;
+    s->piece[0] = obj2gco(ts);
+    setropevalue(L, res, s);
+  }
+}
+#endif
+
+/* }====================================================== */
+#endif
@@ -41,6 +41,73 @@
 #define eqshrstr(a,b)	check_exp((a)->tt == LUA_VSHRSTR, (a) == (b))
 
 
+/* bits of 'extra' in long strings */
+#define LSTRHASHED	1  /* has its hash */
+#define LSTRMAPPED	2  /* does not own its bytes (see 'luaS_newmapped') */
+
+
+#if defined(LUA_USE_MMAPFILE)
+/*
+** A mapped long string: 'release' gives back its bytes, which follow
+** its header.
+*/
+typedef struct MappedStr {
+  void (*release) (void *buff, size_t size);
+  TString ts;  /* must be the last field */
+} MappedStr;
+
+#define ismapped(ts)	((ts)->extra & LSTRMAPPED)
+#endif
+
+
+#if defined(LUA_USE_ROPES)
+/*
+** Minimum length of a concatenation to make it a rope. (It must be
+** larger than LUAI_MAXSHORTLEN, so that flattened ropes are long
+** strings.)
+*/
+#if !defined(LUAI_ROPEMIN)
+#define LUAI_ROPEMIN	512
+#endif
+
+/*
+** Maximum 'depth' of a rope; deeper concatenations are copied at once.
+** (It bounds the recursion when flattening.)
+*/
+#if !defined(LUAI_ROPEDEPTH)
+#define LUAI_ROPEDEPTH	32
+#endif
+
+#if defined(LUA_USE_SLICES)
+/*
+** Minimum length of a substring to make it a slice; shorter ones are
+** copied. (It must be larger than LUAI_MAXSHORTLEN.)
+*/
+#if !defined(LUAI_SLICEMIN)
+#define LUAI_SLICEMIN	64
+#endif
+
+/* whether rope 'r' is a slice that ends where its piece ends */
+#define luaS_issuffix(r)  ((r)->n == 1 && \
+	(r)->off + (r)->len == gco2ts((r)->piece[0])->u.lnglen)
+#endif
+
+/* size of a rope with 'n' pieces */
+#define sizerope(n)  \
+	(offsetof(Rope, piece) + cast_sizet(n) * sizeof(GCObject *))
+
+/* string of a string value, flattening it if it is a rope */
+#define luaS_tostr(L,o)  \
+	(ttisrope(o) ? luaS_flatten(L, ropevalue(o)) : tsvalue(o))
+
+/* length of a string value */
+#define vslen(o)	(ttisrope(o) ? ropevalue(o)->len : tsslen(tsvalue(o)))
+#else
+#define luaS_tostr(L,o)	((void)(L), tsvalue(o))
+#define vslen(o)	tsslen(tsvalue(o))
+#endif
+
+
 LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
@@ -52,6 +119,23 @@ LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, int nuvalue);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+#if defined(LUA_USE_ROPES)
+LUAI_FUNC int luaS_newrope (lua_State *L, StkId top, int n, size_t l);
+LUAI_FUNC void luaS_copyrope (const Rope *r, char *buff);
+LUAI_FUNC TString *luaS_flatten (lua_State *L, Rope *r);
+LUAI_FUNC const TValue *luaS_flatvalue (lua_State *L, const TValue *o,
+                                        TValue *aux);
+LUAI_FUNC int luaS_eqrope (lua_State *L, const TValue *a, const TValue *b);
+#endif
+#if defined(LUA_USE_MMAPFILE)
+LUAI_FUNC TString *luaS_newmapped (lua_State *L, char *buff, size_t l,
+                                   void (*release) (void *buff, size_t size));
+LUAI_FUNC void luaS_freemapped (TString *ts);
+#endif
+#if defined(LUA_USE_SLICES)
+LUAI_FUNC void luaS_sub (lua_State *L, const TValue *o, size_t i, size_t l,
+                         TValue *res);
+#endif
 
 
 #endif
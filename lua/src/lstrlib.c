@@ -97,13 +97,31 @@ static size_t getendpos (lua_State *L, int arg, lua_Integer def,
 }
 
 
+#if defined(LUA_USE_SLICES)
+/*
+** Long substrings share the bytes of their subject (see 'luaS_sub'),
+** so 'string.sub' needs only the subject's length, which is known
+** without building the subject if it is itself a slice or a rope.
+*/
+#define checksubject(L,arg,l)  \
+	(lua_type(L, arg) == LUA_TSTRING \
+	  ? (*(l) = lua_rawlen(L, arg), (const char *)NULL) \
+	  : luaL_checklstring(L, arg, l))
+#define pushsubstring(L,arg,s,i,l)  \
+	((void)(s), lua_pushsubstring(L, arg, i, l))
+#else
+#define checksubject(L,arg,l)	luaL_checklstring(L, arg, l)
+#define pushsubstring(L,arg,s,i,l)	lua_pushlstring(L, (s) + (i), l)
+#endif
+
+
 static int str_sub (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checksubject(L, 1, &l);
   size_t start = posrelatI(luaL_checkinteger(L, 2), l);
   size_t end = getendpos(L, 3, -1, l);
   if (start <= end)
-    lua_pushlstring(L, s + start - 1, (end - start) + 1);
+    pushsubstring(L, 1, s, start - 1, (end - start) + 1);
   else lua_pushliteral(L, "");
   return 1;
 }
@@ -360,6 +378,12 @@ typedef struct MatchState {
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
+#if defined(LUA_USE_SLICES)
+  int src_idx;  /* index of source string, for its substrings */
+#endif
+#if defined(LUA_USE_PATTERNCACHE)
+  const struct Pattern *pat;  /* compiled pattern, or NULL */
+#endif
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -670,28 +694,707 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/* search for 's2' inside 's1', with 0 < 'l2' <= 'l1' */
+static const char *scanfind (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+  const char *init;  /* to search for a '*s2' inside 's1' */
+  l2--;  /* 1st char will be checked by 'memchr' */
+  l1 = l1-l2;  /* 's2' cannot be found after that */
+  while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
+    init++;   /* 1st char is already checked */
+    if (memcmp(init, s2+1, l2) == 0)
+      return init-1;
+    else {  /* correct 'l1' and 's1' to try again */
+      l1 -= init-s1;
+      s1 = init;
+    }
+  }
+  return NULL;  /* not found */
+}
+
+
+#if defined(LUA_USE_SIMDFIND) && defined(__GNUC__) && \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+/*
+** {======================================================
+** Vectorized search
+** =======================================================
+*/
+
+/*
+** 'simdfind' looks for 's2' (with at least 2 bytes) comparing 16 (SSE2)
+** or 32 (AVX2) positions of 's1' at once with its first byte, and the
+** same positions shifted by 'l2 - 1' with its last byte; 'memcmp' checks
+** only the positions where both match. AVX2 is used when the processor
+** has it, even if the compiler does not target it. Blocks are loaded
+** only inside 's1'; the last positions are left to 'scanfind'.
+*/
+
+#include <immintrin.h>
+
+#if defined(__AVX2__)
+#define l_avx2
+#else
+#define l_avx2		__attribute__((target("avx2")))
+#endif
+
+
+/* check each position set in 'm', from 'i' on; return the first match */
+#define checkmask(m,i)  \
+  while (m != 0) {  \
+    const char *c = s1 + (i) + __builtin_ctz(m);  \
+    if (memcmp(c + 1, s2 + 1, l2 - 2) == 0) return c;  \
+    m &= m - 1;  \
+  }
+
+
+static const char *find_sse2 (const char *s1, size_t l1,
+                              const char *s2, size_t l2) {
+  const __m128i first = _mm_set1_epi8(s2[0]);
+  const __m128i last = _mm_set1_epi8(s2[l2 - 1]);
+  size_t i;
+  for (i = 0; l1 - i >= l2 - 1 + 16; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(s1 + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(s1 + i + l2 - 1));
+    unsigned int m = (unsigned int)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+    checkmask(m, i);
+  }
+  return (l1 - i >= l2) ? scanfind(s1 + i, l1 - i, s2, l2) : NULL;
+}
+
+
+static l_avx2 const char *find_avx2 (const char *s1, size_t l1,
+                                     const char *s2, size_t l2) {
+  const __m256i first = _mm256_set1_epi8(s2[0]);
+  const __m256i last = _mm256_set1_epi8(s2[l2 - 1]);
+  size_t i;
+  for (i = 0; l1 - i >= l2 - 1 + 32; i += 32) {
+    __m256i bf = _mm256_loadu_si256((const __m256i *)(s1 + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i *)(s1 + i + l2 - 1));
+    unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+    checkmask(m, i);
+  }
+  return find_sse2(s1 + i, l1 - i, s2, l2);
+}
+
+
+static const char *simdfind (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+#if !defined(__AVX2__)
+  if (!__builtin_cpu_supports("avx2"))
+    return find_sse2(s1, l1, s2, l2);
+#endif
+  return find_avx2(s1, l1, s2, l2);
+}
+
+/* }====================================================== */
+#endif
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
+#if defined(l_avx2)
+  else if (l2 > 1)  /* ('memchr' is as good for a single byte) */
+    return simdfind(s1, l1, s2, l2);
+#endif
+  else return scanfind(s1, l1, s2, l2);
+}
+
+
+#if defined(LUA_USE_PATTERNCACHE)
+/*
+** {======================================================
+** Compiled patterns
+** =======================================================
+*/
+
+/*
+** Patterns are compiled into a list of items, with the sets of bytes
+** of their character classes as bitmaps and runs of single bytes as
+** literals. 'cmatch' runs that list exactly as 'match' runs the
+** pattern (recursing at the same points, so that 'matchdepth' and all
+** errors are the same). Malformed patterns are not compiled, so that
+** their errors come from 'match' as soon as it reaches them. Classes
+** follow the locale in effect when the pattern was compiled.
+*/
+
+/*
+** Number of compiled patterns kept by a state (in the table that is the
+** first upvalue of all functions of this library), in slots chosen by
+** the hashes of their contents.
+*/
+#if !defined(LUAI_PATCACHE)
+#define LUAI_PATCACHE	64
+#endif
+
+
+/* size of a set of bytes */
+#define CSETSIZE	(UCHAR_MAX / CHAR_BIT + 1)
+
+#define inset(cs,c)	((cs)[(c) / CHAR_BIT] & (1u << ((c) % CHAR_BIT)))
+
+
+/* kinds of pattern items */
+#define PAT_END		0	/* end of pattern */
+#define PAT_LITERAL	1	/* the 'len' bytes at 'str' */
+#define PAT_CLASS	2	/* a byte in 'set', with quantifier 'rep' */
+#define PAT_OPEN	3	/* '(' */
+#define PAT_POSITION	4	/* '()' */
+#define PAT_CLOSE	5	/* ')' */
+#define PAT_EOS		6	/* '$' at the end of the pattern */
+#define PAT_BALANCE	7	/* '%b', with its two bytes at 'str' */
+#define PAT_FRONTIER	8	/* '%f', with its class in 'set' */
+#define PAT_BACKREF	9	/* '%0'-'%9', with the digit in 'len' */
+
+
+typedef struct PatItem {
+  int code;  /* PAT_* */
+  int rep;  /* quantifier of a class ('*', '+', '-' or '?'), or 0 */
+  size_t len;
+  const unsigned char *set;
+  const char *str;
+} PatItem;
+
+
+typedef struct Pattern {
+  int anchor;  /* pattern starts with '^'? */
+  const unsigned char *first;  /* bytes that can start a match, or NULL */
+  const char *prefix;  /* literal that starts every match, or NULL */
+  size_t lprefix;
+  PatItem item[1];  /* ended by PAT_END; sets and literals follow them */
+} Pattern;
+
+
+/* sizes of the parts of a compiled pattern */
+typedef struct PatSizes {
+  int nitems;
+  int nsets;
+  size_t nlit;
+} PatSizes;
+
+
+/*
+** End of the class at 'p', as 'classend', or NULL if it is malformed.
+*/
+static const char *checkclassend (const char *p, const char *p_end) {
+  switch (*p++) {
+    case L_ESC:
+      return (p == p_end) ? NULL : p + 1;
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == p_end)
+          return NULL;
+        if (*(p++) == L_ESC && p < p_end)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p + 1;
+    }
+    default:
+      return p;
+  }
+}
+
+
+/* fill 'cs' with the bytes that 'singlematch' accepts for class 'p' */
+static void classset (const char *p, const char *ep, unsigned char *cs) {
+  int c;
+  memset(cs, 0, CSETSIZE);
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    int in;
+    switch (*p) {
+      case '.': in = 1; break;
+      case L_ESC: in = match_class(c, uchar(*(p + 1))); break;
+      case '[': in = matchbracketclass(c, p, ep - 1); break;
+      default: in = (uchar(*p) == c); break;
+    }
+    if (in)
+      cs[c / CHAR_BIT] |= 1u << (c % CHAR_BIT);
+  }
+}
+
+
+/* the only byte in set 'cs', or -1 if it has another number of bytes */
+static int singlebyte (const unsigned char *cs) {
+  int c, b = -1;
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    if (inset(cs, c)) {
+      if (b >= 0) return -1;
+      b = c;
+    }
+  }
+  return b;
+}
+
+
+/*
+** Add an item to compiled pattern 'pt', or only count it in 'sz' if
+** 'pt' is NULL (first pass). Sets and literal bytes go after the
+** items, in the spaces 'pt->first' and 'pt->prefix' point to while
+** compiling.
+*/
+static PatItem *additem (Pattern *pt, PatSizes *sz, int code, int rep,
+                         const unsigned char *cs, const char *str,
+                         size_t len) {
+  PatItem *pi = (pt != NULL) ? &pt->item[sz->nitems] : NULL;
+  sz->nitems++;
+  if (pi != NULL) {
+    pi->code = code;
+    pi->rep = rep;
+    pi->len = len;
+    pi->set = NULL;
+    pi->str = NULL;
+    if (cs != NULL) {
+      unsigned char *set = (unsigned char *)pt->first +
+                           sz->nsets * CSETSIZE;
+      memcpy(set, cs, CSETSIZE);
+      pi->set = set;
+    }
+    if (str != NULL) {
+      char *lit = (char *)pt->prefix + sz->nlit;
+      memcpy(lit, str, len);
+      pi->str = lit;
+    }
+  }
+  if (cs != NULL) sz->nsets++;
+  if (str != NULL) sz->nlit += len;
+  return pi;
+}
+
+
+/* add byte 'c' to a literal item, which may extend the previous one */
+static void addbyte (Pattern *pt, PatSizes *sz, int *lastlit, char c) {
+  if (*lastlit) {  /* previous item is a literal? */
+    if (pt != NULL) {
+      PatItem *pi = &pt->item[sz->nitems - 1];
+      ((char *)pt->prefix)[sz->nlit] = c;  /* literals end together */
+      pi->len++;
+    }
+    sz->nlit++;
+  }
+  else
+    additem(pt, sz, PAT_LITERAL, 0, NULL, &c, 1);
+  *lastlit = 1;
+}
+
+
+/*
+** Compile the pattern 'p' (without its '^') into 'pt', or only measure
+** it if 'pt' is NULL. Return false if the pattern is not compiled.
+*/
+static int buildpattern (const char *p, const char *p_end, Pattern *pt,
+                         PatSizes *sz) {
+  unsigned char cs[CSETSIZE];
+  int ncap = 0;
+  int lastlit = 0;  /* last item is a literal? */
+  sz->nitems = sz->nsets = 0;
+  sz->nlit = 0;
+  while (p != p_end) {
+    int wasliteral = lastlit;
+    const char *ep;
+    lastlit = 0;
+    switch (*p) {
+      case '(': {
+        if (++ncap > LUA_MAXCAPTURES)
+          return 0;  /* let 'match' raise "too many captures" */
+        if (*(p + 1) == ')') {
+          additem(pt, sz, PAT_POSITION, 0, NULL, NULL, 0);
+          p += 2;
+        }
+        else {
+          additem(pt, sz, PAT_OPEN, 0, NULL, NULL, 0);
+          p++;
+        }
+        continue;
+      }
+      case ')': {
+        additem(pt, sz, PAT_CLOSE, 0, NULL, NULL, 0);
+        p++;
+        continue;
+      }
+      case '$': {
+        if (p + 1 != p_end)
+          break;  /* not at the end: a class */
+        additem(pt, sz, PAT_EOS, 0, NULL, NULL, 0);
+        p++;
+        continue;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= p_end - 1)
+              return 0;  /* missing arguments */
+            additem(pt, sz, PAT_BALANCE, 0, NULL, p + 2, 2);
+            p += 4;
+            continue;
+          }
+          case 'f': {
+            p += 2;
+            if (*p != '[' || (ep = checkclassend(p, p_end)) == NULL)
+              return 0;
+            classset(p, ep, cs);  /* '[' accepts as 'matchbracketclass' */
+            additem(pt, sz, PAT_FRONTIER, 0, cs, NULL, 0);
+            p = ep;
+            continue;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            additem(pt, sz, PAT_BACKREF, 0, NULL, NULL, uchar(*(p + 1)));
+            p += 2;
+            continue;
+          }
+          default: break;
+        }
+        break;
+      }
+      default: break;
+    }
+    /* pattern class plus optional suffix */
+    if ((ep = checkclassend(p, p_end)) == NULL)
+      return 0;
+    classset(p, ep, cs);
+    if (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?') {
+      additem(pt, sz, PAT_CLASS, uchar(*ep), cs, NULL, 0);
+      ep++;
+    }
+    else {
+      int c = singlebyte(cs);
+      if (c >= 0) {
+        lastlit = wasliteral;
+        addbyte(pt, sz, &lastlit, (char)c);
+      }
+      else
+        additem(pt, sz, PAT_CLASS, 0, cs, NULL, 0);
+    }
+    p = ep;
+  }
+  additem(pt, sz, PAT_END, 0, NULL, NULL, 0);
+  return 1;
+}
+
+
+/*
+** Set what every match of 'pt' starts with: the first item that
+** consumes bytes, after its initial captures, if it is mandatory.
+*/
+static void setfirst (Pattern *pt) {
+  const PatItem *pi = pt->item;
+  pt->first = NULL;
+  pt->prefix = NULL;
+  pt->lprefix = 0;
+  while (pi->code == PAT_OPEN || pi->code == PAT_POSITION)
+    pi++;
+  switch (pi->code) {
+    case PAT_LITERAL: case PAT_BALANCE: {
+      pt->prefix = pi->str;
+      pt->lprefix = (pi->code == PAT_LITERAL) ? pi->len : 1;
+      break;
+    }
+    case PAT_CLASS: {
+      if (pi->rep == 0 || pi->rep == '+')
+        pt->first = pi->set;
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Compile pattern 'p' and push it, as a full userdata; return it, or
+** NULL (pushing false) if it is not compiled.
+*/
+static const Pattern *compile (lua_State *L, const char *p, size_t lp) {
+  const char *p_end = p + lp;
+  int anchor = (*p == '^');
+  PatSizes sz;
+  Pattern *pt;
+  if (anchor) p++;
+  if (!buildpattern(p, p_end, NULL, &sz)) {
+    lua_pushboolean(L, 0);
+    return NULL;
+  }
+  pt = (Pattern *)lua_newuserdatauv(L, offsetof(Pattern, item) +
+                  sz.nitems * sizeof(PatItem) + sz.nsets * CSETSIZE +
+                  sz.nlit, 0);
+  pt->anchor = anchor;
+  pt->first = (const unsigned char *)&pt->item[sz.nitems];  /* sets */
+  pt->prefix = (const char *)(pt->first + sz.nsets * CSETSIZE);  /* literals */
+  buildpattern(p, p_end, pt, &sz);
+  setfirst(pt);
+  return pt;
+}
+
+
+/*
+** Push the compiled form of pattern 'p', the string at index 'arg', and
+** return it; return NULL (pushing false) if it is not compiled. It
+** comes from the cache if a pattern equal to 'p' is there; otherwise it
+** replaces the pattern in its slot.
+*/
+static const Pattern *getpattern (lua_State *L, int arg, const char *p,
+                                  size_t lp) {
+  unsigned int h = (unsigned int)lp;
+  size_t i;
+  int slot;
+  const Pattern *pt;
+  for (i = 0; i < lp; i++)
+    h ^= ((h << 5) + (h >> 2) + uchar(p[i]));
+  slot = (int)(h % LUAI_PATCACHE) * 2 + 1;
+  lua_rawgeti(L, lua_upvalueindex(1), slot);
+  if (lua_rawequal(L, -1, arg)) {  /* pattern is in the cache? */
+    lua_pop(L, 1);
+    lua_rawgeti(L, lua_upvalueindex(1), slot + 1);
+    return (const Pattern *)lua_touserdata(L, -1);
+  }
+  lua_pop(L, 1);
+  pt = compile(L, p, lp);
+  lua_pushvalue(L, arg);
+  lua_rawseti(L, lua_upvalueindex(1), slot);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, lua_upvalueindex(1), slot + 1);
+  return pt;
+}
+
+
+/*
+** Return the first position from 's' where a match of 'ms->pat' can
+** start ('ms->src_end' if there is none); matches at the positions
+** skipped would fail without side effects.
+*/
+static const char *skipstart (MatchState *ms, const char *s) {
+  const Pattern *pt = ms->pat;
+  if (pt == NULL)
+    return s;
+  else if (pt->prefix != NULL) {
+    s = lmemfind(s, ms->src_end - s, pt->prefix, pt->lprefix);
+    return (s != NULL) ? s : ms->src_end;
+  }
+  else if (pt->first != NULL) {
+    while (s < ms->src_end && !inset(pt->first, uchar(*s)))
+      s++;
+  }
+  return s;
+}
+
+
+/*
+** Whether a call 'cmatch(ms, s, pi)' would fail at its first item
+** without doing anything else (so that it can be skipped).
+*/
+static int cannotstart (MatchState *ms, const char *s, const PatItem *pi) {
+  if (ms->matchdepth == 0)
+    return 0;  /* the call raises an error */
+  switch (pi->code) {
+    case PAT_LITERAL:
+      return (s >= ms->src_end || *s != pi->str[0]);
+    case PAT_CLASS:
+      return (pi->rep == 0 || pi->rep == '+') &&
+             (s >= ms->src_end || !inset(pi->set, uchar(*s)));
+    default:
+      return 0;
+  }
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s,
+                           const PatItem *pi);
+
+
+/* 'matchbalance' for compiled patterns, whose '%b' has its arguments */
+static const char *cmatchbalance (MatchState *ms, const char *s,
+                                  const char *p) {
+  if (*s != *p) return NULL;
   else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct 'l1' and 's1' to try again */
-        l1 -= init-s1;
-        s1 = init;
+    int b = *p;
+    int e = *(p+1);
+    int cont = 1;
+    while (++s < ms->src_end) {
+      if (*s == e) {
+        if (--cont == 0) return s+1;
       }
+      else if (*s == b) cont++;
+    }
+  }
+  return NULL;  /* string ends out of balance */
+}
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                const PatItem *pi) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while (s + i < ms->src_end && inset(pi->set, uchar(s[i])))
+    i++;
+  pi++;  /* what follows the item */
+  /* keeps trying to match with the maximum repetitions */
+  while (i >= 0) {
+    if (!cannotstart(ms, s + i, pi)) {
+      const char *res = cmatch(ms, s + i, pi);
+      if (res) return res;
+    }
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                const PatItem *pi) {
+  for (;;) {
+    if (!cannotstart(ms, s, pi + 1)) {
+      const char *res = cmatch(ms, s, pi + 1);
+      if (res != NULL)
+        return res;
     }
-    return NULL;  /* not found */
+    if (s < ms->src_end && inset(pi->set, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else return NULL;
   }
 }
 
 
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                   const PatItem *pi, int what) {
+  const char *res;
+  int level = ms->level;
+  lua_assert(level < LUA_MAXCAPTURES);  /* checked by 'buildpattern' */
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, pi)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                 const PatItem *pi) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, pi)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/* 'match' for compiled patterns */
+static const char *cmatch (MatchState *ms, const char *s,
+                           const PatItem *pi) {
+  if (l_unlikely(ms->matchdepth-- == 0))
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto to optimize tail recursion */
+  switch (pi->code) {
+    case PAT_END:
+      break;
+    case PAT_LITERAL: {
+      if ((size_t)(ms->src_end - s) >= pi->len &&
+          memcmp(s, pi->str, pi->len) == 0) {
+        s += pi->len; pi++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PAT_OPEN: {
+      s = cstart_capture(ms, s, pi + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PAT_POSITION: {
+      s = cstart_capture(ms, s, pi + 1, CAP_POSITION);
+      break;
+    }
+    case PAT_CLOSE: {
+      s = cend_capture(ms, s, pi + 1);
+      break;
+    }
+    case PAT_EOS: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case PAT_BALANCE: {
+      s = cmatchbalance(ms, s, pi->str);
+      if (s != NULL) {
+        pi++; goto init;
+      }
+      break;
+    }
+    case PAT_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+      if (!inset(pi->set, previous) && inset(pi->set, uchar(*s))) {
+        pi++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PAT_BACKREF: {
+      s = match_capture(ms, s, (int)pi->len);
+      if (s != NULL) {
+        pi++; goto init;
+      }
+      break;
+    }
+    default: {  /* PAT_CLASS */
+      lua_assert(pi->code == PAT_CLASS);
+      /* does not match at least once? */
+      if (!(s < ms->src_end && inset(pi->set, uchar(*s)))) {
+        if (pi->rep == '*' || pi->rep == '?' || pi->rep == '-') {
+          pi++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (pi->rep) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = cmatch(ms, s + 1, pi + 1)) != NULL)
+              s = res;
+            else {
+              pi++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, pi);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, pi);
+            break;
+          default:  /* no suffix */
+            s++; pi++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/* match at 's' with the compiled pattern, if any, or with 'p' */
+static const char *domatch (MatchState *ms, const char *s, const char *p) {
+  if (ms->pat != NULL)
+    return cmatch(ms, s, ms->pat->item);
+  else
+    return match(ms, s, p);
+}
+
+/* }====================================================== */
+#else
+#define skipstart(ms,s)		(s)
+#define domatch(ms,s,p)		match(ms,s,p)
+#endif
+
+
 /*
 ** get information about the i-th capture. If there are no captures
 ** and 'i==0', return information about the whole match, which
@@ -727,7 +1430,7 @@ static void push_onecapture (MatchState *ms, int i, const char *s,
   const char *cap;
   ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
   if (l != CAP_POSITION)
-    lua_pushlstring(ms->L, cap, l);
+    pushsubstring(ms->L, ms->src_idx, ms->src_init, cap - ms->src_init, l);
   /* else position was already pushed */
 }
 
@@ -757,6 +1460,12 @@ static int nospecials (const char *p, size_t l) {
 static void prepstate (MatchState *ms, lua_State *L,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+#if defined(LUA_USE_SLICES)
+  ms->src_idx = 1;  /* every function has its subject as 1st argument */
+#endif
+#if defined(LUA_USE_PATTERNCACHE)
+  ms->pat = NULL;
+#endif
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
@@ -793,14 +1502,22 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init;
     int anchor = (*p == '^');
+#if defined(LUA_USE_PATTERNCACHE)
+    const Pattern *pt = getpattern(L, 2, p, lp);
+#endif
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+#if defined(LUA_USE_PATTERNCACHE)
+    ms.pat = pt;
+#endif
     do {
       const char *res;
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if (!anchor)
+        s1 = skipstart(&ms, s1);
+      if ((res=domatch(&ms, s1, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -842,7 +1559,8 @@ static int gmatch_aux (lua_State *L) {
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    src = skipstart(&gm->ms, src);
+    if ((e = domatch(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -862,8 +1580,18 @@ static int gmatch (lua_State *L) {
   if (init > ls)  /* start after string's end? */
     init = ls + 1;  /* avoid overflows in 's + init' */
   prepstate(&gm->ms, L, s, ls, p, lp);
+#if defined(LUA_USE_SLICES)
+  gm->ms.src_idx = lua_upvalueindex(1);  /* 'gmatch_aux' keeps it there */
+#endif
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
+#if defined(LUA_USE_PATTERNCACHE)
+  gm->ms.pat = getpattern(L, 2, p, lp);  /* kept on closure as well */
+  if (gm->ms.pat != NULL && gm->ms.pat->anchor)
+    gm->ms.pat = NULL;  /* '^' is not an anchor here; interpret it */
+  lua_pushcclosure(L, gmatch_aux, 4);
+#else
   lua_pushcclosure(L, gmatch_aux, 3);
+#endif
   return 1;
 }
 
@@ -951,18 +1679,34 @@ static int str_gsub (lua_State *L) {
   int changed = 0;  /* change flag */
   MatchState ms;
   luaL_Buffer b;
+#if defined(LUA_USE_PATTERNCACHE)
+  const Pattern *pt;
+#endif
   luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table");
+#if defined(LUA_USE_PATTERNCACHE)
+  pt = getpattern(L, 2, p, lp);  /* (below the buffer) */
+#endif
   luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
+#if defined(LUA_USE_PATTERNCACHE)
+  ms.pat = pt;
+#endif
   while (n < max_s) {
     const char *e;
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+#if defined(LUA_USE_PATTERNCACHE)
+    if (!anchor && ms.pat != NULL) {  /* copy what no match can start at */
+      const char *next = skipstart(&ms, src);
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
+#endif
+    if ((e = domatch(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
       changed = add_value(&ms, &b, src, e, tr) | changed;
       src = lastmatch = e;
@@ -1867,7 +2611,13 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
+#if defined(LUA_USE_PATTERNCACHE)
+  luaL_newlibtable(L, strlib);
+  lua_createtable(L, 2 * LUAI_PATCACHE, 0);  /* cache of compiled patterns */
+  luaL_setfuncs(L, strlib, 1);  /* shared by all functions */
+#else
   luaL_newlib(L, strlib);
+#endif
   createmetatable(L);
   return 1;
 }
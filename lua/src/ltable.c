@@ -21,10 +21,15 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With shapes (LUA_USE_SHAPES), tables created by record constructors
+** start with a shape instead of a hash part; see 'luaH_newrecord'.
+** With LUA_USE_SWISSTABLE, the hash part uses open addressing instead,
+** probed in groups of control bytes (see "Swiss tables" below).
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -39,20 +44,6 @@
 #include "lvm.h"
 
 
-/*
-** MAXABITS is the largest integer such that MAXASIZE fits in an
-** unsigned int.
-*/
-#define MAXABITS	cast_int(sizeof(int) * CHAR_BIT - 1)
-
-
-/*
-** MAXASIZE is the maximum size of the array part. It is the minimum
-** between 2^MAXABITS and the maximum size that, measured in bytes,
-** fits in a 'size_t'.
-*/
-#define MAXASIZE	luaM_limitN(1u << MAXABITS, TValue)
-
 /*
 ** MAXHBITS is the largest integer such that 2^MAXHBITS fits in a
 ** signed int.
@@ -88,6 +79,8 @@
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 #define dummynode		(&dummynode_)
 
 static const Node dummynode_ = {
@@ -95,10 +88,13 @@ static const Node dummynode_ = {
    LUA_VNIL, 0, {NULL}}  /* key type, next, and key value */
 };
 
+#endif
+
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
+#if !defined(LUA_USE_SWISSTABLE)
 /*
 ** Hash for integers. To allow a good hash, use the remainder operator
 ** ('%'). If integer fits as a non-negative int, compute an int
@@ -112,6 +108,7 @@ static Node *hashint (const Table *t, lua_Integer i) {
   else
     return hashmod(t, ui);
 }
+#endif
 
 
 /*
@@ -144,6 +141,7 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+#if !defined(LUA_USE_SWISSTABLE)
 /*
 ** returns the 'main' position of an element in a table (that is,
 ** the index of its hash value).
@@ -191,6 +189,7 @@ l_sinline Node *mainpositionfromnode (const Table *t, Node *nd) {
   getnodekey(cast(lua_State *, NULL), &key, nd);
   return mainpositionTV(t, &key);
 }
+#endif
 
 
 /*
@@ -236,6 +235,257 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
 }
 
 
+#if defined(LUA_USE_SWISSTABLE)
+/*
+** {=============================================================
+** Swiss tables
+** ===============================================================
+** The hash part is an open-addressing table. Each node has a control
+** byte, which is CTRL_EMPTY for free nodes or holds 7 bits of the hash
+** of its key ('ctrltag'). Searches probe groups of GROUPSIZE
+** consecutive control bytes at once, comparing them with the tag of
+** the key (with SIMD instructions, when available); only nodes with
+** matching tags have their keys compared. A search stops at a group
+** with a free node. Groups start at the home position of a key and
+** follow a triangular sequence, which visits all nodes.
+** The control bytes follow the nodes in the same block. The last
+** GROUPSIZE - 1 bytes are clones of the first ones (repeated, in
+** small tables), so that groups can wrap around the end.
+** As in the classic layout, keys are never removed from nodes (their
+** values become empty and, for collectable keys, the collector can
+** make them dead) until the table is rehashed. 'lastfree' counts how
+** many nodes can still be used ('lastfree - node') before a rehash;
+** at most 7/8 of the nodes are used, except in tables with less than
+** 8 nodes.
+** ==============================================================
+*/
+
+#define CTRL_EMPTY	0x80
+
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define GROUPSIZE	32
+#define loadgroup(g)	_mm256_loadu_si256(cast(const __m256i *, g))
+#define matchtag(g,tag)	cast_uint(_mm256_movemask_epi8(_mm256_cmpeq_epi8( \
+                          loadgroup(g), _mm256_set1_epi8(cast(char, tag)))))
+/* free nodes are the only ones with the high bit set */
+#define matchempty(g)	cast_uint(_mm256_movemask_epi8(loadgroup(g)))
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+#define GROUPSIZE	16
+#define loadgroup(g)	_mm_loadu_si128(cast(const __m128i *, g))
+#define matchtag(g,tag)	cast_uint(_mm_movemask_epi8(_mm_cmpeq_epi8( \
+                          loadgroup(g), _mm_set1_epi8(cast(char, tag)))))
+/* free nodes are the only ones with the high bit set */
+#define matchempty(g)	cast_uint(_mm_movemask_epi8(loadgroup(g)))
+
+#else
+
+#define GROUPSIZE	8
+
+static unsigned int matchtag (const lu_byte *g, int tag) {
+  unsigned int m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++)
+    m |= cast_uint(g[i] == tag) << i;
+  return m;
+}
+
+#define matchempty(g)	matchtag(g, CTRL_EMPTY)
+
+#endif
+
+
+/* index of the lowest bit set in a (non-zero) mask */
+#if defined(__GNUC__)
+#define lowbit(m)	cast_uint(__builtin_ctz(m))
+#else
+static unsigned int lowbit (unsigned int m) {
+  unsigned int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/* control bytes of a table */
+#define gctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* size of the block with 'n' nodes and their control bytes */
+#define sizehashpart(n)	((n) * (sizeof(Node) + 1) + (GROUPSIZE - 1))
+
+/* maximum number of keys in a hash part with 'n' nodes */
+#define maxload(n)	((n) < 8 ? (n) : (n) - (n) / 8)
+
+
+/*
+** The dummy node, with its control bytes, for tables with an empty
+** hash part.
+*/
+static const struct {
+  Node node;
+  lu_byte ctrl[GROUPSIZE];
+} dummy_ = {
+  {{{NULL}, LUA_VEMPTY,  /* value's value and type */
+    LUA_VNIL, 0, {NULL}}},  /* key type, next, and key value */
+  {CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY
+#if GROUPSIZE > 8
+   , CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY
+#endif
+#if GROUPSIZE > 16
+   , CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY
+#endif
+  }
+};
+
+#define dummynode		(&dummy_.node)
+
+
+/* mix the bits of a hash value (finalizer of MurmurHash3) */
+l_sinline unsigned int mixhash (unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/* tag of a (mixed) hash in the control bytes: its highest 7 bits */
+#define ctrltag(h)	cast_byte(((h) >> 25) & 0x7F)
+
+
+#define hashinteger(i)	\
+	mixhash(cast_uint(l_castS2U(i) ^ (l_castS2U(i) >> 31 >> 1)))
+
+
+/* mixed hash of a key (normalized, as in 'mainpositionTV') */
+static unsigned int keyhash (const TValue *key) {
+  switch (ttypetag(key)) {
+    case LUA_VNUMINT:
+      return hashinteger(ivalue(key));
+    case LUA_VNUMFLT:
+      return mixhash(cast_uint(l_hashfloat(fltvalue(key))));
+    case LUA_VSHRSTR:
+      return mixhash(tsvalue(key)->hash);
+    case LUA_VLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_VFALSE:
+      return mixhash(0);
+    case LUA_VTRUE:
+      return mixhash(1);
+    case LUA_VLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_VLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/*
+** Body of a search for the node whose key has hash 'h' and satisfies
+** 'eq' (an expression on node 'n'); returns that node or NULL.
+*/
+#define probegroups(t,h,n,eq) { \
+	unsigned int mask_ = cast_uint(sizenode(t) - 1); \
+	unsigned int pos_ = (h) & mask_; \
+	unsigned int step_ = 0; \
+	int tag_ = ctrltag(h); \
+	for (;;) { \
+	  const lu_byte *g_ = gctrl(t) + pos_; \
+	  unsigned int m_ = matchtag(g_, tag_); \
+	  while (m_ != 0) { \
+	    Node *n = gnode(t, (pos_ + lowbit(m_)) & mask_); \
+	    if (eq) return n; \
+	    m_ &= m_ - 1;  /* clear lowest bit */ \
+	  } \
+	  if (matchempty(g_) != 0 || step_ > mask_) \
+	    return NULL;  /* not found */ \
+	  step_ += GROUPSIZE; \
+	  pos_ = (pos_ + step_) & mask_; \
+	} }
+
+
+static Node *findgeneric (const Table *t, const TValue *key, int deadok) {
+  unsigned int h = keyhash(key);
+  probegroups(t, h, n, equalkey(key, n, deadok));
+}
+
+
+l_sinline Node *findint (const Table *t, lua_Integer key) {
+  unsigned int h = hashinteger(key);
+  probegroups(t, h, n, keyisinteger(n) && keyival(n) == key);
+}
+
+
+l_sinline Node *findshrstr (const Table *t, const TString *key) {
+  unsigned int h = mixhash(key->hash);
+  probegroups(t, h, n, keyisshrstr(n) && eqshrstr(keystrval(n), key));
+}
+
+
+/* set the control byte of node 'i' (and its clones) */
+static void setctrl (Table *t, unsigned int i, lu_byte c) {
+  lu_byte *ctrl = gctrl(t);
+  unsigned int size = cast_uint(sizenode(t));
+  ctrl[i] = c;
+  for (i += size; i < size + GROUPSIZE - 1; i += size)
+    ctrl[i] = c;
+}
+
+
+/*
+** Get a free node for a new key with hash 'h', following the same
+** sequence of searches. (There is always one, as 'lastfree' counts
+** the free nodes left.) When 'key' is not NULL, a dead node of that
+** key on the way is returned instead: a removed key that was collected
+** must not get a second node after its dead one, as 'findindex' would
+** find the dead node and 'next' would never get past the live one.
+*/
+static Node *getfreenode (Table *t, unsigned int h, const TValue *key) {
+  unsigned int mask = cast_uint(sizenode(t) - 1);
+  unsigned int pos = h & mask;
+  unsigned int step = 0;
+  for (;;) {
+    const lu_byte *g = gctrl(t) + pos;
+    unsigned int m;
+    if (key != NULL) {
+      for (m = matchtag(g, ctrltag(h)); m != 0; m &= m - 1) {
+        Node *n = gnode(t, (pos + lowbit(m)) & mask);
+        if (keyisdead(n) && equalkey(key, n, 1))
+          return n;
+      }
+    }
+    m = matchempty(g);
+    if (m != 0) {
+      unsigned int i = (pos + lowbit(m)) & mask;
+      setctrl(t, i, ctrltag(h));
+      return gnode(t, i);
+    }
+    lua_assert(step <= mask);
+    step += GROUPSIZE;
+    pos = (pos + step) & mask;
+  }
+}
+
+/* }============================================================= */
+#endif
+
+
 /*
 ** True if value of 'alimit' is equal to the real size of the array
 ** part of table 't'. (Otherwise, the array part must be larger than
@@ -290,6 +540,47 @@ static unsigned int setlimittosize (Table *t) {
 #define limitasasize(t)	check_exp(isrealasize(t), t->alimit)
 
 
+/*
+** Frozen tables (see 'lua_freezestate') are changed only through the
+** functions below, which raise an error for them. (The fast paths in
+** the VM and in the API skip frozen tables; see 'luaV_fastset'.)
+*/
+#if defined(LUA_USE_FROZEN)
+#define checkfrozen(L,t)  \
+  { if (l_unlikely(isfrozen(t)))  \
+      luaG_runerror(L, "attempt to modify a frozen table"); }
+#else
+#define checkfrozen(L,t)	((void)0)
+#endif
+
+
+
+#if defined(LUA_USE_SHAPES)
+
+/* first entry for 'key' in the index of a shape */
+#define shapeslot(key)	((key)->hash & (2 * LUAI_MAXSHAPEKEYS - 1))
+
+/* index of 'key' in shape 's', or -1 if absent */
+static int shapeindex (const Shape *s, const TString *key) {
+  unsigned int h = shapeslot(key);
+  int e;
+  while ((e = s->index[h]) != 0) {  /* the index is never full */
+    if (s->keys[e - 1] == key)
+      return e - 1;
+    h = (h + 1) & (2 * LUAI_MAXSHAPEKEYS - 1);
+  }
+  return -1;
+}
+
+
+/* search function for tables with a shape */
+static const TValue *getshaped (Table *t, const TString *key) {
+  int i = shapeindex(t->shape, key);
+  return (i < 0) ? &absentkey : &t->svals[i];
+}
+
+#endif
+
 
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
@@ -297,7 +588,16 @@ static unsigned int setlimittosize (Table *t) {
 ** See explanation about 'deadok' in function 'equalkey'.
 */
 static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
-  Node *n = mainpositionTV(t, key);
+  Node *n;
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL)  /* only short strings are in the hash part */
+    return ttisshrstring(key) ? getshaped(t, tsvalue(key)) : &absentkey;
+#endif
+#if defined(LUA_USE_SWISSTABLE)
+  n = findgeneric(t, key, deadok);
+  return (n != NULL) ? gval(n) : &absentkey;
+#else
+  n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (equalkey(key, n, deadok))
       return gval(n);  /* that's it */
@@ -308,6 +608,7 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
       n += nx;
     }
   }
+#endif
 }
 
 
@@ -339,6 +640,11 @@ static unsigned int findindex (lua_State *L, Table *t, TValue *key,
     const TValue *n = getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
       luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+#if defined(LUA_USE_SHAPES)
+    if (t->shape != NULL)
+      i = cast_uint(n - t->svals);  /* key index in shape */
+    else
+#endif
     i = cast_int(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
@@ -356,6 +662,18 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {  /* hash part is a shape? */
+    for (i -= asize; cast_int(i) < t->shape->nkeys; i++) {
+      if (!isempty(&t->svals[i])) {  /* a non-empty entry? */
+        setsvalue2s(L, key, t->shape->keys[i]);
+        setobj2s(L, key + 1, &t->svals[i]);
+        return 1;
+      }
+    }
+    return 0;  /* no more elements */
+  }
+#endif
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
@@ -369,8 +687,13 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
 
 
 static void freehash (lua_State *L, Table *t) {
-  if (!isdummy(t))
+  if (!isdummy(t)) {
+#if defined(LUA_USE_SWISSTABLE)
+    luaM_freemem(L, t->node, sizehashpart(cast_sizet(sizenode(t))));
+#else
     luaM_freearray(L, t->node, cast_sizet(sizenode(t)));
+#endif
+  }
 }
 
 
@@ -488,8 +811,18 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     int lsize = luaO_ceillog2(size);
     if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
       luaG_runerror(L, "table overflow");
+#if defined(LUA_USE_SWISSTABLE)
+    if (maxload(cast_uint(twoto(lsize))) < size)  /* too full? */
+      lsize++;  /* use a larger table */
+    if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    t->node = cast(Node *, luaM_newobject(L, 0, sizehashpart(size)));
+    memset(gnode(t, size), CTRL_EMPTY, size + GROUPSIZE - 1);
+#else
     size = twoto(lsize);
     t->node = luaM_newvector(L, size, Node);
+#endif
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -497,7 +830,11 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
       setempty(gval(n));
     }
     t->lsizenode = cast_byte(lsize);
+#if defined(LUA_USE_SWISSTABLE)
+    t->lastfree = gnode(t, maxload(size));  /* nodes that can be used */
+#else
     t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
   }
 }
 
@@ -515,6 +852,19 @@ static void reinsert (lua_State *L, Table *ot, Table *t) {
          already present in the table */
       TValue k;
       getnodekey(L, &k, old);
+#if defined(LUA_USE_SWISSTABLE)
+      /* keys are unique, so only those going to the array part can be
+         found; the others go straight to a free node */
+      if (!keyisinteger(old) || isabstkey(luaH_getint(t, keyival(old)))) {
+        Node *n;
+        lua_assert(t->lastfree > t->node);
+        t->lastfree--;
+        n = getfreenode(t, keyhash(&k), NULL);
+        setnodekey(L, n, &k);
+        setobj2t(L, gval(n), gval(old));
+        continue;
+      }
+#endif
       luaH_set(L, t, &k, gval(old));
     }
   }
@@ -537,6 +887,199 @@ static void exchangehashpart (Table *t1, Table *t2) {
 }
 
 
+#if defined(LUA_USE_SHAPES)
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/* maximum number of shapes in a state */
+#if !defined(LUAI_MAXSHAPES)
+#define LUAI_MAXSHAPES		4096
+#endif
+
+/* maximum number of different shapes extending a shape */
+#if !defined(LUAI_MAXSHAPECHILDREN)
+#define LUAI_MAXSHAPECHILDREN	16
+#endif
+
+
+/* size of a shape with 'n' keys */
+#define sizeshape(n)	(offsetof(Shape, keys) + cast_sizet(n) * sizeof(TString *))
+
+
+/*
+** Create a shape extending 'parent' with 'key' (or a new empty shape,
+** when 'parent' is NULL). 'size' is the size of the value vectors of
+** tables with the new shape.
+*/
+static Shape *newshape (lua_State *L, Shape *parent, TString *key,
+                                      int size) {
+  global_State *g = G(L);
+  int n = (parent == NULL) ? 0 : parent->nkeys + 1;
+  Shape *s = cast(Shape *, luaM_newobject(L, 0, sizeshape(n)));
+  s->nkeys = cast_byte(n);
+  s->size = cast_byte(size);
+  s->parent = parent;
+  s->child = s->sibling = NULL;
+  s->nchildren = 0;
+  s->age = 0;
+  if (parent == NULL)
+    memset(s->index, 0, sizeof(s->index));
+  else {
+    unsigned int h = shapeslot(key);
+    memcpy(s->keys, parent->keys, parent->nkeys * sizeof(TString *));
+    memcpy(s->index, parent->index, sizeof(s->index));
+    s->keys[parent->nkeys] = key;
+    while (s->index[h] != 0)  /* find a free entry for 'key' */
+      h = (h + 1) & (2 * LUAI_MAXSHAPEKEYS - 1);
+    s->index[h] = cast_byte(n);
+    s->sibling = parent->child;
+    parent->child = s;
+    parent->nchildren++;
+    luaH_useshape(parent);  /* not older than its children */
+  }
+  s->gnext = g->shapes;
+  g->shapes = s;
+  g->nshapes++;
+  return s;
+}
+
+
+/*
+** Get the shape extending 's' with 'key', creating it if needed.
+** Returns NULL when the shape would be too big or too polymorphic.
+*/
+static Shape *getchild (lua_State *L, Shape *s, TString *key) {
+  Shape *c;
+  for (c = s->child; c != NULL; c = c->sibling) {
+    if (c->keys[s->nkeys] == key) {
+      luaH_useshape(c);
+      return c;
+    }
+  }
+  if (s->nkeys == LUAI_MAXSHAPEKEYS || s->nchildren == LUAI_MAXSHAPECHILDREN ||
+      G(L)->nshapes >= LUAI_MAXSHAPES)
+    return NULL;
+  else {  /* keep the size of the values vector, or double it if full */
+    int size = (s->nkeys < s->size) ? s->size
+             : (s->size == 0) ? 2 : 2 * s->size;
+    return newshape(L, s, key, size);
+  }
+}
+
+
+/*
+** Try to add 'key' to table 't' by extending its shape. Fails when the
+** table has deleted fields (empty values), so that a table that is not
+** used as a record anymore goes back to plain nodes, and when
+** 'getchild' fails.
+*/
+static int shapeappend (lua_State *L, Table *t, TString *key,
+                                      const TValue *value) {
+  Shape *s = t->shape;
+  Shape *ns;
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (isempty(&t->svals[i]))  /* deleted field? */
+      return 0;
+  }
+  ns = getchild(L, s, key);
+  if (ns == NULL)
+    return 0;
+  if (ns->size != s->size)
+    t->svals = luaM_reallocvector(L, t->svals, s->size, ns->size, TValue);
+  t->shape = ns;
+  setobj2t(L, &t->svals[s->nkeys], value);
+  return 1;
+}
+
+
+/*
+** Move the keys of table 't' from its shape to a new hash part, with
+** room for 'extra' more keys. (The allocation comes first, so that an
+** error leaves the table unchanged.)
+*/
+static void unshape (lua_State *L, Table *t, unsigned int extra) {
+  Shape *s = t->shape;
+  TValue *v = t->svals;
+  Table newt;
+  int i;
+  lua_assert(isdummy(t));
+  setnodevector(L, &newt, s->nkeys + extra);
+  exchangehashpart(t, &newt);
+  t->shape = NULL;
+  t->svals = NULL;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(&v[i])) {
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      luaH_set(L, t, &k, &v[i]);
+    }
+  }
+  luaM_freearray(L, v, s->size);
+}
+
+
+/*
+** Give a shape to the new table 't', created by a constructor with
+** 'size' record fields and no list items. Without shapes to spare, or
+** for large constructors, 't' gets a hash part as usual.
+*/
+void luaH_newrecord (lua_State *L, Table *t, unsigned int size) {
+  global_State *g = G(L);
+  if (size <= LUAI_MAXSHAPEKEYS &&
+      (g->shaperoot[size] != NULL || g->nshapes < LUAI_MAXSHAPES)) {
+    if (g->shaperoot[size] == NULL)
+      g->shaperoot[size] = newshape(L, NULL, NULL, cast_int(size));
+    t->svals = luaM_newvector(L, size, TValue);
+    t->shape = g->shaperoot[size];
+    luaH_useshape(t->shape);
+  }
+  else if (size > 0)
+    luaH_resize(L, t, 0, size);
+}
+
+
+/*
+** Free shape 's', which no table uses. Its children, if any, must have
+** been freed already.
+*/
+void luaH_freeshape (lua_State *L, Shape *s) {
+  global_State *g = G(L);
+  Shape **p;
+  lua_assert(s->child == NULL);
+  if (s->parent == NULL) {  /* a root? */
+    lua_assert(g->shaperoot[s->size] == s);
+    g->shaperoot[s->size] = NULL;
+  }
+  else {  /* remove it from the children of its parent */
+    for (p = &s->parent->child; *p != s; p = &(*p)->sibling) ;
+    *p = s->sibling;
+    s->parent->nchildren--;
+  }
+  g->nshapes--;
+  luaM_freemem(L, s, sizeshape(s->nkeys));
+}
+
+
+void luaH_freeshapes (lua_State *L) {
+  global_State *g = G(L);
+  Shape *s = g->shapes;
+  while (s != NULL) {
+    Shape *next = s->gnext;
+    luaM_freemem(L, s, sizeshape(s->nkeys));
+    s = next;
+  }
+  g->shapes = NULL;
+  g->nshapes = 0;
+}
+
+/* }============================================================= */
+#endif
+
+
 /*
 ** Resize table 't' for the new given sizes. Both allocations (for
 ** the hash part and for the array part) can fail, which creates some
@@ -549,13 +1092,26 @@ static void exchangehashpart (Table *t1, Table *t2) {
 ** into the table, initializes the new part of the array (if any) with
 ** nils and reinserts the elements of the old hash back into the new
 ** parts of the table.
+** (Inline caches in the VM, see 'luaH_getshortstrIC', keep node indices
+** into the old hash part; they are revalidated on use, so they simply
+** miss once after the resize.)
 */
 void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
                                           unsigned int nhsize) {
   unsigned int i;
   Table newt;  /* to keep the new hash part */
-  unsigned int oldasize = setlimittosize(t);
+  unsigned int oldasize;
   TValue *newarray;
+  checkfrozen(L, t);
+#if defined(LUA_USE_SHAPES)
+  /* a shape can live with an array part, but not with nodes */
+  if (t->shape != NULL &&
+      (nhsize > 0 || newasize < luaH_realasize(t))) {
+    nhsize += t->shape->nkeys;  /* room for its keys */
+    unshape(L, t, 0);
+  }
+#endif
+  oldasize = setlimittosize(t);
   /* create new hash part with appropriate size into 'newt' */
   setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
@@ -631,17 +1187,26 @@ Table *luaH_new (lua_State *L) {
   t->array = NULL;
   t->alimit = 0;
   setnodevector(L, t, 0);
+#if defined(LUA_USE_SHAPES)
+  t->shape = NULL;
+  t->svals = NULL;
+#endif
   return t;
 }
 
 
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL)
+    luaM_freearray(L, t->svals, t->shape->size);
+#endif
   luaM_freearray(L, t->array, luaH_realasize(t));
   luaM_free(L, t);
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -652,6 +1217,7 @@ static Node *getfreepos (Table *t) {
   }
   return NULL;  /* could not find a free place */
 }
+#endif
 
 
 
@@ -666,6 +1232,9 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   Node *mp;
   TValue aux;
+#if defined(LUA_USE_ROPES)
+  lua_assert(!ttisrope(key));  /* callers flatten them */
+#endif
   if (l_unlikely(ttisnil(key)))
     luaG_runerror(L, "table index is nil");
   else if (ttisfloat(key)) {
@@ -680,6 +1249,24 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
   }
   if (ttisnil(value))
     return;  /* do not insert nil values */
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {
+    if (ttisshrstring(key) && shapeappend(L, t, tsvalue(key), value))
+      return;
+    unshape(L, t, 1);  /* go back to a hash part */
+  }
+#endif
+#if defined(LUA_USE_SWISSTABLE)
+  if (isdummy(t) || t->lastfree == t->node) {  /* no free nodes left? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    luaH_set(L, t, key, value);  /* insert key into grown table */
+    return;
+  }
+  mp = getfreenode(t, keyhash(key), iscollectable(key) ? key : NULL);
+  if (!keyisdead(mp))  /* not reusing a dead node of 'key'? */
+    t->lastfree--;  /* one less free node */
+#else
   mp = mainpositionTV(t, key);
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -713,6 +1300,7 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
       mp = f;
     }
   }
+#endif
   setnodekey(L, mp, key);
   luaC_barrierback(L, obj2gco(t), key);
   lua_assert(isempty(gval(mp)));
@@ -752,6 +1340,10 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
     return &t->array[key - 1];
   }
   else {  /* key is not in the array part; check the hash */
+#if defined(LUA_USE_SWISSTABLE)
+    Node *n = findint(t, key);
+    return (n != NULL) ? gval(n) : &absentkey;
+#else
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (keyisinteger(n) && keyival(n) == key)
@@ -763,6 +1355,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
       }
     }
     return &absentkey;
+#endif
   }
 }
 
@@ -771,8 +1364,17 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(key->tt == LUA_VSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL)
+    return getshaped(t, key);
+#endif
+#if defined(LUA_USE_SWISSTABLE)
+  n = findshrstr(t, key);
+  return (n != NULL) ? gval(n) : &absentkey;
+#else
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -783,7 +1385,51 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#endif
+}
+
+
+#if defined(LUA_USE_INLINECACHE)
+/*
+** Slow path of 'luaH_getshortstrIC': search for 'key' and, when found,
+** update the inline cache 'ic' with the index of its node.
+*/
+const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                              unsigned int *ic) {
+  Node *n;
+  lua_assert(key->tt == LUA_VSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {
+    int i = shapeindex(t->shape, key);
+    if (i < 0)
+      return &absentkey;  /* not found */
+    *ic = cast_uint(i);  /* remember its position */
+    return &t->svals[i];
+  }
+#endif
+#if defined(LUA_USE_SWISSTABLE)
+  n = findshrstr(t, key);
+  if (n == NULL)
+    return &absentkey;  /* not found */
+  *ic = cast_uint(n - gnode(t, 0));  /* remember its position */
+  return gval(n);
+#else
+  n = hashstr(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key)) {
+      *ic = cast_uint(n - gnode(t, 0));  /* remember its position */
+      return gval(n);  /* that's it */
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return &absentkey;  /* not found */
+      n += nx;
+    }
+  }
+#endif
 }
+#endif
 
 
 const TValue *luaH_getstr (Table *t, TString *key) {
@@ -813,6 +1459,12 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     }  /* FALLTHROUGH */
     default:
       return getgeneric(t, key, 0);
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE: {  /* keys are never ropes; use its contents, if built */
+      TString *flat = ropevalue(key)->flat;
+      return (flat != NULL) ? luaH_getstr(t, flat) : &absentkey;
+    }
+#endif
   }
 }
 
@@ -825,6 +1477,7 @@ const TValue *luaH_get (Table *t, const TValue *key) {
 */
 void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                    const TValue *slot, TValue *value) {
+  checkfrozen(L, t);
   if (isabstkey(slot))
     luaH_newkey(L, t, key, value);
   else
@@ -837,13 +1490,19 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
 ** barrier and invalidate the TM cache.
 */
 void luaH_set (lua_State *L, Table *t, const TValue *key, TValue *value) {
-  const TValue *slot = luaH_get(t, key);
+  const TValue *slot;
+#if defined(LUA_USE_ROPES)
+  TValue aux;
+  key = luaS_flatvalue(L, key, &aux);  /* keys are never ropes */
+#endif
+  slot = luaH_get(t, key);
   luaH_finishset(L, t, key, slot, value);
 }
 
 
 void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
   const TValue *p = luaH_getint(t, key);
+  checkfrozen(L, t);
   if (isabstkey(p)) {
     TValue k;
     setivalue(&k, key);
@@ -989,7 +1648,11 @@ lua_Unsigned luaH_getn (Table *t) {
 /* export these functions for the test library */
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if defined(LUA_USE_SWISSTABLE)
+  return gnode(t, lmod(keyhash(key), sizenode(t)));
+#else
   return mainpositionTV(t, key);
+#endif
 }
 
 #endif
@@ -35,10 +35,71 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/*
+** MAXABITS is the largest integer such that MAXASIZE fits in an
+** unsigned int.
+*/
+#define MAXABITS	cast_int(sizeof(int) * CHAR_BIT - 1)
+
+
+/*
+** MAXASIZE is the maximum size of the array part. It is the minimum
+** between 2^MAXABITS and the maximum size that, measured in bytes,
+** fits in a 'size_t'. (It uses 'luaM_limitN', from 'lmem.h'.)
+*/
+#define MAXASIZE	luaM_limitN(1u << MAXABITS, TValue)
+
+
+#if defined(LUA_USE_SHAPES)
+/*
+** Shape 's' is in use: make it and its ancestors young. (A shape is
+** never older than its parent, so the walk stops at a young shape.)
+*/
+#define luaH_useshape(s)  \
+  { Shape *s_ = (s); \
+    for (; s_ != NULL && s_->age != 0; s_ = s_->parent) s_->age = 0; }
+#endif
+
+
+#if defined(LUA_USE_INLINECACHE)
+/*
+** Inline-cached version of 'luaH_getshortstr': '*ic' is a hint with the
+** index of the node where 'key' was last found. A hint is checked on
+** every use (it must be inside the node vector and its node must hold
+** 'key'), so it never needs to be invalidated when 'luaH_resize' moves
+** keys around. Tables with the same shape (same size and same insertion
+** order) keep their keys in the same nodes and, therefore, share hits.
+** For tables with a shape, the hint is the index of the key in the shape.
+*/
+#define nodeichit(t,key,ic) \
+  (*(ic) < cast_uint(sizenode(t)) && \
+   keyisshrstr(gnode(t, *(ic))) && keystrval(gnode(t, *(ic))) == (key))
+
+#if defined(LUA_USE_SHAPES)
+#define luaH_ichit(t,key,ic) \
+  (((t)->shape == NULL) ? nodeichit(t, key, ic) \
+   : (*(ic) < (t)->shape->nkeys && (t)->shape->keys[*(ic)] == (key)))
+#define luaH_icval(t,ic) \
+  (((t)->shape == NULL) ? gval(gnode(t, *(ic))) : &(t)->svals[*(ic)])
+#else
+#define luaH_ichit(t,key,ic)	nodeichit(t, key, ic)
+#define luaH_icval(t,ic)	gval(gnode(t, *(ic)))
+#endif
+
+#define luaH_getshortstrIC(t,key,ic) \
+  (luaH_ichit(t, key, ic) ? luaH_icval(t, ic) \
+                          : luaH_getshortstrhint(t, key, ic))
+#endif
+
+
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+#if defined(LUA_USE_INLINECACHE)
+LUAI_FUNC const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                                       unsigned int *ic);
+#endif
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
@@ -46,6 +107,11 @@ LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
 LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                        const TValue *slot, TValue *value);
 LUAI_FUNC Table *luaH_new (lua_State *L);
+#if defined(LUA_USE_SHAPES)
+LUAI_FUNC void luaH_newrecord (lua_State *L, Table *t, unsigned int size);
+LUAI_FUNC void luaH_freeshape (lua_State *L, Shape *s);
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
+#endif
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
@@ -73,6 +73,10 @@ static int tinsert (lua_State *L) {
       /* check whether 'pos' is in [1, e] */
       luaL_argcheck(L, (lua_Unsigned)pos - 1u < (lua_Unsigned)e, 2,
                        "position out of bounds");
+#if defined(LUA_USE_ARRAYOPS)
+      if (pos < e && lua_movearray(L, 1, pos, e - 1, pos + 1, 1))
+        break;  /* elements moved up natively */
+#endif
       for (i = e; i > pos; i--) {  /* move up elements */
         lua_geti(L, 1, i - 1);
         lua_seti(L, 1, i);  /* t[i] = t[i - 1] */
@@ -96,6 +100,10 @@ static int tremove (lua_State *L) {
     luaL_argcheck(L, (lua_Unsigned)pos - 1u <= (lua_Unsigned)size, 2,
                      "position out of bounds");
   lua_geti(L, 1, pos);  /* result = t[pos] */
+#if defined(LUA_USE_ARRAYOPS)
+  if (pos < size && lua_movearray(L, 1, pos + 1, size, pos, 1))
+    pos = size;  /* elements moved down natively */
+#endif
   for ( ; pos < size; pos++) {
     lua_geti(L, 1, pos + 1);
     lua_seti(L, 1, pos);  /* t[pos] = t[pos + 1] */
@@ -126,6 +134,11 @@ static int tmove (lua_State *L) {
     n = e - f + 1;  /* number of elements to move */
     luaL_argcheck(L, t <= LUA_MAXINTEGER - n + 1, 4,
                   "destination wrap around");
+#if defined(LUA_USE_ARRAYOPS)
+    if (lua_movearray(L, 1, f, e, t, tt))
+      ;  /* moved natively */
+    else
+#endif
     if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
       for (i = 0; i < n; i++) {
         lua_geti(L, 1, f + i);
@@ -160,6 +173,10 @@ static int tconcat (lua_State *L) {
   const char *sep = luaL_optlstring(L, 2, "", &lsep);
   lua_Integer i = luaL_optinteger(L, 3, 1);
   last = luaL_optinteger(L, 4, last);
+#if defined(LUA_USE_ARRAYOPS)
+  if (i <= last && lua_concatarray(L, 1, i, last, sep, lsep))
+    return 1;  /* concatenated natively */
+#endif
   luaL_buffinit(L, &b);
   for (; i < last; i++) {
     addfield(L, &b, i);
@@ -200,6 +217,10 @@ static int tunpack (lua_State *L) {
   if (l_unlikely(n >= (unsigned int)INT_MAX  ||
                  !lua_checkstack(L, (int)(++n))))
     return luaL_error(L, "too many results to unpack");
+#if defined(LUA_USE_ARRAYOPS)
+  if (lua_unpackarray(L, 1, i, (int)n))
+    return (int)n;  /* pushed natively */
+#endif
   for (; i < e; i++) {  /* push arg[i..e - 1] (to avoid overflows) */
     lua_geti(L, 1, i);
   }
@@ -224,6 +245,7 @@ static int tunpack (lua_State *L) {
 typedef unsigned int IdxT;
 
 
+#if !defined(LUA_USE_PDQSORT)
 /*
 ** Produce a "random" 'unsigned int' to randomize pivot choice. This
 ** macro is used only when 'sort' detects a big imbalance in the result
@@ -260,6 +282,7 @@ static unsigned int l_randomizePivot (void) {
 
 /* arrays larger than 'RANLIMIT' may use randomized pivots */
 #define RANLIMIT	100u
+#endif
 
 
 static void set2 (lua_State *L, IdxT i, IdxT j) {
@@ -288,6 +311,297 @@ static int sort_comp (lua_State *L, int a, int b) {
 }
 
 
+#if defined(LUA_USE_PDQSORT)	/* { */
+
+/*
+** Pattern-defeating quicksort (Orson Peters): a quicksort that detects
+** sorted, reversed and repeated runs, and falls back to heapsort after
+** too many unbalanced partitions. Sorts the half-open interval
+** a[lo .. up). Arrays that 'lua_sortarray' can handle never get here.
+*/
+
+/* below this size, use insertion sort */
+#define PDQINSERT	24u
+
+/* above this size, choose pivots with Tukey's ninther */
+#define PDQNINTHER	128u
+
+/* maximum number of moves in a partial insertion sort */
+#define PDQPARTIAL	8u
+
+
+static void badorder (lua_State *L) {
+  luaL_error(L, "invalid order function for sorting");
+}
+
+
+/* a[i] < a[j]? */
+static int lessthan (lua_State *L, IdxT i, IdxT j) {
+  int res;
+  lua_geti(L, 1, i);
+  lua_geti(L, 1, j);
+  res = sort_comp(L, -2, -1);
+  lua_pop(L, 2);
+  return res;
+}
+
+
+static void swap (lua_State *L, IdxT i, IdxT j) {
+  lua_geti(L, 1, i);
+  lua_geti(L, 1, j);
+  set2(L, i, j);
+}
+
+
+/* sort a[i], a[j], and a[k] */
+static void sort3 (lua_State *L, IdxT i, IdxT j, IdxT k) {
+  if (lessthan(L, j, i)) swap(L, i, j);
+  if (lessthan(L, k, j)) {
+    swap(L, j, k);
+    if (lessthan(L, j, i)) swap(L, i, j);
+  }
+}
+
+
+/*
+** Insertion sort of a[lo .. up). Gives up (returning 0) after moving
+** more than 'limit' elements.
+*/
+static int insertsort (lua_State *L, IdxT lo, IdxT up, IdxT limit) {
+  IdxT i;
+  IdxT moved = 0;
+  for (i = lo + 1; i < up; i++) {
+    IdxT j = i;
+    lua_geti(L, 1, i);  /* element to be inserted */
+    while (j > lo) {
+      lua_geti(L, 1, j - 1);
+      if (!sort_comp(L, -2, -1)) {  /* a[j - 1] <= a[i]? */
+        lua_pop(L, 1);
+        break;
+      }
+      lua_seti(L, 1, j--);  /* move a[j - 1] up */
+    }
+    if (j == i)
+      lua_pop(L, 1);  /* already in place */
+    else {
+      lua_seti(L, 1, j);
+      moved += i - j;
+      if (moved > limit)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Partition a[lo .. up) around the pivot P at a[lo], putting elements
+** equal to P to the right. Returns the final position of P and sets
+** 'done' if no element was out of place. As in 'partition', P stays
+** on the stack, with the elements being compared above it. The choice
+** of P ensures that, with a valid order, scans stop before leaving
+** the interval.
+*/
+static IdxT partright (lua_State *L, IdxT lo, IdxT up, int *done) {
+  IdxT i = lo;
+  IdxT j = up;
+  lua_geti(L, 1, lo);  /* push P */
+  /* repeat ++i while a[i] < P */
+  while ((void)lua_geti(L, 1, ++i), sort_comp(L, -1, -2)) {
+    if (l_unlikely(i == up - 1))  /* a[i] < P for all of them ?? */
+      badorder(L);
+    lua_pop(L, 1);
+  }
+  /* repeat --j while a[j] >= P */
+  if (i - 1 == lo) {  /* no element < P so far? */
+    for (;;) {  /* search is bounded by 'i' */
+      if (j - 1 <= i) {  /* none found? */
+        j = i;
+        lua_pushvalue(L, -1);  /* a[j] is a[i] */
+        break;
+      }
+      lua_geti(L, 1, --j);
+      if (sort_comp(L, -1, -3))  /* a[j] < P? */
+        break;
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    while ((void)lua_geti(L, 1, --j), !sort_comp(L, -1, -3)) {
+      if (l_unlikely(j == lo))  /* but a[i - 1] < P ?? */
+        badorder(L);
+      lua_pop(L, 1);
+    }
+  }
+  *done = (i >= j);
+  while (i < j) {  /* a[i] >= P and a[j] < P are on the top */
+    set2(L, i, j);  /* swap them */
+    while ((void)lua_geti(L, 1, ++i), sort_comp(L, -1, -2)) {
+      if (l_unlikely(i == up - 1))  /* but old a[j] >= P ?? */
+        badorder(L);
+      lua_pop(L, 1);
+    }
+    while ((void)lua_geti(L, 1, --j), !sort_comp(L, -1, -3)) {
+      if (l_unlikely(j == lo))  /* but old a[i] < P ?? */
+        badorder(L);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 2);  /* remove a[i] and a[j] */
+  lua_geti(L, 1, i - 1);
+  lua_seti(L, 1, lo);  /* a[lo] = a[i - 1] */
+  lua_seti(L, 1, i - 1);  /* a[i - 1] = P */
+  return i - 1;
+}
+
+
+/*
+** Partition a[lo .. up) around the pivot P at a[lo], putting elements
+** equal to P to the left. Used when a[lo - 1], which is not greater
+** than any element in the interval, is equal to P, so that runs of
+** equal elements take linear time. Returns the final position of P.
+*/
+static IdxT partleft (lua_State *L, IdxT lo, IdxT up) {
+  IdxT i = lo;
+  IdxT j = up;
+  lua_geti(L, 1, lo);  /* push P */
+  /* repeat --j while P < a[j] */
+  while ((void)lua_geti(L, 1, --j), sort_comp(L, -2, -1)) {
+    if (l_unlikely(j == lo))  /* P < P ?? */
+      badorder(L);
+    lua_pop(L, 1);
+  }
+  /* repeat ++i while a[i] <= P */
+  if (j + 1 == up) {  /* no element > P so far? */
+    for (;;) {  /* search is bounded by 'j' */
+      if (i + 1 >= j) {  /* none found? */
+        i = j;
+        lua_pushvalue(L, -1);  /* a[i] is a[j] */
+        break;
+      }
+      lua_geti(L, 1, ++i);
+      if (sort_comp(L, -3, -1))  /* P < a[i]? */
+        break;
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    while ((void)lua_geti(L, 1, ++i), !sort_comp(L, -3, -1)) {
+      if (l_unlikely(i == up - 1))  /* but a[j + 1] > P ?? */
+        badorder(L);
+      lua_pop(L, 1);
+    }
+  }
+  while (i < j) {  /* a[j] <= P and a[i] > P are on the top */
+    set2(L, j, i);  /* swap them */
+    while ((void)lua_geti(L, 1, --j), sort_comp(L, -2, -1)) {
+      if (l_unlikely(j == lo))  /* but old a[i] <= P ?? */
+        badorder(L);
+      lua_pop(L, 1);
+    }
+    while ((void)lua_geti(L, 1, ++i), !sort_comp(L, -3, -1)) {
+      if (l_unlikely(i == up - 1))  /* but old a[j] > P ?? */
+        badorder(L);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 2);  /* remove a[j] and a[i] */
+  lua_geti(L, 1, j);
+  lua_seti(L, 1, lo);  /* a[lo] = a[j] */
+  lua_seti(L, 1, j);  /* a[j] = P */
+  return j;
+}
+
+
+static void heapsort (lua_State *L, IdxT lo, IdxT n) {
+  IdxT k = n / 2;
+  for (;;) {
+    IdxT i, c;
+    if (k > 0)  /* building the heap? */
+      i = --k;
+    else if (--n > 0) {  /* move the maximum to the end */
+      swap(L, lo, lo + n);
+      i = 0;
+    }
+    else
+      return;
+    while ((c = 2 * i + 1) < n) {  /* sift a[lo + i] down */
+      if (c + 1 < n && lessthan(L, lo + c, lo + c + 1)) c++;
+      if (!lessthan(L, lo + i, lo + c)) break;
+      swap(L, lo + i, lo + c);
+      i = c;
+    }
+  }
+}
+
+
+/* swap elements near the ends of an unbalanced partition a[lo .. up) */
+static void breakpatterns (lua_State *L, IdxT lo, IdxT up) {
+  IdxT n = up - lo;
+  if (n >= PDQINSERT) {
+    swap(L, lo, lo + n / 4);
+    swap(L, up - 1, up - n / 4);
+    if (n > PDQNINTHER) {
+      swap(L, lo + 1, lo + (n / 4 + 1));
+      swap(L, lo + 2, lo + (n / 4 + 2));
+      swap(L, up - 2, up - (n / 4 + 1));
+      swap(L, up - 3, up - (n / 4 + 2));
+    }
+  }
+}
+
+
+/*
+** Sort a[lo .. up). 'bad' counts the unbalanced partitions still
+** allowed before switching to heapsort; 'leftmost' is false when
+** a[lo - 1] belongs to the array and is not greater than any element
+** in the interval.
+*/
+static void pdqsort (lua_State *L, IdxT lo, IdxT up, int bad,
+                     int leftmost) {
+  for (;;) {
+    IdxT n = up - lo;
+    IdxT half = n / 2;
+    IdxT p;
+    int done;
+    if (n < PDQINSERT) {
+      insertsort(L, lo, up, UINT_MAX);
+      return;
+    }
+    if (n > PDQNINTHER) {  /* pivot is the median of medians */
+      sort3(L, lo, lo + half, up - 1);
+      sort3(L, lo + 1, lo + (half - 1), up - 2);
+      sort3(L, lo + 2, lo + (half + 1), up - 3);
+      sort3(L, lo + (half - 1), lo + half, lo + (half + 1));
+      swap(L, lo, lo + half);
+    }
+    else
+      sort3(L, lo + half, lo, up - 1);
+    if (!leftmost && !lessthan(L, lo - 1, lo)) {  /* P equal to a[lo-1]? */
+      lo = partleft(L, lo, up) + 1;  /* skip elements equal to P */
+      continue;
+    }
+    p = partright(L, lo, up, &done);
+    if (p - lo < n / 8 || up - p - 1 < n / 8) {  /* unbalanced? */
+      if (--bad == 0) {  /* too many of them? */
+        heapsort(L, lo, n);  /* guarantee O(n log n) */
+        return;
+      }
+      breakpatterns(L, lo, p);
+      breakpatterns(L, p + 1, up);
+    }
+    else if (done &&  /* no swaps? try to finish with insertion sorts */
+             insertsort(L, lo, p, PDQPARTIAL) &&
+             insertsort(L, p + 1, up, PDQPARTIAL))
+      return;
+    pdqsort(L, lo, p, bad, leftmost);  /* sort lower part */
+    lo = p + 1;  /* and iterate over the upper one */
+    leftmost = 0;
+  }
+}
+
+#else					/* }{ */
+
 /*
 ** Does the partition: Pivot P is at the top of the stack.
 ** precondition: a[lo] <= P == a[up-1] <= a[up],
@@ -395,6 +709,8 @@ static void auxsort (lua_State *L, IdxT lo, IdxT up,
   }  /* tail call auxsort(L, lo, up, rnd) */
 }
 
+#endif					/* } */
+
 
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
@@ -403,7 +719,15 @@ static int sort (lua_State *L) {
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
+#if defined(LUA_USE_PDQSORT)
+    if (!lua_isnil(L, 2) || !lua_sortarray(L, 1, n)) {  /* not native? */
+      int bad = 0;
+      while (((IdxT)n >> bad) > 1) bad++;  /* allow log2(n) bad partitions */
+      pdqsort(L, 1, (IdxT)n + 1, bad, 1);
+    }
+#else
     auxsort(L, 1, (IdxT)n, 0);
+#endif
   }
   return 0;
 }
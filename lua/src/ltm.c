@@ -55,12 +55,17 @@ void luaT_init (lua_State *L) {
 
 /*
 ** function to be used with macro "fasttm": optimized for absence of
-** tag methods
+** tag methods. (Frozen tables are shared by threads and read only; they
+** got their cache when frozen, see 'freezelist'.)
 */
 const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
   const TValue *tm = luaH_getshortstr(events, ename);
   lua_assert(event <= TM_EQ);
   if (notm(tm)) {  /* no tag method? */
+#if defined(LUA_USE_FROZEN)
+    if (isfrozen(events))
+      return NULL;  /* read only */
+#endif
     events->flags |= cast_byte(1u<<event);  /* cache this fact */
     return NULL;
   }
@@ -94,7 +99,7 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
     const TValue *name = luaH_getshortstr(mt, luaS_new(L, "__name"));
     if (ttisstring(name))  /* is '__name' a string? */
-      return getstr(tsvalue(name));  /* use it as type name */
+      return getstr(luaS_tostr(L, name));  /* use it as type name */
   }
   return ttypename(ttype(o));  /* else use standard type name */
 }
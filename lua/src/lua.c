@@ -812,7 +812,11 @@ static int pmain (lua_State *L) {
 
 int main (int argc, char **argv) {
   int status, result;
+#if defined(LUA_USE_SLABALLOC)
+  lua_State *L = luaL_newslabstate();  /* create state */
+#else
   lua_State *L = luaL_newstate();  /* create state */
+#endif
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
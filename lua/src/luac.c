@@ -34,6 +34,9 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+#if defined(LUA_USE_MMAPLOAD)
+static int aligning=0;			/* align code arrays? */
+#endif
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -63,6 +66,9 @@ static void usage(const char* message)
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
+#if defined(LUA_USE_MMAPLOAD)
+  "  -a       align code for loading by mapping (mode 'm')\n"
+#endif
   "  -s       strip debug information\n"
   "  -v       show version information\n"
   "  --       stop handling options\n"
@@ -101,6 +107,10 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-p"))			/* parse only */
    dumping=0;
+#if defined(LUA_USE_MMAPLOAD)
+  else if (IS("-a"))			/* align code */
+   aligning=1;
+#endif
   else if (IS("-s"))			/* strip debug information */
    stripping=1;
   else if (IS("-v"))			/* show version */
@@ -185,7 +195,11 @@ static int pmain(lua_State* L)
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
+#if defined(LUA_USE_MMAPLOAD)
+  luaU_dump(L,f,writer,D,(stripping ? LUAU_STRIP : 0)|(aligning ? LUAU_ALIGN : 0));
+#else
   luaU_dump(L,f,writer,D,stripping);
+#endif
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
@@ -352,7 +366,7 @@ static void PrintCode(const Proto* f)
   printf("\t%d\t",pc+1);
   if (line>0) printf("[%d]\t",line); else printf("[-]\t");
   printf("%-9s\t",opnames[o]);
-  switch (o)
+  switch (luaP_baseop(o))	/* superinstructions show their first operand */
   {
    case OP_MOVE:
 	printf("%d %d",a,b);
@@ -650,6 +664,10 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+#if defined(LUA_USE_QUICKENING)
+   default:	/* superinstructions; not reached (see 'luaP_baseop') */
+	break;
+#endif
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
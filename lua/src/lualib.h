@@ -44,6 +44,21 @@ LUAMOD_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUAMOD_API int (luaopen_package) (lua_State *L);
 
+#if defined(LUA_USE_JIT)
+#define LUA_JITLIBNAME	"jit"
+LUAMOD_API int (luaopen_jit) (lua_State *L);
+#endif
+
+#if defined(LUA_USE_WORKERS)
+#define LUA_WORKLIBNAME	"worker"
+LUAMOD_API int (luaopen_worker) (lua_State *L);
+#endif
+
+#if defined(LUA_USE_AIO)
+#define LUA_AIOLIBNAME	"aio"
+LUAMOD_API int (luaopen_aio) (lua_State *L);
+#endif
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
@@ -34,9 +34,21 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+#if defined(LUA_USE_MMAPLOAD)
+  Mapping *map;  /* chunk being loaded, if mapped */
+  size_t offset;  /* bytes read from the chunk */
+  int aligned;  /* chunk has format LUAC_FORMATALIGNED */
+#endif
 } LoadState;
 
 
+#if defined(LUA_USE_MMAPLOAD)
+#define addoffset(S,n)	((S)->offset += (n))
+#else
+#define addoffset(S,n)	((void)0)
+#endif
+
+
 static l_noret error (LoadState *S, const char *why) {
   luaO_pushfstring(S->L, "%s: bad binary format (%s)", S->name, why);
   luaD_throw(S->L, LUA_ERRSYNTAX);
@@ -52,6 +64,7 @@ static l_noret error (LoadState *S, const char *why) {
 static void loadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated chunk");
+  addoffset(S, size);
 }
 
 
@@ -62,6 +75,7 @@ static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
     error(S, "truncated chunk");
+  addoffset(S, 1);
   return cast_byte(b);
 }
 
@@ -141,11 +155,52 @@ static TString *loadString (LoadState *S, Proto *p) {
 }
 
 
+#if defined(LUA_USE_MMAPLOAD)
+
+/*
+** Returns the address of the next 'size' bytes of a mapped chunk,
+** skipping them, if they are aligned to 'align'; otherwise returns
+** NULL and they must be copied.
+*/
+static void *loadMapped (LoadState *S, size_t size, size_t align) {
+  ZIO *Z = S->Z;
+  if (S->map != NULL && size > 0 && Z->n >= size &&
+      ((L_P2I)Z->p & (align - 1)) == 0) {
+    void *b = S->map->base + (Z->p - S->map->base);  /* drop 'const' */
+    Z->p += size;
+    Z->n -= size;
+    addoffset(S, size);
+    return b;
+  }
+  return NULL;
+}
+
+
+static void loadCode (LoadState *S, Proto *f) {
+  int n = loadInt(S);
+  if (S->aligned) {  /* skip padding before the code */
+    while (S->offset % sizeof(Instruction) != 0)
+      loadByte(S);
+  }
+  f->code = cast(Instruction *, loadMapped(S, n * sizeof(Instruction),
+                                              sizeof(Instruction)));
+  if (f->code != NULL)
+    f->sizecode = n;
+  else {
+    f->code = luaM_newvectorchecked(S->L, n, Instruction);
+    f->sizecode = n;
+    loadVector(S, f->code, n);
+  }
+#else
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
   f->code = luaM_newvectorchecked(S->L, n, Instruction);
   f->sizecode = n;
   loadVector(S, f->code, n);
+#endif
+#if defined(LUA_USE_INLINECACHE)
+  luaF_initicache(S->L, f);
+#endif
 }
 
 
@@ -227,9 +282,17 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+#if defined(LUA_USE_MMAPLOAD)
+  f->lineinfo = cast(ls_byte *, loadMapped(S, n, 1));
+  if (f->lineinfo != NULL)
+    f->sizelineinfo = n;
+  else
+#endif
+  {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
   n = loadInt(S);
   f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
   f->sizeabslineinfo = n;
@@ -256,6 +319,12 @@ static void loadDebug (LoadState *S, Proto *f) {
 
 
 static void loadFunction (LoadState *S, Proto *f, TString *psource) {
+#if defined(LUA_USE_MMAPLOAD)
+  if (S->map != NULL) {  /* keep the mapping while 'f' lives */
+    f->mapping = S->map;
+    S->map->refs++;
+  }
+#endif
   f->source = loadStringN(S, f);
   if (f->source == NULL)  /* no source in dump? */
     f->source = psource;  /* reuse parent's source */
@@ -294,8 +363,17 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
   if (loadByte(S) != LUAC_VERSION)
     error(S, "version mismatch");
+#if defined(LUA_USE_MMAPLOAD)
+  {
+    int format = loadByte(S);
+    S->aligned = (format == LUAC_FORMATALIGNED);
+    if (format != LUAC_FORMAT && !S->aligned)
+      error(S, "format mismatch");
+  }
+#else
   if (loadByte(S) != LUAC_FORMAT)
     error(S, "format mismatch");
+#endif
   checkliteral(S, LUAC_DATA, "corrupted chunk");
   checksize(S, Instruction);
   checksize(S, lua_Integer);
@@ -321,6 +399,10 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+#if defined(LUA_USE_MMAPLOAD)
+  S.map = (Z->reader == luaU_mapreader) ? cast(Mapping *, Z->data) : NULL;
+  S.offset = 1;  /* 1st char was read by the caller */
+#endif
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top.p, cl);
@@ -333,3 +415,32 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
   return cl;
 }
 
+
+
+#if defined(LUA_USE_MMAPLOAD)
+
+/*
+** Reader for a mapped chunk: gives the whole chunk at once. 'luaU_undump'
+** recognizes it to load arrays in place.
+*/
+const char *luaU_mapreader (lua_State *L, void *ud, size_t *size) {
+  Mapping *m = cast(Mapping *, ud);
+  UNUSED(L);
+  if (m->given)
+    return NULL;
+  m->given = 1;
+  *size = m->size;
+  return m->base;
+}
+
+
+void luaU_unmap (lua_State *L, Mapping *m) {
+  lua_assert(m->refs > 0);
+  if (--m->refs == 0) {
+    if (m->release != NULL)
+      (*m->release)(m->base, m->size);
+    luaM_free(L, m);
+  }
+}
+
+#endif
@@ -25,6 +25,35 @@
 
 #define LUAC_FORMAT	0	/* this is the official format */
 
+#if defined(LUA_USE_MMAPLOAD)
+/* format with code arrays aligned to their size, for mapped loading */
+#define LUAC_FORMATALIGNED	1
+
+/* options for 'luaU_dump' */
+#define LUAU_STRIP	1	/* strip debug information */
+#define LUAU_ALIGN	2	/* use LUAC_FORMATALIGNED */
+
+/*
+** A binary chunk mapped in memory. Prototypes loaded from it point
+** to their code and line information in place, and each one keeps a
+** reference to the mapping; the loader keeps another one while it
+** runs. 'release' is called when the last reference goes.
+*/
+typedef struct Mapping {
+  char *base;
+  size_t size;
+  int refs;
+  int given;  /* whether the reader already returned the chunk */
+  void (*release) (void *base, size_t size);
+} Mapping;
+
+#define luaU_inmapping(m,a)  \
+	((a) != NULL && cast_charp(a) >= (m)->base && cast_charp(a) < (m)->base + (m)->size)
+
+LUAI_FUNC const char *luaU_mapreader (lua_State *L, void *ud, size_t *size);
+LUAI_FUNC void luaU_unmap (lua_State *L, Mapping *m);
+#endif
+
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 
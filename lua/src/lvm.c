@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -209,6 +210,12 @@ static int forprep (lua_State *L, StkId ra) {
   TValue *pinit = s2v(ra);
   TValue *plimit = s2v(ra + 1);
   TValue *pstep = s2v(ra + 2);
+#if defined(LUA_USE_ROPES)
+  /* numerals must be built to be converted */
+  cast_void(luaS_flatvalue(L, pinit, pinit));
+  cast_void(luaS_flatvalue(L, plimit, plimit));
+  cast_void(luaS_flatvalue(L, pstep, pstep));
+#endif
   if (ttisinteger(pinit) && ttisinteger(pstep)) { /* integer loop? */
     lua_Integer init = ivalue(pinit);
     lua_Integer step = ivalue(pstep);
@@ -290,6 +297,16 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+#if defined(LUA_USE_ROPES)
+  TValue aux;
+  if (l_unlikely(ttisrope(key))) {  /* only its contents can match a key */
+    key = cast(TValue *, luaS_flatvalue(L, key, &aux));
+    if (slot != NULL && !isempty(slot = luaH_get(hvalue(t), key))) {
+      setobj2s(L, val, slot);  /* found it */
+      return;
+    }
+  }
+#endif
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == NULL) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
@@ -332,11 +349,25 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      TValue *val, const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
+#if defined(LUA_USE_ROPES)
+  TValue aux;
+  if (l_unlikely(ttisrope(key))) {  /* only its contents can match a key */
+    key = cast(TValue *, luaS_flatvalue(L, key, &aux));
+    if (slot != NULL && luaV_fastset(L, t, key, slot, luaH_get)) {
+      luaV_finishfastset(L, t, slot, val);  /* found it */
+      return;
+    }
+  }
+#endif
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
+#if defined(LUA_USE_FROZEN)
+      lua_assert(isempty(slot) || isfrozen(h));  /* see 'luaV_fastset' */
+#else
       lua_assert(isempty(slot));  /* slot must be empty */
+#endif
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
       if (tm == NULL) {  /* no metamethod? */
         sethvalue2s(L, L->top.p, h);  /* anchor 't' */
@@ -360,7 +391,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
       return;
     }
     t = tm;  /* else repeat assignment over 'tm' */
-    if (luaV_fastget(L, t, key, slot, luaH_get)) {
+    if (luaV_fastset(L, t, key, slot, luaH_get)) {
       luaV_finishfastset(L, t, slot, val);
       return;  /* done */
     }
@@ -527,7 +558,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(luaS_tostr(L, l), luaS_tostr(L, r)) < 0;
   else
     return luaT_callorderTM(L, l, r, TM_LT);
 }
@@ -549,7 +580,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(luaS_tostr(L, l), luaS_tostr(L, r)) <= 0;
   else
     return luaT_callorderTM(L, l, r, TM_LE);
 }
@@ -565,12 +596,276 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
 }
 
 
+/*
+** {==================================================================
+** Native sorting (LUA_USE_PDQSORT)
+** ===================================================================
+*/
+#if defined(LUA_USE_PDQSORT)
+
+/*
+** Pattern-defeating quicksort (Orson Peters) of the array part of a
+** table whose elements are all of one kind, with the default order
+** '<'. Elements are moved in place; as they only change places in the
+** same table, there is no need for barriers.
+*/
+
+/* kinds of arrays sorted natively */
+#define SORTINT		0	/* integers */
+#define SORTFLT		1	/* floats (without NaNs) */
+#define SORTSTR		2	/* strings (without ropes) */
+
+/* below this size, use insertion sort */
+#define PDQINSERT	24
+
+/* above this size, choose pivots with Tukey's ninther */
+#define PDQNINTHER	128
+
+/* maximum number of moves in a partial insertion sort */
+#define PDQPARTIAL	8
+
+
+l_sinline int sortlt (int kind, const TValue *a, const TValue *b) {
+  switch (kind) {
+    case SORTINT: return ivalue(a) < ivalue(b);
+    case SORTFLT: return luai_numlt(fltvalue(a), fltvalue(b));
+    default: return (tsvalue(a) != tsvalue(b) &&
+                     l_strcmp(tsvalue(a), tsvalue(b)) < 0);
+  }
+}
+
+
+l_sinline void sortswap (lua_State *L, TValue *a, TValue *b) {
+  TValue temp;
+  setobj(L, &temp, a);
+  setobj(L, a, b);
+  setobj(L, b, &temp);
+}
+
+
+/* sort 'a', 'b', and 'c' */
+static void sort3 (lua_State *L, int kind, TValue *a, TValue *b, TValue *c) {
+  if (sortlt(kind, b, a)) sortswap(L, a, b);
+  if (sortlt(kind, c, b)) {
+    sortswap(L, b, c);
+    if (sortlt(kind, b, a)) sortswap(L, a, b);
+  }
+}
+
+
+/*
+** Insertion sort of [lo, up). When not 'leftmost', 'lo[-1]' is not
+** greater than any element in the interval, so it stops the search.
+** Gives up (returning 0) after moving more than 'limit' elements.
+*/
+static int insertsort (lua_State *L, int kind, TValue *lo, TValue *up,
+                       int leftmost, size_t limit) {
+  TValue *i;
+  size_t moved = 0;
+  for (i = lo + 1; i < up; i++) {
+    if (sortlt(kind, i, i - 1)) {
+      TValue temp;
+      TValue *j = i;
+      setobj(L, &temp, i);
+      do {  /* move greater elements up */
+        setobj(L, j, j - 1);
+        j--;
+      } while ((!leftmost || j > lo) && sortlt(kind, &temp, j - 1));
+      setobj(L, j, &temp);
+      moved += cast_sizet(i - j);
+      if (moved > limit)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Partition [lo, up) around the pivot at 'lo', putting elements equal
+** to it to the right; return the final position of the pivot and
+** whether the interval was already partitioned.
+*/
+static TValue *partright (lua_State *L, int kind, TValue *lo, TValue *up,
+                          int *done) {
+  TValue pivot;
+  TValue *i = lo;
+  TValue *j = up;
+  setobj(L, &pivot, lo);
+  while (sortlt(kind, ++i, &pivot)) ;  /* median of 3 bounds it */
+  if (i - 1 == lo)
+    while (i < j && !sortlt(kind, --j, &pivot)) ;
+  else
+    while (!sortlt(kind, --j, &pivot)) ;  /* 'i - 1' bounds it */
+  *done = (i >= j);
+  while (i < j) {
+    sortswap(L, i, j);
+    while (sortlt(kind, ++i, &pivot)) ;
+    while (!sortlt(kind, --j, &pivot)) ;
+  }
+  setobj(L, lo, i - 1);
+  setobj(L, i - 1, &pivot);
+  return i - 1;
+}
+
+
+/*
+** Partition [lo, up) around the pivot at 'lo', putting elements equal
+** to it to the left. Used when 'lo[-1]' is equal to the pivot, so that
+** many repeated elements take linear time.
+*/
+static TValue *partleft (lua_State *L, int kind, TValue *lo, TValue *up) {
+  TValue pivot;
+  TValue *i = lo;
+  TValue *j = up;
+  setobj(L, &pivot, lo);
+  while (sortlt(kind, &pivot, --j)) ;
+  if (j + 1 == up)
+    while (i < j && !sortlt(kind, &pivot, ++i)) ;
+  else
+    while (!sortlt(kind, &pivot, ++i)) ;
+  while (i < j) {
+    sortswap(L, i, j);
+    while (sortlt(kind, &pivot, --j)) ;
+    while (!sortlt(kind, &pivot, ++i)) ;
+  }
+  setobj(L, lo, j);
+  setobj(L, j, &pivot);
+  return j;
+}
+
+
+static void heapsort (lua_State *L, int kind, TValue *a, size_t n) {
+  size_t k = n / 2;
+  for (;;) {
+    size_t i, c;
+    if (k > 0)  /* building the heap? */
+      i = --k;
+    else if (--n > 0) {  /* move the maximum to the end */
+      sortswap(L, a, a + n);
+      i = 0;
+    }
+    else
+      return;
+    while ((c = 2 * i + 1) < n) {  /* sift 'a[i]' down */
+      if (c + 1 < n && sortlt(kind, a + c, a + c + 1)) c++;
+      if (!sortlt(kind, a + i, a + c)) break;
+      sortswap(L, a + i, a + c);
+      i = c;
+    }
+  }
+}
+
+
+/* swap elements near the ends of an unbalanced partition */
+static void breakpatterns (lua_State *L, TValue *lo, TValue *up) {
+  size_t n = cast_sizet(up - lo);
+  if (n >= PDQINSERT) {
+    sortswap(L, lo, lo + n / 4);
+    sortswap(L, up - 1, up - n / 4);
+    if (n > PDQNINTHER) {
+      sortswap(L, lo + 1, lo + (n / 4 + 1));
+      sortswap(L, lo + 2, lo + (n / 4 + 2));
+      sortswap(L, up - 2, up - (n / 4 + 1));
+      sortswap(L, up - 3, up - (n / 4 + 2));
+    }
+  }
+}
+
+
+static void pdqsort (lua_State *L, int kind, TValue *lo, TValue *up,
+                     int bad, int leftmost) {
+  for (;;) {
+    size_t n = cast_sizet(up - lo);
+    size_t half = n / 2;
+    TValue *p;
+    int done;
+    if (n < PDQINSERT) {
+      insertsort(L, kind, lo, up, leftmost, MAX_SIZET);
+      return;
+    }
+    if (n > PDQNINTHER) {  /* pivot is the median of medians */
+      sort3(L, kind, lo, lo + half, up - 1);
+      sort3(L, kind, lo + 1, lo + (half - 1), up - 2);
+      sort3(L, kind, lo + 2, lo + (half + 1), up - 3);
+      sort3(L, kind, lo + (half - 1), lo + half, lo + (half + 1));
+      sortswap(L, lo, lo + half);
+    }
+    else
+      sort3(L, kind, lo + half, lo, up - 1);
+    if (!leftmost && !sortlt(kind, lo - 1, lo)) {  /* equal to lo[-1]? */
+      lo = partleft(L, kind, lo, up) + 1;  /* skip elements equal to it */
+      continue;
+    }
+    p = partright(L, kind, lo, up, &done);
+    if (cast_sizet(p - lo) < n / 8 || cast_sizet(up - p - 1) < n / 8) {
+      if (--bad == 0) {  /* too many bad partitions? */
+        heapsort(L, kind, lo, n);  /* guarantee O(n log n) */
+        return;
+      }
+      breakpatterns(L, lo, p);
+      breakpatterns(L, p + 1, up);
+    }
+    else if (done &&  /* no swaps? try to finish with insertion sorts */
+             insertsort(L, kind, lo, p, leftmost, PDQPARTIAL) &&
+             insertsort(L, kind, p + 1, up, 0, PDQPARTIAL))
+      return;
+    pdqsort(L, kind, lo, p, bad, leftmost);  /* sort lower part */
+    lo = p + 1;  /* and iterate over the upper one */
+    leftmost = 0;
+  }
+}
+
+
+/*
+** Sort 't[1..n]' with the default order, if all these elements are in
+** the array part and are all integers, all floats (without NaNs), or
+** all strings. Return 0 (changing nothing) otherwise.
+*/
+int luaV_sortarray (lua_State *L, Table *t, unsigned int n) {
+  TValue *a = t->array;
+  unsigned int i;
+  int kind;
+  int bad = 0;
+#if defined(LUA_USE_FROZEN)
+  if (isfrozen(t))
+    return 0;  /* let the general path raise the error */
+#endif
+  if (n < 2 || n > luaH_realasize(t))
+    return (n < 2);
+  if (ttisinteger(a)) kind = SORTINT;
+  else if (ttisfloat(a)) kind = SORTFLT;
+  else if (ttisshrstring(a) || ttislngstring(a)) kind = SORTSTR;
+  else return 0;
+  for (i = 0; i < n; i++) {  /* check that elements are homogeneous */
+    const TValue *o = &a[i];
+    switch (kind) {
+      case SORTINT: if (!ttisinteger(o)) return 0; break;
+      case SORTFLT:
+        if (!ttisfloat(o) || luai_numisnan(fltvalue(o))) return 0;
+        break;
+      default: if (!ttisshrstring(o) && !ttislngstring(o)) return 0;
+    }
+  }
+  while ((n >> bad) > 1) bad++;  /* log2(n) bad partitions allowed */
+  pdqsort(L, kind, a, a + n, bad, 1);
+  return 1;
+}
+
+#endif
+/* }================================================================== */
+
+
 /*
 ** Main operation for equality of Lua values; return 't1 == t2'.
 ** L == NULL means raw equality (no metamethods)
 */
 int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
   const TValue *tm;
+#if defined(LUA_USE_ROPES)
+  if (l_unlikely(ttisrope(t1) || ttisrope(t2)))  /* lazy concatenation? */
+    return (ttisstring(t1) && ttisstring(t2) && luaS_eqrope(L, t1, t2));
+#endif
   if (ttypetag(t1) != ttypetag(t2)) {  /* not the same variant? */
     if (ttype(t1) != ttype(t2) || ttype(t1) != LUA_TNUMBER)
       return 0;  /* only numbers can be equal with different variants */
@@ -631,9 +926,16 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
 static void copy2buff (StkId top, int n, char *buff) {
   size_t tl = 0;  /* size already copied */
   do {
-    TString *st = tsvalue(s2v(top - n));
-    size_t l = tsslen(st);  /* length of string being copied */
-    memcpy(buff + tl, getstr(st), l * sizeof(char));
+    const TValue *o = s2v(top - n);
+    size_t l = vslen(o);  /* length of string being copied */
+#if defined(LUA_USE_ROPES)
+    if (ttisrope(o))
+      luaS_copyrope(ropevalue(o), buff + tl);
+    else
+      memcpy(buff + tl, getstr(tsvalue(o)), l * sizeof(char));
+#else
+    memcpy(buff + tl, getstr(tsvalue(o)), l * sizeof(char));
+#endif
     tl += l;
   } while (--n > 0);
 }
@@ -659,11 +961,10 @@ void luaV_concat (lua_State *L, int total) {
     }
     else {
       /* at least two non-empty string values; get as many as possible */
-      size_t tl = tsslen(tsvalue(s2v(top - 1)));
-      TString *ts;
+      size_t tl = vslen(s2v(top - 1));
       /* collect total length and number of strings */
       for (n = 1; n < total && tostring(L, s2v(top - n - 1)); n++) {
-        size_t l = tsslen(tsvalue(s2v(top - n - 1)));
+        size_t l = vslen(s2v(top - n - 1));
         if (l_unlikely(l >= MAX_SIZE - sizeof(TString) - tl)) {
           L->top.p = top - total;  /* pop strings to avoid wasting stack */
           luaG_runerror(L, "string length overflow");
@@ -673,13 +974,17 @@ void luaV_concat (lua_State *L, int total) {
       if (tl <= LUAI_MAXSHORTLEN) {  /* is result a short string? */
         char buff[LUAI_MAXSHORTLEN];
         copy2buff(top, n, buff);  /* copy strings to buffer */
-        ts = luaS_newlstr(L, buff, tl);
+        setsvalue2s(L, top - n, luaS_newlstr(L, buff, tl));
       }
+#if defined(LUA_USE_ROPES)
+      else if (tl >= LUAI_ROPEMIN && luaS_newrope(L, top, n, tl))
+        lua_assert(ttisrope(s2v(top - n)));  /* contents built on demand */
+#endif
       else {  /* long string; copy strings directly to final result */
-        ts = luaS_createlngstrobj(L, tl);
+        TString *ts = luaS_createlngstrobj(L, tl);
         copy2buff(top, n, getlngstr(ts));
+        setsvalue2s(L, top - n, ts);  /* create result */
       }
-      setsvalue2s(L, top - n, ts);  /* create result */
     }
     total -= n - 1;  /* got 'n' strings to create one new */
     L->top.p -= n - 1;  /* popped 'n' strings and pushed one */
@@ -708,6 +1013,12 @@ void luaV_objlen (lua_State *L, StkId ra, const TValue *rb) {
       setivalue(s2v(ra), tsvalue(rb)->u.lnglen);
       return;
     }
+#if defined(LUA_USE_ROPES)
+    case LUA_VROPE: {  /* length does not need the contents */
+      setivalue(s2v(ra), ropevalue(rb)->len);
+      return;
+    }
+#endif
     default: {  /* try metamethod */
       tm = luaT_gettmbyobj(L, rb, TM_LEN);
       if (l_unlikely(notm(tm)))  /* no metamethod? */
@@ -811,6 +1122,27 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+#if defined(LUA_USE_JIT)
+/*
+** Entries for the stencils of the JIT compiler (see 'ljit.c').
+*/
+int luaV_forprep (lua_State *L, StkId ra) {
+  return forprep(L, ra);
+}
+
+
+int luaV_floatforloop (StkId ra) {
+  return floatforloop(ra);
+}
+
+
+void luaV_pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
+                       StkId ra) {
+  pushclosure(L, p, encup, base, ra);
+}
+#endif
+
+
 /*
 ** finish execution of an opcode interrupted by a yield
 */
@@ -818,7 +1150,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
       setobjs2s(L, base + GETARG_A(*(ci->u.l.savedpc - 2)), --L->top.p);
@@ -880,6 +1212,43 @@ void luaV_finishOp (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_QUICKENING)
+/*
+** Rewrite common pairs of instructions of a (hot) function into
+** superinstructions. Only the opcode of the first instruction of each
+** pair changes, so the rewrite is safe even while the function is
+** active in other frames.
+*/
+void luaV_quicken (Proto *p) {
+  int pc;
+  for (pc = 0; pc + 1 < p->sizecode; pc++) {
+    Instruction *i = &p->code[pc];
+    OpCode next = GET_OPCODE(*(i + 1));
+    switch (GET_OPCODE(*i)) {
+      case OP_GETUPVAL: {
+        if (next == OP_GETFIELD)
+          SET_OPCODE(*i, OP_GETUPVAL_GETFIELD);
+        break;
+      }
+      case OP_GETTABUP: {
+        if (next == OP_GETFIELD)
+          SET_OPCODE(*i, OP_GETTABUP_GETFIELD);
+        break;
+      }
+      case OP_MOVE: {
+        if (next == OP_CALL)
+          SET_OPCODE(*i, OP_MOVE_CALL);
+        break;
+      }
+      default: continue;
+    }
+    if (GET_OPCODE(*i) != luaP_baseop(GET_OPCODE(*i)))
+      pc++;  /* second instruction of a pair cannot start another one */
+  }
+}
+#endif
+
+
 
 
 /*
@@ -1092,7 +1461,9 @@ void luaV_finishOp (lua_State *L) {
 
 
 /* for test instructions, execute the jump instruction that follows it */
-#define donextjump(ci)	{ Instruction ni = *pc; dojump(ci, ni, 1); }
+#define donextjump(ci)  \
+	{ Instruction ni = *pc; dojump(ci, ni, 1); \
+	  if (GETARG_sJ(ni) < 0) jitbackedge(); }
 
 /*
 ** do a conditional jump: skip next instruction if 'cond' is not what
@@ -1151,6 +1522,67 @@ void luaV_finishOp (lua_State *L) {
 #define vmbreak		break
 
 
+/*
+** Go to the second instruction of a superinstruction, without a new
+** dispatch. With hooks active, let 'vmfetch' handle it as usual.
+*/
+#define nextinpair()	{ if (l_unlikely(trap)) { vmbreak; } i = *(pc++); }
+
+
+/* label of an opcode body that superinstructions continue into */
+#if defined(LUA_USE_QUICKENING)
+#define pairlabel(l)	l:
+#else
+#define pairlabel(l)	/* empty */
+#endif
+
+
+/*
+** Count a loop of the running function for the JIT compiler. If the
+** function has native code, run the loop (from the instruction that
+** prepares it) there.
+*/
+#if defined(LUA_USE_JIT)
+#define jitloop()  \
+	{ luaJ_checkhot(L, cl->p); \
+	  if (cl->p->jit != NULL && !trap) { \
+	    ci->u.l.savedpc = pc - 1; goto returning; } }
+#else
+#define jitloop()	((void)0)
+#endif
+
+
+/*
+** Count a backward jump of the running function, after 'pc' was set to
+** its target. A function that becomes hot in a loop continues in native
+** code from that target, so that long loops run natively even in
+** functions called only once (such as main chunks).
+*/
+#if defined(LUA_USE_JIT)
+#define jitbackedge()  \
+	{ if (l_unlikely(cl->p->jitcount < LUAI_JITHOT)) { \
+	    luaJ_checkhot(L, cl->p); \
+	    if (cl->p->jit != NULL && !trap) { \
+	      ci->u.l.savedpc = pc; goto returning; } } }
+#else
+#define jitbackedge()	((void)0)
+#endif
+
+
+/*
+** Raw access to a global (a field of an upvalue) with a short-string
+** key, using the inline cache of the instruction being executed when
+** available. (Other fields have no caches: for them, checking a cache
+** costs more than it saves.)
+*/
+#if defined(LUA_USE_INLINECACHE)
+#define globalgetshortstr(t,key)  \
+	luaV_getshortstrIC(L, t, key, luaF_icache(cl->p, pcRel(pc, cl->p)))
+#else
+#define globalgetshortstr(t,key)	luaH_getshortstr(t, key)
+#endif
+
+
 void luaV_execute (lua_State *L, CallInfo *ci) {
   LClosure *cl;
   TValue *k;
@@ -1162,12 +1594,28 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
 #endif
  startfunc:
   trap = L->hookmask;
+  luaV_checkquicken(ci_func(ci)->p);
+  luaJ_checkhot(L, ci_func(ci)->p);
  returning:  /* trap already set */
   cl = ci_func(ci);
   k = cl->p->k;
   pc = ci->u.l.savedpc;
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
+#if defined(LUA_USE_JIT)
+  else if (cl->p->jit != NULL) {  /* run native code */
+    int n = luaJ_execute(L, ci, cl->p, pc);
+    if (n == JITRETURN)  /* returned from the fresh frame? */
+      return;  /* end this execution */
+    ci = L->ci;  /* native code may have changed frames */
+    if (n == JITNEWFRAME)  /* frame not compiled? */
+      goto startfunc;  /* run it from its saved pc */
+    cl = ci_func(ci);
+    k = cl->p->k;
+    pc = cl->p->code + n;  /* continue here in the interpreter */
+    trap = ci->u.l.trap;
+  }
+#endif
   base = ci->func.p + 1;
   /* main loop of interpreter */
   for (;;) {
@@ -1255,7 +1703,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (luaV_fastget(L, upval, key, slot, globalgetshortstr)) {
           setobj2s(L, ra, slot);
         }
         else
@@ -1293,6 +1741,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETFIELD) {
+       pairlabel(l_getfield) {
         StkId ra = RA(i);
         const TValue *slot;
         TValue *rb = vRB(i);
@@ -1304,14 +1753,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         else
           Protect(luaV_finishget(L, rb, rc, ra, slot));
         vmbreak;
-      }
+      }}
       vmcase(OP_SETTABUP) {
         const TValue *slot;
         TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (luaV_fastset(L, upval, key, slot, globalgetshortstr)) {
           luaV_finishfastset(L, upval, slot, rc);
         }
         else
@@ -1325,8 +1774,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);  /* value */
         lua_Unsigned n;
         if (ttisinteger(rb)  /* fast track for integers? */
-            ? (cast_void(n = ivalue(rb)), luaV_fastgeti(L, s2v(ra), n, slot))
-            : luaV_fastget(L, s2v(ra), rb, slot, luaH_get)) {
+            ? (cast_void(n = ivalue(rb)), luaV_fastseti(L, s2v(ra), n, slot))
+            : luaV_fastset(L, s2v(ra), rb, slot, luaH_get)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
@@ -1338,7 +1787,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         const TValue *slot;
         int c = GETARG_B(i);
         TValue *rc = RKC(i);
-        if (luaV_fastgeti(L, s2v(ra), c, slot)) {
+        if (luaV_fastseti(L, s2v(ra), c, slot)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else {
@@ -1354,7 +1803,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {
+        if (luaV_fastset(L, s2v(ra), key, slot, luaH_getshortstr)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
@@ -1375,6 +1824,11 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         L->top.p = ra + 1;  /* correct top in case of emergency GC */
         t = luaH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
+#if defined(LUA_USE_SHAPES)
+        if (c == 0)  /* only record fields? */
+          luaH_newrecord(L, t, b);  /* idem */
+        else
+#endif
         if (b != 0 || c != 0)
           luaH_resize(L, t, c, b);  /* idem */
         checkGC(L, ra + 1);
@@ -1601,6 +2055,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sJ(i) < 0)
+          jitbackedge();
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1674,6 +2130,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_CALL) {
+       pairlabel(l_call) {
         StkId ra = RA(i);
         CallInfo *newci;
         int b = GETARG_B(i);
@@ -1689,7 +2146,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           goto startfunc;
         }
         vmbreak;
-      }
+      }}
       vmcase(OP_TAILCALL) {
         StkId ra = RA(i);
         int b = GETARG_B(i);  /* number of arguments + 1 (function) */
@@ -1796,15 +2253,20 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), idx);  /* update internal index */
             setivalue(s2v(ra + 3), idx);  /* and control variable */
             pc -= GETARG_Bx(i);  /* jump back */
+            jitbackedge();
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (floatforloop(ra)) {  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
+          jitbackedge();
+        }
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
       }
       vmcase(OP_FORPREP) {
         StkId ra = RA(i);
+        luaV_checkquicken(cl->p);
+        jitloop();
         savestate(L, ci);  /* in case of errors */
         if (forprep(L, ra))
           pc += GETARG_Bx(i) + 1;  /* skip the loop */
@@ -1812,6 +2274,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_TFORPREP) {
        StkId ra = RA(i);
+        luaV_checkquicken(cl->p);
+        jitloop();
         /* create to-be-closed upvalue (if needed) */
         halfProtect(luaF_newtbcupval(L, ra + 3));
         pc += GETARG_Bx(i);
@@ -1842,6 +2306,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
+          jitbackedge();
         }
         vmbreak;
       }}
@@ -1895,6 +2360,38 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+#if defined(LUA_USE_QUICKENING)
+      vmcase(OP_GETUPVAL_GETFIELD) {
+        StkId ra = RA(i);
+        int b = GETARG_B(i);
+        setobj2s(L, ra, cl->upvals[b]->v.p);
+        nextinpair();
+        lua_assert(GET_OPCODE(i) == OP_GETFIELD);
+        goto l_getfield;
+      }
+      vmcase(OP_GETTABUP_GETFIELD) {
+        StkId ra = RA(i);
+        const TValue *slot;
+        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
+        TValue *rc = KC(i);
+        TString *key = tsvalue(rc);  /* key must be a short string */
+        if (luaV_fastget(L, upval, key, slot, globalgetshortstr)) {
+          setobj2s(L, ra, slot);
+        }
+        else
+          Protect(luaV_finishget(L, upval, rc, ra, slot));
+        nextinpair();
+        lua_assert(GET_OPCODE(i) == OP_GETFIELD);
+        goto l_getfield;
+      }
+      vmcase(OP_MOVE_CALL) {
+        StkId ra = RA(i);
+        setobjs2s(L, ra, RB(i));
+        nextinpair();
+        lua_assert(GET_OPCODE(i) == OP_CALL);
+        goto l_call;
+      }
+#endif
     }
   }
 }
@@ -10,6 +10,7 @@
 
 #include "ldo.h"
 #include "lobject.h"
+#include "ltable.h"
 #include "ltm.h"
 
 
@@ -102,7 +103,23 @@ typedef enum {
 
 
 /*
-** Finish a fast set operation (when fast get succeeds). In that case,
+** Fast track for 'settable': like 'luaV_fastget', but it fails for
+** frozen tables, so that the store goes to 'luaV_finishset', which
+** raises the error.
+*/
+#if defined(LUA_USE_FROZEN)
+#define luaV_fastset(L,t,k,slot,f) \
+  (luaV_fastget(L,t,k,slot,f) && !isfrozen(hvalue(t)))
+#define luaV_fastseti(L,t,k,slot) \
+  (luaV_fastgeti(L,t,k,slot) && !isfrozen(hvalue(t)))
+#else
+#define luaV_fastset(L,t,k,slot,f)	luaV_fastget(L,t,k,slot,f)
+#define luaV_fastseti(L,t,k,slot)	luaV_fastgeti(L,t,k,slot)
+#endif
+
+
+/*
+** Finish a fast set operation (when fast set succeeds). In that case,
 ** 'slot' points to the place to put the value.
 */
 #define luaV_finishfastset(L,t,slot,v) \
@@ -110,6 +127,47 @@ typedef enum {
       luaC_barrierback(L, gcvalue(t), v); }
 
 
+#if defined(LUA_USE_QUICKENING)
+/*
+** Number of times a function must be called (or must start a loop)
+** before its code is rewritten with superinstructions.
+*/
+#if !defined(LUAI_QUICKENHOT)
+#define LUAI_QUICKENHOT		2
+#endif
+
+/* count one more use of 'p' and quicken it when it becomes hot */
+#define luaV_checkquicken(p)  \
+	{ if (l_unlikely((p)->hotcount < LUAI_QUICKENHOT) && \
+	      ++(p)->hotcount == LUAI_QUICKENHOT) luaV_quicken(p); }
+#else
+#define luaV_checkquicken(p)	((void)0)
+#endif
+
+
+#if defined(LUA_USE_INLINECACHE)
+/*
+** Raw access to a field with short-string key 'key' through the inline
+** cache 'ic'; with LUAI_ICSTATS, it counts the hits and misses of the
+** cache in the global state (see 'lua_icstats').
+*/
+l_sinline const TValue *luaV_getshortstrIC (lua_State *L, Table *t,
+                                            TString *key, unsigned int *ic) {
+#if defined(LUAI_ICSTATS)
+  if (luaH_ichit(t, key, ic)) {
+    G(L)->ichits++;
+    return luaH_icval(t, ic);
+  }
+  G(L)->icmisses++;
+  return luaH_getshortstrhint(t, key, ic);
+#else
+  UNUSED(L);
+  return luaH_getshortstrIC(t, key, ic);
+#endif
+}
+#endif
+
+
 /*
 ** Shift right is the same as shift left with a negative 'y'
 */
@@ -130,6 +188,15 @@ LUAI_FUNC void luaV_finishget (lua_State *L, const TValue *t, TValue *key,
 LUAI_FUNC void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                                TValue *val, const TValue *slot);
 LUAI_FUNC void luaV_finishOp (lua_State *L);
+#if defined(LUA_USE_QUICKENING)
+LUAI_FUNC void luaV_quicken (Proto *p);
+#endif
+#if defined(LUA_USE_JIT)
+LUAI_FUNC int luaV_forprep (lua_State *L, StkId ra);
+LUAI_FUNC int luaV_floatforloop (StkId ra);
+LUAI_FUNC void luaV_pushclosure (lua_State *L, Proto *p, UpVal **encup,
+                                 StkId base, StkId ra);
+#endif
 LUAI_FUNC void luaV_execute (lua_State *L, CallInfo *ci);
 LUAI_FUNC void luaV_concat (lua_State *L, int total);
 LUAI_FUNC lua_Integer luaV_idiv (lua_State *L, lua_Integer x, lua_Integer y);
@@ -137,5 +204,8 @@ LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Number luaV_modf (lua_State *L, lua_Number x, lua_Number y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
+#if defined(LUA_USE_PDQSORT)
+LUAI_FUNC int luaV_sortarray (lua_State *L, Table *t, unsigned int n);
+#endif
 
 #endif
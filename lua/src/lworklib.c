@@ -0,0 +1,1468 @@
+/*
+** $Id: lworklib.c $
+** Worker pools, channels and blobs for parallel scripts
+** See Copyright Notice in lua.h
+*/
+
+#define lworklib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#if defined(LUA_USE_WORKERS)
+
+#include <pthread.h>
+#include <unistd.h>
+
+
+/* number of times a receiver polls an empty channel before sleeping */
+#if !defined(LUAI_WORKSPIN)
+#define LUAI_WORKSPIN	50
+#endif
+
+/* maximum nesting of tables in a message */
+#if !defined(LUAI_WORKDEPTH)
+#define LUAI_WORKDEPTH	100
+#endif
+
+/* maximum number of workers in a pool */
+#if !defined(LUAI_WORKMAX)
+#define LUAI_WORKMAX	256
+#endif
+
+/* number of loaded functions a worker keeps for later jobs */
+#if !defined(LUAI_WORKFUNCS)
+#define LUAI_WORKFUNCS	64
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define workpause()	__builtin_ia32_pause()
+#else
+#define workpause()	((void)0)
+#endif
+
+
+#define POOLMETA	"worker.pool"
+#define FUTUREMETA	"worker.future"
+#define CHANMETA	"worker.channel"
+#define BLOBMETA	"worker.blob"
+#define FROZENMETA	"worker.frozen"
+#define BOXMETA		"worker.message"
+
+/* registry keys */
+#define DUMPS		"worker.dumps"
+#define FUNCS		"worker.functions"
+#define WORKERID	"worker.id"
+
+
+static int nomem (lua_State *L) {
+  lua_pushliteral(L, "not enough memory");
+  return lua_error(L);
+}
+
+
+/*
+** Sets the metatable 'tname' for the userdata on the top, creating it
+** (with the metamethods 'meta' and the methods 'methods') the first time
+** it is needed in a state; so the C API does not need the library to
+** be open.
+*/
+static void setmeta (lua_State *L, const char *tname, const luaL_Reg *meta,
+                     const luaL_Reg *methods) {
+  if (luaL_newmetatable(L, tname)) {
+    luaL_setfuncs(L, meta, 0);
+    if (methods != NULL) {
+      lua_newtable(L);
+      luaL_setfuncs(L, methods, 0);
+      lua_setfield(L, -2, "__index");
+    }
+  }
+  lua_setmetatable(L, -2);
+}
+
+
+/*
+** {======================================================
+** Shared objects: blobs, channels and handles to frozen heaps may be
+** referred to by several states and messages at once, and are freed by
+** their last 'unref'
+** =======================================================
+*/
+
+typedef struct Shared {
+  int refs;  /* (atomic) */
+  void (*free) (struct Shared *o);
+} Shared;
+
+
+static Shared *ref (Shared *o) {
+  __atomic_fetch_add(&o->refs, 1, __ATOMIC_RELAXED);
+  return o;
+}
+
+
+static void unref (Shared *o) {
+  if (__atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    o->free(o);
+}
+
+
+/*
+** An immutable byte string outside any state. Blobs made from Lua
+** strings keep their bytes right after the header; those given by the
+** C API keep the memory of their owner and a function to release it.
+*/
+typedef struct Blob {
+  Shared h;
+  size_t size;
+  const char *data;
+  void (*release) (void *data, size_t size);
+} Blob;
+
+
+static void freeblob (Shared *o) {
+  Blob *b = (Blob *)o;
+  if (b->release)
+    b->release((void *)b->data, b->size);
+  free(b);
+}
+
+
+static Blob *newblob (const char *data, size_t size,
+                      void (*release) (void *data, size_t size)) {
+  Blob *b;
+  if (release != NULL || data == NULL) {  /* keep given memory? */
+    b = (Blob *)malloc(sizeof(Blob));
+    if (b == NULL) return NULL;
+    b->data = data;
+  }
+  else {  /* copy 'data' */
+    char *buff;
+    b = (Blob *)malloc(sizeof(Blob) + size + 1);
+    if (b == NULL) return NULL;
+    buff = (char *)(b + 1);
+    memcpy(buff, data, size);
+    buff[size] = '\0';
+    b->data = buff;
+  }
+  b->h.refs = 1;
+  b->h.free = freeblob;
+  b->size = size;
+  b->release = release;
+  return b;
+}
+
+
+#if defined(LUA_USE_FROZEN)
+/* a handle to a frozen heap (see 'luaL_freeze') */
+typedef struct Frozen {
+  Shared h;
+  lua_Frozen *heap;  /* NULL while it is being built */
+} Frozen;
+
+
+static void freefrozen (Shared *o) {
+  Frozen *f = (Frozen *)o;
+  if (f->heap != NULL)
+    lua_releasefrozen(f->heap);
+  free(f);
+}
+#endif
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Messages: values encoded in a buffer of their own, with references
+** to the shared objects among them
+** =======================================================
+*/
+
+typedef struct Msg {
+  struct Msg *next;  /* next message in a channel (atomic) */
+  struct Channel *reply;  /* where the results of a job go */
+  int status;  /* of a reply: LUA_OK or the error of the job */
+  int n;  /* number of values */
+  char *data;
+  size_t size;
+  size_t capacity;
+  Shared **refs;
+  int nrefs;
+  int sizerefs;
+} Msg;
+
+
+/* tags of encoded values */
+enum { TNIL, TFALSE, TTRUE, TINT, TFLT, TSTR, TTABLE, TEND, TFUNC, TBLOB,
+       TCHAN, TFROZEN };
+
+
+/* releases the contents of a message, leaving it empty */
+static void clearmsg (Msg *m) {
+  int i;
+  for (i = 0; i < m->nrefs; i++)
+    unref(m->refs[i]);
+  free(m->refs);
+  free(m->data);
+  m->n = 0;
+  m->data = NULL;
+  m->size = m->capacity = 0;
+  m->refs = NULL;
+  m->nrefs = m->sizerefs = 0;
+}
+
+
+static void freemsg (Msg *m) {
+  clearmsg(m);
+  if (m->reply)
+    unref((Shared *)m->reply);
+  free(m);
+}
+
+
+/*
+** Messages being built live in a box on the stack, which frees them if
+** an error interrupts the encoding.
+*/
+static int box_gc (lua_State *L) {
+  Msg **box = (Msg **)lua_touserdata(L, 1);
+  if (*box != NULL) {
+    freemsg(*box);
+    *box = NULL;
+  }
+  return 0;
+}
+
+
+static const luaL_Reg box_meta[] = {
+  {"__gc", box_gc},
+  {"__close", box_gc},
+  {NULL, NULL}
+};
+
+
+static Msg *newmsg (lua_State *L) {
+  Msg **box = (Msg **)lua_newuserdatauv(L, sizeof(Msg *), 0);
+  *box = NULL;
+  setmeta(L, BOXMETA, box_meta, NULL);
+  *box = (Msg *)calloc(1, sizeof(Msg));
+  if (*box == NULL)
+    nomem(L);
+  return *box;
+}
+
+
+/* takes the message out of its box at index 'idx' */
+static Msg *takemsg (lua_State *L, int idx) {
+  Msg **box = (Msg **)lua_touserdata(L, idx);
+  Msg *m = *box;
+  *box = NULL;
+  return m;
+}
+
+
+static void putbytes (lua_State *L, Msg *m, const void *p, size_t size) {
+  if (size > m->capacity - m->size) {
+    size_t newsize = (m->capacity > 0) ? m->capacity : 64;
+    char *data;
+    while (newsize - m->size < size) {
+      if (newsize > (~(size_t)0) / 2)
+        luaL_error(L, "message too large");
+      newsize *= 2;
+    }
+    data = (char *)realloc(m->data, newsize);
+    if (data == NULL)
+      nomem(L);
+    m->data = data;
+    m->capacity = newsize;
+  }
+  memcpy(m->data + m->size, p, size);
+  m->size += size;
+}
+
+
+#define puttag(L,m,t)	{ char t_ = (char)(t); putbytes(L, m, &t_, 1); }
+#define putvar(L,m,x)	putbytes(L, m, &(x), sizeof(x))
+
+
+static void putref (lua_State *L, Msg *m, int tag, Shared *o) {
+  if (m->nrefs == m->sizerefs) {
+    int newsize = (m->sizerefs > 0) ? 2 * m->sizerefs : 4;
+    Shared **refs = (Shared **)realloc(m->refs, newsize * sizeof(Shared *));
+    if (refs == NULL)
+      nomem(L);
+    m->refs = refs;
+    m->sizerefs = newsize;
+  }
+  puttag(L, m, tag);
+  putvar(L, m, m->nrefs);
+  m->refs[m->nrefs++] = ref(o);
+}
+
+
+struct str_Writer {
+  int init;  /* true iff buffer has been initialized */
+  luaL_Buffer B;
+};
+
+
+static int writer (lua_State *L, const void *b, size_t size, void *ud) {
+  struct str_Writer *state = (struct str_Writer *)ud;
+  if (!state->init) {
+    state->init = 1;
+    luaL_buffinit(L, &state->B);
+  }
+  luaL_addlstring(&state->B, (const char *)b, size);
+  return 0;
+}
+
+
+/*
+** Pushes the binary chunk of the Lua function at 'idx', which is kept
+** in a weak table so that functions submitted many times are dumped
+** only once. The only upvalue the function may have is its _ENV, which
+** the receiver sets to its own globals.
+*/
+static void dumpfunc (lua_State *L, int idx) {
+  if (lua_iscfunction(L, idx))
+    luaL_error(L, "cannot send a C function");
+  if (luaL_getsubtable(L, LUA_REGISTRYINDEX, DUMPS) == 0) {  /* new? */
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_pushvalue(L, -1);
+    lua_setmetatable(L, -2);  /* the table is its own metatable */
+  }
+  lua_pushvalue(L, idx);
+  if (lua_rawget(L, -2) != LUA_TSTRING) {
+    struct str_Writer state;
+    const char *name;
+    int i;
+    lua_pop(L, 1);
+    for (i = 1; (name = lua_getupvalue(L, idx, i)) != NULL; i++) {
+      lua_pop(L, 1);
+      if (strcmp(name, "_ENV") != 0 && !(*name == '\0' && i == 1))
+        luaL_error(L, "cannot send a function with upvalue '%s'", name);
+    }
+    lua_pushvalue(L, idx);
+    state.init = 0;
+    if (lua_dump(L, writer, &state, 0) != 0 || !state.init)
+      luaL_error(L, "unable to dump given function");
+    luaL_pushresult(&state.B);
+    lua_remove(L, -2);  /* function */
+    lua_pushvalue(L, idx);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);  /* DUMPS[function] = chunk */
+  }
+  lua_remove(L, -2);  /* DUMPS */
+}
+
+
+static Blob *toblob (lua_State *L, int idx);
+static struct Channel *tochannel (lua_State *L, int idx);
+#if defined(LUA_USE_FROZEN)
+static Frozen *tofrozen (lua_State *L, int idx);
+#endif
+
+
+static void encode (lua_State *L, Msg *m, int idx, int depth) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL: {
+      puttag(L, m, TNIL);
+      break;
+    }
+    case LUA_TBOOLEAN: {
+      puttag(L, m, lua_toboolean(L, idx) ? TTRUE : TFALSE);
+      break;
+    }
+    case LUA_TNUMBER: {
+      if (lua_isinteger(L, idx)) {
+        lua_Integer i = lua_tointeger(L, idx);
+        puttag(L, m, TINT);
+        putvar(L, m, i);
+      }
+      else {
+        lua_Number n = lua_tonumber(L, idx);
+        puttag(L, m, TFLT);
+        putvar(L, m, n);
+      }
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t size;
+      const char *s = lua_tolstring(L, idx, &size);
+      puttag(L, m, TSTR);
+      putvar(L, m, size);
+      putbytes(L, m, s, size);
+      break;
+    }
+    case LUA_TTABLE: {  /* contents only; metatables are not sent */
+      lua_Unsigned n = lua_rawlen(L, idx);
+      if (depth >= LUAI_WORKDEPTH)
+        luaL_error(L, "table too deep (or cyclic) to be sent");
+      luaL_checkstack(L, 3, "table too deep to be sent");
+      puttag(L, m, TTABLE);
+      putvar(L, m, n);  /* size hint */
+      lua_pushnil(L);
+      while (lua_next(L, idx)) {
+        int top = lua_gettop(L);
+        encode(L, m, top - 1, depth + 1);
+        encode(L, m, top, depth + 1);
+        lua_pop(L, 1);
+      }
+      puttag(L, m, TEND);
+      break;
+    }
+    case LUA_TFUNCTION: {
+      size_t size;
+      const char *s;
+      dumpfunc(L, idx);
+      s = lua_tolstring(L, -1, &size);
+      puttag(L, m, TFUNC);
+      putvar(L, m, size);
+      putbytes(L, m, s, size);
+      lua_pop(L, 1);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Blob *b = toblob(L, idx);
+      struct Channel *c;
+      if (b != NULL) {
+        putref(L, m, TBLOB, &b->h);
+        break;
+      }
+      else if ((c = tochannel(L, idx)) != NULL) {
+        putref(L, m, TCHAN, (Shared *)c);
+        break;
+      }
+#if defined(LUA_USE_FROZEN)
+      else if (tofrozen(L, idx) != NULL) {
+        putref(L, m, TFROZEN, (Shared *)tofrozen(L, idx));
+        break;
+      }
+#endif
+    }  /* FALLTHROUGH */
+    default:
+      luaL_error(L, "cannot send a %s value", luaL_typename(L, idx));
+  }
+}
+
+
+/* encodes the 'n' values from index 'first' on */
+static void encodeall (lua_State *L, Msg *m, int first, int n) {
+  int i;
+  for (i = 0; i < n; i++)
+    encode(L, m, first + i, 0);
+  m->n += n;
+}
+
+
+typedef struct Reader {
+  const char *p;
+  const Msg *m;
+} Reader;
+
+
+#define getvar(R,x)	(memcpy(&(x), (R)->p, sizeof(x)), (R)->p += sizeof(x))
+
+
+static void pushblob (lua_State *L, Blob *b);
+static void pushchannel (lua_State *L, struct Channel *c);
+
+
+/*
+** Pushes the function of a binary chunk; each state keeps the last
+** functions it loaded, so that jobs using the same function do not load
+** it again.
+*/
+static void loadfunc (lua_State *L, const char *chunk, size_t size) {
+  int t;
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, FUNCS);
+  t = lua_gettop(L);
+  lua_pushlstring(L, chunk, size);
+  lua_pushvalue(L, -1);
+  if (lua_rawget(L, t) != LUA_TFUNCTION) {  /* not loaded yet? */
+    lua_Integer n;
+    lua_rawgeti(L, t, 0);  /* number of functions in the table */
+    n = lua_tointeger(L, -1);
+    lua_pop(L, 2);
+    if (luaL_loadbufferx(L, chunk, size, "=(worker)", "b") != LUA_OK)
+      lua_error(L);
+    if (n >= LUAI_WORKFUNCS) {  /* table full? start a new one */
+      lua_newtable(L);
+      lua_replace(L, t);
+      lua_pushvalue(L, t);
+      lua_setfield(L, LUA_REGISTRYINDEX, FUNCS);
+      n = 0;
+    }
+    lua_pushinteger(L, n + 1);
+    lua_rawseti(L, t, 0);
+    lua_pushvalue(L, -2);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, t);  /* FUNCS[chunk] = function */
+  }
+  lua_replace(L, t);
+  lua_pop(L, 1);  /* chunk */
+}
+
+
+static void decode (lua_State *L, Reader *R) {
+  int tag = *R->p++;
+  luaL_checkstack(L, 3, "table too deep");
+  switch (tag) {
+    case TNIL: lua_pushnil(L); break;
+    case TFALSE: lua_pushboolean(L, 0); break;
+    case TTRUE: lua_pushboolean(L, 1); break;
+    case TINT: {
+      lua_Integer i;
+      getvar(R, i);
+      lua_pushinteger(L, i);
+      break;
+    }
+    case TFLT: {
+      lua_Number n;
+      getvar(R, n);
+      lua_pushnumber(L, n);
+      break;
+    }
+    case TSTR: {
+      size_t size;
+      getvar(R, size);
+      lua_pushlstring(L, R->p, size);
+      R->p += size;
+      break;
+    }
+    case TTABLE: {
+      lua_Unsigned n;
+      getvar(R, n);
+      lua_createtable(L, (n < 1u << 24) ? (int)n : 0, 0);
+      while (*R->p != TEND) {
+        decode(L, R);
+        decode(L, R);
+        lua_rawset(L, -3);
+      }
+      R->p++;
+      break;
+    }
+    case TFUNC: {
+      size_t size;
+      getvar(R, size);
+      loadfunc(L, R->p, size);
+      R->p += size;
+      break;
+    }
+    case TBLOB: case TCHAN: {
+      int i;
+      Shared *o;
+      getvar(R, i);
+      o = ref(R->m->refs[i]);
+      if (tag == TBLOB)
+        pushblob(L, (Blob *)o);
+      else
+        pushchannel(L, (struct Channel *)o);
+      break;
+    }
+#if defined(LUA_USE_FROZEN)
+    case TFROZEN: {  /* the receiver gets the table itself */
+      int i;
+      getvar(R, i);
+      if (!lua_pushfrozen(L, ((Frozen *)R->m->refs[i])->heap))
+        luaL_error(L, "frozen table is newer than the receiving state");
+      break;
+    }
+#endif
+    default: lua_assert(0);
+  }
+}
+
+
+/* pushes the values of a message and returns their number */
+static int decodeall (lua_State *L, const Msg *m) {
+  Reader R;
+  int i;
+  R.p = m->data;
+  R.m = m;
+  luaL_checkstack(L, m->n, "too many values");
+  for (i = 0; i < m->n; i++)
+    decode(L, &R);
+  return m->n;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Channels: lock-free queues with many senders (Vyukov's intrusive
+** MPSC queue). Receivers take 'rlock' to pop, and sleep on 'ready'
+** when the queue is empty; a sender signals only if somebody sleeps.
+** =======================================================
+*/
+
+typedef struct Channel {
+  Shared h;
+  Msg *head;  /* last message pushed (atomic) */
+  Msg *tail;  /* next message to pop (owned by 'rlock') */
+  int waiting;  /* number of sleeping receivers (atomic) */
+  pthread_mutex_t rlock;
+  pthread_cond_t ready;
+  Msg stub;
+} Channel;
+
+
+static void push (Channel *c, Msg *m) {
+  Msg *prev;
+  __atomic_store_n(&m->next, NULL, __ATOMIC_RELAXED);
+  prev = __atomic_exchange_n(&c->head, m, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&prev->next, m, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+** Pops the oldest message, or returns NULL if there is none; also NULL
+** while a sender is between its exchange and its link, in which case
+** the sender will see 'waiting' (both sides are sequentially
+** consistent) and wake the receiver.
+*/
+static Msg *pop (Channel *c) {
+  Msg *tail = c->tail;
+  Msg *next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+  if (tail == &c->stub) {  /* skip the stub */
+    if (next == NULL)
+      return NULL;
+    c->tail = tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+  }
+  if (next == NULL) {  /* 'tail' is the last message? */
+    if (tail != __atomic_load_n(&c->head, __ATOMIC_SEQ_CST))
+      return NULL;  /* a push is in progress */
+    push(c, &c->stub);  /* so that 'tail' gets a successor */
+    next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+    if (next == NULL)
+      return NULL;
+  }
+  c->tail = next;
+  return tail;
+}
+
+
+static void send (Channel *c, Msg *m) {
+  push(c, m);
+  if (__atomic_load_n(&c->waiting, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&c->rlock);
+    pthread_cond_signal(&c->ready);
+    pthread_mutex_unlock(&c->rlock);
+  }
+}
+
+
+static Msg *receive (Channel *c, int wait) {
+  Msg *m;
+  int i;
+  pthread_mutex_lock(&c->rlock);
+  m = pop(c);
+  for (i = 0; m == NULL && wait && i < LUAI_WORKSPIN; i++) {
+    pthread_mutex_unlock(&c->rlock);
+    workpause();
+    pthread_mutex_lock(&c->rlock);
+    m = pop(c);
+  }
+  if (m == NULL && wait) {
+    __atomic_fetch_add(&c->waiting, 1, __ATOMIC_SEQ_CST);
+    while ((m = pop(c)) == NULL)
+      pthread_cond_wait(&c->ready, &c->rlock);
+    __atomic_fetch_sub(&c->waiting, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&c->rlock);
+  return m;
+}
+
+
+static void freechannel (Shared *o) {
+  Channel *c = (Channel *)o;
+  Msg *m;
+  while ((m = pop(c)) != NULL)  /* messages nobody received */
+    freemsg(m);
+  pthread_cond_destroy(&c->ready);
+  pthread_mutex_destroy(&c->rlock);
+  free(c);
+}
+
+
+static Channel *newchannel (void) {
+  Channel *c = (Channel *)malloc(sizeof(Channel));
+  if (c == NULL)
+    return NULL;
+  c->h.refs = 1;
+  c->h.free = freechannel;
+  c->stub.next = NULL;
+  c->head = c->tail = &c->stub;
+  c->waiting = 0;
+  pthread_mutex_init(&c->rlock, NULL);
+  pthread_cond_init(&c->ready, NULL);
+  return c;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Blob and channel objects
+** =======================================================
+*/
+
+static Blob *toblob (lua_State *L, int idx) {
+  Blob **b = (Blob **)luaL_testudata(L, idx, BLOBMETA);
+  return (b != NULL) ? *b : NULL;
+}
+
+
+static Blob *checkblob (lua_State *L, int idx) {
+  return *(Blob **)luaL_checkudata(L, idx, BLOBMETA);
+}
+
+
+static int blob_gc (lua_State *L) {
+  Blob **b = (Blob **)luaL_checkudata(L, 1, BLOBMETA);
+  if (*b != NULL) {
+    unref(&(*b)->h);
+    *b = NULL;
+  }
+  return 0;
+}
+
+
+static int blob_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkblob(L, 1)->size);
+  return 1;
+}
+
+
+static int blob_tostring (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  lua_pushlstring(L, b->data, b->size);
+  return 1;
+}
+
+
+static size_t posrelat (lua_Integer pos, size_t len) {
+  if (pos >= 0)
+    return (pos > 0) ? (size_t)pos : 1;
+  else if (pos < -(lua_Integer)len)  /* inverted comparison */
+    return 1;  /* clip to 1 */
+  else return len + (size_t)pos + 1;
+}
+
+
+/* blob:sub(i [, j]), as 'string.sub' */
+static int blob_sub (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  size_t start = posrelat(luaL_checkinteger(L, 2), b->size);
+  lua_Integer j = luaL_optinteger(L, 3, -1);
+  size_t end = (j > (lua_Integer)b->size) ? b->size
+             : (j >= 0) ? (size_t)j
+             : (j < -(lua_Integer)b->size) ? 0 : b->size + (size_t)j + 1;
+  if (start <= end)
+    lua_pushlstring(L, b->data + start - 1, (end - start) + 1);
+  else lua_pushliteral(L, "");
+  return 1;
+}
+
+
+static const luaL_Reg blob_meta[] = {
+  {"__gc", blob_gc},
+  {"__len", blob_len},
+  {"__tostring", blob_tostring},
+  {NULL, NULL}
+};
+
+static const luaL_Reg blob_methods[] = {
+  {"sub", blob_sub},
+  {"tostring", blob_tostring},
+  {NULL, NULL}
+};
+
+
+/* pushes a blob object, which takes over the reference 'b' */
+static void pushblob (lua_State *L, Blob *b) {
+  Blob **ud = (Blob **)lua_newuserdatauv(L, sizeof(Blob *), 0);
+  *ud = b;
+  setmeta(L, BLOBMETA, blob_meta, blob_methods);
+}
+
+
+#if defined(LUA_USE_FROZEN)
+/*
+** {======================================================
+** Frozen tables: a handle to a frozen heap travels in messages like
+** blobs; states created after the heap receive its table, which they
+** read in place
+** =======================================================
+*/
+
+static Frozen *tofrozen (lua_State *L, int idx) {
+  Frozen **f = (Frozen **)luaL_testudata(L, idx, FROZENMETA);
+  return (f != NULL) ? *f : NULL;
+}
+
+
+static int frozen_gc (lua_State *L) {
+  Frozen **f = (Frozen **)luaL_checkudata(L, 1, FROZENMETA);
+  if (*f != NULL) {
+    unref(&(*f)->h);
+    *f = NULL;
+  }
+  return 0;
+}
+
+
+static const luaL_Reg frozen_meta[] = {
+  {"__gc", frozen_gc},
+  {NULL, NULL}
+};
+
+
+/* worker.freeze(t): pushes a handle to a frozen copy of 't' */
+static int worker_freeze (lua_State *L) {
+  Frozen **ud;
+  Frozen *f;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  ud = (Frozen **)lua_newuserdatauv(L, sizeof(Frozen *), 0);
+  *ud = NULL;
+  setmeta(L, FROZENMETA, frozen_meta, NULL);
+  f = (Frozen *)malloc(sizeof(Frozen));
+  if (f == NULL)
+    return nomem(L);
+  f->h.refs = 1;
+  f->h.free = freefrozen;
+  f->heap = NULL;
+  *ud = f;  /* from now on '__gc' frees it */
+  f->heap = luaL_freeze(L, 1);
+  return 1;
+}
+
+/* }====================================================== */
+
+#endif
+
+
+static Channel *tochannel (lua_State *L, int idx) {
+  Channel **c = (Channel **)luaL_testudata(L, idx, CHANMETA);
+  return (c != NULL) ? *c : NULL;
+}
+
+
+static Channel *checkchannel (lua_State *L, int idx) {
+  return *(Channel **)luaL_checkudata(L, idx, CHANMETA);
+}
+
+
+static int chan_gc (lua_State *L) {
+  Channel **c = (Channel **)luaL_checkudata(L, 1, CHANMETA);
+  if (*c != NULL) {
+    unref(&(*c)->h);
+    *c = NULL;
+  }
+  return 0;
+}
+
+
+static int chan_send (lua_State *L) {
+  luaL_send(L, 1, lua_gettop(L) - 1);
+  return 0;
+}
+
+
+static int chan_receive (lua_State *L) {
+  lua_settop(L, 1);
+  return luaL_receive(L, 1, 1);
+}
+
+
+/* channel:poll() returns true and a message, or false if none */
+static int chan_poll (lua_State *L) {
+  int n;
+  lua_settop(L, 1);
+  lua_pushboolean(L, 1);
+  n = luaL_receive(L, 1, 0);
+  if (n < 0) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  return n + 1;
+}
+
+
+static const luaL_Reg chan_meta[] = {
+  {"__gc", chan_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg chan_methods[] = {
+  {"send", chan_send},
+  {"receive", chan_receive},
+  {"poll", chan_poll},
+  {NULL, NULL}
+};
+
+
+/* pushes a channel object, which takes over the reference 'c' */
+static void pushchannel (lua_State *L, Channel *c) {
+  Channel **ud = (Channel **)lua_newuserdatauv(L, sizeof(Channel *), 0);
+  *ud = c;
+  setmeta(L, CHANMETA, chan_meta, chan_methods);
+}
+
+
+LUALIB_API void luaL_newchannel (lua_State *L) {
+  Channel **ud = (Channel **)lua_newuserdatauv(L, sizeof(Channel *), 0);
+  *ud = NULL;
+  setmeta(L, CHANMETA, chan_meta, chan_methods);
+  if ((*ud = newchannel()) == NULL)
+    nomem(L);
+}
+
+
+LUALIB_API void luaL_send (lua_State *L, int channel, int n) {
+  Channel *c = checkchannel(L, channel);
+  int first = lua_gettop(L) - n + 1;
+  Msg *m = newmsg(L);
+  encodeall(L, m, first, n);
+  send(c, takemsg(L, -1));
+  lua_settop(L, first - 1);
+}
+
+
+LUALIB_API int luaL_receive (lua_State *L, int channel, int wait) {
+  Channel *c = checkchannel(L, channel);
+  Msg *m = receive(c, wait);
+  int n;
+  if (m == NULL)
+    return -1;
+  *(Msg **)lua_newuserdatauv(L, sizeof(Msg *), 0) = m;  /* box it */
+  setmeta(L, BOXMETA, box_meta, NULL);
+  n = decodeall(L, m);
+  freemsg(takemsg(L, -(n + 1)));  /* free the message now */
+  lua_remove(L, -(n + 1));
+  return n;
+}
+
+
+LUALIB_API void luaL_pushblob (lua_State *L, const void *data, size_t size,
+                               void (*release) (void *data, size_t size)) {
+  Blob **ud = (Blob **)lua_newuserdatauv(L, sizeof(Blob *), 0);
+  *ud = NULL;
+  setmeta(L, BLOBMETA, blob_meta, blob_methods);
+  if ((*ud = newblob((const char *)data, size, release)) == NULL)
+    nomem(L);
+}
+
+
+LUALIB_API const void *luaL_toblob (lua_State *L, int idx, size_t *size) {
+  Blob *b = toblob(L, idx);
+  if (b == NULL)
+    return NULL;
+  if (size)
+    *size = b->size;
+  return b->data;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Pools of workers. Each worker is an OS thread with a state of its
+** own, which takes jobs (a function and its arguments) from the job
+** channel of its pool and sends the results to the future of the job.
+** =======================================================
+*/
+
+typedef struct Worker {
+  struct Pool *pool;
+  int id;  /* 1 to the number of workers */
+  pthread_t thread;
+} Worker;
+
+
+typedef struct Pool {
+  Channel *jobs;
+  int size;  /* number of workers */
+  int n;  /* number of workers running */
+  int started;  /* number of workers done starting (under 'lock') */
+  char *error;  /* first error of a starting worker (under 'lock') */
+  Msg *init;  /* initialization function, or NULL */
+  Msg **stop;  /* a message to stop each worker */
+  Worker *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Pool;
+
+
+/* runs in the state of a new worker */
+static int startworker (lua_State *L) {
+  Worker *w = (Worker *)lua_touserdata(L, 1);
+  luaL_openlibs(L);
+  lua_pushinteger(L, w->id);
+  lua_setfield(L, LUA_REGISTRYINDEX, WORKERID);
+  if (w->pool->init != NULL) {
+    decodeall(L, w->pool->init);
+    lua_call(L, 0, 0);
+  }
+  return 0;
+}
+
+
+/*
+** Runs the job in message 1, and returns its results in a new message
+** (as a light userdata).
+*/
+static int dojob (lua_State *L) {
+  Msg *job = (Msg *)lua_touserdata(L, 1);
+  Msg *r;
+  int status;
+  decodeall(L, job);
+  status = lua_pcall(L, job->n - 1, LUA_MULTRET, 0);
+  r = newmsg(L);
+  r->status = status;
+  encodeall(L, r, 2, lua_gettop(L) - 2);
+  lua_pushlightuserdata(L, takemsg(L, -1));
+  return 1;
+}
+
+
+/* a message with the error 'msg' (or NULL if there is no memory) */
+static Msg *errormsg (const char *msg, size_t size) {
+  Msg *m = (Msg *)calloc(1, sizeof(Msg));
+  size_t total = 1 + sizeof(size) + size;
+  if (m == NULL)
+    return NULL;
+  m->status = LUA_ERRRUN;
+  if ((m->data = (char *)malloc(total)) == NULL) {
+    free(m);
+    return NULL;
+  }
+  m->data[0] = TSTR;
+  memcpy(m->data + 1, &size, sizeof(size));
+  memcpy(m->data + 1 + sizeof(size), msg, size);
+  m->size = m->capacity = total;
+  m->n = 1;
+  return m;
+}
+
+
+/*
+** Sends the results of a job to its future. When they cannot be
+** encoded, the error that prevented it is sent instead; without memory
+** even for that, the emptied job message goes back as a memory error.
+*/
+static void runjob (lua_State *L, Msg *job) {
+  Channel *reply = job->reply;
+  Msg *r;
+  job->reply = NULL;  /* its reference is now in 'reply' */
+  lua_pushcfunction(L, dojob);
+  lua_pushlightuserdata(L, job);
+  if (lua_pcall(L, 1, 1, 0) == LUA_OK)
+    r = (Msg *)lua_touserdata(L, -1);
+  else {
+    size_t size;
+    const char *msg = lua_tolstring(L, -1, &size);
+    r = (msg != NULL) ? errormsg(msg, size) : NULL;
+  }
+  lua_settop(L, 0);
+  if (r != NULL)
+    freemsg(job);
+  else {
+    r = job;
+    clearmsg(r);
+    r->status = LUA_ERRMEM;
+  }
+  send(reply, r);
+  unref(&reply->h);
+}
+
+
+static void *workermain (void *ud) {
+  Worker *w = (Worker *)ud;
+  Pool *p = w->pool;
+#if defined(LUA_USE_SLABALLOC)
+  lua_State *L = luaL_newslabstate();
+#else
+  lua_State *L = luaL_newstate();
+#endif
+  const char *error = NULL;
+  if (L == NULL)
+    error = "cannot create state: not enough memory";
+  else {
+    lua_pushcfunction(L, startworker);
+    lua_pushlightuserdata(L, w);
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      error = lua_tostring(L, -1);
+      if (error == NULL)
+        error = "(error object is not a string)";
+    }
+  }
+  pthread_mutex_lock(&p->lock);
+  if (error != NULL && p->error == NULL) {
+    size_t size = strlen(error) + 1;
+    if ((p->error = (char *)malloc(size)) != NULL)
+      memcpy(p->error, error, size);
+  }
+  p->started++;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  if (error == NULL) {
+    for (;;) {
+      Msg *m = receive(p->jobs, 1);
+      if (m->reply == NULL) {  /* a stop message? */
+        freemsg(m);
+        break;
+      }
+      runjob(L, m);
+    }
+  }
+  if (L != NULL)
+    lua_close(L);
+  return NULL;
+}
+
+
+/*
+** Stops the workers after the jobs already submitted, and frees the
+** pool.
+*/
+static void closepool (Pool *p) {
+  int i;
+  for (i = 0; i < p->n; i++)
+    send(p->jobs, p->stop[i]);
+  for (i = 0; i < p->n; i++)
+    pthread_join(p->workers[i].thread, NULL);
+  for (i = p->n; i < p->size; i++)  /* of workers never started */
+    freemsg(p->stop[i]);
+  if (p->jobs)
+    unref(&p->jobs->h);  /* (with stop messages of failed workers) */
+  if (p->init)
+    freemsg(p->init);
+  free(p->error);
+  free(p->workers);
+  free(p->stop);
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->lock);
+  free(p);
+}
+
+
+static Pool *checkpool (lua_State *L, int idx) {
+  Pool *p = *(Pool **)luaL_checkudata(L, idx, POOLMETA);
+  if (p == NULL)
+    luaL_error(L, "attempt to use a closed pool");
+  return p;
+}
+
+
+static int pool_close (lua_State *L) {
+  Pool **ud = (Pool **)luaL_checkudata(L, 1, POOLMETA);
+  Pool *p = *ud;
+  if (p != NULL) {
+    *ud = NULL;
+    closepool(p);
+  }
+  return 0;
+}
+
+
+static int pool_submit (lua_State *L) {
+  luaL_submit(L, 1, lua_gettop(L) - 2);
+  return 1;
+}
+
+
+static int pool_size (lua_State *L) {
+  lua_pushinteger(L, checkpool(L, 1)->n);
+  return 1;
+}
+
+
+static const luaL_Reg pool_meta[] = {
+  {"__gc", pool_close},
+  {"__close", pool_close},
+  {NULL, NULL}
+};
+
+static const luaL_Reg pool_methods[] = {
+  {"submit", pool_submit},
+  {"size", pool_size},
+  {"close", pool_close},
+  {NULL, NULL}
+};
+
+
+static int cores (void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n <= 0) ? 1 : (n < LUAI_WORKMAX) ? (int)n : LUAI_WORKMAX;
+}
+
+
+LUALIB_API void luaL_newpool (lua_State *L, int n, int init) {
+  Pool **ud;
+  Pool *p;
+  int i;
+  if (init != 0)
+    init = lua_absindex(L, init);
+  if (n <= 0)
+    n = cores();
+  else if (n > LUAI_WORKMAX)
+    luaL_error(L, "too many workers (limit is %d)", LUAI_WORKMAX);
+  ud = (Pool **)lua_newuserdatauv(L, sizeof(Pool *), 0);
+  *ud = NULL;
+  setmeta(L, POOLMETA, pool_meta, pool_methods);
+  if ((p = (Pool *)calloc(1, sizeof(Pool))) == NULL)
+    nomem(L);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  *ud = p;  /* from now on, the userdata frees it */
+  p->workers = (Worker *)calloc(n, sizeof(Worker));
+  p->stop = (Msg **)calloc(n, sizeof(Msg *));
+  p->jobs = newchannel();
+  if (p->workers == NULL || p->stop == NULL || p->jobs == NULL)
+    nomem(L);
+  for (; p->size < n; p->size++) {
+    if ((p->stop[p->size] = (Msg *)calloc(1, sizeof(Msg))) == NULL)
+      nomem(L);
+  }
+  if (init != 0) {
+    Msg *m = newmsg(L);
+    encodeall(L, m, init, 1);
+    p->init = takemsg(L, -1);
+    lua_pop(L, 1);
+  }
+  for (i = 0; i < n; i++) {
+    Worker *w = &p->workers[i];
+    w->pool = p;
+    w->id = i + 1;
+    if (pthread_create(&w->thread, NULL, workermain, w) != 0)
+      break;
+    p->n++;
+  }
+  pthread_mutex_lock(&p->lock);
+  while (p->started < p->n)
+    pthread_cond_wait(&p->cond, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  if (p->error != NULL || p->n < n) {
+    lua_pushstring(L, (p->error != NULL) ? p->error
+                                         : "cannot create worker thread");
+    *ud = NULL;
+    closepool(p);
+    lua_error(L);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Futures
+** =======================================================
+*/
+
+typedef struct Future {
+  Channel *c;  /* where the results arrive, until they do */
+  int status;  /* of the job, once its results arrived */
+} Future;
+
+
+static Future *checkfuture (lua_State *L, int idx) {
+  return (Future *)luaL_checkudata(L, idx, FUTUREMETA);
+}
+
+
+static int future_gc (lua_State *L) {
+  Future *f = checkfuture(L, 1);
+  if (f->c != NULL) {
+    unref(&f->c->h);
+    f->c = NULL;
+  }
+  return 0;
+}
+
+
+/* keeps the results 'r' of the future at 'idx' in its user value */
+static void settle (lua_State *L, int idx, Future *f, Msg *r) {
+  int i, n;
+  *(Msg **)lua_newuserdatauv(L, sizeof(Msg *), 0) = r;  /* box it */
+  setmeta(L, BOXMETA, box_meta, NULL);
+  lua_createtable(L, r->n, 1);
+  n = decodeall(L, r);
+  for (i = n; i >= 1; i--)
+    lua_rawseti(L, -1 - i, i);
+  lua_pushinteger(L, n);
+  lua_setfield(L, -2, "n");
+  lua_setiuservalue(L, idx, 1);
+  f->status = r->status;
+  unref(&f->c->h);
+  f->c = NULL;
+  freemsg(takemsg(L, -1));  /* free the message now */
+  lua_pop(L, 1);
+}
+
+
+LUALIB_API int luaL_await (lua_State *L, int future) {
+  Future *f = checkfuture(L, future);
+  int i, n;
+  future = lua_absindex(L, future);
+  if (f->c != NULL)
+    settle(L, future, f, receive(f->c, 1));
+  lua_getiuservalue(L, future, 1);
+  lua_getfield(L, -1, "n");
+  n = (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (f->status != LUA_OK) {
+    if (n == 0)
+      lua_pushliteral(L, "not enough memory");
+    else
+      lua_rawgeti(L, -1, 1);
+    return lua_error(L);
+  }
+  luaL_checkstack(L, n, "too many results");
+  for (i = 1; i <= n; i++)
+    lua_rawgeti(L, -i, i);
+  lua_remove(L, -(n + 1));
+  return n;
+}
+
+
+static int future_await (lua_State *L) {
+  lua_settop(L, 1);
+  return luaL_await(L, 1);
+}
+
+
+static int future_ready (lua_State *L) {
+  Future *f = checkfuture(L, 1);
+  if (f->c != NULL) {
+    Msg *r = receive(f->c, 0);
+    if (r != NULL)
+      settle(L, 1, f, r);
+  }
+  lua_pushboolean(L, f->c == NULL);
+  return 1;
+}
+
+static const luaL_Reg future_meta[] = {
+  {"__gc", future_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg future_methods[] = {
+  {"await", future_await},
+  {"ready", future_ready},
+  {NULL, NULL}
+};
+
+
+static Future *newfuture (lua_State *L) {
+  Future *f = (Future *)lua_newuserdatauv(L, sizeof(Future), 1);
+  f->c = NULL;
+  f->status = LUA_OK;
+  setmeta(L, FUTUREMETA, future_meta, future_methods);
+  if ((f->c = newchannel()) == NULL)
+    nomem(L);
+  return f;
+}
+
+
+LUALIB_API void luaL_submit (lua_State *L, int pool, int nargs) {
+  Pool *p = checkpool(L, pool);
+  int first = lua_gettop(L) - nargs;  /* index of the function */
+  Msg *m;
+  Future *f;
+  luaL_checktype(L, first, LUA_TFUNCTION);
+  m = newmsg(L);
+  encodeall(L, m, first, nargs + 1);
+  f = newfuture(L);
+  m->reply = (Channel *)ref(&f->c->h);
+  send(p->jobs, takemsg(L, -2));
+  lua_replace(L, first);  /* future replaces the function */
+  lua_settop(L, first);
+}
+
+
+/* }====================================================== */
+
+
+static int worker_pool (lua_State *L) {
+  int n = (int)luaL_optinteger(L, 1, 0);
+  int init = 0;
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    init = 2;
+  }
+  luaL_newpool(L, n, init);
+  return 1;
+}
+
+
+static int worker_channel (lua_State *L) {
+  luaL_newchannel(L);
+  return 1;
+}
+
+
+static int worker_blob (lua_State *L) {
+  if (toblob(L, 1) != NULL)
+    lua_settop(L, 1);
+  else {
+    size_t size;
+    const char *s = luaL_checklstring(L, 1, &size);
+    luaL_pushblob(L, s, size, NULL);
+  }
+  return 1;
+}
+
+
+static int worker_cores (lua_State *L) {
+  lua_pushinteger(L, cores());
+  return 1;
+}
+
+
+/* 1 to n in the workers of a pool of size n, 0 elsewhere */
+static int worker_id (lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, WORKERID);
+  lua_pushinteger(L, lua_tointeger(L, -1));
+  return 1;
+}
+
+
+static const luaL_Reg worker_funcs[] = {
+  {"pool", worker_pool},
+  {"channel", worker_channel},
+  {"blob", worker_blob},
+  {"cores", worker_cores},
+  {"id", worker_id},
+#if defined(LUA_USE_FROZEN)
+  {"freeze", worker_freeze},
+#endif
+  {NULL, NULL}
+};
+
+
+
+LUAMOD_API int luaopen_worker (lua_State *L) {
+  luaL_newlib(L, worker_funcs);
+  return 1;
+}
+
+#endif
@@ -1062,6 +1062,149 @@ namespace lua
     {
       return lua_toclose (L, idx);
     }
+
+#if defined(LUA_USE_WORKERS)
+  public: // Worker library.
+    /** Push a pool of @a n workers (one per core if @a n <= 0).
+     * @param init Stack index of a function run first by each worker (0 for none).
+     * */
+    void
+    newpool (count_type n = 0, index_type init = 0)
+    {
+      luaL_newpool (L, n, init);
+    }
+
+    /** Pop a function and its @a nargs arguments, push the future of its call by a worker.
+     * @param pool Stack index of the pool.
+     * */
+    void
+    submit (index_type pool, count_type nargs)
+    {
+      luaL_submit (L, pool, nargs);
+    }
+
+    /** Wait for a future and push the results of its job.
+     * @returns Number of results.
+     * */
+    count_type
+    await (index_type future)
+    {
+      return luaL_await (L, future);
+    }
+
+    /** Push a new channel.
+     * */
+    void
+    newchannel ()
+    {
+      luaL_newchannel (L);
+    }
+
+    /** Pop @a n values and send them as one message.
+     * */
+    void
+    send (index_type channel, count_type n)
+    {
+      luaL_send (L, channel, n);
+    }
+
+    /** Push the values of the oldest message of a channel.
+     * @param wait Wait for a message if there is none.
+     * @returns Number of values, or -1 if there was no message (and @a wait is false).
+     * */
+    count_type
+    receive (index_type channel, bool wait = true)
+    {
+      return luaL_receive (L, channel, wait);
+    }
+
+    /** Push a blob of @a size bytes, shared with other states without copies.
+     * @param release Called when no state refers to @a data any more; if null, @a data is copied.
+     * */
+    void
+    pushblob (const_pointer data, size_type size, void (*release) (void *, size_t) = nullptr)
+    {
+      luaL_pushblob (L, data, size, release);
+    }
+
+    /** Get the bytes of a blob (null if the value is not a blob).
+     * */
+    const_pointer
+    toblob (index_type idx, size_type &size)
+    {
+      return luaL_toblob (L, idx, &size);
+    }
+#endif
+
+#if defined(LUA_USE_FROZEN)
+  public: // Frozen tables.
+    /** Copy the table at @a idx into a frozen heap, read in place by the states created afterwards.
+     * @returns A handle, to be released with lua_releasefrozen.
+     * */
+    lua_Frozen *
+    freeze (index_type idx)
+    {
+      return luaL_freeze (L, idx);
+    }
+
+    /** Push the table of a frozen heap.
+     * @returns False (pushing nothing) if this state is older than the heap.
+     * */
+    bool
+    pushfrozen (lua_Frozen *f)
+    {
+      return lua_pushfrozen (L, f) != 0;
+    }
+#endif
+
+#if defined(LUA_USE_SLICES)
+  public: // Slices.
+    /** Push the @a len bytes at offset @a i of the string at @a idx, sharing them if the substring is long.
+     * */
+    void
+    pushsubstring (index_type idx, size_type i, size_type len)
+    {
+      lua_pushsubstring (L, idx, i, len);
+    }
+#endif
+#if defined(LUA_USE_PDQSORT)
+  public: // Native sorting.
+    /** Sort the first @a n elements of the table at @a idx in place, if they are all integers, floats or strings.
+     * @returns Whether they were sorted (if not, the table is unchanged).
+     * */
+    bool
+    sortarray (index_type idx, integer n)
+    {
+      return lua_sortarray (L, idx, n) != 0;
+    }
+#endif
+#if defined(LUA_USE_ARRAYOPS)
+  public: // Array operations.
+    /** Copy elements @a f to @a e of the table at @a src to the table at @a dst, from @a t on, if no metamethod would be called.
+     * @returns Whether they were copied (if not, nothing visible changed).
+     * */
+    bool
+    movearray (index_type src, integer f, integer e, integer t, index_type dst)
+    {
+      return lua_movearray (L, src, f, e, t, dst) != 0;
+    }
+    /** Push elements @a i to @a i + @a n - 1 of the table at @a idx, if no metamethod would be called.
+     * @returns Whether they were pushed.
+     * */
+    bool
+    unpackarray (index_type idx, integer i, int n)
+    {
+      return lua_unpackarray (L, idx, i, n) != 0;
+    }
+    /** Push the concatenation of elements @a i to @a j of the table at @a idx, separated by @a sep, if they are all strings or numbers.
+     * @returns Whether it was pushed.
+     * */
+    bool
+    concatarray (index_type idx, integer i, integer j, const char *sep, size_type lsep)
+    {
+      return lua_concatarray (L, idx, i, j, sep, lsep) != 0;
+    }
+#endif
   };
 
 } // namespace lua
@@ -0,0 +1 @@
+../../lua/src/laiolib.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../lua/src/ljit.c
\ No newline at end of file
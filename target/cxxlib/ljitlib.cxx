@@ -0,0 +1 @@
+../../lua/src/ljitlib.c
\ No newline at end of file
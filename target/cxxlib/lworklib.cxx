@@ -0,0 +1 @@
+../../lua/src/lworklib.c
\ No newline at end of file
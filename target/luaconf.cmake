@@ -10,6 +10,33 @@ option(LUA_USE_DLOPEN "Use dlopen (requires dl library, auto-detected)." ${LUA_U
 # Compatibility
 set(LUA_COMPAT_5_3 "${LUA_COMPAT_5_3_INIT}" CACHE BOOL "Retain 5.3 compatibility.")
 
+# Performance
+option(LUA_USE_INLINECACHE "Use inline caches for access to globals in the VM." ${LUA_USE_INLINECACHE_INIT})
+option(LUA_USE_QUICKENING "Rewrite instruction pairs of hot functions into superinstructions." ${LUA_USE_QUICKENING_INIT})
+option(LUA_USE_SHAPES "Store record tables as shared shapes plus value vectors." ${LUA_USE_SHAPES_INIT})
+option(LUA_USE_SWISSTABLE "Use an open-addressing hash part probed in groups of control bytes." ${LUA_USE_SWISSTABLE_INIT})
+option(LUA_USE_PARALLELMARK "Run the mark phase of full and atomic collections on several threads (POSIX threads)." ${LUA_USE_PARALLELMARK_INIT})
+option(LUA_USE_BGSWEEP "Allow dead objects to be released by a background thread (POSIX threads)." ${LUA_USE_BGSWEEP_INIT})
+option(LUA_USE_SLABALLOC "Provide luaL_newslabstate, a state with a size-class slab allocator, and use it in the interpreter (POSIX)." ${LUA_USE_SLABALLOC_INIT})
+option(LUA_USE_BCCACHE "Cache the bytecode of modules loaded by require (POSIX)." ${LUA_USE_BCCACHE_INIT})
+option(LUA_USE_MMAPLOAD "Load binary chunks by mapping their files, with code in place (POSIX)." ${LUA_USE_MMAPLOAD_INIT})
+option(LUA_USE_THREADLOCK "Implement lua_lock/lua_unlock with a lock per global state, so that its threads can run on several OS threads (POSIX)." ${LUA_USE_THREADLOCK_INIT})
+option(LUA_USE_WORKERS "Provide the worker library: pools of states on OS threads, channels and shared blobs (POSIX threads)." ${LUA_USE_WORKERS_INIT})
+option(LUA_USE_FROZEN "Provide frozen tables: immutable table trees outside any heap, shared by all states created afterwards (POSIX threads)." ${LUA_USE_FROZEN_INIT})
+option(LUA_USE_ROPES "Make long concatenations lazy ropes, flattened when their contents are observed." ${LUA_USE_ROPES_INIT})
+option(LUA_USE_SLICES "Make long substrings slices that share the bytes of their string (implies LUA_USE_ROPES)." ${LUA_USE_SLICES_INIT})
+option(LUA_USE_PATTERNCACHE "Compile the patterns of string.find, match, gmatch and gsub, keeping the last ones used in a cache per state." ${LUA_USE_PATTERNCACHE_INIT})
+option(LUA_USE_SIMDFIND "Search plain strings with SSE2/AVX2 instructions, chosen at run time (x86, GCC or Clang)." ${LUA_USE_SIMDFIND_INIT})
+option(LUA_USE_FASTNUM "Convert decimal numerals and floats with Eisel-Lemire and Ryu instead of strtod and snprintf." ${LUA_USE_FASTNUM_INIT})
+option(LUA_USE_PDQSORT "Sort with pattern-defeating quicksort, natively for arrays of integers, floats or strings." ${LUA_USE_PDQSORT_INIT})
+option(LUA_USE_ARRAYOPS "Copy elements of array parts directly in table.concat, move, unpack, insert and remove." ${LUA_USE_ARRAYOPS_INIT})
+option(LUA_USE_FASTLINES "Read lines from the buffer of their FILE in blocks, finding newlines with memchr (glibc, macOS)." ${LUA_USE_FASTLINES_INIT})
+option(LUA_USE_MMAPFILE "Provide io.mmap, reading a file mapped into memory as a string, with slices of it when available (POSIX)." ${LUA_USE_MMAPFILE_INIT})
+option(LUA_USE_AIO "Provide the aio library: file reads and writes of coroutines on io_uring (Linux)." ${LUA_USE_AIO_INIT})
+option(LUA_USE_GATHERWRITE "Gather the arguments of file:write into one buffer and one fwrite, and provide file:writer, a buffered writer." ${LUA_USE_GATHERWRITE_INIT})
+option(LUA_USE_READNUMBERS "Provide file:readnumbers, and read numerals from the buffer of their FILE in blocks (glibc, macOS)." ${LUA_USE_READNUMBERS_INIT})
+set(LUA_USE_JIT ${LUA_BUILD_JIT})
+
 # Characters
 set(LUA_PATH_SEP ";" CACHE STRING "Character that separates templates in a path.")
 set(LUA_PATH_MARK "?" CACHE STRING "String that marks the substitution points in a template.")